@@ -10,319 +10,391 @@
 * * Program: dig plugin for NetSaint
 * * License: GPL
 * * Copyright (c) 2000
-* * 
+* *
 * * $Id: check_rbl.c 970 2004-12-02 00:30:32Z opensides $
 *
+* Looks up all hosts on all RBL zones at once with the utils_dns client,
+* a window of queries in flight at a time, instead of one dig per zone.
+*
 *****************************************************************************/
 
-#include "config.h"
+const char *progname = "check_rbl";
+const char *copyright = "2002-2013";
+const char *email = "nagiosplug-devel@lists.sourceforge.net";
+
 #include "common.h"
 #include "utils.h"
-#include "popen.h"
-#include "string.h"
-
-const char progname = "check_rbl";
-const char *revision = "$Revision: 970 $";
-//const char *copyright = "2000-2003";
-//const char *email = "nagiosplug-devel@lists.sourceforge.net";
-
-int process_arguments(int, char **);
-int call_getopt(int, char **);
-int validate_arguments(void);
-int check_disk(int usp,int free_disk);
-void print_help(void);
-void print_usage(void);
-char *reverse_ipaddr(char *ipaddr);
-
-char *query_address=NULL;
-char *query_address_rev=NULL;
-char *dns_server=NULL;
-char *rbl_name=NULL;
-int verbose=FALSE;
-
-int main(int argc, char **argv){
-	char input_buffer[MAX_INPUT_BUFFER];
-	char *command_line=NULL;
-	char *output=NULL;
-	int result=STATE_OK;
-
-	/* Set signal handling and alarm */
-	if (signal(SIGALRM,popen_timeout_alarm_handler)==SIG_ERR)
-		usage("Cannot catch SIGALRM\n");
-
-	if (process_arguments(argc,argv)!=OK)
-		usage	(_("check_rbl: could not parse arguments\n"));
-
-	/* reverse the octets in the IP address */
-	query_address_rev = reverse_ipaddr(query_address);
-
-	/* build the command to run */
-	if (dns_server) {
-	  command_line=ssprintf(command_line,"%s @%s %s.%s",
-				PATH_TO_DIG,dns_server,
-				query_address_rev, rbl_name);
-	} else {
-	  command_line=ssprintf(command_line,"%s %s.%s",
-				PATH_TO_DIG,
-				query_address_rev, rbl_name);
-	}
-	alarm(timeout_interval);
-	time(&start_time);
-
-	if (verbose)
-		printf("%s\n",command_line);
-	/* run the command */
-	child_process=spopen(command_line);
-	if (child_process==NULL) {
-		printf("Could not open pipe: %s\n",command_line);
-		return STATE_UNKNOWN;
-	}
-
-	child_stderr=fdopen(child_stderr_array[fileno(child_process)],"r");
-	if(child_stderr==NULL)
-		printf("Could not open stderr for %s\n",command_line);
-
-	output=strscpy(output,"");
-
-	while (fgets(input_buffer,MAX_INPUT_BUFFER-1,child_process)) {
-
-		/* the server is responding, we just got the host name... */
-		if (strstr(input_buffer,";; ANSWER SECTION:")) {
-
-			/* get the host address */
-			if (!fgets(input_buffer,MAX_INPUT_BUFFER-1,child_process))
-				break;
-
-			if (strpbrk(input_buffer,"\r\n"))
-				input_buffer[strcspn(input_buffer,"\r\n")] = '\0';
-
-			if (strstr(input_buffer,query_address_rev)==input_buffer) {
-				output=strscpy(output,input_buffer);
-				/* we found it, which means it's listed! */
-				result=STATE_CRITICAL;
-			} else {
-				strcpy(output,"Server not RBL listed.");
-				result=STATE_OK;
-			}
-
-			continue;
-		}
-
-	}
-	
-	/*
-	if (result!=STATE_OK) {
-		strcpy(output,"No ANSWER SECTION found");
-	}
-	*/
-
-	while (fgets(input_buffer,MAX_INPUT_BUFFER-1,child_stderr)) {
-		/* If we get anything on STDERR, at least set warning */
-		result=error_set(result,STATE_WARNING);
-		printf("%s",input_buffer);
-		if (!strcmp(output,""))
-			strcpy(output,1+index(input_buffer,':'));
-	}
-
-	(void)fclose(child_stderr);
-
-	/* close the pipe */
-	if (spclose(child_process)) {
-		result=error_set(result,STATE_WARNING);
-		if (!strcmp(output,""))
-			strcpy(output,"nslookup returned an error status");
-	}
-	
-	(void)time(&end_time);
-
-	if (result==STATE_OK)
-		printf("RBL check okay - not listed.\n");
-	else if (result==STATE_WARNING)
-		printf("RBL WARNING - %s\n",!strcmp(output,"")?" Probably a non-existent host/domain":output);
-	else if (result==STATE_CRITICAL)
-		printf("RBL CRITICAL - %s is listed on %s\n",query_address, rbl_name);
-	else
-		printf("DNS problem - %s\n",!strcmp(output,"")?" Probably a non-existent host/domain":output);
-
-	return result;
-}
-
+#include "utils_base.h"
+#include "netutils.h"
+#include "utils_dns.h"
+
+#define DEFAULT_WINDOW 64
+#define DEFAULT_QUERY_TIMEOUT 2000
+
+int process_arguments (int, char **);
+int validate_arguments (void);
+void print_help (void);
+void print_usage (void);
+char *reverse_ipaddr (const char *ipaddr);
+
+char **hosts = NULL;
+int n_hosts = 0;
+char **zones = NULL;
+int n_zones = 0;
+char *dns_server = NULL;
+int server_port = NP_DNS_PORT;
+int window = DEFAULT_WINDOW;
+int query_timeout = DEFAULT_QUERY_TIMEOUT;
+int retries = 1;
+int verbose = FALSE;
+thresholds *listed_thresholds = NULL;
+
+int
+main (int argc, char **argv)
+{
+  np_dns_request *req;
+  np_dns_options opts;
+  np_dns_resolv resolv;
+  char *rev, *output = NULL, *perf = "", *listed_on, *label;
+  double *zone_time;
+  int *listed, *unlisted, *failed;
+  int result = STATE_OK, state, n, i, j, h, z;
+
+  setlocale (LC_ALL, "");
+  bindtextdomain (PACKAGE, LOCALEDIR);
+  textdomain (PACKAGE);
+
+  /* Set signal handling and alarm */
+  if (signal (SIGALRM, socket_timeout_alarm_handler) == SIG_ERR)
+    usage_va (_("Cannot catch SIGALRM"));
+
+  /* Parse extra opts if any */
+  argv = np_extra_opts (&argc, argv, progname);
+
+  if (process_arguments (argc, argv) == ERROR)
+    usage_va (_("Could not parse arguments"));
+
+  if (!dns_server) {
+    np_dns_read_resolv_conf (NULL, &resolv);
+    dns_server = resolv.server;
+  }
 
+  np_dns_init_options (&opts);
+  opts.port = server_port;
+  opts.family = address_family;
+  opts.retries = retries;
+  opts.timeout = query_timeout;
+  opts.window = window;
+  alarm (timeout_interval);
+
+  /* request h * n_zones + z looks up host h on zone z */
+  n = n_hosts * n_zones;
+  req = calloc (n, sizeof (*req));
+  zone_time = calloc (n_zones, sizeof (*zone_time));
+  listed = calloc (n_hosts, sizeof (*listed));
+  unlisted = calloc (n_hosts, sizeof (*unlisted));
+  failed = calloc (n_hosts, sizeof (*failed));
+  if (!req || !zone_time || !listed || !unlisted || !failed)
+    die (STATE_UNKNOWN, _("RBL UNKNOWN - Could not allocate memory\n"));
+  for (h = 0; h < n_hosts; h++) {
+    rev = reverse_ipaddr (hosts[h]);
+    for (z = 0; z < n_zones; z++) {
+      i = h * n_zones + z;
+      req[i].server = dns_server;
+      req[i].type = NP_DNS_TYPE_A;
+      xasprintf ((char **)&req[i].name, "%s.%s", rev, zones[z]);
+    }
+  }
 
-/* reverse the ipaddr */
-char *reverse_ipaddr(char *ipaddr)
-{
-  static char revip[MAX_HOST_ADDRESS_LENGTH];
-  int a, b, c, d;
+  np_dns_query_many (req, n, &opts);
+
+  for (h = 0; h < n_hosts; h++) {
+    listed_on = "";
+    for (z = 0; z < n_zones; z++) {
+      i = h * n_zones + z;
+      if (req[i].reply.time / 1.0e3 > zone_time[z])
+        zone_time[z] = req[i].reply.time / 1.0e3;
+
+      /* any address is a listing, the name not existing is none */
+      for (j = 0; req[i].result == NP_DNS_OK && j < req[i].reply.n_rr; j++)
+        if (req[i].reply.rr[j].section == NP_DNS_ANSWER && req[i].reply.rr[j].type == NP_DNS_TYPE_A)
+          break;
+      if (req[i].result == NP_DNS_OK && req[i].reply.rcode == NP_DNS_NOERROR && j < req[i].reply.n_rr) {
+        listed[h]++;
+        xasprintf (&listed_on, "%s%s%s", listed_on, *listed_on ? ", " : "", zones[z]);
+      }
+      else if (req[i].result == NP_DNS_OK &&
+               (req[i].reply.rcode == NP_DNS_NXDOMAIN || req[i].reply.rcode == NP_DNS_NOERROR))
+        unlisted[h]++;
+      else
+        failed[h]++;
+
+      if (verbose)
+        printf ("%s: %s in %.3f ms\n", req[i].name,
+                req[i].result != NP_DNS_OK ? (req[i].result == NP_DNS_ERROR ? strerror (req[i].error) : np_dns_strerror (req[i].result))
+                : np_dns_rcode_name (req[i].reply.rcode), req[i].reply.time);
+    }
+
+    state = get_status (listed[h], listed_thresholds);
+    if (failed[h])
+      state = max_state (state, STATE_WARNING);
+    result = max_state (result, state);
+
+    xasprintf (&output, "%s%s%s listed on %d, unlisted on %d", output ? output : "", output ? "; " : "",
+               hosts[h], listed[h], unlisted[h]);
+    if (failed[h])
+      xasprintf (&output, _("%s, %d lookups failed"), output, failed[h]);
+    if (listed[h])
+      xasprintf (&output, "%s (%s)", output, listed_on);
+
+    xasprintf (&label, "listed_%s", hosts[h]);
+    xasprintf (&perf, "%s%s%s", perf, *perf ? " " : "",
+               perfdata (label, listed[h], "",
+                         listed_thresholds->warning != NULL, listed_thresholds->warning ? listed_thresholds->warning->end : 0,
+                         listed_thresholds->critical != NULL, listed_thresholds->critical ? listed_thresholds->critical->end : 0,
+                         TRUE, 0, TRUE, n_zones));
+  }
 
-  if (strlen(ipaddr) >= MAX_HOST_ADDRESS_LENGTH ||
-      sscanf(ipaddr, "%d.%d.%d.%d", &a, &b, &c, &d) != 4) {
-    usage("IP address invalid or too long");
+  for (z = 0; z < n_zones; z++) {
+    xasprintf (&label, "time_%s", zones[z]);
+    xasprintf (&perf, "%s %s", perf, fperfdata (label, zone_time[z], "s", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0));
   }
-  sprintf(revip, "%d.%d.%d.%d", d, c, b, a);
 
-  return revip;
+  printf ("RBL %s - %s|%s\n", state_text (result), output, perf);
+  return result;
 }
 
 
 
-/* process command-line arguments */
-int process_arguments(int argc, char **argv)
+/* the name to look up on a zone: 192.0.2.1 is listed as 1.2.0.192.zone
+ * and IPv6 addresses by their reversed nibbles */
+char *
+reverse_ipaddr (const char *ipaddr)
 {
-  int c;
+  char *rev, *suffix;
 
-  if(argc<2)
-    return ERROR;
+  if ((rev = np_dns_reverse_name (ipaddr)) == NULL)
+    usage2 (_("IP address invalid"), ipaddr);
+  if ((suffix = strstr (rev, ".in-addr.arpa.")) != NULL || (suffix = strstr (rev, ".ip6.arpa.")) != NULL)
+    *suffix = '\0';
+  return rev;
+}
 
 
-  c=0;
-  while((c+=(call_getopt(argc-c,&argv[c])))<argc){
 
-		if (is_option(argv[c]))
-			continue;
+/* add an item or a comma separated list of them */
+static void
+add_list (char ***list, int *n, char *items)
+{
+  char *item;
 
-    if (query_address==NULL) {
-			if (is_host(argv[c])) {
-				query_address=argv[c];
-			} else {
-				usage("Invalid host name");
-			}
-		}
+  for (item = strtok (items, ","); item; item = strtok (NULL, ",")) {
+    *list = realloc (*list, (*n + 1) * sizeof (**list));
+    (*list)[(*n)++] = strdup (item);
   }
+}
+
 
-  return validate_arguments();
+
+/* one zone per line, # for comments */
+static void
+read_zone_file (const char *path)
+{
+  char line[MAX_INPUT_BUFFER], *zone;
+  FILE *fp;
+
+  if ((fp = fopen (path, "r")) == NULL)
+    die (STATE_UNKNOWN, _("RBL UNKNOWN - Cannot read %s: %s\n"), path, strerror (errno));
+  while (fgets (line, sizeof (line), fp))
+    if ((zone = strtok (line, " \t\r\n")) != NULL && *zone != '#')
+      add_list (&zones, &n_zones, zone);
+  fclose (fp);
 }
 
 
 
-int call_getopt(int argc, char **argv)
+/* process command-line arguments */
+int
+process_arguments (int argc, char **argv)
 {
-  int c,i=0;
-
-#ifdef HAVE_GETOPT_H
-	int option_index = 0;
-	static struct option long_options[] =
-	{ 
-		{"hostname",       required_argument,0,'H'},
-		{"server",         required_argument,0,'s'},
-		{"rblname",        required_argument,0,'r'},
-		{"verbose",        no_argument,      0,'v'},
-		{"version",        no_argument,      0,'V'},
-		{"help",           no_argument,      0,'h'},
-		{0,0,0,0}
-	};
-#endif
-
-  while (1){
-#ifdef HAVE_GETOPT_H
-    c = getopt_long(argc,argv,"+hVvt:s:H:r:",long_options,&option_index);
-#else
-    c = getopt(argc,argv,"+?hVvt:s:H:r:");
-#endif
-
-    i++;
-
-    if(c==-1||c==EOF||c==1)
-      break;
+  int c;
+  char *warning = NULL;
+  char *critical = "0";
+
+  int option = 0;
+  static struct option longopts[] = {
+    {"hostname", required_argument, 0, 'H'},
+    {"server", required_argument, 0, 's'},
+    {"port", required_argument, 0, 'p'},
+    {"rblname", required_argument, 0, 'r'},
+    {"rbl-file", required_argument, 0, 'f'},
+    {"window", required_argument, 0, 'W'},
+    {"query-timeout", required_argument, 0, 'q'},
+    {"retries", required_argument, 0, 'R'},
+    {"warning", required_argument, 0, 'w'},
+    {"critical", required_argument, 0, 'c'},
+    {"timeout", required_argument, 0, 't'},
+    {"use-ipv4", no_argument, 0, '4'},
+    {"use-ipv6", no_argument, 0, '6'},
+    {"verbose", no_argument, 0, 'v'},
+    {"version", no_argument, 0, 'V'},
+    {"help", no_argument, 0, 'h'},
+    {0, 0, 0, 0}
+  };
+
+  if (argc < 2)
+    return ERROR;
 
-    switch (c)
-      {
-      case 't':
-      case 'l':
-      case 'H':
-				i++;
-      }
+  while (1) {
+    c = getopt_long (argc, argv, "hVvt:s:p:H:r:f:W:q:R:w:c:46", longopts, &option);
+
+    if (c == -1 || c == EOF)
+      break;
 
-    switch (c)
-      {
-      case 'H': /* hostname */
-				if (is_host(optarg)) {
-					query_address=optarg;
-				} else {
-					usage("Invalid host name (-H)\n");
-				}
-				break;
-      case 's': /* server */
-				if (is_host(optarg)) {
-					dns_server=optarg;
-				} else {
-					usage("Invalid host name (-s)\n");
-				}
-				break;
-      case 'r': /* rblname */
-				rbl_name=optarg;
-				break;
-      case 'v': /* verbose */
-				verbose=TRUE;
-				break;
-      case 't': /* timeout */
-				if (is_intnonneg(optarg)) {
-					timeout_interval=atoi(optarg);
-				} else {
-					usage("Time interval must be a nonnegative integer\n");
-				}
-				break;
-      case 'V': /* version */
-				print_revision(progname,"$Revision: 970 $");
-				exit(STATE_OK);
-      case 'h': /* help */
-				print_help();
-				exit(STATE_OK);
-      case '?': /* help */
-			printf (_("%s: Unknown argument: %s\n\n"), progname, optarg);
-			print_usage ();
-			exit (STATE_UNKNOWN);
-			}
+    switch (c) {
+    case 'H': /* hostname */
+      add_list (&hosts, &n_hosts, optarg);
+      break;
+    case 's': /* server */
+      host_or_die (optarg);
+      dns_server = optarg;
+      break;
+    case 'p': /* server port */
+      if (!is_intpos (optarg) || (server_port = atoi (optarg)) > 65535)
+        usage2 (_("Port must be a positive integer"), optarg);
+      break;
+    case 'r': /* rblname */
+      add_list (&zones, &n_zones, optarg);
+      break;
+    case 'f': /* file of rblnames */
+      read_zone_file (optarg);
+      break;
+    case 'W': /* queries in flight */
+      if (!is_intpos (optarg))
+        usage2 (_("Window must be a positive integer"), optarg);
+      window = atoi (optarg);
+      break;
+    case 'q': /* ms per try */
+      if (!is_intpos (optarg))
+        usage2 (_("Query timeout must be a positive integer"), optarg);
+      query_timeout = atoi (optarg);
+      break;
+    case 'R': /* retries */
+      if (!is_intnonneg (optarg))
+        usage2 (_("Retries must be a non-negative integer"), optarg);
+      retries = atoi (optarg);
+      break;
+    case 'w':
+      warning = optarg;
+      break;
+    case 'c':
+      critical = optarg;
+      break;
+    case 't': /* timeout */
+      if (!is_intnonneg (optarg))
+        usage2 (_("Timeout interval must be a positive integer"), optarg);
+      timeout_interval = atoi (optarg);
+      break;
+    case '4':
+      address_family = AF_INET;
+      break;
+    case '6':
+      address_family = AF_INET6;
+      break;
+    case 'v': /* verbose */
+      verbose = TRUE;
+      break;
+    case 'V': /* version */
+      print_revision (progname, NP_VERSION);
+      exit (STATE_OK);
+    case 'h': /* help */
+      print_help ();
+      exit (STATE_OK);
+    default:
+      usage5 ();
+    }
   }
-  return i;
+
+  for (c = optind; c < argc; c++)
+    add_list (&hosts, &n_hosts, argv[c]);
+
+  set_thresholds (&listed_thresholds, warning, critical);
+
+  return validate_arguments ();
 }
 
 
 
-int validate_arguments(void)
+int
+validate_arguments (void)
 {
-  if (query_address == NULL || rbl_name == NULL)
+  int i;
+
+  if (n_hosts == 0 || n_zones == 0)
     return ERROR;
-  else
-    return OK;
+  for (i = 0; i < n_hosts; i++)
+    reverse_ipaddr (hosts[i]);
+  return OK;
 }
 
 
 
-void print_help(void)
+void
+print_help (void)
 {
-	print_revision(progname,"$Revision: 970 $");
-	printf
-		("Copyright (c) 2000 Karl DeBisschop\n\n"
-		 "This plugin uses dig to test whether the specified host is on any RBL lists.\n\n");
-	print_usage();
-	printf
-		("\nOptions:\n"
-		 " -H, --hostname=IPADDRESS\n"
-		 "   Check status of indicated host\n"
-		 " -s, --server=STRING or IPADDRESS\n"
-		 "   DNS server to use\n"
-		 " -r, --rblname=STRING\n"
-		 "   RBL domain name to use (e.g. relays.ordb.org)\n"
-		 " -t, --timeout=INTEGER\n"
-		 "   Seconds before connection attempt times out (default: %d)\n"
-		 " -v, --verbose\n"
-		 "   Print extra information (command-line use only)\n"
-		 " -h, --help\n"
-		 "   Print detailed help screen\n"
-		 " -V, --version\n"
-		 "   Print version information\n\n",
-		 DEFAULT_SOCKET_TIMEOUT);
-		support();
+  print_revision (progname, NP_VERSION);
+
+  printf ("Copyright (c) 2000 Karl DeBisschop\n");
+  printf (COPYRIGHT, copyright, email);
+
+  printf ("%s\n", _("This plugin tests whether the specified hosts are on any RBL lists. All hosts are"));
+  printf ("%s\n", _("looked up on all lists at once."));
+
+  printf ("\n\n");
+
+  print_usage ();
+
+  printf (UT_HELP_VRSN);
+  printf (UT_EXTRA_OPTS);
+
+  printf (" %s\n", "-H, --hostname=IPADDRESS[,IPADDRESS...]");
+  printf ("    %s\n", _("Check status of indicated hosts, the option can be repeated"));
+  printf (" %s\n", "-r, --rblname=STRING[,STRING...]");
+  printf ("    %s\n", _("RBL domain names to use (e.g. zen.spamhaus.org), the option can be repeated"));
+  printf (" %s\n", "-f, --rbl-file=FILE");
+  printf ("    %s\n", _("Read RBL domain names from FILE, one per line"));
+  printf (" %s\n", "-s, --server=STRING or IPADDRESS");
+  printf ("    %s\n", _("DNS server to use (default: the first one in /etc/resolv.conf)"));
+  printf (" %s\n", "-p, --port=INTEGER");
+  printf ("    %s (%s: %d)\n", _("Port number of the DNS server"), _("default"), NP_DNS_PORT);
+  printf (UT_IPv46);
+  printf (" %s\n", "-W, --window=INTEGER");
+  printf ("    %s (%s: %d)\n", _("Lookups waiting for an answer at any time"), _("default"), DEFAULT_WINDOW);
+  printf (" %s\n", "-q, --query-timeout=INTEGER");
+  printf ("    %s (%s: %d)\n", _("Milliseconds to wait for each lookup"), _("default"), DEFAULT_QUERY_TIMEOUT);
+  printf (" %s\n", "-R, --retries=INTEGER");
+  printf ("    %s (%s: %d)\n", _("Times to resend an unanswered lookup"), _("default"), retries);
+  printf (" %s\n", "-w, --warning=RANGE");
+  printf ("    %s\n", _("Number of lists a host may be on before a warning (default: none)"));
+  printf (" %s\n", "-c, --critical=RANGE");
+  printf ("    %s\n", _("Number of lists a host may be on before it is critical (default: 0)"));
+  printf (UT_TIMEOUT, DEFAULT_SOCKET_TIMEOUT);
+  printf (UT_VERBOSE);
+
+  printf ("\n");
+  printf ("%s\n", _("Notes:"));
+  printf (" %s\n", _("Failed lookups make the check WARNING. The output gives each host's listed and"));
+  printf (" %s\n", _("unlisted counts, the perfdata the listings per host and the slowest answer per list."));
+
+  printf (UT_SUPPORT);
 }
 
 
 
-void print_usage(void)
+void
+print_usage (void)
 {
-	printf
-		("Usage: %s -H hostip -r rblname [-s server] [-t timeout] [-v]\n"
-		 "       %s --help\n"
-		 "       %s --version\n",
-		 progname, progname, progname);
+  printf ("%s\n", _("Usage:"));
+  printf ("%s -H hostip[,hostip...] -r rblname[,rblname...] [-f rblfile] [-s server]\n", progname);
+  printf ("  [-p port] [-W window] [-q query-timeout] [-R retries] [-w warn] [-c crit] [-t timeout] [-v]\n");
 }
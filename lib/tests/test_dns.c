@@ -0,0 +1,196 @@
+/*****************************************************************************
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "utils_dns.h"
+#include "tap.h"
+
+/* reply to a query for www.example.com A: a CNAME to web.example.com with
+ * two addresses, an NS record for example.com and glue for the NS */
+static const unsigned char reply_www[] = {
+	0x12, 0x34, 0x85, 0x80, 0x00, 0x01, 0x00, 0x03, 0x00, 0x01, 0x00, 0x01,
+	/* 12: www.example.com A IN */
+	0x03, 'w', 'w', 'w', 0x07, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 0x03, 'c', 'o', 'm', 0x00,
+	0x00, 0x01, 0x00, 0x01,
+	/* 33: www -> CNAME web.(16) */
+	0xc0, 0x0c, 0x00, 0x05, 0x00, 0x01, 0x00, 0x00, 0x0e, 0x10, 0x00, 0x06,
+	0x03, 'w', 'e', 'b', 0xc0, 0x10,
+	/* 51: web.example.com (45) A 192.0.2.2 */
+	0xc0, 0x2d, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x3c, 0x00, 0x04,
+	192, 0, 2, 2,
+	/* web.example.com A 192.0.2.1 */
+	0xc0, 0x2d, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x3c, 0x00, 0x04,
+	192, 0, 2, 1,
+	/* 83: example.com NS ns1.example.com */
+	0xc0, 0x10, 0x00, 0x02, 0x00, 0x01, 0x00, 0x01, 0x51, 0x80, 0x00, 0x06,
+	0x03, 'n', 's', '1', 0xc0, 0x10,
+	/* 101: ns1.example.com (95) A 192.0.2.53 */
+	0xc0, 0x5f, 0x00, 0x01, 0x00, 0x01, 0x00, 0x01, 0x51, 0x80, 0x00, 0x04,
+	192, 0, 2, 53
+};
+
+/* MX, TXT, SOA and an unknown type, with an OPT record */
+static const unsigned char reply_misc[] = {
+	0xab, 0xcd, 0x81, 0x03, 0x00, 0x01, 0x00, 0x03, 0x00, 0x01, 0x00, 0x01,
+	0x01, 'x', 0x00, 0x00, 0xff, 0x00, 0x01,
+	/* 19: x. MX 10 mail.x. */
+	0xc0, 0x0c, 0x00, 0x0f, 0x00, 0x01, 0x00, 0x00, 0x00, 0x01, 0x00, 0x09,
+	0x00, 0x0a, 0x04, 'm', 'a', 'i', 'l', 0xc0, 0x0c,
+	/* x. TXT "a b" "\"" */
+	0xc0, 0x0c, 0x00, 0x10, 0x00, 0x01, 0x00, 0x00, 0x00, 0x01, 0x00, 0x06,
+	0x03, 'a', ' ', 'b', 0x01, '"',
+	/* x. TYPE99 \# 2 beef */
+	0xc0, 0x0c, 0x00, 0x63, 0x00, 0x01, 0x00, 0x00, 0x00, 0x01, 0x00, 0x02,
+	0xbe, 0xef,
+	/* x. SOA x. x. 1 2 3 4 5 */
+	0xc0, 0x0c, 0x00, 0x06, 0x00, 0x01, 0x00, 0x00, 0x00, 0x01, 0x00, 0x18,
+	0xc0, 0x0c, 0xc0, 0x0c, 0, 0, 0, 1, 0, 0, 0, 2, 0, 0, 0, 3, 0, 0, 0, 4, 0, 0, 0, 5,
+	/* OPT, 4096 byte payload */
+	0x00, 0x00, 0x29, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+/* an answer whose name points at itself */
+static const unsigned char reply_loop[] = {
+	0x00, 0x01, 0x81, 0x80, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+	0xc0, 0x0c, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x01, 0x00, 0x04,
+	1, 2, 3, 4
+};
+
+int
+main (int argc, char **argv)
+{
+	unsigned char buf[512];
+	np_dns_options opts;
+	np_dns_reply reply;
+	np_dns_resolv resolv;
+	char *name, conf[] = "/tmp/test_dns.XXXXXX";
+	FILE *fp;
+	int len, fd;
+
+	plan_tests(49);
+
+	np_dns_init_options(&opts);
+	len = np_dns_build_query(buf, sizeof(buf), 0x1234, "www.example.com", NP_DNS_TYPE_A, &opts);
+	ok(len == 33, "Query length");
+	ok(buf[0] == 0x12 && buf[1] == 0x34 && buf[2] == 0x01 && buf[3] == 0,
+	   "Query id and RD bit");
+	ok(buf[5] == 1 && buf[7] == 0 && buf[11] == 0, "One question, no OPT record");
+	ok(!memcmp(buf + 12, reply_www + 12, 21), "Question encoded");
+
+	len = np_dns_build_query(buf, sizeof(buf), 1, "www.example.com.", NP_DNS_TYPE_A, &opts);
+	ok(len == 33 && !memcmp(buf + 12, reply_www + 12, 21), "Trailing dot ignored");
+
+	opts.recurse = 0;
+	opts.edns = 4096;
+	len = np_dns_build_query(buf, sizeof(buf), 1, ".", NP_DNS_TYPE_NS, &opts);
+	ok(len == 12 + 5 + 11, "Root query with OPT record");
+	ok(buf[2] == 0 && buf[11] == 1, "No RD bit, one additional record");
+	ok(buf[17] == 0 && buf[18] == 0 && buf[19] == 41 && buf[20] == 0x10 && buf[21] == 0,
+	   "OPT record advertises the payload size");
+	np_dns_init_options(&opts);
+
+	ok(np_dns_build_query(buf, sizeof(buf), 1, "a..b", NP_DNS_TYPE_A, &opts) == -1,
+	   "Empty label refused");
+	ok(np_dns_build_query(buf, sizeof(buf), 1,
+	   "0123456789012345678901234567890123456789012345678901234567890123.com",
+	   NP_DNS_TYPE_A, &opts) == -1, "Label over 63 characters refused");
+	ok(np_dns_build_query(buf, 20, 1, "www.example.com", NP_DNS_TYPE_A, &opts) == -1,
+	   "Query not fitting the buffer refused");
+
+	ok(np_dns_parse_reply(reply_www, sizeof(reply_www), &reply) == NP_DNS_OK, "Reply parsed");
+	ok(reply.id == 0x1234 && reply.rcode == NP_DNS_NOERROR, "Id and rcode");
+	ok(reply.aa && reply.rd && reply.ra && !reply.tc, "Flags");
+	ok(reply.n_rr == 5, "All records");
+	ok(!strcmp(reply.rr[0].name, "www.example.com.") && reply.rr[0].type == NP_DNS_TYPE_CNAME &&
+	   !strcmp(reply.rr[0].data, "web.example.com."), "Compressed CNAME");
+	ok(reply.rr[0].ttl == 3600 && reply.rr[0].section == NP_DNS_ANSWER, "TTL and section");
+	ok(!strcmp(reply.rr[1].name, "web.example.com.") && !strcmp(reply.rr[1].data, "192.0.2.2"),
+	   "First address");
+	ok(!strcmp(reply.rr[2].data, "192.0.2.1"), "Second address");
+	ok(reply.rr[3].type == NP_DNS_TYPE_NS && reply.rr[3].section == NP_DNS_AUTHORITY &&
+	   !strcmp(reply.rr[3].data, "ns1.example.com."), "Authority section");
+	ok(reply.rr[4].section == NP_DNS_ADDITIONAL && !strcmp(reply.rr[4].name, "ns1.example.com.") &&
+	   !strcmp(reply.rr[4].data, "192.0.2.53"), "Additional section");
+	ok(reply.edns_size == 0, "No EDNS");
+	np_dns_free_reply(&reply);
+
+	ok(np_dns_parse_reply(reply_misc, sizeof(reply_misc), &reply) == NP_DNS_OK, "Other types parsed");
+	ok(reply.rcode == NP_DNS_NXDOMAIN && !reply.aa && !reply.ra, "NXDOMAIN");
+	ok(reply.n_rr == 4, "OPT record not listed");
+	ok(reply.edns_size == 4096, "EDNS payload size");
+	ok(!strcmp(reply.rr[0].data, "10 mail.x."), "MX");
+	ok(!strcmp(reply.rr[1].data, "\"a b\" \"\\\"\""), "TXT");
+	ok(!strcmp(reply.rr[2].data, "\\# 2 beef"), "Unknown type");
+	ok(!strcmp(reply.rr[3].data, "x. x. 1 2 3 4 5"), "SOA");
+	np_dns_free_reply(&reply);
+
+	ok(np_dns_parse_reply(reply_loop, sizeof(reply_loop), &reply) == NP_DNS_BADREPLY,
+	   "Compression loop rejected");
+	np_dns_free_reply(&reply);
+	ok(np_dns_parse_reply(reply_www, 60, &reply) == NP_DNS_BADREPLY, "Short reply rejected");
+	np_dns_free_reply(&reply);
+	memcpy(buf, reply_www, sizeof(reply_www));
+	buf[2] |= 0x02;
+	ok(np_dns_parse_reply(buf, 60, &reply) == NP_DNS_OK && reply.tc && reply.n_rr == 1,
+	   "Truncated reply keeps the complete records");
+	np_dns_free_reply(&reply);
+	buf[2] &= ~0x80;
+	ok(np_dns_parse_reply(buf, sizeof(reply_www), &reply) == NP_DNS_BADREPLY, "Query rejected");
+	np_dns_free_reply(&reply);
+
+	name = np_dns_reverse_name("192.0.2.1");
+	ok(name && !strcmp(name, "1.2.0.192.in-addr.arpa."), "IPv4 reverse name");
+	free(name);
+	name = np_dns_reverse_name("2001:db8::1");
+	ok(name && !strcmp(name, "1.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.8.b.d.0.1.0.0.2.ip6.arpa."),
+	   "IPv6 reverse name");
+	free(name);
+	ok(np_dns_reverse_name("www.example.com") == NULL, "No reverse name for names");
+
+	ok(np_dns_type("aaaa") == NP_DNS_TYPE_AAAA, "Type by name");
+	ok(np_dns_type("TYPE99") == 99, "Generic type");
+	ok(np_dns_type("bogus") == -1, "Unknown type");
+	ok(!strcmp(np_dns_type_name(NP_DNS_TYPE_MX), "MX"), "Type name");
+	ok(!strcmp(np_dns_type_name(99), "TYPE99"), "Generic type name");
+	ok(!strcmp(np_dns_rcode_name(NP_DNS_REFUSED), "REFUSED"), "Rcode name");
+	ok(np_dns_class("ch") == NP_DNS_CLASS_CH && np_dns_class("CLASS42") == 42, "Class by name");
+	ok(!strcmp(np_dns_class_name(NP_DNS_CLASS_IN), "IN") && !strcmp(np_dns_class_name(42), "CLASS42"),
+	   "Class name");
+
+	opts.qclass = NP_DNS_CLASS_CH;
+	len = np_dns_build_query(buf, sizeof(buf), 1, "version.bind", NP_DNS_TYPE_TXT, &opts);
+	ok(len == 12 + 14 + 4 && buf[len - 1] == NP_DNS_CLASS_CH && buf[len - 3] == NP_DNS_TYPE_TXT,
+	   "Query for another class");
+	np_dns_init_options(&opts);
+
+	fd = mkstemp(conf);
+	fp = fdopen(fd, "w");
+	fputs("# comment\ndomain example.org\nsearch example.com example.net\n"
+	      "nameserver 192.0.2.53\nnameserver 192.0.2.54\n", fp);
+	fclose(fp);
+	np_dns_read_resolv_conf(conf, &resolv);
+	unlink(conf);
+	ok(!strcmp(resolv.server, "192.0.2.53"), "First nameserver");
+	ok(resolv.n_search == 2 && !strcmp(resolv.search[0], "example.com") &&
+	   !strcmp(resolv.search[1], "example.net"), "Last search list wins");
+	np_dns_read_resolv_conf("/nonexistent/resolv.conf", &resolv);
+	ok(!strcmp(resolv.server, "127.0.0.1") && resolv.n_search == 0,
+	   "Defaults without resolv.conf");
+
+	return exit_status();
+}
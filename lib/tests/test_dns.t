@@ -0,0 +1,6 @@
+#!/usr/bin/perl
+use Test::More;
+if (! -e "./test_dns") {
+	plan skip_all => "./test_dns not compiled - please install tap library to test";
+}
+exec "./test_dns";
@@ -0,0 +1,201 @@
+/*****************************************************************************
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "utils_snmp.h"
+#include "tap.h"
+
+/* SNMPv1 GET sysUpTime.0, community public, request-id 0x1234 */
+static const unsigned char get_uptime[] = {
+	0x30, 0x82, 0x00, 0x2d, 0x02, 0x01, 0x00,
+	0x04, 0x06, 'p', 'u', 'b', 'l', 'i', 'c',
+	0xa0, 0x82, 0x00, 0x1e, 0x02, 0x02, 0x12, 0x34, 0x02, 0x01, 0x00, 0x02, 0x01, 0x00,
+	0x30, 0x82, 0x00, 0x10,
+	0x30, 0x82, 0x00, 0x0c,
+	0x06, 0x08, 0x2b, 0x06, 0x01, 0x02, 0x01, 0x01, 0x03, 0x00, 0x05, 0x00
+};
+
+/* SNMPv2c response with one value of each kind */
+static const unsigned char response[] = {
+	0x30, 0x81, 0xb9, 0x02, 0x01, 0x01,
+	0x04, 0x06, 'p', 'u', 'b', 'l', 'i', 'c',
+	0xa2, 0x81, 0xab, 0x02, 0x02, 0x12, 0x34, 0x02, 0x01, 0x00, 0x02, 0x01, 0x00,
+	0x30, 0x81, 0x9e,
+	/* sysUpTime.0 = Timeticks: 123456789 */
+	0x30, 0x10, 0x06, 0x08, 0x2b, 0x06, 0x01, 0x02, 0x01, 0x01, 0x03, 0x00,
+	0x43, 0x04, 0x07, 0x5b, 0xcd, 0x15,
+	/* sysDescr.0 = STRING: a "b" */
+	0x30, 0x11, 0x06, 0x08, 0x2b, 0x06, 0x01, 0x02, 0x01, 0x01, 0x01, 0x00,
+	0x04, 0x05, 'a', ' ', '"', 'b', '"',
+	/* ifOperStatus.1 = INTEGER: -2 */
+	0x30, 0x0f, 0x06, 0x0a, 0x2b, 0x06, 0x01, 0x02, 0x01, 0x02, 0x02, 0x01, 0x08, 0x01,
+	0x02, 0x01, 0xfe,
+	/* ifHCInOctets.1 = Counter64: 2^64 - 1, with a leading zero */
+	0x30, 0x18, 0x06, 0x0b, 0x2b, 0x06, 0x01, 0x02, 0x01, 0x1f, 0x01, 0x01, 0x01, 0x06, 0x01,
+	0x46, 0x09, 0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	/* ipAdEntAddr.192.0.2.1 = IpAddress: 192.0.2.1 */
+	0x30, 0x16, 0x06, 0x0e, 0x2b, 0x06, 0x01, 0x02, 0x01, 0x04, 0x14, 0x01, 0x01,
+	0x81, 0x40, 0x00, 0x02, 0x01,
+	0x40, 0x04, 0xc0, 0x00, 0x02, 0x01,
+	/* sysObjectID.0 = OID: .1.3.6.1.4.1.8072 */
+	0x30, 0x13, 0x06, 0x08, 0x2b, 0x06, 0x01, 0x02, 0x01, 0x01, 0x02, 0x00,
+	0x06, 0x07, 0x2b, 0x06, 0x01, 0x04, 0x01, 0xbf, 0x08,
+	/* sysORLastChange.9.0 = noSuchInstance */
+	0x30, 0x0c, 0x06, 0x08, 0x2b, 0x06, 0x01, 0x02, 0x01, 0x01, 0x09, 0x00,
+	0x81, 0x00,
+	/* ifPhysAddress.1 = Hex-STRING: 00 01 FF */
+	0x30, 0x11, 0x06, 0x0a, 0x2b, 0x06, 0x01, 0x02, 0x01, 0x02, 0x02, 0x01, 0x06, 0x01,
+	0x04, 0x03, 0x00, 0x01, 0xff
+};
+
+static int
+value_is(const np_snmp_varbind *vb, const char *expect)
+{
+	char *s = np_snmp_value_string(vb);
+	int ret = s && !strcmp(s, expect);
+
+	if (!ret)
+		diag("got '%s'", s ? s : "(null)");
+	free(s);
+	return ret;
+}
+
+int
+main (int argc, char **argv)
+{
+	unsigned char buf[1024];
+	char str[64];
+	np_snmp_options opts;
+	np_snmp_oid oid[2], big;
+	np_snmp_pdu pdu;
+	np_snmp_varbind vb;
+	char *s;
+	int len, i, same;
+
+	plan_tests(41);
+
+	ok(np_snmp_parse_oid("1.3.6.1.2.1.1.3.0", &oid[0]) == 0 && oid[0].n == 9 && oid[0].id[6] == 1,
+	   "OID parsed");
+	ok(np_snmp_parse_oid(".1.3.6.1.2.1.1.3.0", &oid[1]) == 0 && np_snmp_oid_compare(&oid[0], &oid[1]) == 0,
+	   "Leading dot ignored");
+	ok(!strcmp(np_snmp_oid_string(&oid[0], str, sizeof(str)), ".1.3.6.1.2.1.1.3.0"), "OID printed");
+	ok(np_snmp_parse_oid("1.3..6", &oid[1]) == -1, "Empty sub-identifier refused");
+	ok(np_snmp_parse_oid("1.3.6.", &oid[1]) == -1, "Trailing dot refused");
+	ok(np_snmp_parse_oid("sysUpTime.0", &oid[1]) == -1, "Names refused");
+	ok(np_snmp_parse_oid("1", &oid[1]) == -1 && np_snmp_parse_oid("3.1", &oid[1]) == -1 &&
+	   np_snmp_parse_oid("1.40", &oid[1]) == -1, "Impossible first sub-identifiers refused");
+	ok(np_snmp_parse_oid("1.3.4294967296", &oid[1]) == -1, "Sub-identifier over 32 bits refused");
+
+	np_snmp_parse_oid("1.3.6.1.2.1.1", &oid[1]);
+	ok(np_snmp_oid_compare(&oid[1], &oid[0]) < 0 && np_snmp_oid_compare(&oid[0], &oid[1]) > 0,
+	   "A prefix sorts first");
+	np_snmp_parse_oid("1.3.6.1.2.1.1.10", &oid[1]);
+	ok(np_snmp_oid_compare(&oid[0], &oid[1]) < 0, "Sub-identifiers compared as numbers");
+
+	np_snmp_init_options(&opts);
+	len = np_snmp_build_request(buf, sizeof(buf), &opts, NP_SNMP_GET, 0x1234, 0, 0, oid, 1);
+	ok(len == sizeof(get_uptime) && !memcmp(buf, get_uptime, len), "GET encoded");
+	ok(np_snmp_build_request(buf, 40, &opts, NP_SNMP_GET, 0x1234, 0, 0, oid, 1) == -1,
+	   "Request not fitting the buffer refused");
+
+	opts.version = NP_SNMP_V2C;
+	len = np_snmp_build_request(buf, sizeof(buf), &opts, NP_SNMP_GETBULK, 128, 1, 10, oid, 2);
+	ok(buf[6] == NP_SNMP_V2C && buf[15] == NP_SNMP_GETBULK, "GETBULK for v2c");
+	ok(buf[19] == 0x02 && buf[20] == 2 && buf[21] == 0 && buf[22] == 0x80,
+	   "Request-id with its top bit set gets a leading zero");
+	ok(buf[23] == 0x02 && buf[25] == 1 && buf[26] == 0x02 && buf[28] == 10,
+	   "Non-repeaters and max-repetitions");
+
+	ok(np_snmp_parse_pdu(buf, len, &pdu) == NP_SNMP_OK && pdu.n_vb == 2 && pdu.request_id == 128 &&
+	   pdu.error_status == 1 && pdu.error_index == 10, "Request decoded again");
+	np_snmp_free_pdu(&pdu);
+
+	big.n = NP_SNMP_MAX_OID;
+	big.id[0] = 1;
+	big.id[1] = 3;
+	for (i = 2; i < NP_SNMP_MAX_OID; i++)
+		big.id[i] = 4000000000U - i;
+	len = np_snmp_build_request(buf, sizeof(buf), &opts, NP_SNMP_GETNEXT, 1, 0, 0, &big, 1);
+	ok(len > 0 && np_snmp_parse_pdu(buf, len, &pdu) == NP_SNMP_OK && pdu.n_vb == 1 &&
+	   np_snmp_oid_compare(&pdu.vb[0].oid, &big) == 0, "Longest OID encoded and decoded");
+	np_snmp_free_pdu(&pdu);
+
+	ok(np_snmp_parse_pdu(response, sizeof(response), &pdu) == NP_SNMP_OK, "Response parsed");
+	ok(pdu.version == NP_SNMP_V2C && pdu.type == NP_SNMP_RESPONSE && pdu.request_id == 0x1234,
+	   "Version, type and request-id");
+	ok(pdu.error_status == NP_SNMP_NOERROR && pdu.n_vb == 8, "All variables");
+	ok(!strcmp(np_snmp_oid_string(&pdu.vb[0].oid, str, sizeof(str)), ".1.3.6.1.2.1.1.3.0"),
+	   "Variable name");
+	ok(value_is(&pdu.vb[0], "Timeticks: (123456789) 14 days, 6:56:07.89"), "Timeticks");
+	ok(value_is(&pdu.vb[1], "STRING: \"a \\\"b\\\"\""), "String with quotes");
+	ok(pdu.vb[2].integer == -2 && value_is(&pdu.vb[2], "INTEGER: -2"), "Negative integer");
+	ok(value_is(&pdu.vb[3], "Counter64: 18446744073709551615"), "Counter64");
+	ok(!strcmp(np_snmp_oid_string(&pdu.vb[4].oid, str, sizeof(str)), ".1.3.6.1.2.1.4.20.1.1.192.0.2.1"),
+	   "Sub-identifier over 127");
+	ok(value_is(&pdu.vb[4], "IpAddress: 192.0.2.1"), "IpAddress");
+	ok(value_is(&pdu.vb[5], "OID: .1.3.6.1.4.1.8072"), "Object identifier");
+	ok(value_is(&pdu.vb[6], "No Such Instance currently exists at this OID"), "Exception");
+	ok(value_is(&pdu.vb[7], "Hex-STRING: 00 01 FF"), "Binary string");
+
+	for (i = 0, same = 1; i < pdu.n_vb && same; i++) {
+		len = np_snmp_encode_varbind(buf, sizeof(buf), &pdu.vb[i]);
+		same = len > 0 && np_snmp_decode_varbind(buf, len, &vb) == len &&
+		       np_snmp_oid_compare(&vb.oid, &pdu.vb[i].oid) == 0;
+		if (same) {
+			s = np_snmp_value_string(&pdu.vb[i]);
+			same = value_is(&vb, s);
+			free(s);
+		}
+		np_snmp_free_varbind(&vb);
+	}
+	ok(same, "Varbinds encoded and decoded again");
+	len = np_snmp_encode_varbind(buf, sizeof(buf), &pdu.vb[3]);
+	ok(buf[len - 11] == NP_SNMP_COUNTER64 && buf[len - 10] == 9 && buf[len - 9] == 0,
+	   "Leading zero for an unsigned top bit");
+	ok(np_snmp_decode_varbind(buf, len - 1, &vb) == -1, "Short varbind rejected");
+	ok(np_snmp_encode_varbind(buf, 10, &pdu.vb[3]) == -1, "Varbind too long for the buffer");
+	np_snmp_free_pdu(&pdu);
+
+	memcpy(buf, response, sizeof(response));
+	buf[23] = NP_SNMP_NOSUCHNAME;
+	buf[26] = 1;
+	ok(np_snmp_parse_pdu(buf, sizeof(response), &pdu) == NP_SNMP_OK &&
+	   pdu.error_status == NP_SNMP_NOSUCHNAME && pdu.error_index == 1, "Error status");
+	ok(!strcmp(np_snmp_error_name(pdu.error_status), "noSuchName"), "Error name");
+	np_snmp_free_pdu(&pdu);
+
+	ok(np_snmp_parse_pdu(response, sizeof(response) - 1, &pdu) == NP_SNMP_BADREPLY,
+	   "Short response rejected");
+	np_snmp_free_pdu(&pdu);
+	buf[sizeof(response) - 5] = NP_SNMP_IPADDRESS;
+	ok(np_snmp_parse_pdu(buf, sizeof(response), &pdu) == NP_SNMP_BADREPLY,
+	   "IpAddress of the wrong size rejected");
+	np_snmp_free_pdu(&pdu);
+
+	/* RFC 3414 A.3.2 */
+	memset(buf, 0, 12);
+	buf[11] = 2;
+	np_snmp_localize_sha1("maplesyrup", buf, 12, buf + 12);
+	ok(!memcmp(buf + 12, "\x66\x95\xfe\xbc\x92\x88\xe3\x62\x82\x23\x5f\xc7\x15\x1f"
+	           "\x12\x84\x97\xb3\x8f\x3f", NP_SNMP_SHA1_KEY_LEN), "SHA-1 key localized");
+
+	ok(!strcmp(np_snmp_type_name(NP_SNMP_GAUGE32), "Gauge32"), "Type name");
+	ok(!strcmp(np_snmp_strerror(NP_SNMP_TIMEOUT), "no response"), "Result text");
+
+	return exit_status();
+}
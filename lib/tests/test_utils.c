@@ -38,7 +38,7 @@ main (int argc, char **argv)
 	state_data *temp_state_data;
 	time_t	current_time;
 
-	plan_tests(141);
+	plan_tests(147);
 
 	ok( this_nagios_plugin==NULL, "nagios_plugin not initialised");
 
@@ -415,6 +415,27 @@ main (int argc, char **argv)
 	/* Check time is set to current_time */
 	ok(system("cmp var/generated var/statefile > /dev/null")!=0, "Generated file should be different this time");
 	ok(this_nagios_plugin->state->state_data->time-current_time<=1, "Has time generated from current time");
+
+	/* Data strings are not limited to a fixed line length */
+	temp_string = (char *) malloc(100001);
+	for(rc=0; rc<100000; rc++)
+		temp_string[rc] = 'a' + rc % 26;
+	temp_string[100000] = '\0';
+	np_state_write_string(0, temp_string);
+	temp_state_data = np_state_read();
+	ok(temp_state_data!=NULL && strlen((char *)temp_state_data->data)==100000, "Read back long data string");
+	ok(temp_state_data!=NULL && !strcmp((char *)temp_state_data->data, temp_string), "Long data string intact");
+	free(temp_string);
+
+	/* Binary data keeps its newlines and NULs */
+	np_state_write_binary(0, "two\nlines\0and a NUL", 20);
+	temp_state_data = np_state_read();
+	ok(temp_state_data!=NULL, "Read back binary data");
+	ok(temp_state_data!=NULL && temp_state_data->length==20, "Binary data length");
+	ok(temp_state_data!=NULL && !memcmp(temp_state_data->data, "two\nlines\0and a NUL", 20), "Binary data intact");
+	np_state_write_binary(0, "", 0);
+	temp_state_data = np_state_read();
+	ok(temp_state_data!=NULL && temp_state_data->length==0, "Empty binary data");
 	
 
 	/* Don't know how to automatically test this. Need to be able to redefine die and catch the error */
@@ -507,23 +507,35 @@ state_data *np_state_read() {
  */
 int _np_state_read_file(FILE *f) {
 	int status=FALSE;
-	size_t pos;
+	size_t pos, size=1024;
 	char *line;
-	int i;
+	int i, binary=FALSE;
 	int failure=0;
+	long length;
 	time_t current_time, data_time;
-	enum { STATE_FILE_VERSION, STATE_DATA_VERSION, STATE_DATA_TIME, STATE_DATA_TEXT, STATE_DATA_END } expected=STATE_FILE_VERSION;
+	enum { STATE_FILE_VERSION, STATE_DATA_VERSION, STATE_DATA_TIME, STATE_DATA_TEXT, STATE_DATA_LENGTH, STATE_DATA_END } expected=STATE_FILE_VERSION;
 
 	time(&current_time);
 
-	/* Note: This introduces a limit of 1024 bytes in the string data */
-	line = (char *) calloc(1, 1024);
+	line = (char *) calloc(1, size);
 	if(line==NULL)
 		die(STATE_UNKNOWN, _("Cannot allocate memory: %s"),
 		    strerror(errno));
 
-	while(!failure && (fgets(line,1024,f))!=NULL){
+	while(!failure && (fgets(line,size,f))!=NULL){
 		pos=strlen(line);
+		/* Grow the buffer until we have the whole line, so there is
+		 * no limit on the size of the string data */
+		while(pos==size-1 && line[pos-1]!='\n') {
+			size*=2;
+			line = (char *) realloc(line, size);
+			if(line==NULL)
+				die(STATE_UNKNOWN, _("Cannot allocate memory: %s"),
+				    strerror(errno));
+			if(fgets(line+pos,size-pos,f)==NULL)
+				break;
+			pos+=strlen(line+pos);
+		}
 		if(line[pos-1]=='\n') {
 			line[pos-1]='\0';
 		}
@@ -533,10 +545,12 @@ int _np_state_read_file(FILE *f) {
 		switch(expected) {
 			case STATE_FILE_VERSION:
 				i=atoi(line);
-				if(i!=NP_STATE_FORMAT_VERSION)
+				if(i!=NP_STATE_FORMAT_VERSION && i!=NP_STATE_BINARY_FORMAT_VERSION)
 					failure++;
-				else
+				else {
+					binary=(i==NP_STATE_BINARY_FORMAT_VERSION);
 					expected=STATE_DATA_VERSION;
+				}
 				break;
 			case STATE_DATA_VERSION:
 				i=atoi(line);
@@ -552,13 +566,34 @@ int _np_state_read_file(FILE *f) {
 					failure++;
 				else {
 					this_nagios_plugin->state->state_data->time = data_time;
-					expected=STATE_DATA_TEXT;
+					expected=binary ? STATE_DATA_LENGTH : STATE_DATA_TEXT;
 				}
 				break;
 			case STATE_DATA_TEXT:
 				this_nagios_plugin->state->state_data->data = strdup(line);
 				if(this_nagios_plugin->state->state_data->data==NULL)
 					die(STATE_UNKNOWN, _("Cannot execute strdup: %s"), strerror(errno));
+				this_nagios_plugin->state->state_data->length = strlen(line);
+				expected=STATE_DATA_END;
+				status=TRUE;
+				break;
+			case STATE_DATA_LENGTH:
+				/* The data follows as it is, newlines and all */
+				length=strtol(line,NULL,10);
+				if(length<0 || length>INT_MAX) {
+					failure++;
+					break;
+				}
+				this_nagios_plugin->state->state_data->data = malloc(length+1);
+				if(this_nagios_plugin->state->state_data->data==NULL)
+					die(STATE_UNKNOWN, _("Cannot allocate memory: %s"),
+					    strerror(errno));
+				if(fread(this_nagios_plugin->state->state_data->data,1,length,f)!=(size_t)length) {
+					failure++;
+					break;
+				}
+				((char *)this_nagios_plugin->state->state_data->data)[length]='\0';
+				this_nagios_plugin->state->state_data->length = length;
 				expected=STATE_DATA_END;
 				status=TRUE;
 				break;
@@ -578,7 +613,7 @@ int _np_state_read_file(FILE *f) {
  * two things writing to same key at same time. 
  * Will die with UNKNOWN if errors
  */
-void np_state_write_string(time_t data_time, char *data_string) {
+void _np_state_write(time_t data_time, const void *data, int length, int binary) {
 	FILE *fp;
 	char *temp_file=NULL;
 	int fd=0, result=0;
@@ -631,10 +666,15 @@ void np_state_write_string(time_t data_time, char *data_string) {
 	}
 	
 	fprintf(fp,"# NP State file\n");
-	fprintf(fp,"%d\n",NP_STATE_FORMAT_VERSION);
+	fprintf(fp,"%d\n",binary ? NP_STATE_BINARY_FORMAT_VERSION : NP_STATE_FORMAT_VERSION);
 	fprintf(fp,"%d\n",this_nagios_plugin->state->data_version);
 	fprintf(fp,"%lu\n",current_time);
-	fprintf(fp,"%s\n",data_string);
+	if(binary) {
+		fprintf(fp,"%d\n",length);
+		fwrite(data,1,length,fp);
+	} else {
+		fprintf(fp,"%.*s\n",length,(const char *)data);
+	}
 	
 	fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP);
 	
@@ -659,3 +699,14 @@ void np_state_write_string(time_t data_time, char *data_string) {
 	np_free(temp_file);
 }
 
+void np_state_write_string(time_t data_time, char *data_string) {
+	_np_state_write(data_time, data_string, strlen(data_string), FALSE);
+}
+
+/*
+ * As np_state_write_string, for data of any length and content. It is
+ * read back by np_state_read, with its length in state_data->length
+ */
+void np_state_write_binary(time_t data_time, const void *data, int length) {
+	_np_state_write(data_time, data, length, TRUE);
+}
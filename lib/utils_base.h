@@ -31,6 +31,7 @@ typedef struct thresholds_struct {
 	} thresholds;
 
 #define NP_STATE_FORMAT_VERSION 1
+#define NP_STATE_BINARY_FORMAT_VERSION 2 /* length line, then the raw data */
 
 typedef struct state_data_struct {
 	time_t	time;
@@ -95,8 +96,10 @@ char *np_extract_value(const char*, const char*, char);
 
 
 void np_enable_state(char *, int);
+char *_np_state_calculate_location_prefix();
 state_data *np_state_read();
 void np_state_write_string(time_t, char *);
+void np_state_write_binary(time_t, const void *, int);
 
 void np_init(char *, int argc, char **argv);
 void np_set_args(int argc, char **argv);
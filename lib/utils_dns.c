@@ -0,0 +1,987 @@
+/*****************************************************************************
+*
+* Library for check_dns and friends
+*
+* License: GPL
+* Copyright (c) 2013 Nagios Plugins Development Team
+*
+* Description:
+*
+* This file contains a small DNS client: query encoding, reply decoding and
+* a stub resolver talking to one server over UDP, falling back to TCP. The
+* packet code is tested by libtap
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "utils_dns.h"
+#include <fcntl.h>
+#include <ctype.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+/* compression pointers may only be followed this often per name */
+#define MAX_POINTERS 64
+
+/* room for a query with the longest name and an OPT record */
+#define QUERY_SIZE (NP_DNS_MAX_NAME + NP_DNS_HEADER_SIZE + 16)
+
+static const struct {
+	int type;
+	const char *name;
+} dns_types[] = {
+	{ NP_DNS_TYPE_A, "A" },
+	{ NP_DNS_TYPE_NS, "NS" },
+	{ NP_DNS_TYPE_CNAME, "CNAME" },
+	{ NP_DNS_TYPE_SOA, "SOA" },
+	{ NP_DNS_TYPE_PTR, "PTR" },
+	{ NP_DNS_TYPE_MX, "MX" },
+	{ NP_DNS_TYPE_TXT, "TXT" },
+	{ NP_DNS_TYPE_AAAA, "AAAA" },
+	{ NP_DNS_TYPE_SRV, "SRV" },
+	{ NP_DNS_TYPE_OPT, "OPT" },
+	{ NP_DNS_TYPE_ANY, "ANY" },
+	{ 0, NULL }
+};
+
+static const struct {
+	int class;
+	const char *name;
+} dns_classes[] = {
+	{ NP_DNS_CLASS_IN, "IN" },
+	{ NP_DNS_CLASS_CH, "CH" },
+	{ NP_DNS_CLASS_HS, "HS" },
+	{ NP_DNS_CLASS_ANY, "ANY" },
+	{ 0, NULL }
+};
+
+void
+np_dns_init_options(np_dns_options *opts)
+{
+	memset(opts, 0, sizeof(*opts));
+	opts->port = NP_DNS_PORT;
+	opts->family = AF_UNSPEC;
+	opts->retries = 2;
+	opts->timeout = 2000;
+	opts->qclass = NP_DNS_CLASS_IN;
+	opts->recurse = 1;
+}
+
+static void
+put16(unsigned char *p, unsigned int v)
+{
+	p[0] = (v >> 8) & 0xff;
+	p[1] = v & 0xff;
+}
+
+static unsigned int
+get16(const unsigned char *p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+static unsigned long
+get32(const unsigned char *p)
+{
+	return ((unsigned long)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/* encode a dotted name. Returns the bytes used, or -1 */
+static int
+put_name(unsigned char *buf, size_t size, const char *name)
+{
+	size_t pos = 0, len;
+	const char *dot;
+
+	while (*name) {
+		dot = strchr(name, '.');
+		len = dot ? (size_t)(dot - name) : strlen(name);
+		if (len == 0 || len > 63)
+			return -1;
+		if (pos + len + 1 >= size || pos + len + 1 > 254)
+			return -1;
+		buf[pos++] = len;
+		memcpy(buf + pos, name, len);
+		pos += len;
+		name += len;
+		if (*name == '.')
+			name++;
+	}
+	if (pos >= size)
+		return -1;
+	buf[pos++] = 0;
+	return pos;
+}
+
+int
+np_dns_build_query(unsigned char *buf, size_t size, unsigned short id,
+                   const char *name, int type, const np_dns_options *opts)
+{
+	int len, pos;
+
+	if (size < NP_DNS_HEADER_SIZE + 5)
+		return -1;
+
+	memset(buf, 0, NP_DNS_HEADER_SIZE);
+	put16(buf, id);
+	if (opts->recurse)
+		buf[2] |= 0x01;
+	put16(buf + 4, 1);
+	if (opts->edns)
+		put16(buf + 10, 1);
+	pos = NP_DNS_HEADER_SIZE;
+
+	/* "." is the root, which is encoded as the empty name */
+	if ((len = put_name(buf + pos, size - pos - 4, strcmp(name, ".") ? name : "")) < 0)
+		return -1;
+	pos += len;
+	put16(buf + pos, type);
+	put16(buf + pos + 2, opts->qclass);
+	pos += 4;
+
+	/* an OPT pseudo record advertising our UDP buffer size */
+	if (opts->edns) {
+		if ((size_t)pos + 11 > size)
+			return -1;
+		buf[pos] = 0;
+		put16(buf + pos + 1, NP_DNS_TYPE_OPT);
+		put16(buf + pos + 3, opts->edns);
+		memset(buf + pos + 5, 0, 6);
+		pos += 11;
+	}
+
+	return pos;
+}
+
+/* decode a possibly compressed name starting at *pos into out, and move
+ * *pos past it. Returns -1 on malformed names */
+static int
+get_name(const unsigned char *msg, size_t len, size_t *pos, char *out, size_t outsize)
+{
+	size_t p = *pos, o = 0, end = 0;
+	int jumps = 0, i, n;
+	char esc[5];
+
+	for (;;) {
+		if (p >= len)
+			return -1;
+		n = msg[p];
+		if ((n & 0xc0) == 0xc0) {
+			if (p + 1 >= len || ++jumps > MAX_POINTERS)
+				return -1;
+			if (!end)
+				end = p + 2;
+			p = ((n & 0x3f) << 8) | msg[p + 1];
+			continue;
+		}
+		if (n & 0xc0)
+			return -1;
+		p++;
+		if (n == 0)
+			break;
+		if (p + n > len)
+			return -1;
+		for (i = 0; i < n; i++, p++) {
+			if (msg[p] == '.' || msg[p] == '\\')
+				snprintf(esc, sizeof(esc), "\\%c", msg[p]);
+			else if (msg[p] <= ' ' || msg[p] >= 0x7f)
+				snprintf(esc, sizeof(esc), "\\%03u", msg[p]);
+			else
+				snprintf(esc, sizeof(esc), "%c", msg[p]);
+			if (o + strlen(esc) + 2 > outsize)
+				return -1;
+			strcpy(out + o, esc);
+			o += strlen(esc);
+		}
+		out[o++] = '.';
+	}
+
+	if (o == 0)
+		out[o++] = '.';
+	out[o] = '\0';
+	*pos = end ? end : p;
+	return 0;
+}
+
+/* character strings, as in TXT records */
+static char *
+get_strings(const unsigned char *p, size_t len)
+{
+	char *s, *o;
+	size_t i = 0, n;
+
+	/* worst case, every byte becomes \DDD */
+	o = s = malloc(len * 4 + 3 * len + 1);
+	if (!s)
+		return NULL;
+	while (i < len) {
+		n = p[i++];
+		if (i + n > len)
+			n = len - i;
+		if (o != s)
+			*o++ = ' ';
+		*o++ = '"';
+		for (; n; n--, i++) {
+			if (p[i] == '"' || p[i] == '\\') {
+				*o++ = '\\';
+				*o++ = p[i];
+			} else if (p[i] < ' ' || p[i] >= 0x7f) {
+				o += sprintf(o, "\\%03u", p[i]);
+			} else
+				*o++ = p[i];
+		}
+		*o++ = '"';
+	}
+	*o = '\0';
+	return s;
+}
+
+/* rdata in presentation form. Names inside it may point anywhere in msg */
+static char *
+get_rdata(const unsigned char *msg, size_t len, size_t pos, int type, size_t rdlen)
+{
+	char name[NP_DNS_MAX_NAME], name2[NP_DNS_MAX_NAME];
+	char addr[INET6_ADDRSTRLEN];
+	const unsigned char *rd = msg + pos;
+	char *s = NULL;
+	size_t p = pos, i;
+
+	switch (type) {
+	case NP_DNS_TYPE_A:
+		if (rdlen != 4 || !inet_ntop(AF_INET, rd, addr, sizeof(addr)))
+			return NULL;
+		return strdup(addr);
+	case NP_DNS_TYPE_AAAA:
+		if (rdlen != 16 || !inet_ntop(AF_INET6, rd, addr, sizeof(addr)))
+			return NULL;
+		return strdup(addr);
+	case NP_DNS_TYPE_NS:
+	case NP_DNS_TYPE_CNAME:
+	case NP_DNS_TYPE_PTR:
+		if (get_name(msg, len, &p, name, sizeof(name)) < 0 || p != pos + rdlen)
+			return NULL;
+		return strdup(name);
+	case NP_DNS_TYPE_MX:
+		p += 2;
+		if (rdlen < 3 || get_name(msg, len, &p, name, sizeof(name)) < 0 || p != pos + rdlen)
+			return NULL;
+		if (asprintf(&s, "%u %s", get16(rd), name) < 0)
+			return NULL;
+		return s;
+	case NP_DNS_TYPE_SRV:
+		p += 6;
+		if (rdlen < 7 || get_name(msg, len, &p, name, sizeof(name)) < 0 || p != pos + rdlen)
+			return NULL;
+		if (asprintf(&s, "%u %u %u %s", get16(rd), get16(rd + 2), get16(rd + 4), name) < 0)
+			return NULL;
+		return s;
+	case NP_DNS_TYPE_SOA:
+		if (get_name(msg, len, &p, name, sizeof(name)) < 0 ||
+		    get_name(msg, len, &p, name2, sizeof(name2)) < 0 ||
+		    p + 20 != pos + rdlen)
+			return NULL;
+		rd = msg + p;
+		if (asprintf(&s, "%s %s %lu %lu %lu %lu %lu", name, name2, get32(rd),
+		             get32(rd + 4), get32(rd + 8), get32(rd + 12), get32(rd + 16)) < 0)
+			return NULL;
+		return s;
+	case NP_DNS_TYPE_TXT:
+		return get_strings(rd, rdlen);
+	}
+
+	/* anything else in the generic format of RFC 3597 */
+	s = malloc(rdlen * 2 + 16);
+	if (!s)
+		return NULL;
+	i = sprintf(s, "\\# %lu ", (unsigned long)rdlen);
+	for (p = 0; p < rdlen; p++)
+		i += sprintf(s + i, "%02x", rd[p]);
+	return s;
+}
+
+int
+np_dns_parse_reply(const unsigned char *buf, size_t len, np_dns_reply *reply)
+{
+	char name[NP_DNS_MAX_NAME];
+	unsigned int qd, counts[3], i, total, section;
+	size_t pos;
+	np_dns_rr *rr;
+	size_t rdlen;
+
+	memset(reply, 0, sizeof(*reply));
+	if (len < NP_DNS_HEADER_SIZE || !(buf[2] & 0x80))
+		return NP_DNS_BADREPLY;
+
+	reply->size = len;
+	reply->id = get16(buf);
+	reply->aa = (buf[2] & 0x04) != 0;
+	reply->tc = (buf[2] & 0x02) != 0;
+	reply->rd = (buf[2] & 0x01) != 0;
+	reply->ra = (buf[3] & 0x80) != 0;
+	reply->rcode = buf[3] & 0x0f;
+	qd = get16(buf + 4);
+	counts[0] = get16(buf + 6);
+	counts[1] = get16(buf + 8);
+	counts[2] = get16(buf + 10);
+
+	pos = NP_DNS_HEADER_SIZE;
+	for (i = 0; i < qd; i++) {
+		if (get_name(buf, len, &pos, name, sizeof(name)) < 0 || pos + 4 > len)
+			return NP_DNS_BADREPLY;
+		pos += 4;
+	}
+
+	/* a truncated reply may stop anywhere, so only take what's complete.
+	 * The spare entry is for a record that fails half way */
+	total = counts[0] + counts[1] + counts[2];
+	reply->rr = calloc(total + 1, sizeof(np_dns_rr));
+	if (!reply->rr)
+		return NP_DNS_BADREPLY;
+	for (i = 0; i < total; i++) {
+		section = i < counts[0] ? NP_DNS_ANSWER :
+			i < counts[0] + counts[1] ? NP_DNS_AUTHORITY : NP_DNS_ADDITIONAL;
+		if (get_name(buf, len, &pos, name, sizeof(name)) < 0 || pos + 10 > len)
+			return reply->tc ? NP_DNS_OK : NP_DNS_BADREPLY;
+		rdlen = get16(buf + pos + 8);
+		if (pos + 10 + rdlen > len)
+			return reply->tc ? NP_DNS_OK : NP_DNS_BADREPLY;
+
+		/* the OPT pseudo record only carries EDNS parameters */
+		if (get16(buf + pos) == NP_DNS_TYPE_OPT) {
+			reply->edns_size = get16(buf + pos + 2);
+			reply->rcode |= buf[pos + 4] << 4;
+			pos += 10 + rdlen;
+			continue;
+		}
+
+		rr = &reply->rr[reply->n_rr];
+		rr->type = get16(buf + pos);
+		rr->class = get16(buf + pos + 2);
+		rr->ttl = get32(buf + pos + 4);
+		rr->section = section;
+		if (!(rr->data = get_rdata(buf, len, pos + 10, rr->type, rdlen)) ||
+		    !(rr->name = strdup(name))) {
+			return NP_DNS_BADREPLY;
+		}
+		reply->n_rr++;
+		pos += 10 + rdlen;
+	}
+
+	return NP_DNS_OK;
+}
+
+void
+np_dns_free_reply(np_dns_reply *reply)
+{
+	int i;
+
+	for (i = 0; i < reply->n_rr; i++) {
+		free(reply->rr[i].name);
+		free(reply->rr[i].data);
+	}
+	if (reply->rr) {
+		free(reply->rr[reply->n_rr].name);
+		free(reply->rr[reply->n_rr].data);
+	}
+	free(reply->rr);
+	reply->rr = NULL;
+	reply->n_rr = 0;
+}
+
+static double
+elapsed_ms(struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) * 1000.0 +
+		(now.tv_usec - start->tv_usec) / 1000.0;
+}
+
+/* wait up to timeout ms for fd to become ready for events. Returns 1 if
+ * it is, 0 on timeout and -1 on errors */
+static int
+wait_fd(int fd, int events, int timeout, struct timeval *start)
+{
+	struct pollfd pfd;
+	int left, ret;
+
+	for (;;) {
+		left = timeout - (int)elapsed_ms(start);
+		if (left <= 0)
+			return 0;
+		pfd.fd = fd;
+		pfd.events = events;
+		pfd.revents = 0;
+		ret = poll(&pfd, 1, left);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		return ret < 0 ? -1 : ret > 0;
+	}
+}
+
+/* read or write exactly len bytes within the timeout */
+static int
+tcp_io(int fd, unsigned char *buf, size_t len, int writing, int timeout, struct timeval *start)
+{
+	size_t done = 0;
+	ssize_t n;
+	int ret;
+
+	while (done < len) {
+		if ((ret = wait_fd(fd, writing ? POLLOUT : POLLIN, timeout, start)) <= 0)
+			return ret < 0 ? NP_DNS_ERROR : NP_DNS_TIMEOUT;
+		n = writing ? write(fd, buf + done, len - done) : read(fd, buf + done, len - done);
+		if (n < 0 && (errno == EINTR || errno == EAGAIN))
+			continue;
+		if (n < 0)
+			return NP_DNS_ERROR;
+		if (n == 0) {
+			errno = ECONNRESET;
+			return NP_DNS_ERROR;
+		}
+		done += n;
+	}
+	return NP_DNS_OK;
+}
+
+static int
+query_tcp(struct addrinfo *ai, unsigned char *query, int qlen,
+          const np_dns_options *opts, np_dns_reply *reply)
+{
+	unsigned char *buf, lenbuf[2];
+	struct timeval start;
+	socklen_t errlen;
+	int fd, ret, err;
+	size_t len;
+
+	if ((fd = socket(ai->ai_family, SOCK_STREAM, 0)) < 0)
+		return NP_DNS_ERROR;
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+	gettimeofday(&start, NULL);
+	if (connect(fd, ai->ai_addr, ai->ai_addrlen) < 0 && errno != EINPROGRESS) {
+		err = errno;
+		close(fd);
+		errno = err;
+		return NP_DNS_ERROR;
+	}
+	if ((ret = wait_fd(fd, POLLOUT, opts->timeout, &start)) <= 0) {
+		close(fd);
+		return ret < 0 ? NP_DNS_ERROR : NP_DNS_TIMEOUT;
+	}
+	errlen = sizeof(err);
+	if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &errlen) < 0 || err) {
+		close(fd);
+		errno = err;
+		return NP_DNS_ERROR;
+	}
+
+	/* messages are prefixed by their length over TCP */
+	put16(lenbuf, qlen);
+	if ((ret = tcp_io(fd, lenbuf, 2, 1, opts->timeout, &start)) != NP_DNS_OK ||
+	    (ret = tcp_io(fd, query, qlen, 1, opts->timeout, &start)) != NP_DNS_OK ||
+	    (ret = tcp_io(fd, lenbuf, 2, 0, opts->timeout, &start)) != NP_DNS_OK)
+	{
+		err = errno;
+		close(fd);
+		errno = err;
+		return ret;
+	}
+	len = get16(lenbuf);
+	if (!(buf = malloc(len ? len : 1))) {
+		close(fd);
+		return NP_DNS_ERROR;
+	}
+	ret = tcp_io(fd, buf, len, 0, opts->timeout, &start);
+	err = errno;
+	close(fd);
+	if (ret == NP_DNS_OK) {
+		ret = np_dns_parse_reply(buf, len, reply);
+		if (ret == NP_DNS_OK && reply->id != get16(query))
+			ret = NP_DNS_BADREPLY;
+		reply->tcp = 1;
+	}
+	free(buf);
+	errno = err;
+	return ret;
+}
+
+static int
+query_udp(struct addrinfo *ai, unsigned char *query, int qlen,
+          const np_dns_options *opts, np_dns_reply *reply)
+{
+	unsigned char buf[NP_DNS_MAX_PACKET];
+	struct timeval start;
+	ssize_t n;
+	int fd, ret, err, tries;
+
+	if ((fd = socket(ai->ai_family, SOCK_DGRAM, 0)) < 0)
+		return NP_DNS_ERROR;
+	/* connected, so ICMP errors are reported and strangers ignored */
+	if (connect(fd, ai->ai_addr, ai->ai_addrlen) < 0) {
+		err = errno;
+		close(fd);
+		errno = err;
+		return NP_DNS_ERROR;
+	}
+
+	for (ret = NP_DNS_TIMEOUT; ret == NP_DNS_TIMEOUT && reply->tries <= opts->retries;) {
+		gettimeofday(&start, NULL);
+		if (send(fd, query, qlen, 0) != qlen) {
+			ret = NP_DNS_ERROR;
+			break;
+		}
+		reply->tries++;
+
+		/* skip replies to earlier tries and anything else that isn't ours */
+		while ((ret = wait_fd(fd, POLLIN, opts->timeout, &start)) > 0) {
+			if ((n = recv(fd, buf, sizeof(buf), 0)) < 0) {
+				if (errno == EINTR)
+					continue;
+				ret = -1;
+				break;
+			}
+			if (n < NP_DNS_HEADER_SIZE || get16(buf) != get16(query) || !(buf[2] & 0x80))
+				continue;
+			tries = reply->tries;
+			np_dns_free_reply(reply);
+			n = np_dns_parse_reply(buf, n, reply);
+			reply->tries = tries;
+			ret = (int)n == NP_DNS_OK ? 1 : 2;
+			break;
+		}
+		ret = ret == 1 ? NP_DNS_OK : ret == 2 ? NP_DNS_BADREPLY :
+			ret == 0 ? NP_DNS_TIMEOUT : NP_DNS_ERROR;
+	}
+
+	err = errno;
+	close(fd);
+	errno = err;
+	return ret;
+}
+
+/* query ids start at a random point, so replies from an earlier run
+ * that arrive late are not taken for ours */
+static unsigned short
+next_id(void)
+{
+	static unsigned short id = 0;
+	struct timeval tv;
+
+	if (!id) {
+		gettimeofday(&tv, NULL);
+		id = (getpid() ^ tv.tv_usec) & 0xffff;
+	}
+	return ++id;
+}
+
+int
+np_dns_query(const char *server, const char *name, int type,
+             const np_dns_options *opts, np_dns_reply *reply)
+{
+	unsigned char query[QUERY_SIZE];
+	struct addrinfo hints, *res;
+	struct timeval start;
+	char port[8];
+	int qlen, ret, tries;
+
+	memset(reply, 0, sizeof(*reply));
+
+	if ((qlen = np_dns_build_query(query, sizeof(query), next_id(), name, type, opts)) < 0) {
+		errno = EINVAL;
+		return NP_DNS_ERROR;
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = opts->family;
+	hints.ai_socktype = SOCK_DGRAM;
+	snprintf(port, sizeof(port), "%d", opts->port);
+	if ((ret = getaddrinfo(server, port, &hints, &res)) != 0) {
+		errno = EHOSTUNREACH;
+		return NP_DNS_ERROR;
+	}
+
+	gettimeofday(&start, NULL);
+	if (opts->tcp)
+		ret = query_tcp(res, query, qlen, opts, reply);
+	else {
+		ret = query_udp(res, query, qlen, opts, reply);
+		/* the whole answer only fits in a TCP message */
+		if (ret == NP_DNS_OK && reply->tc) {
+			tries = reply->tries;
+			np_dns_free_reply(reply);
+			ret = query_tcp(res, query, qlen, opts, reply);
+			reply->tries = tries;
+		}
+	}
+	reply->time = elapsed_ms(&start);
+
+	freeaddrinfo(res);
+	return ret;
+}
+
+/* a server of a np_dns_query_many() batch */
+typedef struct batch_server {
+	const char *name;
+	struct addrinfo *ai;
+	int fd;
+	int error;                   /* why there is no socket */
+} batch_server;
+
+/* a query of the batch on the wire */
+typedef struct batch_query {
+	unsigned char data[QUERY_SIZE];
+	int len;
+	int server;
+	int pending;
+	struct timeval first, last;  /* sent */
+} batch_query;
+
+static void
+batch_fail(np_dns_request *req, batch_query *q, int result, int error)
+{
+	req->result = result;
+	req->error = error;
+	q->pending = 0;
+}
+
+int
+np_dns_query_many(np_dns_request *req, int n, const np_dns_options *opts)
+{
+	unsigned char buf[NP_DNS_MAX_PACKET];
+	struct addrinfo hints;
+	struct pollfd *pfd;
+	batch_server *srv;
+	batch_query *q;
+	char port[8];
+	int n_srv = 0, n_pending = 0, in_flight = 0, answered = 0;
+	int i, j, left, wait, tries, held;
+	ssize_t len;
+
+	srv = calloc(n, sizeof(*srv));
+	q = calloc(n, sizeof(*q));
+	pfd = calloc(n, sizeof(*pfd));
+	if (!srv || !q || !pfd) {
+		free(srv);
+		free(q);
+		free(pfd);
+		for (i = 0; i < n; i++)
+			req[i].result = NP_DNS_ERROR, req[i].error = ENOMEM;
+		return 0;
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = opts->family;
+	hints.ai_socktype = SOCK_DGRAM;
+	snprintf(port, sizeof(port), "%d", opts->port);
+
+	/* one connected socket per server, so ICMP errors are reported */
+	for (i = 0; i < n; i++) {
+		memset(&req[i].reply, 0, sizeof(req[i].reply));
+		req[i].result = NP_DNS_OK;
+		req[i].error = 0;
+		q[i].pending = 1;
+		n_pending++;
+
+		for (j = 0; j < n_srv; j++)
+			if (!strcmp(srv[j].name, req[i].server))
+				break;
+		if (j == n_srv) {
+			srv[j].name = req[i].server;
+			srv[j].fd = -1;
+			n_srv++;
+			if (getaddrinfo(req[i].server, port, &hints, &srv[j].ai) != 0) {
+				srv[j].ai = NULL;
+				srv[j].error = EHOSTUNREACH;
+			}
+			else if ((srv[j].fd = socket(srv[j].ai->ai_family, SOCK_DGRAM, 0)) < 0)
+				srv[j].error = errno;
+			else if (connect(srv[j].fd, srv[j].ai->ai_addr, srv[j].ai->ai_addrlen) < 0) {
+				srv[j].error = errno;
+				close(srv[j].fd);
+				srv[j].fd = -1;
+			}
+			else
+				fcntl(srv[j].fd, F_SETFL, fcntl(srv[j].fd, F_GETFL, 0) | O_NONBLOCK);
+		}
+		q[i].server = j;
+
+		if (srv[j].fd < 0)
+			batch_fail(&req[i], &q[i], NP_DNS_ERROR, srv[j].error);
+		else if ((q[i].len = np_dns_build_query(q[i].data, sizeof(q[i].data), next_id(),
+		                                        req[i].name, req[i].type, opts)) < 0)
+			batch_fail(&req[i], &q[i], NP_DNS_ERROR, EINVAL);
+		if (!q[i].pending)
+			n_pending--;
+	}
+
+	while (n_pending > 0) {
+		/* (re)send what is due and work out how long to wait */
+		wait = opts->timeout;
+		held = 0;
+		for (i = 0; i < n; i++) {
+			if (!q[i].pending)
+				continue;
+			if (!req[i].reply.tries && opts->window > 0 && in_flight >= opts->window) {
+				held = 1;
+				continue;
+			}
+			left = req[i].reply.tries ? opts->timeout - (int)elapsed_ms(&q[i].last) : 0;
+			if (left <= 0 && req[i].reply.tries > opts->retries) {
+				batch_fail(&req[i], &q[i], NP_DNS_TIMEOUT, 0);
+				req[i].reply.time = elapsed_ms(&q[i].first);
+				n_pending--;
+				in_flight--;
+				continue;
+			}
+			if (left <= 0) {
+				gettimeofday(&q[i].last, NULL);
+				if (!req[i].reply.tries) {
+					q[i].first = q[i].last;
+					in_flight++;
+				}
+				/* a query the socket can't take now counts as lost */
+				if (send(srv[q[i].server].fd, q[i].data, q[i].len, 0) < 0 &&
+				    errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOBUFS) {
+					batch_fail(&req[i], &q[i], NP_DNS_ERROR, errno);
+					n_pending--;
+					in_flight--;
+					continue;
+				}
+				req[i].reply.tries++;
+				left = opts->timeout;
+			}
+			if (left < wait)
+				wait = left;
+		}
+		if (!n_pending)
+			break;
+		/* a slot came free after queries were held back for the window */
+		if (held && in_flight < opts->window)
+			wait = 0;
+
+		for (j = 0; j < n_srv; j++) {
+			pfd[j].fd = srv[j].fd;
+			pfd[j].events = POLLIN;
+			pfd[j].revents = 0;
+		}
+		if (poll(pfd, n_srv, wait) <= 0)
+			continue;
+
+		for (j = 0; j < n_srv; j++) {
+			if (!pfd[j].revents)
+				continue;
+			while ((len = recv(srv[j].fd, buf, sizeof(buf), 0)) != 0) {
+				if (len < 0 && errno == EINTR)
+					continue;
+				if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+					break;
+				if (len < 0) {
+					/* refused or unreachable: the server answers none of them */
+					for (i = 0; i < n; i++)
+						if (q[i].pending && q[i].server == j) {
+							if (req[i].reply.tries)
+								in_flight--;
+							batch_fail(&req[i], &q[i], NP_DNS_ERROR, errno);
+							n_pending--;
+						}
+					break;
+				}
+				if (len < NP_DNS_HEADER_SIZE || !(buf[2] & 0x80))
+					continue;
+				for (i = 0; i < n; i++)
+					if (q[i].pending && q[i].server == j && get16(q[i].data) == get16(buf))
+						break;
+				if (i == n)
+					continue;
+				tries = req[i].reply.tries;
+				req[i].result = np_dns_parse_reply(buf, len, &req[i].reply);
+				req[i].reply.tries = tries;
+				req[i].reply.time = elapsed_ms(&q[i].first);
+				q[i].pending = 0;
+				n_pending--;
+				in_flight--;
+			}
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		/* the whole answer only fits in a TCP message */
+		if (req[i].result == NP_DNS_OK && req[i].reply.tc) {
+			tries = req[i].reply.tries;
+			np_dns_free_reply(&req[i].reply);
+			req[i].result = query_tcp(srv[q[i].server].ai, q[i].data, q[i].len, opts, &req[i].reply);
+			req[i].error = errno;
+			req[i].reply.tries = tries;
+			req[i].reply.time = elapsed_ms(&q[i].first);
+		}
+		if (req[i].result == NP_DNS_OK)
+			answered++;
+	}
+
+	for (j = 0; j < n_srv; j++) {
+		if (srv[j].fd >= 0)
+			close(srv[j].fd);
+		if (srv[j].ai)
+			freeaddrinfo(srv[j].ai);
+	}
+	free(srv);
+	free(q);
+	free(pfd);
+	return answered;
+}
+
+char *
+np_dns_reverse_name(const char *address)
+{
+	unsigned char a[16];
+	char *name, *p;
+	int i;
+
+	if (inet_pton(AF_INET, address, a) == 1) {
+		if (asprintf(&name, "%u.%u.%u.%u.in-addr.arpa.", a[3], a[2], a[1], a[0]) < 0)
+			return NULL;
+		return name;
+	}
+	if (inet_pton(AF_INET6, address, a) == 1) {
+		if (!(p = name = malloc(16 * 4 + sizeof("ip6.arpa."))))
+			return NULL;
+		for (i = 15; i >= 0; i--)
+			p += sprintf(p, "%x.%x.", a[i] & 0x0f, a[i] >> 4);
+		strcpy(p, "ip6.arpa.");
+		return name;
+	}
+	return NULL;
+}
+
+void
+np_dns_read_resolv_conf(const char *path, np_dns_resolv *resolv)
+{
+	char line[1024], *key, *val;
+	FILE *fp;
+
+	memset(resolv, 0, sizeof(*resolv));
+	if ((fp = fopen(path ? path : "/etc/resolv.conf", "r")) != NULL) {
+		while (fgets(line, sizeof(line), fp)) {
+			if (!(key = strtok(line, " \t\r\n")) || *key == '#' || *key == ';')
+				continue;
+			if (!strcmp(key, "nameserver")) {
+				if (!resolv->server && (val = strtok(NULL, " \t\r\n")))
+					resolv->server = strdup(val);
+			}
+			/* the last of domain and search wins */
+			else if (!strcmp(key, "domain") || !strcmp(key, "search")) {
+				while (resolv->n_search)
+					free(resolv->search[--resolv->n_search]);
+				while ((val = strtok(NULL, " \t\r\n")) != NULL) {
+					resolv->search = realloc(resolv->search,
+					                         (resolv->n_search + 1) * sizeof(char *));
+					if (!resolv->search)
+						break;
+					resolv->search[resolv->n_search++] = strdup(val);
+				}
+			}
+		}
+		fclose(fp);
+	}
+	if (!resolv->server)
+		resolv->server = strdup("127.0.0.1");
+}
+
+int
+np_dns_type(const char *name)
+{
+	int i;
+
+	for (i = 0; dns_types[i].name; i++)
+		if (!strcasecmp(name, dns_types[i].name))
+			return dns_types[i].type;
+	/* the generic TYPEnnn of RFC 3597 */
+	if (!strncasecmp(name, "TYPE", 4) && isdigit((unsigned char)name[4]))
+		return atoi(name + 4);
+	return -1;
+}
+
+const char *
+np_dns_type_name(int type)
+{
+	static char buf[16];
+	int i;
+
+	for (i = 0; dns_types[i].name; i++)
+		if (dns_types[i].type == type)
+			return dns_types[i].name;
+	snprintf(buf, sizeof(buf), "TYPE%d", type);
+	return buf;
+}
+
+int
+np_dns_class(const char *name)
+{
+	int i;
+
+	for (i = 0; dns_classes[i].name; i++)
+		if (!strcasecmp(name, dns_classes[i].name))
+			return dns_classes[i].class;
+	if (!strncasecmp(name, "CLASS", 5) && isdigit((unsigned char)name[5]))
+		return atoi(name + 5);
+	return -1;
+}
+
+const char *
+np_dns_class_name(int class)
+{
+	static char buf[16];
+	int i;
+
+	for (i = 0; dns_classes[i].name; i++)
+		if (dns_classes[i].class == class)
+			return dns_classes[i].name;
+	snprintf(buf, sizeof(buf), "CLASS%d", class);
+	return buf;
+}
+
+const char *
+np_dns_rcode_name(int rcode)
+{
+	static const char *names[] = {
+		"NOERROR", "FORMERR", "SERVFAIL", "NXDOMAIN", "NOTIMP", "REFUSED"
+	};
+	static char buf[16];
+
+	if (rcode >= 0 && rcode < (int)(sizeof(names) / sizeof(names[0])))
+		return names[rcode];
+	snprintf(buf, sizeof(buf), "RCODE%d", rcode);
+	return buf;
+}
+
+const char *
+np_dns_strerror(int result)
+{
+	switch (result) {
+	case NP_DNS_OK:
+		return _("no error");
+	case NP_DNS_TIMEOUT:
+		return _("no response");
+	case NP_DNS_BADREPLY:
+		return _("malformed reply");
+	}
+	return strerror(errno);
+}
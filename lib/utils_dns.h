@@ -0,0 +1,135 @@
+#ifndef _UTILS_DNS_
+#define _UTILS_DNS_
+/* Header file for utils_dns: a minimal DNS stub resolver client */
+
+#define NP_DNS_PORT 53
+#define NP_DNS_HEADER_SIZE 12
+#define NP_DNS_UDP_SIZE 512          /* without EDNS */
+#define NP_DNS_MAX_PACKET 65535
+#define NP_DNS_MAX_NAME 1025         /* presentation form, escapes included */
+
+/* record types */
+#define NP_DNS_TYPE_A 1
+#define NP_DNS_TYPE_NS 2
+#define NP_DNS_TYPE_CNAME 5
+#define NP_DNS_TYPE_SOA 6
+#define NP_DNS_TYPE_PTR 12
+#define NP_DNS_TYPE_MX 15
+#define NP_DNS_TYPE_TXT 16
+#define NP_DNS_TYPE_AAAA 28
+#define NP_DNS_TYPE_SRV 33
+#define NP_DNS_TYPE_OPT 41
+#define NP_DNS_TYPE_ANY 255
+
+#define NP_DNS_CLASS_IN 1
+#define NP_DNS_CLASS_CH 3
+#define NP_DNS_CLASS_HS 4
+#define NP_DNS_CLASS_ANY 255
+
+/* response codes */
+#define NP_DNS_NOERROR 0
+#define NP_DNS_FORMERR 1
+#define NP_DNS_SERVFAIL 2
+#define NP_DNS_NXDOMAIN 3
+#define NP_DNS_NOTIMP 4
+#define NP_DNS_REFUSED 5
+
+/* np_dns_query() results besides NP_DNS_OK. With NP_DNS_ERROR, errno
+ * tells what went wrong */
+#define NP_DNS_OK 0
+#define NP_DNS_ERROR -1
+#define NP_DNS_TIMEOUT -2
+#define NP_DNS_BADREPLY -3
+
+/* sections a record can come from */
+#define NP_DNS_ANSWER 0
+#define NP_DNS_AUTHORITY 1
+#define NP_DNS_ADDITIONAL 2
+
+typedef struct np_dns_rr {
+	char *name;                  /* owner, with the trailing dot */
+	int type;
+	int class;
+	unsigned long ttl;
+	int section;                 /* NP_DNS_ANSWER etc */
+	char *data;                  /* rdata in zone file presentation form */
+} np_dns_rr;
+
+typedef struct np_dns_reply {
+	unsigned short id;
+	int rcode;
+	int aa, tc, rd, ra;
+	int n_rr;
+	np_dns_rr *rr;               /* all sections, in order */
+	int edns_size;               /* the server's UDP payload size, 0 without OPT */
+	int size;                    /* of the reply message */
+	int tcp;                     /* the answer came over TCP */
+	int tries;                   /* queries sent over UDP */
+	double time;                 /* from first query to answer, in ms */
+} np_dns_reply;
+
+typedef struct np_dns_options {
+	int port;
+	int family;                  /* AF_UNSPEC, AF_INET or AF_INET6 */
+	int retries;                 /* UDP retransmissions after the first query */
+	int timeout;                 /* ms to wait for each try */
+	int qclass;                  /* of the question, NP_DNS_CLASS_IN */
+	int recurse;                 /* set RD */
+	int tcp;                     /* skip UDP and query over TCP */
+	int edns;                    /* advertised UDP payload size, 0 for no OPT */
+	int window;                  /* np_dns_query_many() queries in flight, 0 for all */
+} np_dns_options;
+
+/* one query of a np_dns_query_many() batch */
+typedef struct np_dns_request {
+	const char *server;
+	const char *name;
+	int type;
+	int result;                  /* as np_dns_query() would return it */
+	int error;                   /* errno for NP_DNS_ERROR */
+	np_dns_reply reply;
+} np_dns_request;
+
+/* what /etc/resolv.conf says */
+typedef struct np_dns_resolv {
+	char *server;                /* the first nameserver, or 127.0.0.1 */
+	char **search;
+	int n_search;
+} np_dns_resolv;
+
+void np_dns_init_options(np_dns_options *opts);
+
+/* encode a query into buf. Returns its length, or -1 if the name is
+ * invalid or doesn't fit */
+int np_dns_build_query(unsigned char *buf, size_t size, unsigned short id,
+                       const char *name, int type, const np_dns_options *opts);
+
+/* decode a reply. Returns NP_DNS_OK or NP_DNS_BADREPLY. The reply must
+ * be freed with np_dns_free_reply() either way */
+int np_dns_parse_reply(const unsigned char *buf, size_t len, np_dns_reply *reply);
+void np_dns_free_reply(np_dns_reply *reply);
+
+/* send a query to server (a name or an address) and wait for the answer,
+ * retrying over UDP and falling back to TCP if the answer was truncated */
+int np_dns_query(const char *server, const char *name, int type,
+                 const np_dns_options *opts, np_dns_reply *reply);
+
+/* send all requests at once (or opts->window at a time), over one socket
+ * per server, and collect the answers as they come in. Unanswered queries
+ * are resent each timeout, up to the retries, truncated answers are asked
+ * again over TCP. Returns the number of requests with an NP_DNS_OK result */
+int np_dns_query_many(np_dns_request *req, int n, const np_dns_options *opts);
+
+/* "192.0.2.1" -> "1.2.0.192.in-addr.arpa.", NULL if not an address */
+char *np_dns_reverse_name(const char *address);
+
+void np_dns_read_resolv_conf(const char *path, np_dns_resolv *resolv);
+
+int np_dns_type(const char *name);
+const char *np_dns_type_name(int type);
+int np_dns_class(const char *name);
+const char *np_dns_class_name(int class);
+const char *np_dns_rcode_name(int rcode);
+const char *np_dns_strerror(int result);
+
+#endif /* _UTILS_DNS_ */
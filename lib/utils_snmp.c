@@ -0,0 +1,1008 @@
+/*****************************************************************************
+*
+* Library for check_snmp and friends
+*
+* License: GPL
+* Copyright (c) 2013 Nagios Plugins Development Team
+*
+* Description:
+*
+* This file contains a small SNMPv1/v2c manager: BER encoding of GET,
+* GETNEXT and GETBULK requests, decoding of the responses, and clients
+* asking one agent, or many at once, over UDP. The packet code is tested
+* by libtap
+*
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*
+*****************************************************************************/
+
+#include "common.h"
+#include "utils_snmp.h"
+#include "sha1.h"
+#include <ctype.h>
+#include <fcntl.h>
+#include <netdb.h>
+
+/* ASN.1 universal types that aren't values */
+#define BER_SEQUENCE 0x30
+
+/* a message being encoded */
+typedef struct ber_out {
+	unsigned char *buf;
+	size_t size;
+	size_t pos;
+	int overflow;
+} ber_out;
+
+/* a message being decoded */
+typedef struct ber_in {
+	const unsigned char *buf;
+	size_t len;
+	size_t pos;
+} ber_in;
+
+static const struct {
+	int type;
+	const char *name;
+} snmp_types[] = {
+	{ NP_SNMP_INTEGER, "INTEGER" },
+	{ NP_SNMP_OCTET_STRING, "STRING" },
+	{ NP_SNMP_NULL, "NULL" },
+	{ NP_SNMP_OBJECT_ID, "OID" },
+	{ NP_SNMP_IPADDRESS, "IpAddress" },
+	{ NP_SNMP_COUNTER32, "Counter32" },
+	{ NP_SNMP_GAUGE32, "Gauge32" },
+	{ NP_SNMP_TIMETICKS, "Timeticks" },
+	{ NP_SNMP_OPAQUE, "Opaque" },
+	{ NP_SNMP_COUNTER64, "Counter64" },
+	{ NP_SNMP_NOSUCHOBJECT, "noSuchObject" },
+	{ NP_SNMP_NOSUCHINSTANCE, "noSuchInstance" },
+	{ NP_SNMP_ENDOFMIBVIEW, "endOfMibView" },
+	{ 0, NULL }
+};
+
+static const char *snmp_errors[] = {
+	"noError", "tooBig", "noSuchName", "badValue", "readOnly", "genErr",
+	"noAccess", "wrongType", "wrongLength", "wrongEncoding", "wrongValue",
+	"noCreation", "inconsistentValue", "resourceUnavailable", "commitFailed",
+	"undoFailed", "authorizationError", "notWritable", "inconsistentName"
+};
+
+void
+np_snmp_init_options(np_snmp_options *opts)
+{
+	memset(opts, 0, sizeof(*opts));
+	opts->port = NP_SNMP_PORT;
+	opts->family = AF_UNSPEC;
+	opts->version = NP_SNMP_V1;
+	opts->community = "public";
+	opts->retries = 5;
+	opts->timeout = 1000;
+}
+
+int
+np_snmp_parse_oid(const char *str, np_snmp_oid *oid)
+{
+	unsigned long v;
+	char *end;
+
+	oid->n = 0;
+	if (*str == '.')
+		str++;
+	while (*str) {
+		if (!isdigit((unsigned char)*str) || oid->n >= NP_SNMP_MAX_OID)
+			return -1;
+		errno = 0;
+		v = strtoul(str, &end, 10);
+		if (errno || v > 0xffffffffUL)
+			return -1;
+		oid->id[oid->n++] = v;
+		str = end;
+		if (*str == '.' && str[1])
+			str++;
+		else if (*str)
+			return -1;
+	}
+	/* the first two sub-identifiers go into one byte on the wire */
+	if (oid->n < 2 || oid->id[0] > 2 || (oid->id[0] < 2 && oid->id[1] >= 40))
+		return -1;
+	return 0;
+}
+
+char *
+np_snmp_oid_string(const np_snmp_oid *oid, char *buf, size_t size)
+{
+	size_t pos = 0;
+	unsigned int i;
+
+	buf[0] = '\0';
+	for (i = 0; i < oid->n && pos < size; i++)
+		pos += snprintf(buf + pos, size - pos, ".%u", oid->id[i]);
+	return buf;
+}
+
+int
+np_snmp_oid_compare(const np_snmp_oid *a, const np_snmp_oid *b)
+{
+	unsigned int i;
+
+	for (i = 0; i < a->n && i < b->n; i++)
+		if (a->id[i] != b->id[i])
+			return a->id[i] < b->id[i] ? -1 : 1;
+	return a->n == b->n ? 0 : a->n < b->n ? -1 : 1;
+}
+
+static void
+put_byte(ber_out *o, unsigned char c)
+{
+	if (o->pos < o->size)
+		o->buf[o->pos] = c;
+	else
+		o->overflow = 1;
+	o->pos++;
+}
+
+static void
+put_length(ber_out *o, size_t len)
+{
+	if (len < 0x80)
+		put_byte(o, len);
+	else if (len < 0x100) {
+		put_byte(o, 0x81);
+		put_byte(o, len);
+	} else {
+		put_byte(o, 0x82);
+		put_byte(o, len >> 8);
+		put_byte(o, len & 0xff);
+	}
+}
+
+/* constructed types get a two byte length like net-snmp's, filled in by
+ * close_seq() once the contents are known */
+static size_t
+open_seq(ber_out *o, int tag)
+{
+	put_byte(o, tag);
+	put_byte(o, 0x82);
+	put_byte(o, 0);
+	put_byte(o, 0);
+	return o->pos;
+}
+
+static void
+close_seq(ber_out *o, size_t start)
+{
+	size_t len = o->pos - start;
+
+	if (len > 0xffff)
+		o->overflow = 1;
+	if (o->overflow)
+		return;
+	o->buf[start - 2] = len >> 8;
+	o->buf[start - 1] = len & 0xff;
+}
+
+static void
+put_integer(ber_out *o, long v)
+{
+	unsigned char b[sizeof(long)];
+	int n = sizeof(long), i;
+
+	for (i = n - 1; i >= 0; i--, v >>= 8)
+		b[i] = v & 0xff;
+	/* drop leading bytes that only repeat the sign */
+	for (i = 0; i < n - 1; i++)
+		if (!((b[i] == 0 && !(b[i + 1] & 0x80)) || (b[i] == 0xff && (b[i + 1] & 0x80))))
+			break;
+	put_byte(o, NP_SNMP_INTEGER);
+	put_length(o, n - i);
+	for (; i < n; i++)
+		put_byte(o, b[i]);
+}
+
+static void
+put_octets(ber_out *o, int tag, const void *data, size_t len)
+{
+	size_t i;
+
+	put_byte(o, tag);
+	put_length(o, len);
+	for (i = 0; i < len; i++)
+		put_byte(o, ((const unsigned char *)data)[i]);
+}
+
+/* Counter32/64, Gauge32 and TimeTicks: a leading zero byte keeps the top
+ * bit from reading as a sign */
+static void
+put_unsigned(ber_out *o, int tag, unsigned long long v)
+{
+	unsigned char b[9];
+	int i = sizeof(b);
+
+	do {
+		b[--i] = v & 0xff;
+		v >>= 8;
+	} while (v);
+	if (b[i] & 0x80)
+		b[--i] = 0;
+	put_octets(o, tag, b + i, sizeof(b) - i);
+}
+
+static void
+put_subid(ber_out *o, unsigned long v)
+{
+	int shift;
+
+	for (shift = 28; shift > 0 && !(v >> shift); shift -= 7);
+	for (; shift > 0; shift -= 7)
+		put_byte(o, 0x80 | ((v >> shift) & 0x7f));
+	put_byte(o, v & 0x7f);
+}
+
+static void
+put_oid(ber_out *o, const np_snmp_oid *oid)
+{
+	size_t start;
+	unsigned int i;
+
+	/* a one byte length is always enough for NP_SNMP_MAX_OID sub-ids */
+	put_byte(o, NP_SNMP_OBJECT_ID);
+	put_byte(o, 0);
+	start = o->pos;
+	put_subid(o, oid->id[0] * 40UL + oid->id[1]);
+	for (i = 2; i < oid->n; i++)
+		put_subid(o, oid->id[i]);
+	if (o->pos - start > 0x7f) {
+		/* too long for the short form, make room for 0x82 and two bytes */
+		size_t len = o->pos - start;
+		for (i = 0; i < 2; i++)
+			put_byte(o, 0);
+		if (!o->overflow) {
+			memmove(o->buf + start + 2, o->buf + start, len);
+			o->buf[start - 1] = 0x82;
+			o->buf[start] = len >> 8;
+			o->buf[start + 1] = len & 0xff;
+		}
+	} else if (!o->overflow)
+		o->buf[start - 1] = o->pos - start;
+}
+
+int
+np_snmp_build_request(unsigned char *buf, size_t size, const np_snmp_options *opts,
+                      int type, long request_id, int non_repeaters, int max_repetitions,
+                      const np_snmp_oid *oids, int n)
+{
+	ber_out o;
+	size_t msg, pdu, list, vb;
+	int i;
+
+	o.buf = buf;
+	o.size = size;
+	o.pos = 0;
+	o.overflow = 0;
+
+	msg = open_seq(&o, BER_SEQUENCE);
+	put_integer(&o, opts->version);
+	put_octets(&o, NP_SNMP_OCTET_STRING, opts->community, strlen(opts->community));
+	pdu = open_seq(&o, type);
+	put_integer(&o, request_id);
+	put_integer(&o, type == NP_SNMP_GETBULK ? non_repeaters : 0);
+	put_integer(&o, type == NP_SNMP_GETBULK ? max_repetitions : 0);
+	list = open_seq(&o, BER_SEQUENCE);
+	for (i = 0; i < n; i++) {
+		vb = open_seq(&o, BER_SEQUENCE);
+		put_oid(&o, &oids[i]);
+		put_byte(&o, NP_SNMP_NULL);
+		put_byte(&o, 0);
+		close_seq(&o, vb);
+	}
+	close_seq(&o, list);
+	close_seq(&o, pdu);
+	close_seq(&o, msg);
+
+	return o.overflow ? -1 : (int)o.pos;
+}
+
+int
+np_snmp_encode_varbind(unsigned char *buf, size_t size, const np_snmp_varbind *vb)
+{
+	ber_out o;
+	size_t seq;
+
+	o.buf = buf;
+	o.size = size;
+	o.pos = 0;
+	o.overflow = 0;
+
+	seq = open_seq(&o, BER_SEQUENCE);
+	put_oid(&o, &vb->oid);
+	switch (vb->type) {
+	case NP_SNMP_INTEGER:
+		put_integer(&o, vb->integer);
+		break;
+	case NP_SNMP_COUNTER32:
+	case NP_SNMP_GAUGE32:
+	case NP_SNMP_TIMETICKS:
+	case NP_SNMP_COUNTER64:
+		put_unsigned(&o, vb->type, vb->value);
+		break;
+	case NP_SNMP_OCTET_STRING:
+	case NP_SNMP_IPADDRESS:
+	case NP_SNMP_OPAQUE:
+		put_octets(&o, vb->type, vb->data, vb->len);
+		break;
+	case NP_SNMP_OBJECT_ID:
+		put_oid(&o, vb->objid);
+		break;
+	case NP_SNMP_NULL:
+	case NP_SNMP_NOSUCHOBJECT:
+	case NP_SNMP_NOSUCHINSTANCE:
+	case NP_SNMP_ENDOFMIBVIEW:
+		put_byte(&o, vb->type);
+		put_byte(&o, 0);
+		break;
+	default:
+		return -1;
+	}
+	close_seq(&o, seq);
+
+	return o.overflow ? -1 : (int)o.pos;
+}
+
+/* read the next tag and length, leaving in->pos at the contents. Returns
+ * the tag, or -1 if the element doesn't fit in what is left */
+static int
+get_header(ber_in *in, size_t *len)
+{
+	int tag, n;
+
+	if (in->pos + 2 > in->len)
+		return -1;
+	tag = in->buf[in->pos++];
+	/* we have no use for high tag numbers */
+	if ((tag & 0x1f) == 0x1f)
+		return -1;
+	*len = in->buf[in->pos++];
+	if (*len & 0x80) {
+		n = *len & 0x7f;
+		if (n < 1 || n > 3 || in->pos + n > in->len)
+			return -1;
+		for (*len = 0; n > 0; n--)
+			*len = (*len << 8) | in->buf[in->pos++];
+	}
+	if (*len > in->len - in->pos)
+		return -1;
+	return tag;
+}
+
+static int
+get_signed(const unsigned char *p, size_t len, long *v)
+{
+	size_t i;
+
+	if (len < 1 || len > sizeof(long))
+		return -1;
+	*v = (p[0] & 0x80) ? -1 : 0;
+	for (i = 0; i < len; i++)
+		*v = (long)(((unsigned long)*v << 8) | p[i]);
+	return 0;
+}
+
+static int
+get_integer(ber_in *in, long *v)
+{
+	size_t len;
+
+	if (get_header(in, &len) != NP_SNMP_INTEGER)
+		return -1;
+	in->pos += len;
+	return get_signed(in->buf + in->pos - len, len, v);
+}
+
+static int
+get_unsigned(const unsigned char *p, size_t len, unsigned long long *v)
+{
+	/* one more byte than fits, for a leading zero */
+	if (len < 1 || len > sizeof(*v) + 1 || (len == sizeof(*v) + 1 && p[0]))
+		return -1;
+	for (*v = 0; len > 0; len--)
+		*v = (*v << 8) | *p++;
+	return 0;
+}
+
+static int
+get_oid(const unsigned char *p, size_t len, np_snmp_oid *oid)
+{
+	unsigned long long v = 0;
+	size_t i;
+
+	oid->n = 0;
+	for (i = 0; i < len; i++) {
+		v = (v << 7) | (p[i] & 0x7f);
+		if (v > 0xffffffffUL + 80)
+			return -1;
+		if (p[i] & 0x80)
+			continue;
+		if (oid->n + (oid->n ? 1 : 2) > NP_SNMP_MAX_OID)
+			return -1;
+		if (oid->n == 0) {
+			oid->id[0] = v < 40 ? 0 : v < 80 ? 1 : 2;
+			oid->id[1] = v - oid->id[0] * 40;
+			oid->n = 2;
+		} else {
+			if (v > 0xffffffffUL)
+				return -1;
+			oid->id[oid->n++] = v;
+		}
+		v = 0;
+	}
+	/* the last sub-identifier was cut short */
+	return (len == 0 || (p[len - 1] & 0x80)) ? -1 : 0;
+}
+
+static int
+get_varbind(ber_in *in, np_snmp_varbind *vb)
+{
+	const unsigned char *p;
+	size_t len, end;
+
+	if (get_header(in, &len) != BER_SEQUENCE)
+		return -1;
+	end = in->pos + len;
+	if (get_header(in, &len) != NP_SNMP_OBJECT_ID || get_oid(in->buf + in->pos, len, &vb->oid) < 0)
+		return -1;
+	in->pos += len;
+
+	if ((vb->type = get_header(in, &len)) < 0)
+		return -1;
+	p = in->buf + in->pos;
+	in->pos += len;
+	if (in->pos != end)
+		return -1;
+
+	switch (vb->type) {
+	case NP_SNMP_INTEGER:
+		return get_signed(p, len, &vb->integer);
+	case NP_SNMP_COUNTER32:
+	case NP_SNMP_GAUGE32:
+	case NP_SNMP_TIMETICKS:
+	case NP_SNMP_COUNTER64:
+		return get_unsigned(p, len, &vb->value);
+	case NP_SNMP_OCTET_STRING:
+	case NP_SNMP_IPADDRESS:
+	case NP_SNMP_OPAQUE:
+		if (vb->type == NP_SNMP_IPADDRESS && len != 4)
+			return -1;
+		/* one more byte, so strings can be NUL terminated */
+		if (!(vb->data = malloc(len + 1)))
+			return -1;
+		memcpy(vb->data, p, len);
+		vb->data[len] = '\0';
+		vb->len = len;
+		return 0;
+	case NP_SNMP_OBJECT_ID:
+		if (!(vb->objid = malloc(sizeof(np_snmp_oid))))
+			return -1;
+		return get_oid(p, len, vb->objid);
+	case NP_SNMP_NULL:
+	case NP_SNMP_NOSUCHOBJECT:
+	case NP_SNMP_NOSUCHINSTANCE:
+	case NP_SNMP_ENDOFMIBVIEW:
+		return len ? -1 : 0;
+	}
+	return -1;
+}
+
+int
+np_snmp_decode_varbind(const unsigned char *buf, size_t len, np_snmp_varbind *vb)
+{
+	ber_in in;
+
+	in.buf = buf;
+	in.len = len;
+	in.pos = 0;
+	memset(vb, 0, sizeof(*vb));
+	if (get_varbind(&in, vb) < 0) {
+		np_snmp_free_varbind(vb);
+		return -1;
+	}
+	return in.pos;
+}
+
+void
+np_snmp_free_varbind(np_snmp_varbind *vb)
+{
+	free(vb->data);
+	free(vb->objid);
+	vb->data = NULL;
+	vb->objid = NULL;
+}
+
+int
+np_snmp_parse_pdu(const unsigned char *buf, size_t len, np_snmp_pdu *pdu)
+{
+	ber_in in;
+	size_t n, end;
+	long v;
+	void *tmp;
+
+	memset(pdu, 0, sizeof(*pdu));
+	in.buf = buf;
+	in.len = len;
+	in.pos = 0;
+
+	if (get_header(&in, &n) != BER_SEQUENCE || get_integer(&in, &v) < 0)
+		return NP_SNMP_BADREPLY;
+	pdu->version = v;
+	/* the community */
+	if (get_header(&in, &n) != NP_SNMP_OCTET_STRING)
+		return NP_SNMP_BADREPLY;
+	in.pos += n;
+
+	if ((pdu->type = get_header(&in, &n)) < 0 || !(pdu->type & 0xa0))
+		return NP_SNMP_BADREPLY;
+	if (get_integer(&in, &pdu->request_id) < 0 || get_integer(&in, &v) < 0)
+		return NP_SNMP_BADREPLY;
+	pdu->error_status = v;
+	if (get_integer(&in, &v) < 0)
+		return NP_SNMP_BADREPLY;
+	pdu->error_index = v;
+
+	if (get_header(&in, &n) != BER_SEQUENCE)
+		return NP_SNMP_BADREPLY;
+	for (end = in.pos + n; in.pos < end; pdu->n_vb++) {
+		if (!(tmp = realloc(pdu->vb, (pdu->n_vb + 1) * sizeof(*pdu->vb))))
+			return NP_SNMP_BADREPLY;
+		pdu->vb = tmp;
+		memset(&pdu->vb[pdu->n_vb], 0, sizeof(*pdu->vb));
+		if (get_varbind(&in, &pdu->vb[pdu->n_vb]) < 0) {
+			pdu->n_vb++;
+			return NP_SNMP_BADREPLY;
+		}
+	}
+	return in.pos == end ? NP_SNMP_OK : NP_SNMP_BADREPLY;
+}
+
+void
+np_snmp_free_pdu(np_snmp_pdu *pdu)
+{
+	int i;
+
+	for (i = 0; i < pdu->n_vb; i++)
+		np_snmp_free_varbind(&pdu->vb[i]);
+	free(pdu->vb);
+	pdu->vb = NULL;
+	pdu->n_vb = 0;
+}
+
+static double
+elapsed_ms(struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) * 1000.0 +
+		(now.tv_usec - start->tv_usec) / 1000.0;
+}
+
+/* request ids start at a random point, so responses from an earlier run
+ * that arrive late are not taken for ours */
+static long
+next_request_id(void)
+{
+	static long id = 0;
+	struct timeval tv;
+
+	if (!id) {
+		gettimeofday(&tv, NULL);
+		id = ((getpid() << 16) ^ tv.tv_usec) & 0x3fffffff;
+	}
+	id = (id + 1) & 0x7fffffff;
+	return id ? id : ++id;
+}
+
+/* a UDP socket connected to the agent, so ICMP errors are reported and
+ * strangers ignored. Returns -1, with errno set, if there is none */
+static int
+agent_socket(const char *host, const np_snmp_options *opts)
+{
+	struct addrinfo hints, *res;
+	char port[8];
+	int fd, err;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = opts->family;
+	hints.ai_socktype = SOCK_DGRAM;
+	snprintf(port, sizeof(port), "%d", opts->port);
+	if (getaddrinfo(host, port, &hints, &res) != 0) {
+		errno = EHOSTUNREACH;
+		return -1;
+	}
+	if ((fd = socket(res->ai_family, SOCK_DGRAM, 0)) < 0) {
+		freeaddrinfo(res);
+		return -1;
+	}
+	if (connect(fd, res->ai_addr, res->ai_addrlen) < 0) {
+		err = errno;
+		close(fd);
+		freeaddrinfo(res);
+		errno = err;
+		return -1;
+	}
+	freeaddrinfo(res);
+	return fd;
+}
+
+int
+np_snmp_request(const char *host, const np_snmp_options *opts, int type,
+                int non_repeaters, int max_repetitions,
+                const np_snmp_oid *oids, int n, np_snmp_pdu *response)
+{
+	unsigned char query[NP_SNMP_MAX_PACKET], buf[NP_SNMP_MAX_PACKET];
+	struct timeval first, start;
+	struct pollfd pfd;
+	long id = next_request_id();
+	int qlen, fd, ret, err, tries = 0, left;
+	ssize_t len;
+
+	memset(response, 0, sizeof(*response));
+
+	if ((qlen = np_snmp_build_request(query, sizeof(query), opts, type, id,
+	                                  non_repeaters, max_repetitions, oids, n)) < 0) {
+		errno = EMSGSIZE;
+		return NP_SNMP_ERROR;
+	}
+	if ((fd = agent_socket(host, opts)) < 0)
+		return NP_SNMP_ERROR;
+
+	gettimeofday(&first, NULL);
+	for (ret = NP_SNMP_TIMEOUT; ret == NP_SNMP_TIMEOUT && tries <= opts->retries;) {
+		gettimeofday(&start, NULL);
+		if (send(fd, query, qlen, 0) != qlen) {
+			ret = NP_SNMP_ERROR;
+			break;
+		}
+		tries++;
+
+		/* skip responses to earlier tries and anything else that isn't ours */
+		while ((left = opts->timeout - (int)elapsed_ms(&start)) > 0) {
+			pfd.fd = fd;
+			pfd.events = POLLIN;
+			if ((ret = poll(&pfd, 1, left)) < 0 && errno == EINTR)
+				continue;
+			if (ret <= 0) {
+				ret = ret < 0 ? NP_SNMP_ERROR : NP_SNMP_TIMEOUT;
+				break;
+			}
+			if ((len = recv(fd, buf, sizeof(buf), 0)) < 0) {
+				if (errno == EINTR)
+					continue;
+				ret = NP_SNMP_ERROR;
+				break;
+			}
+			np_snmp_free_pdu(response);
+			ret = np_snmp_parse_pdu(buf, len, response);
+			if (ret == NP_SNMP_OK && (response->request_id != id || response->type != NP_SNMP_RESPONSE)) {
+				ret = NP_SNMP_TIMEOUT;
+				continue;
+			}
+			break;
+		}
+		if (left <= 0)
+			ret = NP_SNMP_TIMEOUT;
+	}
+	response->tries = tries;
+	response->time = elapsed_ms(&first);
+
+	err = errno;
+	close(fd);
+	errno = err;
+	return ret;
+}
+
+/* np_snmp_request_all(): a request out to one of the hosts */
+typedef struct np_snmp_flight {
+	int host;                    /* index into hosts, -1 if the slot is free */
+	long id;
+	int tries;
+	struct timeval first, sent;
+} np_snmp_flight;
+
+static int
+send_flight(np_snmp_flight *f, int fd, const np_snmp_options *opts, int type,
+            const np_snmp_oid *oids, int n)
+{
+	unsigned char query[NP_SNMP_MAX_PACKET];
+	int qlen;
+
+	if ((qlen = np_snmp_build_request(query, sizeof(query), opts, type, f->id,
+	                                  0, 0, oids, n)) < 0) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+	gettimeofday(&f->sent, NULL);
+	f->tries++;
+	return send(fd, query, qlen, 0) == qlen ? 0 : -1;
+}
+
+/* the request is done with: note how it went and free its slot */
+static void
+land_flight(np_snmp_flight *f, struct pollfd *pfd, int result, np_snmp_pdu *responses,
+            int *results)
+{
+	np_snmp_pdu *response = &responses[f->host];
+
+	response->error = result == NP_SNMP_ERROR ? errno : 0;
+	response->tries = f->tries;
+	response->time = elapsed_ms(&f->first);
+	results[f->host] = result;
+	if (pfd->fd >= 0)
+		close(pfd->fd);
+	pfd->fd = -1;
+	f->host = -1;
+}
+
+void
+np_snmp_request_all(const char **hosts, int n_hosts, const np_snmp_options *opts, int type,
+                    const np_snmp_oid *oids, int n, int window,
+                    np_snmp_pdu *responses, int *results)
+{
+	unsigned char buf[NP_SNMP_MAX_PACKET];
+	np_snmp_flight *flights;
+	struct pollfd *pfds;
+	np_snmp_pdu *response;
+	int next = 0, busy = 0, i, ret, done, wait, left, flags;
+	ssize_t len;
+
+	memset(responses, 0, n_hosts * sizeof(*responses));
+	window = window < 1 ? 1 : window > n_hosts ? n_hosts : window;
+	if (window == 0)
+		return;
+	flights = calloc(window, sizeof(*flights));
+	pfds = calloc(window, sizeof(*pfds));
+	if (!flights || !pfds) {
+		for (i = 0; i < n_hosts; i++) {
+			responses[i].error = ENOMEM;
+			results[i] = NP_SNMP_ERROR;
+		}
+		free(flights);
+		free(pfds);
+		return;
+	}
+	for (i = 0; i < window; i++) {
+		flights[i].host = -1;
+		pfds[i].fd = -1;
+	}
+
+	while (next < n_hosts || busy > 0) {
+		/* as many requests out as the window takes */
+		for (i = 0; i < window && next < n_hosts; i++) {
+			if (flights[i].host >= 0)
+				continue;
+			flights[i].host = next++;
+			flights[i].id = next_request_id();
+			flights[i].tries = 0;
+			gettimeofday(&flights[i].first, NULL);
+			pfds[i].events = POLLIN;
+			if ((pfds[i].fd = agent_socket(hosts[flights[i].host], opts)) < 0 ||
+			    (flags = fcntl(pfds[i].fd, F_GETFL, 0)) < 0 ||
+			    fcntl(pfds[i].fd, F_SETFL, flags | O_NONBLOCK) < 0 ||
+			    send_flight(&flights[i], pfds[i].fd, opts, type, oids, n) < 0) {
+				land_flight(&flights[i], &pfds[i], NP_SNMP_ERROR, responses, results);
+				continue;
+			}
+			busy++;
+		}
+		if (busy == 0)
+			continue;
+
+		/* until an answer comes, or the earliest try is out of time */
+		for (wait = opts->timeout, i = 0; i < window; i++) {
+			if (flights[i].host >= 0 && (left = opts->timeout - (int)elapsed_ms(&flights[i].sent)) < wait)
+				wait = left > 0 ? left : 0;
+		}
+		if (poll(pfds, window, wait) < 0 && errno != EINTR) {
+			for (i = 0; i < window; i++) {
+				if (flights[i].host >= 0) {
+					land_flight(&flights[i], &pfds[i], NP_SNMP_ERROR, responses, results);
+					busy--;
+				}
+			}
+			continue;
+		}
+
+		for (i = 0; i < window; i++) {
+			if (flights[i].host < 0)
+				continue;
+			response = &responses[flights[i].host];
+			ret = NP_SNMP_TIMEOUT;
+			done = FALSE;
+			while (pfds[i].revents && !done) {
+				if ((len = recv(pfds[i].fd, buf, sizeof(buf), 0)) < 0) {
+					if (errno == EINTR)
+						continue;
+					if (errno != EAGAIN && errno != EWOULDBLOCK) {
+						ret = NP_SNMP_ERROR;
+						done = TRUE;
+					}
+					break;
+				}
+				np_snmp_free_pdu(response);
+				ret = np_snmp_parse_pdu(buf, len, response);
+				done = TRUE;
+				/* responses to earlier tries, and anything else that isn't ours */
+				if (ret == NP_SNMP_OK && (response->request_id != flights[i].id ||
+				                          response->type != NP_SNMP_RESPONSE)) {
+					np_snmp_free_pdu(response);
+					ret = NP_SNMP_TIMEOUT;
+					done = FALSE;
+				}
+			}
+			if (!done && elapsed_ms(&flights[i].sent) >= opts->timeout) {
+				if (flights[i].tries > opts->retries)
+					done = TRUE;
+				else if (send_flight(&flights[i], pfds[i].fd, opts, type, oids, n) < 0) {
+					ret = NP_SNMP_ERROR;
+					done = TRUE;
+				}
+			}
+			if (done) {
+				land_flight(&flights[i], &pfds[i], ret, responses, results);
+				busy--;
+			}
+		}
+	}
+	free(flights);
+	free(pfds);
+}
+
+void
+np_snmp_localize_sha1(const char *password, const unsigned char *engine_id, size_t len,
+                      unsigned char *key)
+{
+	struct sha1_ctx ctx;
+	unsigned char block[64];
+	size_t plen = strlen(password), pos = 0;
+	int i, j;
+
+	/* Ku: the password repeated over a megabyte */
+	sha1_init_ctx(&ctx);
+	for (i = 0; i < 1048576 / 64; i++) {
+		for (j = 0; j < 64; j++)
+			block[j] = password[pos++ % plen];
+		sha1_process_bytes(block, 64, &ctx);
+	}
+	sha1_finish_ctx(&ctx, key);
+
+	/* Kul = H(Ku | engine ID | Ku) */
+	sha1_init_ctx(&ctx);
+	sha1_process_bytes(key, NP_SNMP_SHA1_KEY_LEN, &ctx);
+	sha1_process_bytes(engine_id, len, &ctx);
+	sha1_process_bytes(key, NP_SNMP_SHA1_KEY_LEN, &ctx);
+	sha1_finish_ctx(&ctx, key);
+}
+
+static char *
+append(char *s, size_t *len, const char *fmt, ...)
+{
+	va_list ap;
+	char *more;
+	int n;
+
+	va_start(ap, fmt);
+	n = vasprintf(&more, fmt, ap);
+	va_end(ap);
+	if (n < 0 || !s)
+		return s;
+	s = realloc(s, *len + n + 1);
+	if (s) {
+		memcpy(s + *len, more, n + 1);
+		*len += n;
+	}
+	free(more);
+	return s;
+}
+
+char *
+np_snmp_value_string(const np_snmp_varbind *vb)
+{
+	char oid[NP_SNMP_MAX_OID * 11 + 1], *s = strdup("");
+	size_t len = 0, i;
+	unsigned long long t;
+	int printable = 1;
+
+	switch (vb->type) {
+	case NP_SNMP_INTEGER:
+		return append(s, &len, "INTEGER: %ld", vb->integer);
+	case NP_SNMP_OCTET_STRING:
+		for (i = 0; i < vb->len; i++)
+			if (!isprint(vb->data[i]) && !isspace(vb->data[i]))
+				printable = 0;
+		if (printable) {
+			/* quotes and backslashes are escaped, like net-snmp does */
+			s = append(s, &len, "STRING: \"");
+			for (i = 0; i < vb->len; i++)
+				s = append(s, &len, strchr("\"\\", vb->data[i]) ? "\\%c" : "%c", vb->data[i]);
+			return append(s, &len, "\"");
+		}
+		s = append(s, &len, "Hex-STRING:");
+		for (i = 0; i < vb->len; i++)
+			s = append(s, &len, " %02X", vb->data[i]);
+		return s;
+	case NP_SNMP_OBJECT_ID:
+		return append(s, &len, "OID: %s", np_snmp_oid_string(vb->objid, oid, sizeof(oid)));
+	case NP_SNMP_IPADDRESS:
+		return append(s, &len, "IpAddress: %u.%u.%u.%u", vb->data[0], vb->data[1], vb->data[2], vb->data[3]);
+	case NP_SNMP_COUNTER32:
+	case NP_SNMP_GAUGE32:
+	case NP_SNMP_COUNTER64:
+		return append(s, &len, "%s: %llu", np_snmp_type_name(vb->type), vb->value);
+	case NP_SNMP_TIMETICKS:
+		t = vb->value;
+		s = append(s, &len, "Timeticks: (%llu) ", t);
+		if (t >= 8640000)
+			s = append(s, &len, "%llu day%s, ", t / 8640000, t >= 2 * 8640000 ? "s" : "");
+		return append(s, &len, "%d:%02d:%02d.%02d", (int)(t / 360000 % 24),
+		              (int)(t / 6000 % 60), (int)(t / 100 % 60), (int)(t % 100));
+	case NP_SNMP_OPAQUE:
+		s = append(s, &len, "Opaque:");
+		for (i = 0; i < vb->len; i++)
+			s = append(s, &len, " %02X", vb->data[i]);
+		return s;
+	case NP_SNMP_NULL:
+		return append(s, &len, "NULL");
+	case NP_SNMP_NOSUCHOBJECT:
+		return append(s, &len, "No Such Object available on this agent at this OID");
+	case NP_SNMP_NOSUCHINSTANCE:
+		return append(s, &len, "No Such Instance currently exists at this OID");
+	case NP_SNMP_ENDOFMIBVIEW:
+		return append(s, &len, "No more variables left in this MIB View (It is past the end of the MIB tree)");
+	}
+	return append(s, &len, "Wrong Type (0x%02X)", vb->type);
+}
+
+const char *
+np_snmp_type_name(int type)
+{
+	int i;
+
+	for (i = 0; snmp_types[i].name; i++)
+		if (snmp_types[i].type == type)
+			return snmp_types[i].name;
+	return "unknown";
+}
+
+const char *
+np_snmp_error_name(int status)
+{
+	if (status >= 0 && status < (int)(sizeof(snmp_errors) / sizeof(*snmp_errors)))
+		return snmp_errors[status];
+	return "unknown error";
+}
+
+const char *
+np_snmp_strerror(int result)
+{
+	switch (result) {
+	case NP_SNMP_OK:
+		return "no error";
+	case NP_SNMP_TIMEOUT:
+		return "no response";
+	case NP_SNMP_BADREPLY:
+		return "malformed response";
+	}
+	return strerror(errno);
+}
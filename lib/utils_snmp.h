@@ -0,0 +1,141 @@
+#ifndef _UTILS_SNMP_
+#define _UTILS_SNMP_
+/* Header file for utils_snmp: a minimal SNMPv1/v2c manager */
+
+#define NP_SNMP_PORT 161
+#define NP_SNMP_MAX_PACKET 65535
+#define NP_SNMP_MAX_OID 128          /* sub-identifiers, as RFC 2578 allows */
+
+/* versions, as they go on the wire */
+#define NP_SNMP_V1 0
+#define NP_SNMP_V2C 1
+
+/* PDU types */
+#define NP_SNMP_GET 0xa0
+#define NP_SNMP_GETNEXT 0xa1
+#define NP_SNMP_RESPONSE 0xa2
+#define NP_SNMP_GETBULK 0xa5
+
+/* value types */
+#define NP_SNMP_INTEGER 0x02
+#define NP_SNMP_OCTET_STRING 0x04
+#define NP_SNMP_NULL 0x05
+#define NP_SNMP_OBJECT_ID 0x06
+#define NP_SNMP_IPADDRESS 0x40
+#define NP_SNMP_COUNTER32 0x41
+#define NP_SNMP_GAUGE32 0x42
+#define NP_SNMP_TIMETICKS 0x43
+#define NP_SNMP_OPAQUE 0x44
+#define NP_SNMP_COUNTER64 0x46
+#define NP_SNMP_NOSUCHOBJECT 0x80
+#define NP_SNMP_NOSUCHINSTANCE 0x81
+#define NP_SNMP_ENDOFMIBVIEW 0x82
+
+/* error-status of a response */
+#define NP_SNMP_NOERROR 0
+#define NP_SNMP_TOOBIG 1
+#define NP_SNMP_NOSUCHNAME 2
+#define NP_SNMP_BADVALUE 3
+#define NP_SNMP_READONLY 4
+#define NP_SNMP_GENERR 5
+
+/* np_snmp_request() results besides NP_SNMP_OK. With NP_SNMP_ERROR,
+ * errno tells what went wrong */
+#define NP_SNMP_OK 0
+#define NP_SNMP_ERROR -1
+#define NP_SNMP_TIMEOUT -2
+#define NP_SNMP_BADREPLY -3
+
+typedef struct np_snmp_oid {
+	unsigned int n;
+	unsigned int id[NP_SNMP_MAX_OID];
+} np_snmp_oid;
+
+typedef struct np_snmp_varbind {
+	np_snmp_oid oid;
+	int type;
+	long integer;                /* INTEGER */
+	unsigned long long value;    /* Counter32/64, Gauge32, TimeTicks */
+	unsigned char *data;         /* OCTET STRING, IpAddress and Opaque */
+	size_t len;
+	np_snmp_oid *objid;          /* OBJECT IDENTIFIER */
+} np_snmp_varbind;
+
+typedef struct np_snmp_pdu {
+	int version;
+	int type;
+	long request_id;
+	int error_status;            /* non-repeaters for GETBULK */
+	int error_index;             /* max-repetitions for GETBULK */
+	int n_vb;
+	np_snmp_varbind *vb;
+	int tries;                   /* requests sent */
+	double time;                 /* from first request to response, in ms */
+	int error;                   /* errno, when np_snmp_request_all() failed */
+} np_snmp_pdu;
+
+typedef struct np_snmp_options {
+	int port;
+	int family;                  /* AF_UNSPEC, AF_INET or AF_INET6 */
+	int version;                 /* NP_SNMP_V1 or NP_SNMP_V2C */
+	const char *community;
+	int retries;                 /* retransmissions after the first request */
+	int timeout;                 /* ms to wait for each try */
+} np_snmp_options;
+
+void np_snmp_init_options(np_snmp_options *opts);
+
+/* "1.3.6.1.2.1.1.3.0" (a leading dot is fine) -> oid. Returns 0, or -1 if
+ * the string is not a numeric OID */
+int np_snmp_parse_oid(const char *str, np_snmp_oid *oid);
+/* oid -> ".1.3.6.1.2.1.1.3.0" */
+char *np_snmp_oid_string(const np_snmp_oid *oid, char *buf, size_t size);
+int np_snmp_oid_compare(const np_snmp_oid *a, const np_snmp_oid *b);
+
+/* encode a request into buf. For GET and GETNEXT non_repeaters and
+ * max_repetitions go as 0. Returns its length, or -1 if it doesn't fit */
+int np_snmp_build_request(unsigned char *buf, size_t size, const np_snmp_options *opts,
+                          int type, long request_id, int non_repeaters, int max_repetitions,
+                          const np_snmp_oid *oids, int n);
+
+/* decode a message. Returns NP_SNMP_OK or NP_SNMP_BADREPLY. The pdu must
+ * be freed with np_snmp_free_pdu() either way */
+int np_snmp_parse_pdu(const unsigned char *buf, size_t len, np_snmp_pdu *pdu);
+void np_snmp_free_pdu(np_snmp_pdu *pdu);
+
+/* a varbind on its own, value and all, as caches keep them. Encoding
+ * returns its length, or -1 if it doesn't fit. Decoding returns the bytes
+ * it used, or -1; the varbind must be freed with np_snmp_free_varbind() */
+int np_snmp_encode_varbind(unsigned char *buf, size_t size, const np_snmp_varbind *vb);
+int np_snmp_decode_varbind(const unsigned char *buf, size_t len, np_snmp_varbind *vb);
+void np_snmp_free_varbind(np_snmp_varbind *vb);
+
+/* send a request to host (a name or an address) and wait for the
+ * response, retrying each timeout */
+int np_snmp_request(const char *host, const np_snmp_options *opts, int type,
+                    int non_repeaters, int max_repetitions,
+                    const np_snmp_oid *oids, int n, np_snmp_pdu *response);
+
+/* ask every one of hosts for the same OIDs, with up to window requests
+ * out at once. results[i] is what np_snmp_request() would have returned
+ * for hosts[i], and responses[i] its response. Each response must be
+ * freed with np_snmp_free_pdu() */
+void np_snmp_request_all(const char **hosts, int n_hosts, const np_snmp_options *opts, int type,
+                         const np_snmp_oid *oids, int n, int window,
+                         np_snmp_pdu *responses, int *results);
+
+/* the value as net-snmp's tools print it, e.g. "Counter32: 42" or
+ * "STRING: \"text\"". Returns a malloc()ed string */
+char *np_snmp_value_string(const np_snmp_varbind *vb);
+
+/* SNMPv3 (RFC 3414 A.2.2): the SHA-1 key of a password that is not empty,
+ * localized to an engine. key needs NP_SNMP_SHA1_KEY_LEN bytes */
+#define NP_SNMP_SHA1_KEY_LEN 20
+void np_snmp_localize_sha1(const char *password, const unsigned char *engine_id, size_t len,
+                           unsigned char *key);
+
+const char *np_snmp_type_name(int type);
+const char *np_snmp_error_name(int status);
+const char *np_snmp_strerror(int result);
+
+#endif /* _UTILS_SNMP_ */
@@ -53,6 +53,9 @@ const char *email = "nagiosplug-devel@lists.sourceforge.net";
 #include <sys/ioctl.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
@@ -68,9 +71,14 @@ const char *email = "nagiosplug-devel@lists.sourceforge.net";
 #include <netinet/in.h>
 #include <netinet/ip.h>
 #include <netinet/ip_icmp.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
 #include <arpa/inet.h>
 #include <signal.h>
 #include <float.h>
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif
 
 
 /** sometimes undefined system macros (quite a few, actually) **/
@@ -107,37 +115,149 @@ const char *email = "nagiosplug-devel@lists.sourceforge.net";
 # define DBL_MAX 9.9999999999e999
 #endif
 
+/* on Linux, packets are sent and received in batches of up to
+ * MMSG_BATCH with sendmmsg(2)/recvmmsg(2), waiting in ppoll(2).
+ * Everywhere else, we fall back to one syscall per packet */
+#if defined(HAVE_SENDMMSG) && defined(HAVE_RECVMMSG) && defined(HAVE_PPOLL)
+# define USE_MMSG 1
+# define MMSG_BATCH 64
+#else
+# define MMSG_BATCH 1
+#endif
+/* largest deviation from target_interval we accept to batch packets */
+#define MMSG_PACING_SLACK 1000
+#define RECV_BUF_SIZE 4096
+#define RECV_CTRL_SIZE 64	/* room for one SCM_TIMESTAMP(NS) message */
+
+/* default destination ports for tcp and udp probes. The udp one is
+ * traceroute's, where we expect nothing to listen */
+#define DEFAULT_TCP_PORT 80
+#define DEFAULT_UDP_PORT 33434
+
+/* a tcp probe has no payload, so the ISN of our SYN holds the probe number
+ * in the top bits and the send time in usecs (modulo 2^27, ~134 seconds)
+ * in the rest. The SYN-ACK or RST hands it back to us as ack - 1 */
+#define TCP_STAMP_BITS 27
+#define TCP_STAMP_MASK ((1U << TCP_STAMP_BITS) - 1)
+
+/* with -A, a packet is given up on once srtt + 4 * rttvar (RFC 6298) have
+ * passed since it was sent. The RTO is never below this, nor above crit.rta */
+#define RTO_MIN 20000
+
+/* the prober (-D) publishes the last window of samples of each target in
+ * a file that check_icmp -F maps and evaluates. The layout is a header,
+ * the target table and a ring of window samples per target */
+#define SHM_MAGIC 0x4e50494dU	/* "NPIM" */
+#define SHM_VERSION 1
+#define SHM_NAME_LEN 64
+#define SHM_DEFAULT_WINDOW 60
+#define SHM_MAX_WINDOW 3600
+#define SHM_DEFAULT_INTERVAL 1000000
+#define SHM_LOST 0xffffffffU	/* sample of a lost probe */
+
+typedef struct shm_header {
+	u_int32_t magic;
+	u_int32_t version;
+	u_int32_t targets;
+	u_int32_t window;            /* samples kept per target */
+	u_int32_t interval;          /* usecs between probes to a target */
+	u_int32_t pid;               /* of the prober */
+	u_int64_t updated;           /* wall clock usecs at the start of the last round */
+} shm_header;
+
+typedef struct shm_target {
+	char name[SHM_NAME_LEN];     /* as given to the prober, maybe truncated */
+	u_int32_t addr;              /* network byte order, 0 if unresolved */
+	volatile u_int32_t count;    /* samples ever taken. Bumped after the sample
+	                              * is written, so readers retry if it moved */
+} shm_target;
+
+#ifdef __GNUC__
+# define shm_barrier() __sync_synchronize()
+#else
+# define shm_barrier()
+#endif
+
 typedef unsigned short range_t;  /* type for get_range() -- unimplemented */
 
+/* streaming rtt statistics, updated per reply without allocating.
+ * Bucket k of the histogram holds rtts from 2^(k/2) usecs up to the
+ * next bucket, so 50 buckets cover 1us to ~33s in steps of sqrt(2) */
+#define RTT_BUCKETS 50
+typedef struct rtt_stats {
+	unsigned int n;              /* samples */
+	double mean, m2;             /* Welford running mean and squared deviations */
+	double jitter;               /* RFC 3550 interarrival jitter, usecs */
+	double last;                 /* previous sample, for jitter */
+	unsigned short hist[RTT_BUCKETS];
+} rtt_stats;
+
 typedef struct rta_host {
-	unsigned short id;           /* id in **table, and icmp pkts */
+	unsigned int id;             /* index in **table, sent in icmp payload */
 	char *name;                  /* arg used for adding this host */
 	char *msg;                   /* icmp error message, if any */
 	struct sockaddr_in saddr_in; /* the address of this host */
+	struct in_addr src_addr;     /* our address towards it, for tcp checksums */
 	struct in_addr error_addr;   /* stores address of error replies */
 	unsigned long long time_waited; /* total time waited, in usecs */
-	unsigned int icmp_sent, icmp_recv, icmp_lost; /* counters */
+	unsigned int icmp_sent, icmp_recv, icmp_lost; /* counters, for all probe types */
+	unsigned int recv_mask;      /* tcp and udp probes answered, by number */
+	struct timespec last_send;   /* send time of the last probe */
+	double srtt, rttvar;         /* smoothed rtt and its deviation, 0 if unknown */
+	unsigned int last_seq;       /* icmp seq of the last probe sent */
+	unsigned char pending;       /* prober: last probe is still unanswered */
 	unsigned char icmp_type, icmp_code; /* type and code from errors */
 	unsigned short flags;        /* control/status flags */
 	double rta;                  /* measured RTA */
 	double rtmax;                /* max rtt */
 	double rtmin;                /* min rtt */
+	rtt_stats stats;             /* distribution of rtts */
+	double mos;                  /* MOS estimated from rta, jitter and pl */
 	unsigned char pl;            /* measured packet loss */
 	struct rta_host *next;       /* linked list */
+	struct rta_host *hash_next;  /* address hash chain */
 } rta_host;
 
 #define FLAG_LOST_CAUSE 0x01  /* decidedly dead target. */
+#define FLAG_IN_SHM 0x02      /* found in the prober's table */
+
+/* hostnames are resolved concurrently once all arguments are read. Literal
+ * addresses are kept in the same array, so targets can be added in the
+ * order they were given */
+typedef struct target_arg {
+	char *name;                  /* the argument as given */
+	int state;                   /* RESOLVE_* */
+	struct in_addr addr;         /* for RESOLVE_LITERAL */
+	struct addrinfo *res;        /* for RESOLVE_DONE */
+	int gai_err;                 /* getaddrinfo() return value */
+	struct timeval started;      /* when resolution started */
+} target_arg;
+
+#define RESOLVE_LITERAL 0  /* an ip address, nothing to resolve */
+#define RESOLVE_PENDING 1
+#define RESOLVE_BUSY 2
+#define RESOLVE_DONE 3
+#define RESOLVE_TIMEOUT 4
+
+/* max number of concurrent lookups */
+#define RESOLVER_THREADS 16
 
 /* threshold structure. all values are maximum allowed, exclusive */
 typedef struct threshold {
 	unsigned char pl;    /* max allowed packet loss in percent */
 	unsigned int rta;  /* roundtrip time average, microseconds */
+	unsigned int jitter; /* max jitter, microseconds. 0 if unused */
+	double mos;          /* min allowed MOS, as the "x:" perfdata range. 0 if unused */
 } threshold;
 
-/* the data structure */
+/* the data structure. icmp_seq only has 16 bits, so the target index and
+ * the full send counter travel in the payload. The low 16 bits of the send
+ * counter are also used as icmp_seq, which lets us validate the payload.
+ * udp probes carry it too, with the probe number of the target as seq */
 typedef struct icmp_ping_data {
-	struct timeval stime;	/* timestamp (saved in protocol struct as well) */
-	unsigned short ping_id;
+	struct timespec stime;	/* send time, from the monotonic clock if we have one */
+	u_int32_t target_id;	/* index of the target in **table */
+	u_int32_t seq;			/* value of icmp_sent when this packet was sent */
 } icmp_ping_data;
 
 /* the different modes of this program are as follows:
@@ -182,16 +302,63 @@ void print_help (void);
 void print_usage (void);
 static u_int get_timevar(const char *);
 static u_int get_timevaldiff(struct timeval *, struct timeval *);
+static u_int get_timespecdiff(struct timespec *, struct timespec *);
+static void get_mono_time(struct timespec *);
+static void get_recv_stamp(struct msghdr *, struct timespec *);
 static in_addr_t get_ip_address(const char *);
-static int wait_for_reply(int, u_int);
-static int recvfrom_wto(int, void *, unsigned int, struct sockaddr *, u_int *);
-static int send_icmp_ping(int, struct rta_host *);
+static int wait_for_reply(u_int);
+#ifndef USE_MMSG
+static int recvfrom_wto(void *, unsigned int, struct sockaddr *, u_int *,
+						struct timespec *, int *);
+#endif
+static int recv_replies(u_int *);
+static void dispatch_reply(unsigned int);
+static void handle_reply(unsigned char *, int, struct sockaddr_in *, struct timespec *);
+static void handle_tcp_reply(unsigned char *, int, struct sockaddr_in *, struct timespec *);
+static void handle_udp_reply(struct rta_host *, unsigned char *, int,
+							 struct sockaddr_in *, struct timespec *, unsigned char);
+static int first_reply(struct rta_host *, unsigned int);
+static void record_reply(struct rta_host *, u_int, struct sockaddr_in *,
+						 struct timespec *, unsigned char);
+static void build_icmp_ping(void *, struct rta_host *, unsigned int);
+static void build_tcp_syn(void *, struct rta_host *);
+static void build_udp_probe(void *, struct rta_host *);
+static int build_probe(void *, struct rta_host *, unsigned int, struct sockaddr_in *);
+static u_int32_t get_tcp_stamp(void);
+static int send_probe(int, struct rta_host *);
+static int send_probe_burst(int, struct rta_host **, unsigned int);
+static void set_probe_proto(char *);
+static const char *get_probe_name(void);
+static int get_source_addr(int, struct rta_host *);
+static int enable_recv_stamps(int);
+static void update_rto(struct rta_host *, u_int);
+static u_int get_rto(struct rta_host *);
+static u_int get_adaptive_wait(void);
+static double parse_rtt(const char *);
+static void read_rtt_state(void);
+static void write_rtt_state(void);
+static u_int get_burst_size(void);
+static void run_prober(void);
+static void open_prober_shm(void);
+static void add_shm_sample(struct rta_host *, u_int32_t);
+static void prober_lost(struct rta_host *);
+static void read_shm(void);
 static int get_threshold(char *str, threshold *th);
+static void get_threshold_pair(char *, char, u_int *, u_int *, double *, double *);
+static void update_rtt_stats(rtt_stats *, u_int);
+static double get_rtt_stddev(rtt_stats *);
+static double get_rtt_percentile(struct rta_host *, unsigned int);
+static double get_mos(double, double, unsigned char);
 static void run_checks(void);
 static void set_source_ip(char *);
 static int add_target(char *);
 static int add_target_ip(char *, struct in_addr *);
-static int handle_random_icmp(unsigned char *, struct sockaddr_in *);
+static void add_unresolved_target(char *, const char *);
+static void resolve_targets(void);
+static int handle_random_icmp(unsigned char *, int, struct sockaddr_in *,
+							  struct timespec *, unsigned char);
+static struct rta_host *find_target(in_addr_t);
+static void hash_target(struct rta_host *);
 static unsigned short icmp_checksum(unsigned short *, int);
 static void finish(int);
 static void crash(const char *, ...);
@@ -203,17 +370,46 @@ extern char **environ;
 
 /** global variables **/
 static struct rta_host **table, *cursor, *list;
-static threshold crit = {80, 500000}, warn = {40, 200000};
+static struct rta_host **host_hash;
+static unsigned int host_hash_size;
+static threshold crit = {80, 500000, 0, 0}, warn = {40, 200000, 0, 0};
 static int mode, protocols, sockets, debug = 0, timeout = 10;
 static unsigned short icmp_data_size = DEFAULT_PING_DATA_SIZE;
 static unsigned short icmp_pkt_size = DEFAULT_PING_DATA_SIZE + ICMP_MINLEN;
 
 static unsigned int icmp_sent = 0, icmp_recv = 0, icmp_lost = 0;
+static unsigned int send_calls = 0, recv_calls = 0;
+static unsigned char recv_buf[MMSG_BATCH][RECV_BUF_SIZE];
+static struct sockaddr_in recv_addr[MMSG_BATCH];
+static int recv_len[MMSG_BATCH];
+static struct timespec recv_stamp[MMSG_BATCH];	/* kernel receive time */
+static int recv_proto[MMSG_BATCH];	/* HAVE_* of the socket it came from */
+static unsigned int stamped_replies = 0;
+static unsigned long long stamp_delay_removed = 0; /* usecs, summed */
 #define icmp_pkts_en_route (icmp_sent - (icmp_recv + icmp_lost))
-static unsigned short targets_down = 0, targets = 0, packets = 0;
+static unsigned int targets_down = 0, targets = 0;
+static unsigned short packets = 0;
 #define targets_alive (targets - targets_down)
 static unsigned int retry_interval, pkt_interval, target_interval;
-static int icmp_sock, tcp_sock, udp_sock, status = STATE_OK;
+static unsigned int resolve_timeout = 5; /* seconds per hostname */
+static int adaptive = 0;	/* -A, per-target timeouts from rtt history */
+static char *shm_file = NULL;	/* -D or -F */
+static int prober = 0;		/* -D, we're the prober writing shm_file */
+static shm_header *shm = NULL;
+static shm_target *shm_targets;
+static u_int32_t *shm_samples;
+static target_arg *target_args = NULL;
+static unsigned int num_target_args = 0, target_args_size = 0;
+static int icmp_sock, tcp_sock = -1, udp_sock = -1, status = STATE_OK;
+static int port_sock = -1;	/* holds probe_sport, so nothing else gets it */
+static int probe_proto = HAVE_ICMP;	/* what we send, one of HAVE_ICMP/UDP/TCP */
+static int probe_sock;		/* the socket we send on */
+static unsigned short probe_port = 0, probe_sport = 0; /* tcp/udp ports, host order */
+static struct in_addr source_addr;	/* from -s, INADDR_ANY if not given */
+/* we listen on the icmp socket for errors, and on the probe socket
+ * for tcp and udp replies */
+static struct { int fd, proto; } recv_socks[2];
+static int num_recv_socks = 0;
 static pid_t pid;
 static struct timezone tz;
 static struct timeval prog_start;
@@ -300,10 +496,14 @@ get_icmp_error_msg(unsigned char icmp_type, unsigned char icmp_code)
 }
 
 static int
-handle_random_icmp(unsigned char *packet, struct sockaddr_in *addr)
+handle_random_icmp(unsigned char *packet, int len, struct sockaddr_in *addr,
+				   struct timespec *stamp, unsigned char in_ttl)
 {
 	struct icmp p, sent_icmp;
+	struct ip sent_ip;
 	struct rta_host *host = NULL;
+	unsigned short ports[2];
+	int hlen;
 
 	memcpy(&p, packet, sizeof(p));
 	if(p.icmp_type == ICMP_ECHO && ntohs(p.icmp_id) == pid) {
@@ -329,22 +529,58 @@ handle_random_icmp(unsigned char *packet, struct sockaddr_in *addr)
 		return 0;
 	}
 
-	/* might be for us. At least it holds the original package (according
-	 * to RFC 792). If it isn't, just ignore it */
-	memcpy(&sent_icmp, packet + 28, sizeof(sent_icmp));
-	if(sent_icmp.icmp_type != ICMP_ECHO || ntohs(sent_icmp.icmp_id) != pid ||
-	   ntohs(sent_icmp.icmp_seq) >= targets*packets)
+	/* might be for us. At least it holds the original IP header and the
+	 * first 8 bytes of the original package (according to RFC 792). Our
+	 * payload might be cut off, so find the target by the destination
+	 * address of the original package. If it isn't ours, just ignore it */
+	if(len < ICMP_MINLEN + (int)sizeof(sent_ip)) {
+		if(debug) printf("ICMP error too short to hold the original package\n");
+		return 0;
+	}
+	memcpy(&sent_ip, packet + ICMP_MINLEN, sizeof(sent_ip));
+	hlen = sent_ip.ip_hl << 2;
+	if(len < ICMP_MINLEN + hlen + ICMP_MINLEN) {
+		if(debug) printf("ICMP error too short to hold the original package\n");
+		return 0;
+	}
+	if(sent_ip.ip_p == IPPROTO_ICMP && probe_proto == HAVE_ICMP) {
+		memcpy(&sent_icmp, packet + ICMP_MINLEN + hlen, ICMP_MINLEN);
+		if(sent_icmp.icmp_type == ICMP_ECHO && ntohs(sent_icmp.icmp_id) == pid)
+			host = find_target(sent_ip.ip_dst.s_addr);
+	}
+	else if((sent_ip.ip_p == IPPROTO_TCP && probe_proto == HAVE_TCP) ||
+			(sent_ip.ip_p == IPPROTO_UDP && probe_proto == HAVE_UDP))
 	{
+		/* tcp and udp headers both start with the ports */
+		memcpy(ports, packet + ICMP_MINLEN + hlen, sizeof(ports));
+		if(ntohs(ports[0]) == probe_sport && ntohs(ports[1]) == probe_port)
+			host = find_target(sent_ip.ip_dst.s_addr);
+	}
+	if(!host) {
 		if(debug) printf("Packet is no response to a packet we sent\n");
 		return 0;
 	}
 
 	/* it is indeed a response for us */
-	host = table[ntohs(sent_icmp.icmp_seq)/packets];
 	if(debug) {
-		printf("Received \"%s\" from %s for ICMP ECHO sent to %s.\n",
+		printf("Received \"%s\" from %s for %s probe sent to %s.\n",
 			   get_icmp_error_msg(p.icmp_type, p.icmp_code),
-			   inet_ntoa(addr->sin_addr), host->name);
+			   inet_ntoa(addr->sin_addr), get_probe_name(), host->name);
+	}
+	if(prober) {
+		prober_lost(host);
+		return 0;
+	}
+
+	/* the target telling us nothing listens on the udp port is exactly
+	 * the sign of life we were fishing for */
+	if(probe_proto == HAVE_UDP && p.icmp_type == ICMP_UNREACH &&
+	   p.icmp_code == ICMP_UNREACH_PORT &&
+	   addr->sin_addr.s_addr == host->saddr_in.sin_addr.s_addr)
+	{
+		hlen += ICMP_MINLEN + sizeof(struct udphdr);
+		handle_udp_reply(host, packet + hlen, len - hlen, addr, stamp, in_ttl);
+		return 0;
 	}
 
 	icmp_lost++;
@@ -376,15 +612,23 @@ main(int argc, char **argv)
 	char *ptr;
 	long int arg;
 	int icmp_sockerrno, udp_sockerrno, tcp_sockerrno;
-	int result;
+	int result, sock, is_root, interval_set = 0, packets_set = 0;
 	struct rta_host *host;
+	struct sockaddr_in sa;
+	socklen_t sa_len;
+	static struct option longopts[] = {
+		{"prober", required_argument, 0, 'D'},
+		{"from-shm", required_argument, 0, 'F'},
+		{0, 0, 0, 0}
+	};
 
 	setlocale (LC_ALL, "");
 	bindtextdomain (PACKAGE, LOCALEDIR);
 	textdomain (PACKAGE);
 
-	/* print a helpful error message if geteuid != 0 */
-	np_warn_if_not_root();
+	/* remember if we're root for the warning below. Reading the prober's
+	 * table (-F) doesn't need it, but we don't know yet */
+	is_root = np_check_if_root();
 
 	/* we only need to be setsuid when we get the sockets, so do
 	 * that before pointer magic (esp. on network data) */
@@ -394,19 +638,23 @@ main(int argc, char **argv)
 		sockets |= HAVE_ICMP;
 	else icmp_sockerrno = errno;
 
-	/* if((udp_sock = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP)) != -1) */
-	/* 	sockets |= HAVE_UDP; */
-	/* else udp_sockerrno = errno; */
+	if((udp_sock = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP)) != -1)
+		sockets |= HAVE_UDP;
+	else udp_sockerrno = errno;
 
-	/* if((tcp_sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) != -1) */
-	/* 	sockets |= HAVE_TCP; */
-	/* else tcp_sockerrno = errno; */
+	/* raw, since we craft the SYNs ourselves and never connect */
+	if((tcp_sock = socket(PF_INET, SOCK_RAW, IPPROTO_TCP)) != -1)
+		sockets |= HAVE_TCP;
+	else tcp_sockerrno = errno;
 
 	/* now drop privileges (no effect if not setsuid or geteuid() == 0) */
 	setuid(getuid());
 
-	/* POSIXLY_CORRECT might break things, so unset it (the portable way) */
+	/* POSIXLY_CORRECT might break things, so unset it (the portable way).
+	 * Keep track of where state files go, though */
+	ptr = getenv("NAGIOS_PLUGIN_STATE_DIRECTORY");
 	environ = NULL;
+	if(ptr) setenv("NAGIOS_PLUGIN_STATE_DIRECTORY", ptr, 1);
 
 	/* use the pid to mark packets as ours */
 	/* Some systems have 32-bit pid_t so mask off only 16 bits */
@@ -452,73 +700,99 @@ main(int argc, char **argv)
 	}
 
 	/* Parse extra opts if any */
+	np_init(progname, argc, argv);
 	argv=np_extra_opts(&argc, argv, progname);
+	np_set_args(argc, argv);
+
+	/* parse the arguments. getopt() permutes argv, so a single pass
+	 * picks up options given after the hosts as well */
+	while((arg = getopt_long(argc, argv, "vhVw:c:n:p:t:H:s:i:b:I:l:m:R:J:M:P:AD:F:",
+							 longopts, NULL)) != EOF) {
+		long size;
+		switch(arg) {
+		case 'v':
+			debug++;
+			break;
+		case 'b':
+			size = strtol(optarg,NULL,0);
+			if (size >= (sizeof(struct icmp) + sizeof(struct icmp_ping_data)) &&
+			    size < MAX_PING_DATA) {
+				icmp_data_size = size;
+				icmp_pkt_size = size + ICMP_MINLEN;
+			} else
+				usage_va("ICMP data length must be between: %d and %d",
+				         sizeof(struct icmp) + sizeof(struct icmp_ping_data),
+				         MAX_PING_DATA - 1);
 
-	/* parse the arguments */
-	for(i = 1; i < argc; i++) {
-		while((arg = getopt(argc, argv, "vhVw:c:n:p:t:H:s:i:b:I:l:m:")) != EOF) {
-			long size;
-			switch(arg) {
-			case 'v':
-				debug++;
-				break;
-			case 'b':
-				size = strtol(optarg,NULL,0);
-				if (size >= (sizeof(struct icmp) + sizeof(struct icmp_ping_data)) &&
-				    size < MAX_PING_DATA) {
-					icmp_data_size = size;
-					icmp_pkt_size = size + ICMP_MINLEN;
-				} else
-					usage_va("ICMP data length must be between: %d and %d",
-					         sizeof(struct icmp) + sizeof(struct icmp_ping_data),
-					         MAX_PING_DATA - 1);
-
-				break;
-			case 'i':
-				pkt_interval = get_timevar(optarg);
-				break;
-			case 'I':
-				target_interval = get_timevar(optarg);
-				break;
-			case 'w':
-				get_threshold(optarg, &warn);
-				break;
-			case 'c':
-				get_threshold(optarg, &crit);
-				break;
-			case 'n':
-			case 'p':
-				packets = strtoul(optarg, NULL, 0);
-				break;
-			case 't':
-				timeout = strtoul(optarg, NULL, 0);
-				if(!timeout) timeout = 10;
-				break;
-			case 'H':
-				add_target(optarg);
-				break;
-			case 'l':
-				ttl = (unsigned char)strtoul(optarg, NULL, 0);
-				break;
-			case 'm':
-				min_hosts_alive = (int)strtoul(optarg, NULL, 0);
-				break;
-			case 'd': /* implement later, for cluster checks */
-				warn_down = (unsigned char)strtoul(optarg, &ptr, 0);
-				if(ptr) {
-					crit_down = (unsigned char)strtoul(ptr + 1, NULL, 0);
-				}
-				break;
-			case 's': /* specify source IP address */
-				set_source_ip(optarg);
-				break;
-      case 'V':                 /* version */
-        print_revision (progname, NP_VERSION);
-        exit (STATE_OK);
-      case 'h':                 /* help */
-        print_help ();
-        exit (STATE_OK);
+			break;
+		case 'i':
+			pkt_interval = get_timevar(optarg);
+			interval_set = 1;
+			break;
+		case 'I':
+			target_interval = get_timevar(optarg);
+			break;
+		case 'w':
+			get_threshold(optarg, &warn);
+			break;
+		case 'c':
+			get_threshold(optarg, &crit);
+			break;
+		case 'J':
+			get_threshold_pair(optarg, 'J', &warn.jitter, &crit.jitter, NULL, NULL);
+			break;
+		case 'M':
+			get_threshold_pair(optarg, 'M', NULL, NULL, &warn.mos, &crit.mos);
+			break;
+		case 'n':
+		case 'p':
+			packets = strtoul(optarg, NULL, 0);
+			packets_set = 1;
+			break;
+		case 't':
+			timeout = strtoul(optarg, NULL, 0);
+			if(!timeout) timeout = 10;
+			break;
+		case 'R':
+			resolve_timeout = strtoul(optarg, NULL, 0);
+			if(!resolve_timeout) resolve_timeout = 5;
+			break;
+		case 'H':
+			add_target(optarg);
+			break;
+		case 'l':
+			ttl = (unsigned char)strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			min_hosts_alive = (int)strtoul(optarg, NULL, 0);
+			break;
+		case 'd': /* implement later, for cluster checks */
+			warn_down = (unsigned char)strtoul(optarg, &ptr, 0);
+			if(ptr) {
+				crit_down = (unsigned char)strtoul(ptr + 1, NULL, 0);
 			}
+			break;
+		case 's': /* specify source IP address */
+			set_source_ip(optarg);
+			break;
+		case 'P': /* probe protocol */
+			set_probe_proto(optarg);
+			break;
+		case 'A': /* adaptive timeouts */
+			adaptive = 1;
+			break;
+		case 'D': /* run as prober */
+		case 'F': /* evaluate the prober's samples */
+			if(shm_file) usage_va(_("Only one of -D and -F can be given"));
+			shm_file = optarg;
+			prober = (arg == 'D');
+			break;
+		case 'V':                 /* version */
+			print_revision (progname, NP_VERSION);
+			exit (STATE_OK);
+		case 'h':                 /* help */
+			print_help ();
+			exit (STATE_OK);
 		}
 	}
 
@@ -527,59 +801,135 @@ main(int argc, char **argv)
 		add_target(*argv);
 		argv++;
 	}
+
+	/* stupid users should be able to give whatever thresholds they want
+	 * (nothing will break if they do), but some anal plugin maintainer
+	 * will probably add some printf() thing here later, so it might be
+	 * best to at least show them where to do it. ;) */
+	if(warn.pl > crit.pl) warn.pl = crit.pl;
+	if(warn.rta > crit.rta) warn.rta = crit.rta;
+	if(crit.jitter && warn.jitter > crit.jitter) warn.jitter = crit.jitter;
+	if(warn.mos < crit.mos) warn.mos = crit.mos;
+	if(warn_down > crit_down) crit_down = warn_down;
+
+	/* the prober did all the work, so no sockets or lookups here */
+	if(shm_file && !prober) {
+		read_shm();
+		finish(0);
+	}
+
+	/* print a helpful error message if we weren't root */
+	if(!is_root) np_warn_if_not_root();
+
+	if(prober) {
+		if(probe_proto != HAVE_ICMP)
+			usage_va(_("The prober only sends ICMP probes"));
+		if(!interval_set) pkt_interval = SHM_DEFAULT_INTERVAL;
+		if(!packets_set) packets = SHM_DEFAULT_WINDOW;
+		if(packets < 1 || packets > SHM_MAX_WINDOW)
+			usage_va(_("The prober's window must be between 1 and %d samples"),
+					 SHM_MAX_WINDOW);
+	}
+
+	resolve_targets();
 	if(!targets) {
 		errno = 0;
 		crash("No hosts to check");
 		exit(3);
 	}
 
-	if(!sockets) {
-		if(icmp_sock == -1) {
-			errno = icmp_sockerrno;
-			crash("Failed to obtain ICMP socket");
-			return -1;
-		}
-		/* if(udp_sock == -1) { */
-		/* 	errno = icmp_sockerrno; */
-		/* 	crash("Failed to obtain UDP socket"); */
-		/* 	return -1; */
-		/* } */
-		/* if(tcp_sock == -1) { */
-		/* 	errno = icmp_sockerrno; */
-		/* 	crash("Failed to obtain TCP socker"); */
-		/* 	return -1; */
-		/* } */
+	/* errors for all probe types come in on the icmp socket, so we
+	 * always need that one */
+	if(!(sockets & HAVE_ICMP)) {
+		errno = icmp_sockerrno;
+		crash("Failed to obtain ICMP socket");
+		return -1;
+	}
+	if(probe_proto == HAVE_UDP && !(sockets & HAVE_UDP)) {
+		errno = udp_sockerrno;
+		crash("Failed to obtain UDP socket");
+		return -1;
+	}
+	if(probe_proto == HAVE_TCP && !(sockets & HAVE_TCP)) {
+		errno = tcp_sockerrno;
+		crash("Failed to obtain TCP socket");
+		return -1;
+	}
+	if(probe_proto != HAVE_UDP && udp_sock != -1) {
+		close(udp_sock);
+		udp_sock = -1;
+	}
+	if(probe_proto != HAVE_TCP && tcp_sock != -1) {
+		close(tcp_sock);
+		tcp_sock = -1;
 	}
 	if(!ttl) ttl = 64;
 
-	if(icmp_sock) {
-		result = setsockopt(icmp_sock, SOL_IP, IP_TTL, &ttl, sizeof(ttl));
-		if(debug) {
-			if(result == -1) printf("setsockopt failed\n");
-			else printf("ttl set to %u\n", ttl);
+	probe_sock = icmp_sock;
+	if(probe_proto != HAVE_ICMP) {
+		/* our source port marks replies as ours. For udp, it's the one the
+		 * kernel gives our socket. For tcp we bind a stream socket we never
+		 * use, so no one else can get the port while we're running and the
+		 * kernel resets the connections our SYNs open */
+		memset(&sa, 0, sizeof(sa));
+		sa.sin_family = AF_INET;
+		sa.sin_addr = source_addr;
+		sa_len = sizeof(sa);
+		if(probe_proto == HAVE_UDP) probe_sock = udp_sock;
+		else {
+			probe_sock = tcp_sock;
+			port_sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+		}
+		sock = probe_proto == HAVE_UDP ? udp_sock : port_sock;
+		if(sock == -1 ||
+		   bind(sock, (struct sockaddr *)&sa, sizeof(sa)) == -1 ||
+		   getsockname(sock, (struct sockaddr *)&sa, &sa_len) == -1)
+		{
+			crash("Failed to get a source port for %s probes", get_probe_name());
 		}
+		probe_sport = ntohs(sa.sin_port);
+		if(debug) printf("sending %s probes from port %u to port %u\n",
+						 get_probe_name(), probe_sport, probe_port);
+
+		recv_socks[num_recv_socks].fd = probe_sock;
+		recv_socks[num_recv_socks++].proto = probe_proto;
 	}
+	recv_socks[num_recv_socks].fd = icmp_sock;
+	recv_socks[num_recv_socks++].proto = HAVE_ICMP;
 
-	/* stupid users should be able to give whatever thresholds they want
-	 * (nothing will break if they do), but some anal plugin maintainer
-	 * will probably add some printf() thing here later, so it might be
-	 * best to at least show them where to do it. ;) */
-	if(warn.pl > crit.pl) warn.pl = crit.pl;
-	if(warn.rta > crit.rta) warn.rta = crit.rta;
-	if(warn_down > crit_down) crit_down = warn_down;
+	result = setsockopt(probe_sock, SOL_IP, IP_TTL, &ttl, sizeof(ttl));
+	if(debug) {
+		if(result == -1) printf("setsockopt failed\n");
+		else printf("ttl set to %u\n", ttl);
+	}
+
+	/* have the kernel timestamp replies on arrival, so the time they
+	 * spend queued while we're busy isn't counted as rtt */
+	result = 0;
+	for(i = 0; i < num_recv_socks; i++) {
+		if(enable_recv_stamps(recv_socks[i].fd) == -1) result = -1;
+	}
+	if(debug) {
+		if(result == -1) printf("kernel receive timestamps not available\n");
+		else printf("using kernel receive timestamps\n");
+	}
 
-	signal(SIGINT, finish);
-	signal(SIGHUP, finish);
-	signal(SIGTERM, finish);
-	signal(SIGALRM, finish);
-	if(debug) printf("Setting alarm timeout to %u seconds\n", timeout);
-	alarm(timeout);
+	/* the prober runs until it's killed */
+	if(!prober) {
+		signal(SIGINT, finish);
+		signal(SIGHUP, finish);
+		signal(SIGTERM, finish);
+		signal(SIGALRM, finish);
+		if(debug) printf("Setting alarm timeout to %u seconds\n", timeout);
+		alarm(timeout);
+	}
 
 	/* make sure we don't wait any longer than necessary */
 	gettimeofday(&prog_start, &tz);
 	max_completion_time =
-		((targets * packets * pkt_interval) + (targets * target_interval)) +
-		(targets * packets * crit.rta) + crit.rta;
+		(((unsigned long long)targets * packets * pkt_interval) +
+		 ((unsigned long long)targets * target_interval)) +
+		((unsigned long long)targets * packets * crit.rta) + crit.rta;
 
 	if(debug) {
 		printf("packets: %u, targets: %u\n"
@@ -610,7 +960,7 @@ main(int argc, char **argv)
 			   icmp_pkt_size, timeout);
 	}
 
-	if(packets > 20) {
+	if(packets > 20 && !prober) {
 		errno = 0;
 		crash("packets is > 20 (%d)", packets);
 	}
@@ -621,15 +971,42 @@ main(int argc, char **argv)
 	}
 
 	host = list;
-	table = malloc(sizeof(struct rta_host **) * targets);
+	table = malloc(sizeof(struct rta_host *) * targets);
+	if(!table) {
+		crash("main(): malloc failed for host table");
+	}
 	i = 0;
 	while(host) {
-		host->id = i*packets;
+		host->id = i;
 		table[i] = host;
 		host = host->next;
 		i++;
 	}
 
+	/* find out which address each SYN goes out from, for the checksum */
+	if(probe_proto == HAVE_TCP) {
+		if((sock = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP)) == -1)
+			crash("Failed to obtain socket for route lookups");
+		for(i = 0; i < (int)targets; i++) {
+			host = table[i];
+			if(host->flags & FLAG_LOST_CAUSE) continue;
+			if(get_source_addr(sock, host) == -1) {
+				host->msg = strdup(strerror(errno));
+				host->flags |= FLAG_LOST_CAUSE;
+				targets_down++;
+			}
+		}
+		close(sock);
+	}
+
+	/* the state key is a hash of our arguments, so each service check
+	 * keeps its own rtt history */
+	if(adaptive) {
+		np_enable_state(NULL, 1);
+		read_rtt_state();
+	}
+
+	if(prober) run_prober();
 	run_checks();
 
 	errno = 0;
@@ -638,30 +1015,130 @@ main(int argc, char **argv)
 	return(0);
 }
 
+/* packets are sent in bursts, followed by a wait of target_interval
+ * per packet in the burst. Bursts are kept short enough to never be
+ * more than MMSG_PACING_SLACK usecs ahead of the requested pacing */
+static u_int
+get_burst_size(void)
+{
+	u_int burst = MMSG_BATCH;
+
+	if(target_interval && target_interval * burst > MMSG_PACING_SLACK) {
+		burst = MMSG_PACING_SLACK / target_interval;
+		if(!burst) burst = 1;
+	}
+	if(debug) printf("sending bursts of up to %u packets\n", burst);
+
+	return burst;
+}
+
+/* probe every target once per pkt_interval, forever. A probe still
+ * unanswered when the next one is due counts as lost. Probes are spread
+ * evenly over the interval unless -I says otherwise */
+static void
+run_prober(void)
+{
+	u_int i, t, n, burst, elapsed;
+	unsigned int sent[MMSG_BATCH];
+	struct rta_host *burst_hosts[MMSG_BATCH];
+	struct timeval round_start;
+	struct timespec nap;
+
+	if(!target_interval) target_interval = pkt_interval / targets;
+	burst = get_burst_size();
+	open_prober_shm();
+
+	for(;;) {
+		gettimeofday(&round_start, &tz);
+		shm->updated = (u_int64_t)round_start.tv_sec * 1000000 + round_start.tv_usec;
+
+		t = 0;
+		while(t < targets) {
+			for(n = 0; n < burst && t < targets; t++) {
+				if(table[t]->msg) continue;	/* never resolved */
+				/* errors don't make a target a lost cause here, since
+				 * we'll be asking again in a moment */
+				prober_lost(table[t]);
+				table[t]->flags &= ~FLAG_LOST_CAUSE;
+				sent[n] = table[t]->icmp_sent;
+				burst_hosts[n++] = table[t];
+			}
+			if(!n) continue;
+
+			(void)send_probe_burst(probe_sock, burst_hosts, n);
+			for(i = 0; i < n; i++) {
+				if(burst_hosts[i]->icmp_sent != sent[i]) burst_hosts[i]->pending = 1;
+			}
+			(void)wait_for_reply(target_interval * n);
+		}
+
+		/* wait_for_reply() returns as soon as everything is answered */
+		while((elapsed = get_timevaldiff(&round_start, NULL)) < pkt_interval) {
+			if(icmp_pkts_en_route) (void)wait_for_reply(pkt_interval - elapsed);
+			else {
+				nap.tv_sec = (pkt_interval - elapsed) / 1000000;
+				nap.tv_nsec = ((pkt_interval - elapsed) % 1000000) * 1000;
+				nanosleep(&nap, NULL);
+			}
+		}
+	}
+}
+
 static void
 run_checks()
 {
-	u_int i, t, result;
-	u_int final_wait, time_passed;
+	u_int i, t, n, result;
+	u_int final_wait, time_passed, round_wait, burst, rto_wait, paced;
+	unsigned long long max_round_wait;
+	struct rta_host *burst_hosts[MMSG_BATCH];
+	struct timeval round_start;
+
+	/* the end-of-round wait overflows a u_int when sweeping large nets */
+	max_round_wait = (unsigned long long)pkt_interval * targets;
+	if(max_round_wait > max_completion_time) max_round_wait = max_completion_time;
+	round_wait = max_round_wait > UINT_MAX ? UINT_MAX : (u_int)max_round_wait;
+
+	burst = get_burst_size();
 
 	/* this loop might actually violate the pkt_interval or target_interval
 	 * settings, but only if there aren't any packets on the wire which
 	 * indicates that the target can handle an increased packet rate */
 	for(i = 0; i < packets; i++) {
-		for(t = 0; t < targets; t++) {
+		t = 0;
+		gettimeofday(&round_start, &tz);
+		while(t < targets) {
 			/* don't send useless packets */
 			if(!targets_alive) finish(0);
-			if(table[t]->flags & FLAG_LOST_CAUSE) {
-				if(debug) printf("%s is a lost cause. not sending any more\n",
-								 table[t]->name);
-				continue;
+
+			for(n = 0; n < burst && t < targets; t++) {
+				if(table[t]->flags & FLAG_LOST_CAUSE) {
+					if(debug) printf("%s is a lost cause. not sending any more\n",
+									 table[t]->name);
+					continue;
+				}
+				burst_hosts[n++] = table[t];
 			}
+			if(!n) continue;
+
+			/* we're still in the game, so send next packets */
+			(void)send_probe_burst(probe_sock, burst_hosts, n);
+			result = wait_for_reply(target_interval * n);
+		}
 
-			/* we're still in the game, so send next packet */
-			(void)send_icmp_ping(icmp_sock, table[t]);
-			result = wait_for_reply(icmp_sock, target_interval);
+		/* there's no point waiting for replies that are overdue, so just
+		 * keep pkt_interval between rounds once they are */
+		if(adaptive && i + 1 < packets) {
+			rto_wait = get_adaptive_wait();
+			paced = get_timevaldiff(&round_start, NULL);
+			paced = paced < pkt_interval ? pkt_interval - paced : 0;
+			if(rto_wait < paced) rto_wait = paced;
+			if(rto_wait < round_wait) {
+				if(debug > 1) printf("round %u: adaptive wait %u usecs\n", i, rto_wait);
+				result = wait_for_reply(rto_wait);
+				continue;
+			}
 		}
-		result = wait_for_reply(icmp_sock, pkt_interval * targets);
+		result = wait_for_reply(round_wait);
 	}
 
 	if(icmp_pkts_en_route && targets_alive) {
@@ -676,207 +1153,657 @@ run_checks()
 			if(debug) printf("Time passed. Finishing up\n");
 			finish(0);
 		}
+		if(adaptive && (rto_wait = get_adaptive_wait()) < final_wait) {
+			if(debug) printf("adaptive timeouts cut final wait to %u usecs\n", rto_wait);
+			final_wait = rto_wait;
+		}
 
 		/* catch the packets that might come in within the timeframe, but
 		 * haven't yet */
 		if(debug) printf("Waiting for %u micro-seconds (%0.3f msecs)\n",
 						 final_wait, (float)final_wait / 1000);
-		result = wait_for_reply(icmp_sock, final_wait);
+		result = wait_for_reply(final_wait);
 	}
 }
 
-/* response structure:
- * ip header   : 20 bytes
- * icmp header : 28 bytes
- * icmp echo reply : the rest
- */
 static int
-wait_for_reply(int sock, u_int t)
+wait_for_reply(u_int t)
 {
-	int n, hlen;
-	static unsigned char buf[4096];
-	struct sockaddr_in resp_addr;
-	struct ip *ip;
-	struct icmp icp;
-	struct rta_host *host;
-	struct icmp_ping_data data;
-	struct timeval wait_start, now;
-	u_int tdiff, i, per_pkt_wait;
+	int n, i;
+	struct timeval wait_start;
+	u_int per_pkt_wait, timo;
 
 	/* if we can't listen or don't have anything to listen to, just return */
-	if(!t || !icmp_pkts_en_route) return 0;
+	if(!icmp_pkts_en_route) return 0;
+
+#ifdef USE_MMSG
+	/* not allowed to wait, but reap whatever is already queued so the
+	 * socket buffer doesn't overflow while we're sending bursts */
+	if(!t) {
+		do {
+			timo = 0;
+			n = recv_replies(&timo);
+			for(i = 0; i < n; i++) dispatch_reply(i);
+		} while(n == MMSG_BATCH && icmp_pkts_en_route);
+		return n < 0 ? n : 0;
+	}
+#else
+	if(!t) return 0;
+#endif
 
 	gettimeofday(&wait_start, &tz);
 
-	i = t;
 	per_pkt_wait = t / icmp_pkts_en_route;
-	while(icmp_pkts_en_route && get_timevaldiff(&wait_start, NULL) < i) {
-		t = per_pkt_wait;
+	while(icmp_pkts_en_route && get_timevaldiff(&wait_start, NULL) < t) {
+		timo = per_pkt_wait;
 
 		/* wrap up if all targets are declared dead */
-		if(!targets_alive ||
+		if(!prober && (!targets_alive ||
 		   get_timevaldiff(&prog_start, NULL) >= max_completion_time ||
-		   (mode == MODE_HOSTCHECK && targets_down))
+		   (mode == MODE_HOSTCHECK && targets_down)))
 		{
 			finish(0);
 		}
 
 		/* reap responses until we hit a timeout */
-		n = recvfrom_wto(sock, buf, sizeof(buf),
-						 (struct sockaddr *)&resp_addr, &t);
+		n = recv_replies(&timo);
 		if(!n) {
 			if(debug > 1) {
-				printf("recvfrom_wto() timed out during a %u usecs wait\n",
+				printf("recv_replies() timed out during a %u usecs wait\n",
 					   per_pkt_wait);
 			}
 			continue;	/* timeout for this one, so keep trying */
 		}
 		if(n < 0) {
-			if(debug) printf("recvfrom_wto() returned errors\n");
+			if(debug) printf("recv_replies() returned errors\n");
 			return n;
 		}
 
-		ip = (struct ip *)buf;
-		if(debug > 1) printf("received %u bytes from %s\n",
-						 ntohs(ip->ip_len), inet_ntoa(resp_addr.sin_addr));
+		for(i = 0; i < n; i++) dispatch_reply(i);
+	}
+
+	return 0;
+}
+
+/* hand packet i of recv_buf to the handler for the socket it came in on */
+static void
+dispatch_reply(unsigned int i)
+{
+	struct rta_host *host;
+
+	switch(recv_proto[i]) {
+	case HAVE_TCP:
+		handle_tcp_reply(recv_buf[i], recv_len[i], &recv_addr[i], &recv_stamp[i]);
+		break;
+	case HAVE_UDP:
+		/* a service actually answered our udp probe */
+		if(ntohs(recv_addr[i].sin_port) != probe_port ||
+		   !(host = find_target(recv_addr[i].sin_addr.s_addr)))
+		{
+			if(debug) printf("UDP packet from %s is no response to a packet we sent\n",
+							 inet_ntoa(recv_addr[i].sin_addr));
+			break;
+		}
+		handle_udp_reply(host, NULL, 0, &recv_addr[i], &recv_stamp[i], 0);
+		break;
+	default:
+		handle_reply(recv_buf[i], recv_len[i], &recv_addr[i], &recv_stamp[i]);
+		break;
+	}
+}
+
+/* response structure:
+ * ip header   : 20 bytes
+ * icmp header : 28 bytes
+ * icmp echo reply : the rest
+ */
+static void
+handle_reply(unsigned char *buf, int n, struct sockaddr_in *resp_addr,
+			 struct timespec *stamp)
+{
+	int hlen;
+	struct ip *ip;
+	struct icmp icp;
+	struct rta_host *host;
+	struct icmp_ping_data data;
+	struct timespec now;
+
+	ip = (struct ip *)buf;
+	if(debug > 1) printf("received %u bytes from %s\n",
+						 ntohs(ip->ip_len), inet_ntoa(resp_addr->sin_addr));
 
 /* obsolete. alpha on tru64 provides the necessary defines, but isn't broken */
 /* #if defined( __alpha__ ) && __STDC__ && !defined( __GLIBC__ ) */
-		/* alpha headers are decidedly broken. Using an ansi compiler,
-		 * they provide ip_vhl instead of ip_hl and ip_v, so we mask
-		 * off the bottom 4 bits */
+	/* alpha headers are decidedly broken. Using an ansi compiler,
+	 * they provide ip_vhl instead of ip_hl and ip_v, so we mask
+	 * off the bottom 4 bits */
 /* 		hlen = (ip->ip_vhl & 0x0f) << 2; */
 /* #else */
-		hlen = ip->ip_hl << 2;
+	hlen = ip->ip_hl << 2;
 /* #endif */
 
-		if(n < (hlen + ICMP_MINLEN)) {
-			crash("received packet too short for ICMP (%d bytes, expected %d) from %s\n",
-				  n, hlen + icmp_pkt_size, inet_ntoa(resp_addr.sin_addr));
-		}
-		/* else if(debug) { */
-		/* 	printf("ip header size: %u, packet size: %u (expected %u, %u)\n", */
-		/* 		   hlen, ntohs(ip->ip_len) - hlen, */
-		/* 		   sizeof(struct ip), icmp_pkt_size); */
-		/* } */
-
-		/* check the response */
-		memcpy(&icp, buf + hlen, sizeof(icp));
-
-		if(ntohs(icp.icmp_id) != pid || icp.icmp_type != ICMP_ECHOREPLY ||
-		   ntohs(icp.icmp_seq) >= targets*packets) {
-			if(debug > 2) printf("not a proper ICMP_ECHOREPLY\n");
-			handle_random_icmp(buf + hlen, &resp_addr);
-			continue;
-		}
+	if(n < (hlen + ICMP_MINLEN)) {
+		crash("received packet too short for ICMP (%d bytes, expected %d) from %s\n",
+			  n, hlen + icmp_pkt_size, inet_ntoa(resp_addr->sin_addr));
+	}
+	/* else if(debug) { */
+	/* 	printf("ip header size: %u, packet size: %u (expected %u, %u)\n", */
+	/* 		   hlen, ntohs(ip->ip_len) - hlen, */
+	/* 		   sizeof(struct ip), icmp_pkt_size); */
+	/* } */
+
+	/* check the response */
+	memcpy(&icp, buf + hlen, sizeof(icp));
+
+	if(ntohs(icp.icmp_id) != pid || icp.icmp_type != ICMP_ECHOREPLY) {
+		if(debug > 2) printf("not a proper ICMP_ECHOREPLY\n");
+		handle_random_icmp(buf + hlen, n - hlen, resp_addr, stamp, ip->ip_ttl);
+		return;
+	}
 
-		/* this is indeed a valid response */
-		memcpy(&data, icp.icmp_data, sizeof(data));
-		if (debug > 2)
-			printf("ICMP echo-reply of len %u, id %u, seq %u, cksum 0x%X\n",
-			       sizeof(data), ntohs(icp.icmp_id), ntohs(icp.icmp_seq), icp.icmp_cksum);
+	/* the payload tells us which target this is, so make sure it
+	 * survived the trip and is consistent with the header */
+	if(n < hlen + ICMP_MINLEN + (int)sizeof(data)) {
+		if(debug) printf("ICMP echo-reply from %s too short for our payload\n",
+						 inet_ntoa(resp_addr->sin_addr));
+		return;
+	}
+	memcpy(&data, buf + hlen + ICMP_MINLEN, sizeof(data));
+	if(data.target_id >= targets || data.seq >= icmp_sent ||
+	   (data.seq & 0xffff) != ntohs(icp.icmp_seq))
+	{
+		if(debug) printf("ICMP echo-reply from %s has invalid payload (target %u, seq %u)\n",
+						 inet_ntoa(resp_addr->sin_addr), data.target_id, data.seq);
+		return;
+	}
 
-		host = table[ntohs(icp.icmp_seq)/packets];
-		gettimeofday(&now, &tz);
-		tdiff = get_timevaldiff(&data.stime, &now);
+	/* this is indeed a valid response */
+	if (debug > 2)
+		printf("ICMP echo-reply of len %u, id %u, seq %u, cksum 0x%X\n",
+		       sizeof(data), ntohs(icp.icmp_id), ntohs(icp.icmp_seq), icp.icmp_cksum);
 
-		host->time_waited += tdiff;
-		host->icmp_recv++;
-		icmp_recv++;
-		if (tdiff > host->rtmax)
-			host->rtmax = tdiff;
-		if (tdiff < host->rtmin)
-			host->rtmin = tdiff;
+	host = table[data.target_id];
 
-		if(debug) {
-			printf("%0.3f ms rtt from %s, outgoing ttl: %u, incoming ttl: %u, max: %0.3f, min: %0.3f\n",
-				   (float)tdiff / 1000, inet_ntoa(resp_addr.sin_addr),
-				   ttl, ip->ip_ttl, (float)host->rtmax / 1000, (float)host->rtmin / 1000);
+	/* the prober only wants the answer to the probe it's waiting for. A
+	 * late one to an earlier probe has been counted as lost already */
+	if(prober && (!host->pending || data.seq != host->last_seq)) {
+		if(debug > 1) printf("Late reply to probe %u from %s\n", data.seq, host->name);
+		return;
+	}
+
+	get_mono_time(&now);
+	record_reply(host, get_timespecdiff(&data.stime, &now), resp_addr, stamp,
+				 ip->ip_ttl);
+}
+
+/* tcp replies come in with their ip header, same as icmp */
+static void
+handle_tcp_reply(unsigned char *buf, int n, struct sockaddr_in *resp_addr,
+				 struct timespec *stamp)
+{
+	int hlen;
+	struct ip *ip;
+	struct tcphdr tcp;
+	struct rta_host *host;
+	u_int32_t cookie;
+
+	ip = (struct ip *)buf;
+	hlen = ip->ip_hl << 2;
+	if(n < hlen + (int)sizeof(tcp)) {
+		if(debug) printf("TCP packet from %s too short\n",
+						 inet_ntoa(resp_addr->sin_addr));
+		return;
+	}
+	memcpy(&tcp, buf + hlen, sizeof(tcp));
+
+	/* the raw socket sees all tcp traffic, so most of it isn't ours.
+	 * Both a SYN-ACK (open port) and a RST (closed port) prove the
+	 * target is up, but they have to acknowledge our SYN */
+	if(ntohs(tcp.th_dport) != probe_sport || ntohs(tcp.th_sport) != probe_port ||
+	   !(tcp.th_flags & TH_ACK) || !(tcp.th_flags & (TH_SYN | TH_RST)))
+	{
+		return;
+	}
+	if(!(host = find_target(ip->ip_src.s_addr))) {
+		if(debug) printf("TCP packet from %s is no response to a packet we sent\n",
+						 inet_ntoa(resp_addr->sin_addr));
+		return;
+	}
+
+	cookie = ntohl(tcp.th_ack) - 1;
+	if(debug > 2) printf("TCP %s from %s, probe %u\n",
+						 (tcp.th_flags & TH_RST) ? "RST" : "SYN-ACK",
+						 host->name, cookie >> TCP_STAMP_BITS);
+	if(!first_reply(host, cookie >> TCP_STAMP_BITS)) return;
+
+	record_reply(host, (get_tcp_stamp() - cookie) & TCP_STAMP_MASK,
+				 resp_addr, stamp, ip->ip_ttl);
+}
+
+/* a udp probe is answered either by the service or by the target's port
+ * unreachable, which usually quotes our payload. If it doesn't, or it's
+ * the service that answered, we can only assume it's the last probe */
+static void
+handle_udp_reply(struct rta_host *host, unsigned char *quoted, int len,
+				 struct sockaddr_in *resp_addr, struct timespec *stamp,
+				 unsigned char in_ttl)
+{
+	struct icmp_ping_data data;
+	struct timespec now;
+	unsigned int pkt;
+
+	get_mono_time(&now);
+	if(quoted && len >= (int)sizeof(data)) {
+		memcpy(&data, quoted, sizeof(data));
+		if(data.target_id != host->id) {
+			if(debug) printf("Port unreachable from %s has invalid payload (target %u)\n",
+							 inet_ntoa(resp_addr->sin_addr), data.target_id);
+			return;
 		}
+		pkt = data.seq;
+	}
+	else {
+		pkt = host->icmp_sent - 1;
+		data.stime = host->last_send;
+	}
+	if(!first_reply(host, pkt)) return;
+
+	record_reply(host, get_timespecdiff(&data.stime, &now), resp_addr, stamp,
+				 in_ttl);
+}
+
+/* tcp and udp probes can be answered more than once (retransmitted
+ * SYN-ACKs, a reply and a port unreachable), so only the first reply
+ * to each probe counts */
+static int
+first_reply(struct rta_host *host, unsigned int pkt)
+{
+	if(pkt >= host->icmp_sent || (host->recv_mask & (1U << pkt))) {
+		if(debug > 1) printf("Duplicate or bogus reply to probe %u from %s\n",
+							 pkt, host->name);
+		return 0;
+	}
+	host->recv_mask |= 1U << pkt;
+	return 1;
+}
 
-		/* if we're in hostcheck mode, exit with limited printouts */
-		if(mode == MODE_HOSTCHECK) {
-			printf("OK - %s responds to ICMP. Packet %u, rta %0.3fms|"
-				   "pkt=%u;;0;%u rta=%0.3f;%0.3f;%0.3f;;\n",
-				   host->name, icmp_recv, (float)tdiff / 1000,
-				   icmp_recv, packets, (float)tdiff / 1000,
-				   (float)warn.rta / 1000, (float)crit.rta / 1000);
-			exit(STATE_OK);
+/* account a reply from host that took tdiff usecs */
+static void
+record_reply(struct rta_host *host, u_int tdiff, struct sockaddr_in *resp_addr,
+			 struct timespec *stamp, unsigned char in_ttl)
+{
+	struct timespec now;
+	struct timeval now_tv;
+	u_int delay = 0;
+
+	/* the kernel stamp is wall clock time, so only use it to find out how
+	 * long the reply waited for us in userspace and subtract that */
+	if(stamp->tv_sec) {
+		gettimeofday(&now_tv, &tz);
+		now.tv_sec = now_tv.tv_sec;
+		now.tv_nsec = now_tv.tv_usec * 1000;
+		delay = get_timespecdiff(stamp, &now);
+		if(delay < tdiff) {
+			tdiff -= delay;
+			stamped_replies++;
+			stamp_delay_removed += delay;
 		}
+		else delay = 0;
 	}
 
-	return 0;
+	host->icmp_recv++;
+	icmp_recv++;
+	if(prober) {
+		host->pending = 0;
+		add_shm_sample(host, tdiff);
+		if(debug > 1) printf("%0.3f ms rtt from %s\n", (float)tdiff / 1000, host->name);
+		return;
+	}
+	host->time_waited += tdiff;
+	update_rtt_stats(&host->stats, tdiff);
+	update_rto(host, tdiff);
+	if (tdiff > host->rtmax)
+		host->rtmax = tdiff;
+	if (tdiff < host->rtmin)
+		host->rtmin = tdiff;
+
+	if(debug) {
+		printf("%0.3f ms rtt from %s, outgoing ttl: %u, incoming ttl: %u, max: %0.3f, min: %0.3f\n",
+			   (float)tdiff / 1000, inet_ntoa(resp_addr->sin_addr),
+			   ttl, in_ttl, (float)host->rtmax / 1000, (float)host->rtmin / 1000);
+		if(debug > 1 && delay)
+			printf("%0.3f ms userspace delay removed from rtt\n", (float)delay / 1000);
+	}
+
+	/* if we're in hostcheck mode, exit with limited printouts */
+	if(mode == MODE_HOSTCHECK) {
+		printf("OK - %s responds to %s. Packet %u, rta %0.3fms|"
+			   "pkt=%u;;0;%u rta=%0.3f;%0.3f;%0.3f;;\n",
+			   host->name, get_probe_name(), icmp_recv, (float)tdiff / 1000,
+			   icmp_recv, packets, (float)tdiff / 1000,
+			   (float)warn.rta / 1000, (float)crit.rta / 1000);
+		exit(STATE_OK);
+	}
 }
 
 /* the ping functions */
-static int
-send_icmp_ping(int sock, struct rta_host *host)
+static void
+build_icmp_ping(void *buf, struct rta_host *host, unsigned int seq)
 {
-	static union {
-		void *buf; /* re-use so we prevent leaks */
+	union {
+		void *buf;
 		struct icmp *icp;
 		u_short *cksum_in;
-	} packet = { NULL };
-	long int len;
+	} packet;
 	struct icmp_ping_data data;
-	struct timeval tv;
-	struct sockaddr *addr;
-
-	if(sock == -1) {
-		errno = 0;
-		crash("Attempt to send on bogus socket");
-		return -1;
-	}
-	addr = (struct sockaddr *)&host->saddr_in;
 
-	if(!packet.buf) {
-		if (!(packet.buf = malloc(icmp_pkt_size))) {
-			crash("send_icmp_ping(): failed to malloc %d bytes for send buffer",
-				  icmp_pkt_size);
-			return -1;	/* might be reached if we're in debug mode */
-		}
-	}
+	packet.buf = buf;
 	memset(packet.buf, 0, icmp_pkt_size);
 
-	if((gettimeofday(&tv, &tz)) == -1) return -1;
-
-	data.ping_id = 10; /* host->icmp.icmp_sent; */
-	memcpy(&data.stime, &tv, sizeof(tv));
+	data.target_id = host->id;
+	data.seq = seq;
+	get_mono_time(&data.stime);
 	memcpy(&packet.icp->icmp_data, &data, sizeof(data));
 	packet.icp->icmp_type = ICMP_ECHO;
 	packet.icp->icmp_code = 0;
 	packet.icp->icmp_cksum = 0;
 	packet.icp->icmp_id = htons(pid);
-	packet.icp->icmp_seq = htons(host->id++);
+	packet.icp->icmp_seq = htons(seq & 0xffff);
 	packet.icp->icmp_cksum = icmp_checksum(packet.cksum_in, icmp_pkt_size);
 
 	if (debug > 2)
 		printf("Sending ICMP echo-request of len %u, id %u, seq %u, cksum 0x%X to host %s\n",
 		       sizeof(data), ntohs(packet.icp->icmp_id), ntohs(packet.icp->icmp_seq), packet.icp->icmp_cksum, host->name);
+}
 
-	len = sendto(sock, packet.buf, icmp_pkt_size, 0, (struct sockaddr *)addr,
-				 sizeof(struct sockaddr));
+static u_int32_t
+get_tcp_stamp(void)
+{
+	struct timespec now;
 
-	if(len < 0 || (unsigned int)len != icmp_pkt_size) {
-		if(debug) printf("Failed to send ping to %s\n",
-						 inet_ntoa(host->saddr_in.sin_addr));
-		return -1;
-	}
+	get_mono_time(&now);
+	return (u_int32_t)((unsigned long long)now.tv_sec * 1000000 +
+					   now.tv_nsec / 1000) & TCP_STAMP_MASK;
+}
 
-	icmp_sent++;
-	host->icmp_sent++;
+/* a bare SYN. The kernel adds the ip header, but the checksum covers
+ * our address as well, so that has to be known by now */
+static void
+build_tcp_syn(void *buf, struct rta_host *host)
+{
+	struct {
+		struct in_addr src, dst;
+		u_int8_t zero, proto;
+		u_int16_t len;
+		struct tcphdr tcp;
+	} pseudo;
+	unsigned short words[sizeof(pseudo) / 2];
+
+	memset(&pseudo, 0, sizeof(pseudo));
+	pseudo.src = host->src_addr;
+	pseudo.dst = host->saddr_in.sin_addr;
+	pseudo.proto = IPPROTO_TCP;
+	pseudo.len = htons(sizeof(struct tcphdr));
+	pseudo.tcp.th_sport = htons(probe_sport);
+	pseudo.tcp.th_dport = htons(probe_port);
+	pseudo.tcp.th_seq = htonl(((u_int32_t)host->icmp_sent << TCP_STAMP_BITS) |
+							  get_tcp_stamp());
+	pseudo.tcp.th_off = sizeof(struct tcphdr) >> 2;
+	pseudo.tcp.th_flags = TH_SYN;
+	pseudo.tcp.th_win = htons(1024);
+	/* copy it, so the compiler can't sum it before it's filled in */
+	memcpy(words, &pseudo, sizeof(pseudo));
+	pseudo.tcp.th_sum = icmp_checksum(words, sizeof(pseudo));
+	memcpy(buf, &pseudo.tcp, sizeof(struct tcphdr));
 
-	return 0;
+	if (debug > 2)
+		printf("Sending TCP SYN, probe %u, to host %s port %u\n",
+			   host->icmp_sent, host->name, probe_port);
 }
 
-static int
-recvfrom_wto(int sock, void *buf, unsigned int len, struct sockaddr *saddr,
-			 u_int *timo)
+static void
+build_udp_probe(void *buf, struct rta_host *host)
 {
-	u_int slen;
-	int n;
-	struct timeval to, then, now;
+	struct icmp_ping_data data;
+
+	memset(buf, 0, icmp_data_size);
+	data.target_id = host->id;
+	data.seq = host->icmp_sent;
+	data.stime = host->last_send;
+	memcpy(buf, &data, sizeof(data));
+
+	if (debug > 2)
+		printf("Sending UDP probe %u of len %u to host %s port %u\n",
+			   data.seq, icmp_data_size, host->name, probe_port);
+}
+
+/* build the probe for host in buf and return its length. dst is where it
+ * goes. seq is what icmp_sent will be when it's sent */
+static int
+build_probe(void *buf, struct rta_host *host, unsigned int seq,
+			struct sockaddr_in *dst)
+{
+	memcpy(dst, &host->saddr_in, sizeof(*dst));
+	get_mono_time(&host->last_send);
+
+	switch(probe_proto) {
+	case HAVE_TCP:
+		build_tcp_syn(buf, host);
+		return sizeof(struct tcphdr);
+	case HAVE_UDP:
+		dst->sin_port = htons(probe_port);
+		build_udp_probe(buf, host);
+		return icmp_data_size;
+	}
+
+	build_icmp_ping(buf, host, seq);
+	return icmp_pkt_size;
+}
+
+static int
+send_probe(int sock, struct rta_host *host)
+{
+	static void *buf = NULL; /* re-use so we prevent leaks */
+	long int len;
+	int size;
+	struct sockaddr_in addr;
+
+	if(sock == -1) {
+		errno = 0;
+		crash("Attempt to send on bogus socket");
+		return -1;
+	}
+
+	if(!buf) {
+		if (!(buf = malloc(icmp_pkt_size))) {
+			crash("send_probe(): failed to malloc %d bytes for send buffer",
+				  icmp_pkt_size);
+			return -1;	/* might be reached if we're in debug mode */
+		}
+	}
+	size = build_probe(buf, host, icmp_sent, &addr);
+
+	send_calls++;
+	len = sendto(sock, buf, size, 0, (struct sockaddr *)&addr,
+				 sizeof(addr));
+
+	if(len < 0 || len != size) {
+		if(debug) printf("Failed to send ping to %s\n",
+						 inet_ntoa(host->saddr_in.sin_addr));
+		return -1;
+	}
+
+	host->last_seq = icmp_sent;
+	icmp_sent++;
+	host->icmp_sent++;
+
+	return 0;
+}
+
+/* send one packet to each of the n hosts, returning the number sent */
+static int
+send_probe_burst(int sock, struct rta_host **hosts, unsigned int n)
+{
+#ifdef USE_MMSG
+	static unsigned char *bufs = NULL;
+	struct mmsghdr msgs[MMSG_BATCH];
+	struct iovec iov[MMSG_BATCH];
+	struct sockaddr_in dst[MMSG_BATCH];
+	unsigned int i, done = 0;
+	int ret;
+
+	if(n == 1) return send_probe(sock, hosts[0]) ? 0 : 1;
+
+	if(sock == -1) {
+		errno = 0;
+		crash("Attempt to send on bogus socket");
+	}
+	if(!bufs && !(bufs = malloc(icmp_pkt_size * MMSG_BATCH))) {
+		crash("send_probe_burst(): failed to malloc %d bytes for send buffers",
+			  icmp_pkt_size * MMSG_BATCH);
+	}
+
+	memset(msgs, 0, sizeof(msgs));
+	for(i = 0; i < n; i++) {
+		iov[i].iov_base = bufs + i * icmp_pkt_size;
+		iov[i].iov_len = build_probe(iov[i].iov_base, hosts[i], icmp_sent + i, &dst[i]);
+		msgs[i].msg_hdr.msg_name = &dst[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	/* sendmmsg() stops at the first failing message, so skip past it
+	 * (it's a lost packet, same as when sendto() fails) and go on */
+	while(done < n) {
+		send_calls++;
+		ret = sendmmsg(sock, msgs + done, n - done, 0);
+		if(ret < 0) {
+			if(debug) printf("Failed to send ping to %s\n",
+							 inet_ntoa(hosts[done]->saddr_in.sin_addr));
+			/* the payload of the remaining pings has the wrong seq now.
+			 * tcp and udp probes are numbered per target, so they're fine */
+			for(i = done + 1; i < n && probe_proto == HAVE_ICMP; i++) {
+				build_icmp_ping(bufs + i * icmp_pkt_size, hosts[i], icmp_sent + i - done - 1);
+			}
+			done++;
+			continue;
+		}
+		for(i = done; i < done + (unsigned int)ret; i++) {
+			hosts[i]->last_seq = icmp_sent;
+			icmp_sent++;
+			hosts[i]->icmp_sent++;
+		}
+		done += ret;
+	}
+
+	return n;
+#else
+	unsigned int i, sent = 0;
+
+	for(i = 0; i < n; i++) {
+		if(!send_probe(sock, hosts[i])) sent++;
+	}
+
+	return sent;
+#endif
+}
+
+/* wait at most *timo usecs for replies on any of recv_socks and read as
+ * many as are queued, up to MMSG_BATCH. Returns the number of packets read
+ * into recv_buf. With recvmmsg(), a zero *timo only reaps what is already
+ * queued */
+static int
+recv_replies(u_int *timo)
+{
+#ifdef USE_MMSG
+	static char ctrl[MMSG_BATCH][RECV_CTRL_SIZE];
+	struct mmsghdr msgs[MMSG_BATCH];
+	struct iovec iov[MMSG_BATCH];
+	struct pollfd pfd[2];
+	struct timespec to;
+	struct timeval then;
+	int n, i, s, total = 0;
+
+	for(s = 0; s < num_recv_socks; s++) {
+		pfd[s].fd = recv_socks[s].fd;
+		pfd[s].events = POLLIN;
+		pfd[s].revents = POLLIN;	/* try them all when not waiting */
+	}
+
+	if(*timo) {
+		to.tv_sec = *timo / 1000000;
+		to.tv_nsec = (*timo - (to.tv_sec * 1000000)) * 1000;
+		for(s = 0; s < num_recv_socks; s++) pfd[s].revents = 0;
+
+		errno = 0;
+		gettimeofday(&then, &tz);
+		n = ppoll(pfd, num_recv_socks, &to, NULL);
+		if(n < 0) crash("ppoll() in recv_replies");
+		*timo = get_timevaldiff(&then, NULL);
+
+		if(!n) return 0;				/* timeout */
+	}
+
+	memset(msgs, 0, sizeof(msgs));
+	for(i = 0; i < MMSG_BATCH; i++) {
+		iov[i].iov_base = recv_buf[i];
+		iov[i].iov_len = RECV_BUF_SIZE;
+		msgs[i].msg_hdr.msg_name = &recv_addr[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_control = ctrl[i];
+		msgs[i].msg_hdr.msg_controllen = RECV_CTRL_SIZE;
+	}
+
+	for(s = 0; s < num_recv_socks && total < MMSG_BATCH; s++) {
+		if(!(pfd[s].revents & POLLIN)) continue;
+
+		recv_calls++;
+		n = recvmmsg(pfd[s].fd, msgs + total, MMSG_BATCH - total, MSG_DONTWAIT, NULL);
+		if(n < 0) {
+			/* spurious wakeup, treat it like a timeout */
+			if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) continue;
+			return n;
+		}
+		for(i = total; i < total + n; i++) {
+			recv_len[i] = msgs[i].msg_len;
+			recv_proto[i] = recv_socks[s].proto;
+			get_recv_stamp(&msgs[i].msg_hdr, &recv_stamp[i]);
+		}
+		total += n;
+	}
+
+	return total;
+#else
+	int n;
+
+	recv_calls++;
+	n = recvfrom_wto(recv_buf[0], RECV_BUF_SIZE, (struct sockaddr *)&recv_addr[0],
+					 timo, &recv_stamp[0], &recv_proto[0]);
+	if(n > 0) {
+		recv_len[0] = n;
+		return 1;
+	}
+
+	return n;
+#endif
+}
+
+#ifndef USE_MMSG
+/* read one packet from whichever of recv_socks has one first, storing
+ * the HAVE_* protocol of the socket in *proto */
+static int
+recvfrom_wto(void *buf, unsigned int len, struct sockaddr *saddr,
+			 u_int *timo, struct timespec *stamp, int *proto)
+{
+	int n, s, sock = -1, maxfd = 0;
+	struct timeval to, then, now;
 	fd_set rd, wr;
+	struct msghdr hdr;
+	struct iovec iov;
+	char ctrl[RECV_CTRL_SIZE];
 
 	if(!*timo) {
 		if(debug) printf("*timo is not\n");
@@ -888,19 +1815,72 @@ recvfrom_wto(int sock, void *buf, unsigned int len, struct sockaddr *saddr,
 
 	FD_ZERO(&rd);
 	FD_ZERO(&wr);
-	FD_SET(sock, &rd);
+	for(s = 0; s < num_recv_socks; s++) {
+		FD_SET(recv_socks[s].fd, &rd);
+		if(recv_socks[s].fd > maxfd) maxfd = recv_socks[s].fd;
+	}
 	errno = 0;
 	gettimeofday(&then, &tz);
-	n = select(sock + 1, &rd, &wr, NULL, &to);
+	n = select(maxfd + 1, &rd, &wr, NULL, &to);
 	if(n < 0) crash("select() in recvfrom_wto");
 	gettimeofday(&now, &tz);
 	*timo = get_timevaldiff(&then, &now);
 
 	if(!n) return 0;				/* timeout */
 
-	slen = sizeof(struct sockaddr);
+	for(s = 0; s < num_recv_socks; s++) {
+		if(FD_ISSET(recv_socks[s].fd, &rd)) {
+			sock = recv_socks[s].fd;
+			*proto = recv_socks[s].proto;
+			break;
+		}
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	iov.iov_base = buf;
+	iov.iov_len = len;
+	hdr.msg_name = saddr;
+	hdr.msg_namelen = sizeof(struct sockaddr);
+	hdr.msg_iov = &iov;
+	hdr.msg_iovlen = 1;
+	hdr.msg_control = ctrl;
+	hdr.msg_controllen = sizeof(ctrl);
+
+	n = recvmsg(sock, &hdr, 0);
+	if(n > 0) get_recv_stamp(&hdr, stamp);
+
+	return n;
+}
+#endif
+
+/* pick the kernel receive timestamp out of the ancillary data, if any.
+ * stamp is zeroed if there isn't one */
+static void
+get_recv_stamp(struct msghdr *hdr, struct timespec *stamp)
+{
+	struct cmsghdr *cmsg;
+	struct timeval tv;
+
+	stamp->tv_sec = stamp->tv_nsec = 0;
+	if(hdr->msg_flags & MSG_CTRUNC) return;
 
-	return recvfrom(sock, buf, len, 0, saddr, &slen);
+	for(cmsg = CMSG_FIRSTHDR(hdr); cmsg; cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+		if(cmsg->cmsg_level != SOL_SOCKET) continue;
+#ifdef SCM_TIMESTAMPNS
+		if(cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+			memcpy(stamp, CMSG_DATA(cmsg), sizeof(*stamp));
+			return;
+		}
+#endif
+#ifdef SCM_TIMESTAMP
+		if(cmsg->cmsg_type == SCM_TIMESTAMP) {
+			memcpy(&tv, CMSG_DATA(cmsg), sizeof(tv));
+			stamp->tv_sec = tv.tv_sec;
+			stamp->tv_nsec = tv.tv_usec * 1000;
+			return;
+		}
+#endif
+	}
 }
 
 static void
@@ -921,11 +1901,24 @@ finish(int sig)
 	if(icmp_sock != -1) close(icmp_sock);
 	if(udp_sock != -1) close(udp_sock);
 	if(tcp_sock != -1) close(tcp_sock);
+	if(port_sock != -1) close(port_sock);
 
 	if(debug) {
+		double elapsed = (double)get_timevaldiff(NULL, NULL) / 1000000;
+
 		printf("icmp_sent: %u  icmp_recv: %u  icmp_lost: %u\n",
 			   icmp_sent, icmp_recv, icmp_lost);
 		printf("targets: %u  targets_alive: %u\n", targets, targets_alive);
+		if(elapsed > 0) {
+			printf("%0.3f secs: %0.0f pps sent (%u send calls), %0.0f pps received (%u receive calls)\n",
+				   elapsed, icmp_sent / elapsed, send_calls,
+				   icmp_recv / elapsed, recv_calls);
+		}
+		if(stamped_replies) {
+			printf("kernel timestamps removed %0.3f ms userspace delay from %u replies (avg %0.3f ms)\n",
+				   (float)stamp_delay_removed / 1000, stamped_replies,
+				   (float)stamp_delay_removed / stamped_replies / 1000);
+		}
 	}
 
 	/* iterate thrice to calculate values, give output, and print perfparse */
@@ -946,10 +1939,17 @@ finish(int sig)
 		}
 		host->pl = pl;
 		host->rta = rta;
-		if(pl >= crit.pl || rta >= crit.rta) {
+		host->mos = get_mos(rta, host->stats.jitter, pl);
+		if(pl >= crit.pl || rta >= crit.rta ||
+		   (crit.jitter && host->stats.jitter >= crit.jitter) ||
+		   (crit.mos && host->mos < crit.mos))
+		{
 			status = STATE_CRITICAL;
 		}
-		else if(!status && (pl >= warn.pl || rta >= warn.rta)) {
+		else if(!status && (pl >= warn.pl || rta >= warn.rta ||
+							(warn.jitter && host->stats.jitter >= warn.jitter) ||
+							(warn.mos && host->mos < warn.mos)))
+		{
 			status = STATE_WARNING;
 			hosts_warn++;
 		}
@@ -959,6 +1959,8 @@ finish(int sig)
 
 		host = host->next;
 	}
+	if(adaptive) write_rtt_state();
+
 	/* this is inevitable */
 	if(!targets_alive) status = STATE_CRITICAL;
 	if(min_hosts_alive > -1) {
@@ -977,7 +1979,10 @@ finish(int sig)
 		i++;
 		if(!host->icmp_recv) {
 			status = STATE_CRITICAL;
-			if(host->flags & FLAG_LOST_CAUSE) {
+			if(host->msg) {
+				printf("%s: %s. rta nan, lost 100%%", host->name, host->msg);
+			}
+			else if(host->flags & FLAG_LOST_CAUSE) {
 				printf("%s: %s @ %s. rta nan, lost %d%%",
 					   host->name,
 					   get_icmp_error_msg(host->icmp_type, host->icmp_code),
@@ -991,6 +1996,10 @@ finish(int sig)
 		else {	/* !icmp_recv */
 			printf("%s: rta %0.3fms, lost %u%%",
 				   host->name, host->rta / 1000, host->pl);
+			if(warn.jitter || crit.jitter)
+				printf(", jitter %0.3fms", host->stats.jitter / 1000);
+			if(warn.mos || crit.mos)
+				printf(", mos %0.2f", host->mos);
 		}
 
 		host = host->next;
@@ -1009,6 +2018,22 @@ finish(int sig)
 			   (targets > 1) ? host->name : "", (float)host->rtmax / 1000,
 			   (targets > 1) ? host->name : "", (host->rtmin < DBL_MAX) ? (float)host->rtmin / 1000 : (float)0);
 
+		/* the thresholds of these are optional */
+		printf("%sjitter=%0.3fms;", (targets > 1) ? host->name : "",
+			   host->stats.jitter / 1000);
+		if(warn.jitter) printf("%0.3f", (float)warn.jitter / 1000);
+		printf(";");
+		if(crit.jitter) printf("%0.3f", (float)crit.jitter / 1000);
+		printf(";0; %sstddev=%0.3fms;;;0; %srtp50=%0.3fms;;;0; %srtp95=%0.3fms;;;0; ",
+			   (targets > 1) ? host->name : "", get_rtt_stddev(&host->stats) / 1000,
+			   (targets > 1) ? host->name : "", get_rtt_percentile(host, 50) / 1000,
+			   (targets > 1) ? host->name : "", get_rtt_percentile(host, 95) / 1000);
+		printf("%smos=%0.2f;", (targets > 1) ? host->name : "", host->mos);
+		if(warn.mos) printf("%0.2f:", warn.mos);
+		printf(";");
+		if(crit.mos) printf("%0.2f:", crit.mos);
+		printf(";1;5 ");
+
 		host = host->next;
 	}
 
@@ -1050,6 +2075,39 @@ get_timevaldiff(struct timeval *early, struct timeval *later)
 	return ret;
 }
 
+/* like get_timevaldiff(), but early and later must both be given */
+static u_int
+get_timespecdiff(struct timespec *early, struct timespec *later)
+{
+	u_int ret;
+
+	if(early->tv_sec > later->tv_sec ||
+	   (early->tv_sec == later->tv_sec && early->tv_nsec > later->tv_nsec))
+	{
+		return 0;
+	}
+
+	ret = (later->tv_sec - early->tv_sec) * 1000000;
+	ret += (later->tv_nsec - early->tv_nsec) / 1000;
+
+	return ret;
+}
+
+/* send times are taken from the monotonic clock so rtt isn't skewed by
+ * wall clock adjustments, falling back to gettimeofday() */
+static void
+get_mono_time(struct timespec *ts)
+{
+	struct timeval tv;
+
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+	if(!clock_gettime(CLOCK_MONOTONIC, ts)) return;
+#endif
+	gettimeofday(&tv, &tz);
+	ts->tv_sec = tv.tv_sec;
+	ts->tv_nsec = tv.tv_usec * 1000;
+}
+
 static int
 add_target_ip(char *arg, struct in_addr *in)
 {
@@ -1060,13 +2118,9 @@ add_target_ip(char *arg, struct in_addr *in)
 		return -1;
 
 	/* no point in adding two identical IP's, so don't. ;) */
-	host = list;
-	while(host) {
-		if(host->saddr_in.sin_addr.s_addr == in->s_addr) {
-			if(debug) printf("Identical IP already exists. Not adding %s\n", arg);
-			return -1;
-		}
-		host = host->next;
+	if(find_target(in->s_addr)) {
+		if(debug) printf("Identical IP already exists. Not adding %s\n", arg);
+		return -1;
 	}
 
 	/* add the fresh ip */
@@ -1091,49 +2145,325 @@ add_target_ip(char *arg, struct in_addr *in)
 
 	cursor = host;
 	targets++;
+	hash_target(host);
 
 	return 0;
 }
 
-/* wrapper for add_target_ip */
+/* the address hash keeps duplicate detection and mapping of icmp errors
+ * to targets O(1), so whole subnets can be checked in one go */
+static unsigned int
+target_hash(in_addr_t addr, unsigned int size)
+{
+	u_int32_t h = ntohl(addr) * 2654435761U;
+
+	return (h ^ (h >> 16)) & (size - 1);
+}
+
+static struct rta_host *
+find_target(in_addr_t addr)
+{
+	struct rta_host *host;
+
+	if(!host_hash_size) return NULL;
+
+	host = host_hash[target_hash(addr, host_hash_size)];
+	while(host) {
+		if(host->saddr_in.sin_addr.s_addr == addr) return host;
+		host = host->hash_next;
+	}
+
+	return NULL;
+}
+
+static void
+hash_target(struct rta_host *host)
+{
+	struct rta_host **new_hash, *h, *next;
+	unsigned int new_size, i, slot;
+
+	/* keep the load factor at or below 1 by doubling the bucket count */
+	if(targets > host_hash_size) {
+		new_size = host_hash_size ? host_hash_size * 2 : 64;
+		new_hash = calloc(new_size, sizeof(struct rta_host *));
+		if(!new_hash) {
+			crash("hash_target(): calloc(%u) failed", new_size);
+		}
+		for(i = 0; i < host_hash_size; i++) {
+			for(h = host_hash[i]; h; h = next) {
+				next = h->hash_next;
+				slot = target_hash(h->saddr_in.sin_addr.s_addr, new_size);
+				h->hash_next = new_hash[slot];
+				new_hash[slot] = h;
+			}
+		}
+		free(host_hash);
+		host_hash = new_hash;
+		host_hash_size = new_size;
+	}
+
+	slot = target_hash(host->saddr_in.sin_addr.s_addr, host_hash_size);
+	host->hash_next = host_hash[slot];
+	host_hash[slot] = host;
+}
+
+/* targets that couldn't be resolved are reported as down, but have no
+ * address so they're never pinged nor hashed */
+static void
+add_unresolved_target(char *arg, const char *msg)
+{
+	struct rta_host *host;
+
+	host = calloc(1, sizeof(struct rta_host));
+	if(!host) {
+		crash("add_unresolved_target(%s): malloc(%d) failed",
+			  arg, sizeof(struct rta_host));
+	}
+	host->name = strdup(arg);
+	host->msg = strdup(msg);
+	host->saddr_in.sin_family = AF_INET;
+	host->rtmin = DBL_MAX;
+	host->flags |= FLAG_LOST_CAUSE;
+
+	if(!list) list = cursor = host;
+	else cursor->next = host;
+
+	cursor = host;
+	targets++;
+	targets_down++;
+}
+
+/* record a target argument. Hostnames are resolved by resolve_targets() */
 static int
 add_target(char *arg)
 {
-	int i;
-	struct hostent *he;
-	struct in_addr *in, ip;
+	target_arg *ta;
+
+	if(num_target_args == target_args_size) {
+		target_args_size = target_args_size ? target_args_size * 2 : 16;
+		target_args = realloc(target_args, target_args_size * sizeof(target_arg));
+		if(!target_args) {
+			crash("add_target(%s): realloc(%u) failed", arg,
+				  target_args_size * sizeof(target_arg));
+		}
+	}
+	ta = &target_args[num_target_args++];
+	memset(ta, 0, sizeof(*ta));
+	ta->name = arg;
 
 	/* don't resolve if we don't have to */
-	if((ip.s_addr = inet_addr(arg)) != INADDR_NONE) {
-		/* don't add all ip's if we were given a specific one */
-		return add_target_ip(arg, &ip);
-		/* he = gethostbyaddr((char *)in, sizeof(struct in_addr), AF_INET); */
-		/* if(!he) return add_target_ip(arg, in); */
+	if((ta->addr.s_addr = inet_addr(arg)) != INADDR_NONE) {
+		ta->state = RESOLVE_LITERAL;
 	}
 	else {
-		errno = 0;
-		he = gethostbyname(arg);
-		if(!he) {
-			errno = 0;
-			crash("Failed to resolve %s", arg);
-			return -1;
+		ta->state = RESOLVE_PENDING;
+	}
+
+	return 0;
+}
+
+static void
+resolve_one(target_arg *ta, struct addrinfo **res, int *err)
+{
+	struct addrinfo hints;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_DGRAM;	/* one entry per address */
+	*res = NULL;
+	*err = getaddrinfo(ta->name, NULL, &hints, res);
+}
+
+#ifdef HAVE_LIBPTHREAD
+/* the resolver pool. A thread that is stuck on a timed out lookup is
+ * abandoned and replaced, so a slow resolver can't stall the others */
+typedef struct resolver_slot {
+	target_arg *job;	/* the lookup in progress, if any */
+	int abandoned;		/* set by the main thread on timeout */
+} resolver_slot;
+
+static pthread_mutex_t resolve_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t resolve_cond = PTHREAD_COND_INITIALIZER;
+static unsigned int resolve_next = 0, resolve_left = 0;
+
+static void *
+resolver_thread(void *arg)
+{
+	resolver_slot *slot = (resolver_slot *)arg;
+	target_arg *ta;
+	struct addrinfo *res;
+	int err;
+
+	pthread_mutex_lock(&resolve_lock);
+	while(!slot->abandoned) {
+		while(resolve_next < num_target_args &&
+			  target_args[resolve_next].state != RESOLVE_PENDING)
+		{
+			resolve_next++;
 		}
+		if(resolve_next >= num_target_args) break;
+
+		ta = slot->job = &target_args[resolve_next++];
+		ta->state = RESOLVE_BUSY;
+		gettimeofday(&ta->started, &tz);
+		pthread_mutex_unlock(&resolve_lock);
+
+		resolve_one(ta, &res, &err);
+
+		pthread_mutex_lock(&resolve_lock);
+		if(slot->abandoned) {
+			/* too late, the main thread has given up on this one */
+			if(res) freeaddrinfo(res);
+			break;
+		}
+		ta->res = res;
+		ta->gai_err = err;
+		ta->state = RESOLVE_DONE;
+		slot->job = NULL;
+		resolve_left--;
+		pthread_cond_signal(&resolve_cond);
 	}
+	slot->job = NULL;
+	pthread_mutex_unlock(&resolve_lock);
 
-	/* possibly add all the IP's as targets */
-	for(i = 0; he->h_addr_list[i]; i++) {
-		in = (struct in_addr *)he->h_addr_list[i];
-		add_target_ip(arg, in);
+	/* abandoned slots have been replaced, so nobody else refers to them */
+	if(slot->abandoned) free(slot);
 
-		/* this is silly, but it works */
-		if(mode == MODE_HOSTCHECK || mode == MODE_ALL) {
-			if(debug > 2) printf("mode: %d\n", mode);
-			continue;
+	return NULL;
+}
+
+static resolver_slot *
+start_resolver(void)
+{
+	resolver_slot *slot;
+	pthread_t thread;
+	pthread_attr_t attr;
+
+	slot = calloc(1, sizeof(resolver_slot));
+	if(!slot) crash("start_resolver(): malloc failed");
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if(pthread_create(&thread, &attr, resolver_thread, slot)) {
+		crash("Failed to start resolver thread");
+	}
+	pthread_attr_destroy(&attr);
+
+	return slot;
+}
+#endif /* HAVE_LIBPTHREAD */
+
+/* resolve all hostname arguments concurrently, then add every target in
+ * the order given. Hostnames that fail to resolve within resolve_timeout
+ * seconds are added as down instead of aborting the whole check */
+static void
+resolve_targets(void)
+{
+	unsigned int i, pending = 0;
+	target_arg *ta;
+	struct addrinfo *ai;
+	struct timeval start;
+	char *msg;
+#ifdef HAVE_LIBPTHREAD
+	resolver_slot *slots[RESOLVER_THREADS];
+	unsigned int threads;
+	struct timeval now;
+	struct timespec deadline;
+	u_int waited, next_wait;
+#endif
+
+	for(i = 0; i < num_target_args; i++) {
+		if(target_args[i].state == RESOLVE_PENDING) pending++;
+	}
+
+	gettimeofday(&start, &tz);
+#ifdef HAVE_LIBPTHREAD
+	if(pending) {
+		threads = pending < RESOLVER_THREADS ? pending : RESOLVER_THREADS;
+		pthread_mutex_lock(&resolve_lock);
+		resolve_left = pending;
+		for(i = 0; i < threads; i++) slots[i] = start_resolver();
+
+		while(resolve_left) {
+			/* time out lookups that took too long and find out how long
+			 * we can sleep until the next one would */
+			gettimeofday(&now, &tz);
+			next_wait = resolve_timeout * 1000000;
+			for(i = 0; i < threads; i++) {
+				if(!(ta = slots[i]->job)) continue;
+				waited = get_timevaldiff(&ta->started, &now);
+				if(waited >= resolve_timeout * 1000000) {
+					if(debug) printf("Resolving %s timed out\n", ta->name);
+					ta->state = RESOLVE_TIMEOUT;
+					resolve_left--;
+					slots[i]->abandoned = 1;
+					slots[i] = start_resolver();
+				}
+				else if(resolve_timeout * 1000000 - waited < next_wait) {
+					next_wait = resolve_timeout * 1000000 - waited;
+				}
+			}
+			if(!resolve_left) break;
+
+			deadline.tv_sec = now.tv_sec + next_wait / 1000000;
+			deadline.tv_nsec = (now.tv_usec + next_wait % 1000000) * 1000;
+			if(deadline.tv_nsec >= 1000000000) {
+				deadline.tv_sec++;
+				deadline.tv_nsec -= 1000000000;
+			}
+			pthread_cond_timedwait(&resolve_cond, &resolve_lock, &deadline);
 		}
-		break;
+
+		/* idle threads exit by themselves once there's nothing left */
+		for(i = 0; i < threads; i++) slots[i]->abandoned = 1;
+		pthread_mutex_unlock(&resolve_lock);
+	}
+#else
+	for(i = 0; i < num_target_args; i++) {
+		ta = &target_args[i];
+		if(ta->state != RESOLVE_PENDING) continue;
+		resolve_one(ta, &ta->res, &ta->gai_err);
+		ta->state = RESOLVE_DONE;
 	}
+#endif
 
-	return 0;
+	if(debug && pending) {
+		printf("resolved %u hostnames in %0.3f secs\n", pending,
+			   (float)get_timevaldiff(&start, NULL) / 1000000);
+	}
+
+	for(i = 0; i < num_target_args; i++) {
+		ta = &target_args[i];
+		if(ta->state == RESOLVE_LITERAL) {
+			/* don't add all ip's if we were given a specific one */
+			add_target_ip(ta->name, &ta->addr);
+			continue;
+		}
+		if(ta->state == RESOLVE_TIMEOUT) {
+			add_unresolved_target(ta->name, "Resolution timed out");
+			continue;
+		}
+		if(ta->gai_err || !ta->res) {
+			asprintf(&msg, "Failed to resolve (%s)", gai_strerror(ta->gai_err));
+			add_unresolved_target(ta->name, msg);
+			free(msg);
+			continue;
+		}
+
+		/* possibly add all the IP's as targets */
+		for(ai = ta->res; ai; ai = ai->ai_next) {
+			add_target_ip(ta->name, &((struct sockaddr_in *)ai->ai_addr)->sin_addr);
+
+			/* this is silly, but it works */
+			if(mode == MODE_HOSTCHECK || mode == MODE_ALL) {
+				if(debug > 2) printf("mode: %d\n", mode);
+				continue;
+			}
+			break;
+		}
+		freeaddrinfo(ta->res);
+		ta->res = NULL;
+	}
 }
 
 static void
@@ -1147,6 +2477,95 @@ set_source_ip(char *arg)
 		src.sin_addr.s_addr = get_ip_address(arg);
 	if(bind(icmp_sock, (struct sockaddr *)&src, sizeof(src)) == -1)
 		crash("Cannot bind to IP address %s", arg);
+	if(tcp_sock != -1 && bind(tcp_sock, (struct sockaddr *)&src, sizeof(src)) == -1)
+		crash("Cannot bind to IP address %s", arg);
+	source_addr = src.sin_addr;
+}
+
+/* icmp, tcp[:port] or udp[:port] */
+static void
+set_probe_proto(char *arg)
+{
+	char *port;
+	long p;
+
+	if((port = strchr(arg, ':'))) *port++ = '\0';
+	if(!strcasecmp(arg, "icmp") && !port) {
+		probe_proto = HAVE_ICMP;
+		return;
+	}
+	else if(!strcasecmp(arg, "tcp")) {
+		probe_proto = HAVE_TCP;
+		probe_port = DEFAULT_TCP_PORT;
+	}
+	else if(!strcasecmp(arg, "udp")) {
+		probe_proto = HAVE_UDP;
+		probe_port = DEFAULT_UDP_PORT;
+	}
+	else usage_va(_("Invalid probe protocol '%s'"), arg);
+
+	if(port) {
+		p = strtol(port, NULL, 10);
+		if(p < 1 || p > 65535) usage_va(_("Invalid port '%s'"), port);
+		probe_port = (unsigned short)p;
+	}
+}
+
+static const char *
+get_probe_name(void)
+{
+	switch(probe_proto) {
+	case HAVE_TCP: return "TCP";
+	case HAVE_UDP: return "UDP";
+	}
+	return "ICMP";
+}
+
+/* the tcp checksum covers our own address, which depends on the route
+ * to the target. Connecting a udp socket lets the kernel pick it */
+static int
+get_source_addr(int sock, struct rta_host *host)
+{
+	struct sockaddr_in sa;
+	socklen_t len = sizeof(sa);
+	int err;
+
+	if(source_addr.s_addr != INADDR_ANY) {
+		host->src_addr = source_addr;
+		return 0;
+	}
+
+	memcpy(&sa, &host->saddr_in, sizeof(sa));
+	sa.sin_port = htons(probe_port);
+	if(connect(sock, (struct sockaddr *)&sa, sizeof(sa)) == -1 ||
+	   getsockname(sock, (struct sockaddr *)&sa, &len) == -1)
+	{
+		/* the caller reports errno, which printf() may clobber */
+		err = errno;
+		if(debug) printf("No route to %s: %s\n", host->name, strerror(err));
+		errno = err;
+		return -1;
+	}
+	host->src_addr = sa.sin_addr;
+
+	return 0;
+}
+
+/* ask for SCM_TIMESTAMPNS, or SCM_TIMESTAMP if that's all we have */
+static int
+enable_recv_stamps(int sock)
+{
+	int result = -1, on = 1;
+
+#ifdef SO_TIMESTAMPNS
+	result = setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+#endif
+#ifdef SO_TIMESTAMP
+	if(result == -1)
+		result = setsockopt(sock, SOL_SOCKET, SO_TIMESTAMP, &on, sizeof(on));
+#endif
+
+	return result;
 }
 
 /* TODO: Move this to netutils.c and also change check_dhcp to use that. */
@@ -1247,6 +2666,424 @@ get_threshold(char *str, threshold *th)
 	return 0;
 }
 
+/* -J and -M take a warn,crit pair. -J values are times as for -w/-c,
+ * -M values are MOS scores */
+static void
+get_threshold_pair(char *str, char opt, u_int *warn_time, u_int *crit_time,
+				   double *warn_val, double *crit_val)
+{
+	char *p;
+
+	if(!(p = strchr(str, ','))) {
+		usage_va("-%c requires a warning,critical pair", opt);
+	}
+	*p++ = '\0';
+	if(warn_time) {
+		*warn_time = get_timevar(str);
+		*crit_time = get_timevar(p);
+	}
+	else {
+		*warn_val = strtod(str, NULL);
+		*crit_val = strtod(p, NULL);
+		if(*warn_val < 1 || *warn_val > 5 || *crit_val < 1 || *crit_val > 5)
+			usage_va("MOS thresholds must be between 1 and 5");
+	}
+}
+
+/* bucket k starts at 2^(k/2) usecs */
+static double
+rtt_bucket_start(unsigned int k)
+{
+	double start = (double)(1UL << (k / 2));
+
+	return (k & 1) ? start * 1.41421356 : start;
+}
+
+static void
+update_rtt_stats(rtt_stats *st, u_int rtt)
+{
+	double delta, d;
+	unsigned int k, msb;
+
+	/* Welford's running mean and variance */
+	st->n++;
+	delta = rtt - st->mean;
+	st->mean += delta / st->n;
+	st->m2 += delta * (rtt - st->mean);
+
+	/* RFC 3550 (6.4.1) jitter, using rtt differences as the transit
+	 * time differences since we can't compare clocks with the target */
+	if(st->n > 1) {
+		d = (rtt > st->last) ? rtt - st->last : st->last - rtt;
+		st->jitter += (d - st->jitter) / 16;
+	}
+	st->last = rtt;
+
+	/* histogram bucket: twice the position of the highest bit, plus one
+	 * if rtt is in the upper half (above 2^msb * sqrt(2)) of that octave */
+	for(msb = 0; rtt >> (msb + 1); msb++);
+	k = msb * 2;
+	if((unsigned long long)rtt * rtt >= (1ULL << (msb * 2 + 1))) k++;
+	if(k >= RTT_BUCKETS) k = RTT_BUCKETS - 1;
+
+	/* scale everything down rather than overflow, it keeps the shape */
+	if(st->hist[k] == USHRT_MAX) {
+		for(msb = 0; msb < RTT_BUCKETS; msb++) st->hist[msb] /= 2;
+	}
+	st->hist[k]++;
+}
+
+static double
+get_rtt_stddev(rtt_stats *st)
+{
+	if(st->n < 2) return 0;
+	return sqrt(st->m2 / (st->n - 1));
+}
+
+/* estimate a percentile by interpolating within its histogram bucket.
+ * Clamped to the observed min and max, which are exact */
+static double
+get_rtt_percentile(struct rta_host *host, unsigned int pct)
+{
+	rtt_stats *st = &host->stats;
+	unsigned int k, total = 0, cum = 0;
+	double rank, v;
+
+	for(k = 0; k < RTT_BUCKETS; k++) total += st->hist[k];
+	if(!total) return 0;
+
+	rank = (double)total * pct / 100;
+	for(k = 0; k < RTT_BUCKETS; k++) {
+		if(!st->hist[k] || cum + st->hist[k] < rank) {
+			cum += st->hist[k];
+			continue;
+		}
+		v = rtt_bucket_start(k) + (rank - cum) / st->hist[k] *
+			(rtt_bucket_start(k + 1) - rtt_bucket_start(k));
+		if(v < host->rtmin) v = host->rtmin;
+		if(v > host->rtmax) v = host->rtmax;
+		return v;
+	}
+
+	return host->rtmax;
+}
+
+/* MOS from the simplified ITU-T G.107 E-model commonly used for ping
+ * based VoIP estimates. rta is used as the latency, which overestimates
+ * the one-way delay the model expects, so this errs on the safe side */
+static double
+get_mos(double rta, double jitter, unsigned char pl)
+{
+	double eff, r;
+
+	eff = rta / 1000 + jitter / 1000 * 2 + 10;
+	if(eff < 160) r = 93.2 - eff / 40;
+	else r = 93.2 - (eff - 120) / 10;
+	r -= pl * 2.5;
+
+	if(r < 0) return 1;
+	return 1 + 0.035 * r + 0.000007 * r * (r - 60) * (100 - r);
+}
+
+/* RFC 6298 smoothing, carried on from the previous run if we have one */
+static void
+update_rto(struct rta_host *host, u_int rtt)
+{
+	if(!host->srtt) {
+		host->srtt = rtt;
+		host->rttvar = rtt / 2.0;
+		return;
+	}
+	host->rttvar = 0.75 * host->rttvar + 0.25 * fabs(host->srtt - rtt);
+	host->srtt = 0.875 * host->srtt + 0.125 * rtt;
+}
+
+static u_int
+get_rto(struct rta_host *host)
+{
+	double rto = host->srtt + 4 * host->rttvar;
+
+	/* NaN fails every comparison, so this one has to come first */
+	if(!(rto <= crit.rta)) rto = crit.rta;
+	if(rto < RTO_MIN) rto = RTO_MIN;
+	return (u_int)rto;
+}
+
+/* how long until every packet still on the wire is overdue. Hosts without
+ * an rtt history get the largest RTO of those with one, so a subnet full of
+ * dead hosts is done about as soon as the live ones are */
+static u_int
+get_adaptive_wait(void)
+{
+	u_int i, rto, elapsed, wait = 0, default_rto = 0;
+	struct rta_host *host;
+	struct timespec now;
+
+	for(i = 0; i < targets; i++) {
+		if(table[i]->srtt && (rto = get_rto(table[i])) > default_rto)
+			default_rto = rto;
+	}
+	if(!default_rto) default_rto = crit.rta;
+
+	get_mono_time(&now);
+	for(i = 0; i < targets; i++) {
+		host = table[i];
+		if(host->flags & FLAG_LOST_CAUSE ||
+		   host->icmp_recv + host->icmp_lost >= host->icmp_sent)
+		{
+			continue;
+		}
+		rto = host->srtt ? get_rto(host) : default_rto;
+		elapsed = get_timespecdiff(&host->last_send, &now);
+		if(rto > elapsed && rto - elapsed > wait) wait = rto - elapsed;
+	}
+
+	return wait;
+}
+
+/* an rtt in usecs from the state file, or -1 if it isn't a sane one */
+static double
+parse_rtt(const char *str)
+{
+	char *end;
+	double rtt = strtod(str, &end);
+
+	if(end == str || *end || !(rtt >= 0 && rtt <= UINT_MAX)) return -1;
+	return rtt;
+}
+
+/* the state is a space separated list of address:srtt:rttvar, in usecs */
+static void
+read_rtt_state(void)
+{
+	state_data *previous;
+	char *str, *entry, *addr, *srtt;
+	struct rta_host *host;
+	double srtt_val, rttvar_val;
+	unsigned int loaded = 0;
+
+	if(!(previous = np_state_read())) return;
+
+	str = (char *)previous->data;
+	while((entry = strsep(&str, " ")) != NULL) {
+		addr = strsep(&entry, ":");
+		srtt = strsep(&entry, ":");
+		if(!srtt || !entry) continue;
+		if(!(host = find_target(inet_addr(addr)))) continue;
+		/* a corrupt entry is as good as none, which gets the initial RTO */
+		if((srtt_val = parse_rtt(srtt)) < 0 || (rttvar_val = parse_rtt(entry)) < 0) {
+			if(debug) printf("ignoring bad rtt history for %s\n", host->name);
+			continue;
+		}
+		host->srtt = srtt_val;
+		host->rttvar = rttvar_val;
+		loaded++;
+	}
+	if(debug) printf("rtt history loaded for %u of %u targets\n", loaded, targets);
+}
+
+/* hosts that didn't answer this time keep what we knew about them */
+static void
+write_rtt_state(void)
+{
+	char *str, *p;
+	struct rta_host *host;
+	size_t size, len = 0;
+	int n;
+
+	/* "255.255.255.255:4294967295:4294967295 " per host is usual, but the
+	 * values come from the state file too, so they may be any size */
+	size = targets * 40 + 1;
+	if(!(str = malloc(size)))
+		crash("write_rtt_state(): failed to malloc state string");
+	*str = '\0';
+	for(host = list; host; host = host->next) {
+		if(!host->srtt || host->msg) continue;
+		while((n = snprintf(str + len, size - len, "%s%s:%.0f:%.0f", len ? " " : "",
+							inet_ntoa(host->saddr_in.sin_addr), host->srtt, host->rttvar)) >= 0 &&
+			  (size_t)n >= size - len)
+		{
+			size = size * 2 + n;
+			if(!(p = realloc(str, size)))
+				crash("write_rtt_state(): failed to realloc state string");
+			str = p;
+		}
+		if(n < 0) crash("write_rtt_state(): failed to format state string");
+		len += n;
+	}
+	np_state_write_string(0, str);
+	free(str);
+}
+
+/* the prober writes a fresh file and renames it into place, so readers
+ * that still have the old one mapped aren't pulled out from under */
+static void
+open_prober_shm(void)
+{
+	char *tmp;
+	size_t size;
+	int fd;
+	u_int i;
+
+	size = sizeof(shm_header) + targets * sizeof(shm_target) +
+		(size_t)targets * packets * sizeof(u_int32_t);
+	if(asprintf(&tmp, "%s.XXXXXX", shm_file) == -1)
+		crash("open_prober_shm(): failed to allocate file name");
+	if((fd = mkstemp(tmp)) == -1)
+		crash("Cannot create %s", tmp);
+	if(ftruncate(fd, size) == -1 ||
+	   (shm = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+	{
+		unlink(tmp);
+		crash("Cannot map %s", tmp);
+	}
+	close(fd);
+	chmod(tmp, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+
+	shm_targets = (shm_target *)(shm + 1);
+	shm_samples = (u_int32_t *)(shm_targets + targets);
+	for(i = 0; i < targets; i++) {
+		strncpy(shm_targets[i].name, table[i]->name, SHM_NAME_LEN - 1);
+		shm_targets[i].addr = table[i]->msg ? 0 : table[i]->saddr_in.sin_addr.s_addr;
+	}
+	shm->version = SHM_VERSION;
+	shm->targets = targets;
+	shm->window = packets;
+	shm->interval = pkt_interval;
+	shm->pid = getpid();
+	shm_barrier();
+	shm->magic = SHM_MAGIC;
+
+	if(rename(tmp, shm_file) == -1) {
+		unlink(tmp);
+		crash("Cannot rename %s to %s", tmp, shm_file);
+	}
+	free(tmp);
+
+	if(debug) printf("publishing %u samples per target for %u targets in %s\n",
+					 packets, targets, shm_file);
+}
+
+static void
+add_shm_sample(struct rta_host *host, u_int32_t rtt)
+{
+	shm_target *st = &shm_targets[host->id];
+
+	shm_samples[(size_t)host->id * shm->window + st->count % shm->window] = rtt;
+	shm_barrier();
+	st->count++;
+}
+
+/* the probe on the wire to host won't be answered */
+static void
+prober_lost(struct rta_host *host)
+{
+	if(!host->pending) return;
+	host->pending = 0;
+	host->icmp_lost++;
+	icmp_lost++;
+	add_shm_sample(host, SHM_LOST);
+}
+
+/* look up our targets in the prober's table and load their samples into
+ * the same fields a run of our own would have filled in */
+static void
+read_shm(void)
+{
+	struct stat st;
+	struct timeval now;
+	struct in_addr in;
+	struct rta_host *host;
+	shm_target *t;
+	u_int32_t *samples, count, c2, n, j, rtt;
+	unsigned long long age;
+	unsigned int i;
+	size_t size;
+	int fd;
+
+	if((fd = open(shm_file, O_RDONLY)) == -1)
+		crash("Cannot open %s", shm_file);
+	if(fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(shm_header) ||
+	   (shm = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+	{
+		crash("Cannot map %s", shm_file);
+	}
+	close(fd);
+
+	errno = 0;
+	size = sizeof(shm_header) + shm->targets * sizeof(shm_target) +
+		(size_t)shm->targets * shm->window * sizeof(u_int32_t);
+	if(shm->magic != SHM_MAGIC || shm->version != SHM_VERSION ||
+	   !shm->window || size != (size_t)st.st_size)
+	{
+		crash("%s is not a prober table", shm_file);
+	}
+	shm_targets = (shm_target *)(shm + 1);
+	shm_samples = (u_int32_t *)(shm_targets + shm->targets);
+
+	gettimeofday(&now, &tz);
+	prog_start = now;
+	age = (unsigned long long)now.tv_sec * 1000000 + now.tv_usec - shm->updated;
+	if(age > 3ULL * shm->interval + 1000000) {
+		crash("The prober (pid %u) hasn't updated %s for %llu seconds",
+			  shm->pid, shm_file, age / 1000000);
+	}
+
+	/* addresses are looked up by hash, names by the name the prober got */
+	for(i = 0; i < num_target_args; i++) {
+		if(target_args[i].state == RESOLVE_LITERAL) {
+			add_target_ip(target_args[i].name, &target_args[i].addr);
+			continue;
+		}
+		for(j = 0; j < shm->targets; j++) {
+			t = &shm_targets[j];
+			if(t->addr && !strncmp(t->name, target_args[i].name, SHM_NAME_LEN))
+				break;
+		}
+		in.s_addr = j < shm->targets ? shm_targets[j].addr : INADDR_NONE;
+		if(add_target_ip(target_args[i].name, &in) == -1 && !find_target(in.s_addr))
+			add_unresolved_target(target_args[i].name, "Not monitored by the prober");
+	}
+
+	for(j = 0; j < shm->targets; j++) {
+		t = &shm_targets[j];
+		if(!t->addr || !(host = find_target(t->addr))) continue;
+		host->flags |= FLAG_IN_SHM;
+		samples = &shm_samples[(size_t)j * shm->window];
+
+		/* retry if the prober added a sample while we were reading */
+		do {
+			count = t->count;
+			shm_barrier();
+			n = count < shm->window ? count : shm->window;
+			host->icmp_sent = host->icmp_recv = 0;
+			host->time_waited = 0;
+			host->rtmax = 0;
+			host->rtmin = DBL_MAX;
+			memset(&host->stats, 0, sizeof(host->stats));
+			for(i = count - n; i != count; i++) {
+				rtt = samples[i % shm->window];
+				host->icmp_sent++;
+				if(rtt == SHM_LOST) continue;
+				host->icmp_recv++;
+				host->time_waited += rtt;
+				update_rtt_stats(&host->stats, rtt);
+				if(rtt > host->rtmax) host->rtmax = rtt;
+				if(rtt < host->rtmin) host->rtmin = rtt;
+			}
+			shm_barrier();
+			c2 = t->count;
+		} while(c2 != count);
+
+		if(!n) host->msg = strdup(_("No samples from the prober yet"));
+	}
+
+	for(host = list; host; host = host->next) {
+		if(host->msg || (host->flags & FLAG_IN_SHM)) continue;
+		host->msg = strdup(_("Not monitored by the prober"));
+	}
+}
+
 unsigned short
 icmp_checksum(unsigned short *p, int n)
 {
@@ -1292,8 +3129,18 @@ print_help(void)
   printf (" %s\n", "-c");
   printf ("    %s", _("critical threshold (currently "));
   printf ("%0.3fms,%u%%)\n", (float)crit.rta / 1000, crit.pl);
+  printf (" %s\n", "-J");
+  printf ("    %s\n", _("jitter warning,critical thresholds (optional, same units as -w)"));
+  printf (" %s\n", "-M");
+  printf ("    %s\n", _("MOS warning,critical thresholds, alert below (optional, 1 to 5)"));
   printf (" %s\n", "-s");
   printf ("    %s\n", _("specify a source IP address or device name"));
+  printf (" %s\n", "-P");
+  printf ("    %s", _("probe with icmp, tcp[:port] or udp[:port] (currently "));
+  printf ("%s", get_probe_name());
+  if (probe_port)
+    printf (":%u", probe_port);
+  printf (")\n");
   printf (" %s\n", "-n");
   printf ("    %s", _("number of packets to send (currently "));
   printf ("%u)\n",packets);
@@ -1312,6 +3159,15 @@ print_help(void)
   printf (" %s\n", "-t");
   printf ("    %s",_("timeout value (seconds, currently  "));
   printf ("%u)\n", timeout);
+  printf (" %s\n", "-A");
+  printf ("    %s\n", _("adaptive timeouts, from each target's rtt in previous runs"));
+  printf (" %s\n", "-D, --prober=FILE");
+  printf ("    %s\n", _("run forever, publishing a rolling window of rtt samples in FILE"));
+  printf (" %s\n", "-F, --from-shm=FILE");
+  printf ("    %s\n", _("check the targets against the samples a prober keeps in FILE"));
+  printf (" %s\n", "-R");
+  printf ("    %s",_("max time to resolve each hostname (seconds, currently "));
+  printf ("%u)\n", resolve_timeout);
   printf (" %s\n", "-b");
   printf ("    %s\n", _("Number of icmp data bytes to send"));
   printf ("    %s %u + %d)\n", _("Packet size will be data bytes + icmp header (currently"),icmp_data_size, ICMP_MINLEN);
@@ -1321,11 +3177,32 @@ print_help(void)
   printf ("\n");
   printf ("%s\n", _("Notes:"));
   printf (" %s\n", _("The -H switch is optional. Naming a host (or several) to check is not."));
+  printf (" %s\n", _("Hostnames are resolved in parallel. Hosts that can't be resolved are"));
+  printf (" %s\n", _("reported as down."));
+  printf ("\n");
+  printf (" %s\n", _("TCP probes are bare SYNs (default port 80). Both a SYN-ACK and a RST count"));
+  printf (" %s\n", _("as a reply. UDP probes (default port 33434) are answered by the service or"));
+  printf (" %s\n", _("by a port unreachable from the target itself."));
+  printf ("\n");
+  printf (" %s\n", _("With -A, each target's smoothed rtt and deviation are kept in the plugin"));
+  printf (" %s\n", _("state, and a packet is considered lost once srtt + 4 * rttvar have passed"));
+  printf (" %s\n", _("(at most the critical rta). Targets without history get the largest of the"));
+  printf (" %s\n", _("others, so runs against partly dead networks end as soon as the live hosts"));
+  printf (" %s\n", _("have answered."));
+  printf ("\n");
+  printf (" %s\n", _("With -D, check_icmp stays in the foreground and pings every target once per"));
+  printf (" %s\n", _("-i (default 1s), keeping the last -n (default 60) results for each of them"));
+  printf (" %s\n", _("in FILE. Checks run with -F read those instead of sending anything, so they"));
+  printf (" %s\n", _("need no privileges and return at once. Hosts the prober doesn't know about"));
+  printf (" %s\n", _("are reported as down, and a prober that stopped updating FILE is UNKNOWN."));
   printf ("\n");
   printf (" %s\n", _("Threshold format for -w and -c is 200.25,60% for 200.25 msec RTA and 60%"));
   printf (" %s\n", _("packet loss.  The default values should work well for most users."));
   printf (" %s\n", _("You can specify different RTA factors using the standardized abbreviations"));
   printf (" %s\n", _("us (microseconds), ms (milliseconds, default) or just plain s for seconds."));
+  printf ("\n");
+  printf (" %s\n", _("Jitter (RFC 3550), rtt standard deviation, 50th/95th percentile and a MOS"));
+  printf (" %s\n", _("estimate (E-model, 1 to 4.4) are always added to the performance data."));
 /* -d not yet implemented */
 /*  printf ("%s\n", _("Threshold format for -d is warn,crit.  12,14 means WARNING if >= 12 hops"));
   printf ("%s\n", _("are spent and CRITICAL if >= 14 hops are spent."));
@@ -6,13 +6,14 @@
 use strict;
 use Test::More;
 use NPTest;
+use Time::HiRes qw(gettimeofday tv_interval);
 
 my $allow_sudo = getTestParameter( "NP_ALLOW_SUDO",
 	"If sudo is setup for this user to run any command as root ('yes' to allow)",
 	"no" );
 
 if ($allow_sudo eq "yes") {
-	plan tests => 16;
+	plan tests => 35;
 } else {
 	plan skip_all => "Need sudo to test check_icmp";
 }
@@ -82,3 +83,88 @@ $res = NPTest->testCmd(
 is( $res->return_code, 2, "One of two host nonresponsive - two required" );
 like( $res->output, $failureOutput, "Output OK" );
 
+
+$res = NPTest->testCmd(
+	"sudo ./check_icmp -H $host_responsive -H $hostname_invalid -w 10000ms,100% -c 10000ms,100% -n 1 -m 1"
+	);
+is( $res->return_code, 0, "Unresolvable host reported as down instead of aborting" );
+like( $res->output, "/$hostname_invalid: Failed to resolve .*, lost 100%/", "Output names the unresolved host" );
+
+# a closed port on loopback answers a SYN with a RST and a udp probe with
+# a port unreachable, both of which prove the host is up
+$res = NPTest->testCmd(
+	"sudo ./check_icmp -P tcp:1 -H 127.0.0.1 -w 10000ms,100% -c 10000ms,100%"
+	);
+is( $res->return_code, 0, "TCP probe answered by RST" );
+like( $res->output, $successOutput, "Output OK" );
+
+$res = NPTest->testCmd(
+	"sudo ./check_icmp -P udp -H 127.0.0.1 -w 10000ms,100% -c 10000ms,100%"
+	);
+is( $res->return_code, 0, "UDP probe answered by port unreachable" );
+like( $res->output, $successOutput, "Output OK" );
+
+# adaptive timeouts: once the responsive host's rtt is known, the
+# nonresponsive one is given up on long before the worst case wait
+my $statedir = "/tmp/check_icmp_state.$$";
+$res = NPTest->testCmd(
+	"sudo env NAGIOS_PLUGIN_STATE_DIRECTORY=$statedir ./check_icmp -A -H $host_responsive -H $host_nonresponsive -w 10000ms,100% -c 10000ms,100%"
+	);
+is( $res->return_code, 2, "Adaptive timeouts, first run" );
+my $t1 = [gettimeofday];
+$res = NPTest->testCmd(
+	"sudo env NAGIOS_PLUGIN_STATE_DIRECTORY=$statedir ./check_icmp -A -H $host_responsive -H $host_nonresponsive -w 10000ms,100% -c 10000ms,100%"
+	);
+is( $res->return_code, 2, "Adaptive timeouts, with rtt history" );
+cmp_ok( tv_interval($t1), '<', 5, "Nonresponsive host given up on early" );
+system("sudo", "rm", "-rf", $statedir);
+
+# a prober keeps pinging in the background, and checks reading its table
+# neither need root nor wait for anything
+my $shm = "/tmp/check_icmp_prober.$$";
+my $prober = open(my $prober_fh, "-|", "sudo", "./check_icmp", "-D", $shm, "-i", "100ms",
+	$host_responsive, $host_nonresponsive)
+	or die "Cannot run check_icmp: $!";
+sleep 2;
+$t1 = [gettimeofday];
+$res = NPTest->testCmd(
+	"./check_icmp -F $shm -H $host_responsive -w 10000ms,100% -c 10000ms,100%"
+	);
+is( $res->return_code, 0, "Responsive host from the prober's table" );
+like( $res->output, $successOutput, "Output OK" );
+cmp_ok( tv_interval($t1), '<', 1, "Answered without probing" );
+$res = NPTest->testCmd(
+	"./check_icmp -F $shm -H $host_nonresponsive -w 10000ms,100% -c 10000ms,100%"
+	);
+is( $res->return_code, 2, "Nonresponsive host from the prober's table" );
+$res = NPTest->testCmd(
+	"./check_icmp -F $shm -H 127.0.0.42 -w 10000ms,100% -c 10000ms,100%"
+	);
+is( $res->return_code, 2, "Host unknown to the prober" );
+like( $res->output, "/Not monitored by the prober/", "Output names the reason" );
+system("sudo", "kill", $prober);
+close($prober_fh);
+sleep 4;
+$res = NPTest->testCmd(
+	"./check_icmp -F $shm -H $host_responsive -w 10000ms,100% -c 10000ms,100%"
+	);
+is( $res->return_code, 3, "Stale prober table is UNKNOWN" );
+system("sudo", "rm", "-f", $shm);
+
+# Benchmark: sweep 50k synthetic loopback targets in one process, which
+# needs more than the 16 bit icmp_seq space to map replies to targets.
+# The argument list is too long for a shell, so exec check_icmp directly
+my $bench_targets = 50000;
+my @bench_hosts = map { sprintf("127.%d.%d.%d", 1 + int($_ / 62500), int($_ / 250) % 250, $_ % 250 + 1) } (0 .. $bench_targets - 1);
+my $t0 = [gettimeofday];
+open(my $bench, "-|", "sudo", "./check_icmp", "-n", "2", "-i", "0", "-I", "50u", "-t", "60",
+	"-w", "10000ms,100%", "-c", "10000ms,100%", @bench_hosts, $bench_hosts[0])
+	or die "Cannot run check_icmp: $!";
+my $bench_output = join("", <$bench>);
+close($bench);
+my $bench_elapsed = tv_interval($t0);
+diag(sprintf("%d targets checked in %.3f seconds", $bench_targets, $bench_elapsed));
+is( $? >> 8, 0, "$bench_targets targets all responsive" );
+my @bench_results = ($bench_output =~ /127\.\d+\.\d+\.\d+: rta [\d\.]+ms, lost 0%/g);
+is( scalar(@bench_results), $bench_targets, "Duplicate target dropped and every reply mapped to its target" );
+cmp_ok( $bench_elapsed, '<', 60, "Completed within the timeout" );
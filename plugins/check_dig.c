@@ -40,21 +40,31 @@ const char *email = "nagiosplug-devel@lists.sourceforge.net";
 #include "netutils.h"
 #include "utils.h"
 #include "runcmd.h"
+#include "utils_dns.h"
 
 int process_arguments (int, char **);
+int run_queries (char **, double *, double *, double *, int *, int *);
+int run_dig (char **, double *);
 int validate_arguments (void);
 void print_help (void);
 void print_usage (void);
 
 #define UNDEFINED 0
 #define DEFAULT_PORT 53
+/* ms that each of -n queries waits at least, however they share -t.
+ * Those left when -t runs out are not sent */
+#define MIN_QUERY_TIMEOUT 500
 
 char *query_address = NULL;
-char *record_type = "A";
+int query_type = NP_DNS_TYPE_A;
+int query_class = NP_DNS_CLASS_IN;
 char *expected_address = NULL;
 char *dns_server = NULL;
 char *dig_args = "";
 char *query_transport = "";
+int edns_size = 0;
+int use_tcp = FALSE;
+int query_count = 1;
 int verbose = FALSE;
 int server_port = DEFAULT_PORT;
 double warning_interval = UNDEFINED;
@@ -64,13 +74,11 @@ struct timeval tv;
 int
 main (int argc, char **argv)
 {
-  char *command_line;
-  output chld_out, chld_err;
   char *msg = NULL;
-  size_t i;
-  char *t;
-  long microsec;
+  char *perf;
   double elapsed_time;
+  double min_time, max_time;
+  int answered = 0, asked = 0;
   int result = STATE_UNKNOWN;
 
   setlocale (LC_ALL, "");
@@ -87,15 +95,7 @@ main (int argc, char **argv)
   if (process_arguments (argc, argv) == ERROR)
     usage_va(_("Could not parse arguments"));
 
-  /* get the command to run */
-  xasprintf (&command_line, "%s @%s -p %d %s -t %s %s %s",
-            PATH_TO_DIG, dns_server, server_port, query_address, record_type, dig_args, query_transport);
-
-  alarm (timeout_interval);
-  gettimeofday (&tv, NULL);
-
   if (verbose) {
-    printf ("%s\n", command_line);
     if(expected_address != NULL) {
       printf (_("Looking for: '%s'\n"), expected_address);
     } else {
@@ -103,10 +103,185 @@ main (int argc, char **argv)
     }
   }
 
+  if (*dig_args)
+    result = run_dig (&msg, &elapsed_time);
+  else
+    result = run_queries (&msg, &elapsed_time, &min_time, &max_time, &answered, &asked);
+
+  if (critical_interval > UNDEFINED && elapsed_time > critical_interval)
+    result = STATE_CRITICAL;
+
+  else if (warning_interval > UNDEFINED && elapsed_time > warning_interval)
+    result = max_state (result, STATE_WARNING);
+
+  perf = fperfdata("time", elapsed_time, "s",
+                   (warning_interval>UNDEFINED?TRUE:FALSE),
+                   warning_interval,
+                   (critical_interval>UNDEFINED?TRUE:FALSE),
+                   critical_interval,
+                   TRUE, 0, FALSE, 0);
+
+  if (query_count > 1) {
+    printf ("DNS %s - %.3f seconds average response time (%s), min/avg/max %.3f/%.3f/%.3f over %d of %d queries",
+            state_text (result), elapsed_time,
+            msg ? msg : _("Probably a non-existent host/domain"),
+            min_time, elapsed_time, max_time, answered, asked);
+    if (asked < query_count)
+      printf (_(", %d not sent in time"), query_count - asked);
+    printf ("|%s", perf);
+    printf (" %s", fperfdata ("time_min", min_time, "s", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0));
+    printf (" %s\n", fperfdata ("time_max", max_time, "s", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0));
+  }
+  else
+    printf ("DNS %s - %.3f seconds response time (%s)|%s\n",
+            state_text (result), elapsed_time,
+            msg ? msg : _("Probably a non-existent host/domain"), perf);
+  return result;
+}
+
+
+
+/* ask the server ourselves, query_count times or until the -t timeout is
+ * spent. elapsed_time is the average over the answered queries */
+int
+run_queries (char **msg, double *elapsed_time, double *min_time, double *max_time, int *answered, int *asked)
+{
+  np_dns_options opts;
+  np_dns_reply reply, first;
+  struct timeval start;
+  double total = 0, seconds;
+  long share, remaining;
+  int i, j, ret, error = 0, failure = NP_DNS_OK, n_answers = 0;
+  char *line;
+  int result = STATE_UNKNOWN;
+
+  np_dns_init_options (&opts);
+  opts.port = server_port;
+  opts.family = address_family;
+  opts.qclass = query_class;
+  opts.edns = edns_size;
+  opts.tcp = use_tcp;
+  opts.retries = 0;
+  share = max (timeout_interval * 1000 / query_count, MIN_QUERY_TIMEOUT);
+  alarm (timeout_interval + 1);
+  gettimeofday (&start, NULL);
+
+  *min_time = *max_time = *elapsed_time = 0;
+  memset (&first, 0, sizeof (first));
+  for (i = 0; i < query_count; i++) {
+    /* -t is a hard limit, the last queries only get what is left of it */
+    remaining = timeout_interval * 1000L - deltime (start) / 1000;
+    if (remaining <= 0)
+      break;
+    opts.timeout = min (share, remaining);
+
+    ret = np_dns_query (dns_server, query_address, query_type, &opts, &reply);
+    if (ret != NP_DNS_OK) {
+      failure = ret;
+      error = errno;
+      if (verbose)
+        printf (_("Query %d: %s\n"), i + 1, ret == NP_DNS_ERROR ? strerror (error) : np_dns_strerror (ret));
+      np_dns_free_reply (&reply);
+      continue;
+    }
+
+    seconds = reply.time / 1.0e3;
+    if (!*answered || seconds < *min_time)
+      *min_time = seconds;
+    if (seconds > *max_time)
+      *max_time = seconds;
+    total += seconds;
+    if (verbose)
+      printf (_("Query %d: %s in %.3f ms, %d bytes%s%s\n"), i + 1, np_dns_rcode_name (reply.rcode),
+              reply.time, reply.size, reply.tcp ? _(" over TCP") : "",
+              reply.edns_size ? _(", EDNS") : "");
+
+    /* the answer of the first one is checked, the others only give timing */
+    if ((*answered)++ == 0)
+      first = reply;
+    else
+      np_dns_free_reply (&reply);
+  }
+  *asked = i;
+
+  if (!*answered) {
+    if (failure == NP_DNS_TIMEOUT)
+      xasprintf (msg, _("No response from %s"), dns_server);
+    else if (failure == NP_DNS_ERROR)
+      xasprintf (msg, _("Cannot query %s: %s"), dns_server, strerror (error));
+    else
+      *msg = (char *)np_dns_strerror (failure);
+    return STATE_CRITICAL;
+  }
+  *elapsed_time = total / *answered;
+
+  for (j = 0; j < first.n_rr; j++) {
+    if (first.rr[j].section != NP_DNS_ANSWER)
+      continue;
+    n_answers++;
+    /* as dig prints it, with spaces for tabs */
+    xasprintf (&line, "%s %lu %s %s %s", first.rr[j].name, first.rr[j].ttl,
+               np_dns_class_name (first.rr[j].class), np_dns_type_name (first.rr[j].type),
+               first.rr[j].data);
+    if (verbose)
+      printf ("%s\n", line);
+    if (result == STATE_UNKNOWN &&
+        strstr (line, (expected_address == NULL ? query_address : expected_address)) != NULL) {
+      *msg = line;
+      result = STATE_OK;
+    }
+  }
+
+  if (first.rcode != NP_DNS_NOERROR) {
+    xasprintf (msg, _("Server answered %s"), np_dns_rcode_name (first.rcode));
+    result = STATE_CRITICAL;
+  }
+  else if (result == STATE_UNKNOWN && n_answers > 0) {
+    *msg = (char *)_("Server not found in ANSWER SECTION");
+    result = STATE_WARNING;
+  }
+  else if (result == STATE_UNKNOWN) {
+    *msg = (char *)_("No ANSWER SECTION found");
+    result = STATE_CRITICAL;
+  }
+
+  if (*answered < query_count)
+    result = max_state (result, STATE_WARNING);
+
+  return result;
+}
+
+
+
+/* run dig with the user's arguments and look for the answer in its output */
+int
+run_dig (char **msg, double *elapsed_time)
+{
+#ifdef PATH_TO_DIG
+  char *command_line, *edns = "";
+  output chld_out, chld_err;
+  size_t i;
+  char *t;
+  long microsec;
+  int result = STATE_UNKNOWN;
+
+  /* get the command to run, with -E and -P as dig options */
+  if (edns_size)
+    xasprintf (&edns, " +bufsize=%d", edns_size);
+  xasprintf (&command_line, "%s @%s -p %d %s -t %s -c %s%s%s %s %s",
+            PATH_TO_DIG, dns_server, server_port, query_address, np_dns_type_name (query_type),
+            np_dns_class_name (query_class), edns, use_tcp ? " +tcp" : "", dig_args, query_transport);
+
+  alarm (timeout_interval);
+  gettimeofday (&tv, NULL);
+
+  if (verbose)
+    printf ("%s\n", command_line);
+
   /* run the command */
   if(np_runcmd(command_line, &chld_out, &chld_err, 0) != 0) {
     result = STATE_WARNING;
-    msg = (char *)_("dig returned an error status");
+    *msg = (char *)_("dig returned an error status");
   }
 
   for(i = 0; i < chld_out.lines; i++) {
@@ -120,18 +295,18 @@ main (int argc, char **argv)
           printf ("%s\n", chld_out.line[i]);
 
         if (strstr (chld_out.line[i], (expected_address == NULL ? query_address : expected_address)) != NULL) {
-          msg = chld_out.line[i];
+          *msg = chld_out.line[i];
           result = STATE_OK;
 
           /* Translate output TAB -> SPACE */
-          t = msg;
+          t = *msg;
           while ((t = strchr(t, '\t')) != NULL) *t = ' ';
           break;
         }
       }
 
       if (result == STATE_UNKNOWN) {
-        msg = (char *)_("Server not found in ANSWER SECTION");
+        *msg = (char *)_("Server not found in ANSWER SECTION");
         result = STATE_WARNING;
       }
 
@@ -141,41 +316,28 @@ main (int argc, char **argv)
   }
 
   if (result == STATE_UNKNOWN) {
-    msg = (char *)_("No ANSWER SECTION found");
+    *msg = (char *)_("No ANSWER SECTION found");
     result = STATE_CRITICAL;
   }
 
   /* If we get anything on STDERR, at least set warning */
   if(chld_err.buflen > 0) {
     result = max_state(result, STATE_WARNING);
-    if(!msg) for(i = 0; i < chld_err.lines; i++) {
-      msg = strchr(chld_err.line[0], ':');
-      if(msg) {
-        msg++;
+    if(!*msg) for(i = 0; i < chld_err.lines; i++) {
+      *msg = strchr(chld_err.line[0], ':');
+      if(*msg) {
+        (*msg)++;
         break;
       }
     }
   }
 
   microsec = deltime (tv);
-  elapsed_time = (double)microsec / 1.0e6;
-
-  if (critical_interval > UNDEFINED && elapsed_time > critical_interval)
-    result = STATE_CRITICAL;
-
-  else if (warning_interval > UNDEFINED && elapsed_time > warning_interval)
-    result = STATE_WARNING;
-
-  printf ("DNS %s - %.3f seconds response time (%s)|%s\n",
-          state_text (result), elapsed_time,
-          msg ? msg : _("Probably a non-existent host/domain"),
-          fperfdata("time", elapsed_time, "s",
-                    (warning_interval>UNDEFINED?TRUE:FALSE),
-                    warning_interval,
-                    (critical_interval>UNDEFINED?TRUE:FALSE),
-            critical_interval,
-            TRUE, 0, FALSE, 0));
+  *elapsed_time = (double)microsec / 1.0e6;
   return result;
+#else
+  die (STATE_UNKNOWN, _("DNS UNKNOWN - dig was not found when %s was built, -A is not available\n"), progname);
+#endif
 }
 
 
@@ -198,6 +360,10 @@ process_arguments (int argc, char **argv)
     {"version", no_argument, 0, 'V'},
     {"help", no_argument, 0, 'h'},
     {"record_type", required_argument, 0, 'T'},
+    {"record_class", required_argument, 0, 'C'},
+    {"edns", required_argument, 0, 'E'},
+    {"protocol", required_argument, 0, 'P'},
+    {"count", required_argument, 0, 'n'},
     {"expected_address", required_argument, 0, 'a'},
     {"port", required_argument, 0, 'p'},
     {"use-ipv4", no_argument, 0, '4'},
@@ -209,7 +375,7 @@ process_arguments (int argc, char **argv)
     return ERROR;
 
   while (1) {
-    c = getopt_long (argc, argv, "hVvt:l:H:w:c:T:p:a:A:46", longopts, &option);
+    c = getopt_long (argc, argv, "hVvt:l:H:w:c:T:C:E:P:n:p:a:A:46", longopts, &option);
 
     if (c == -1 || c == EOF)
       break;
@@ -267,16 +433,40 @@ process_arguments (int argc, char **argv)
       verbose = TRUE;
       break;
     case 'T':
-      record_type = optarg;
+      if ((query_type = np_dns_type (optarg)) <= 0 || query_type > 65535)
+        usage_va(_("Unknown record type - %s"), optarg);
+      break;
+    case 'C':
+      if ((query_class = np_dns_class (optarg)) <= 0 || query_class > 65535)
+        usage_va(_("Unknown record class - %s"), optarg);
+      break;
+    case 'E':                 /* EDNS buffer size */
+      if (!is_intnonneg (optarg) || ((edns_size = atoi (optarg)) && edns_size < 512) || edns_size > 65535)
+        usage_va(_("EDNS buffer size must be 0 or between 512 and 65535 - %s"), optarg);
+      break;
+    case 'P':                 /* transport */
+      if (!strcasecmp (optarg, "tcp"))
+        use_tcp = TRUE;
+      else if (!strcasecmp (optarg, "udp"))
+        use_tcp = FALSE;
+      else
+        usage_va(_("Protocol must be udp or tcp - %s"), optarg);
+      break;
+    case 'n':                 /* number of queries */
+      if (!is_intpos (optarg))
+        usage_va(_("Count must be a positive integer - %s"), optarg);
+      query_count = atoi (optarg);
       break;
     case 'a':
       expected_address = optarg;
       break;
     case '4':
       query_transport = "-4";
+      address_family = AF_INET;
       break;
     case '6':
       query_transport = "-6";
+      address_family = AF_INET6;
       break;
     default:                  /* usage5 */
       usage5();
@@ -302,6 +492,9 @@ process_arguments (int argc, char **argv)
 int
 validate_arguments (void)
 {
+  if (*dig_args && query_count > 1)
+    usage_va (_("-n can't be used with -A"));
+
   if (query_address != NULL)
     return OK;
   else
@@ -322,7 +515,8 @@ print_help (void)
   printf ("Copyright (c) 2000 Karl DeBisschop <kdebisschop@users.sourceforge.net>\n");
   printf (COPYRIGHT, copyright, email);
 
-  printf (_("This plugin test the DNS service on the specified host using dig"));
+  printf ("%s\n", _("This plugin tests the DNS service on the specified host. It sends the query itself,"));
+  printf ("%s", _("or uses dig when dig arguments are given"));
 
   printf ("\n\n");
 
@@ -335,26 +529,42 @@ print_help (void)
   printf (UT_HOST_PORT, 'p', myport);
 
   printf (" %s\n","-4, --use-ipv4");
-  printf ("    %s\n",_("Force dig to only use IPv4 query transport"));
+  printf ("    %s\n",_("Force IPv4 query transport"));
   printf (" %s\n","-6, --use-ipv6");
-  printf ("    %s\n",_("Force dig to only use IPv6 query transport"));
+  printf ("    %s\n",_("Force IPv6 query transport"));
   printf (" %s\n","-l, --query_address=STRING");
   printf ("    %s\n",_("Machine name to lookup"));
   printf (" %s\n","-T, --record_type=STRING");
   printf ("    %s\n",_("Record type to lookup (default: A)"));
+  printf (" %s\n","-C, --record_class=STRING");
+  printf ("    %s\n",_("Record class to lookup, like CH for server information (default: IN)"));
+  printf (" %s\n","-E, --edns=INTEGER");
+  printf ("    %s\n",_("Advertise this UDP buffer size with EDNS (default: 0, no EDNS)"));
+  printf (" %s\n","-P, --protocol=udp|tcp");
+  printf ("    %s\n",_("Query over UDP, falling back to TCP for truncated answers, or over TCP only"));
+  printf ("    %s\n",_("(default: udp)"));
+  printf (" %s\n","-n, --count=INTEGER");
+  printf ("    %s\n",_("Send the query this many times, one after the other, and report the"));
+  printf ("    %s\n",_("min/avg/max response time. Thresholds apply to the average (default: 1)"));
+  printf ("    %s\n",_("The queries share the -t timeout, each waiting -t divided by their number,"));
+  printf ("    %s\n",_("but at least 500 ms. Those left when -t runs out are not sent"));
   printf (" %s\n","-a, --expected_address=STRING");
   printf ("    %s\n",_("An address expected to be in the answer section. If not set, uses whatever"));
   printf ("    %s\n",_("was in -l"));
   printf (" %s\n","-A, --dig-arguments=STRING");
-  printf ("    %s\n",_("Pass STRING as argument(s) to dig"));
+  printf ("    %s\n",_("Pass STRING as argument(s) to dig and run it instead of querying the server"));
+  printf ("    %s\n",_("directly. -C, -E and -P are passed on to dig, -n can't be used with it"));
   printf (UT_WARN_CRIT);
   printf (UT_TIMEOUT, DEFAULT_SOCKET_TIMEOUT);
   printf (UT_VERBOSE);
 
   printf ("\n");
   printf ("%s\n", _("Examples:"));
-  printf (" %s\n", "check_dig -H DNSSERVER -l www.example.com -A \"+tcp\"");
+  printf (" %s\n", "check_dig -H DNSSERVER -l www.example.com -P tcp");
   printf (" %s\n", "This will send a tcp query to DNSSERVER for www.example.com");
+  printf (" %s\n", "check_dig -H DNSSERVER -l version.bind -T TXT -C CH -n 10 -w 0.05");
+  printf (" %s\n", "This will ask DNSSERVER for its version 10 times and warn if it takes");
+  printf (" %s\n", "more than 50ms on average");
 
   printf (UT_SUPPORT);
 }
@@ -366,6 +576,7 @@ print_usage (void)
 {
   printf ("%s\n", _("Usage:"));
   printf ("%s -l <query_address> [-H <host>] [-p <server port>]\n", progname);
-  printf (" [-T <query type>] [-w <warning interval>] [-c <critical interval>]\n");
+  printf (" [-T <query type>] [-C <query class>] [-E <edns size>] [-P udp|tcp] [-n <count>]\n");
+  printf (" [-w <warning interval>] [-c <critical interval>]\n");
   printf (" [-t <timeout>] [-a <expected answer address>] [-v]\n");
 }
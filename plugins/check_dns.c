@@ -9,9 +9,6 @@
 * 
 * This file contains the check_dns plugin
 * 
-* LIMITATION: nslookup on Solaris 7 can return output over 2 lines, which
-* will not be picked up by this plugin
-* 
 * 
 * This program is free software: you can redistribute it and/or modify
 * it under the terms of the GNU General Public License as published by
@@ -37,23 +34,31 @@ const char *email = "nagiosplug-devel@lists.sourceforge.net";
 #include "utils.h"
 #include "utils_base.h"
 #include "netutils.h"
-#include "runcmd.h"
+#include "utils_dns.h"
 
 int process_arguments (int, char **);
 int validate_arguments (void);
-int error_scan (char *);
+int check_servers (void);
+char *join_answers (np_dns_reply *, int);
+int check_expected (const char *, char **);
 void print_help (void);
 void print_usage (void);
 
 #define ADDRESS_LENGTH 256
 char query_address[ADDRESS_LENGTH] = "";
 char dns_server[ADDRESS_LENGTH] = "";
+char **dns_servers = NULL;
+int n_servers = 0;
+int *query_types = NULL;
+int n_types = 0;
 char ptr_server[ADDRESS_LENGTH] = "";
 int verbose = FALSE;
 char **expected_address = NULL;
 int expected_address_cnt = 0;
 
 int expect_authority = FALSE;
+int server_port = NP_DNS_PORT;
+int retries = 2;
 thresholds *time_thresholds = NULL;
 
 static int
@@ -69,29 +74,26 @@ qstrcmp(const void *p1, const void *p2)
 int
 main (int argc, char **argv)
 {
-  char *command_line = NULL;
-  char input_buffer[MAX_INPUT_BUFFER];
   char *address = NULL; /* comma seperated str with addrs/ptrs (sorted) */
-  char **addresses = NULL;
-  int n_addresses = 0;
   char *msg = NULL;
-  char *temp_buffer = NULL;
+  char *reverse, **names = NULL;
+  int n_names = 0;
   int non_authoritative = FALSE;
   int result = STATE_UNKNOWN;
-  double elapsed_time;
-  long microsec;
-  struct timeval tv;
+  int type, ret = NP_DNS_OK;
+  double elapsed_time = 0;
   int multi_address;
-  int parse_address = FALSE; /* This flag scans for Address: but only after Name: */
-  output chld_out, chld_err;
-  size_t i;
+  np_dns_options opts;
+  np_dns_reply reply;
+  np_dns_resolv resolv;
+  int i, j;
 
   setlocale (LC_ALL, "");
   bindtextdomain (PACKAGE, LOCALEDIR);
   textdomain (PACKAGE);
 
   /* Set signal handling and alarm */
-  if (signal (SIGALRM, popen_timeout_alarm_handler) == SIG_ERR) {
+  if (signal (SIGALRM, socket_timeout_alarm_handler) == SIG_ERR) {
     usage_va(_("Cannot catch SIGALRM"));
   }
 
@@ -102,120 +104,110 @@ main (int argc, char **argv)
     usage_va(_("Could not parse arguments"));
   }
 
-  /* get the command to run */
-  xasprintf (&command_line, "%s %s %s", NSLOOKUP_COMMAND, query_address, dns_server);
-
-  alarm (timeout_interval);
-  gettimeofday (&tv, NULL);
-
-  if (verbose)
-    printf ("%s\n", command_line);
-
-  /* run the command */
-  if((np_runcmd(command_line, &chld_out, &chld_err, 0)) != 0) {
-    msg = (char *)_("nslookup returned an error status");
-    result = STATE_WARNING;
+  if (n_servers > 1 || n_types > 0)
+    return check_servers ();
+
+  np_dns_read_resolv_conf (NULL, &resolv);
+  if (dns_server[0] == '\0')
+    strcpy (dns_server, resolv.server);
+
+  /* the tries share the timeout, the alarm is only a safety net */
+  np_dns_init_options (&opts);
+  opts.port = server_port;
+  opts.retries = retries;
+  opts.timeout = timeout_interval * 1000 / (retries + 1);
+  alarm (timeout_interval + 1);
+
+  /* addresses are looked up in in-addr.arpa or ip6.arpa, names as they are
+   * if they have a dot and in the resolv.conf search domains */
+  if ((reverse = np_dns_reverse_name (query_address)) != NULL) {
+    type = NP_DNS_TYPE_PTR;
+    names = malloc (sizeof (*names));
+    names[n_names++] = reverse;
+  } else {
+    type = NP_DNS_TYPE_A;
+    names = malloc ((resolv.n_search + 2) * sizeof (*names));
+    if (strchr (query_address, '.'))
+      names[n_names++] = query_address;
+    if (query_address[strlen (query_address) - 1] != '.')
+      for (i = 0; i < resolv.n_search; i++)
+        xasprintf (&names[n_names++], "%s.%s", query_address, resolv.search[i]);
+    if (!strchr (query_address, '.'))
+      names[n_names++] = query_address;
   }
 
-  /* scan stdout */
-  for(i = 0; i < chld_out.lines; i++) {
-    if (addresses == NULL)
-      addresses = malloc(sizeof(*addresses)*10);
-    else if (!(n_addresses % 10))
-      addresses = realloc(addresses,sizeof(*addresses) * (n_addresses + 10));
-
+  for (i = 0; i < n_names; i++) {
     if (verbose)
-      puts(chld_out.line[i]);
-
-    if (strstr (chld_out.line[i], ".in-addr.arpa")) {
-      if ((temp_buffer = strstr (chld_out.line[i], "name = ")))
-        addresses[n_addresses++] = strdup (temp_buffer + 7);
-      else {
-        msg = (char *)_("Warning plugin error");
-        result = STATE_WARNING;
-      }
-    }
-
-    /* the server is responding, we just got the host name... */
-    if (strstr (chld_out.line[i], "Name:"))
-      parse_address = TRUE;
-    else if (parse_address == TRUE && (strstr (chld_out.line[i], "Address:") ||
-             strstr (chld_out.line[i], "Addresses:"))) {
-      temp_buffer = index (chld_out.line[i], ':');
-      temp_buffer++;
-
-      /* Strip leading spaces */
-      for (; *temp_buffer != '\0' && *temp_buffer == ' '; temp_buffer++)
-        /* NOOP */;
-
-      strip(temp_buffer);
-      if (temp_buffer==NULL || strlen(temp_buffer)==0) {
-        die (STATE_CRITICAL,
-             _("DNS CRITICAL - '%s' returned empty host name string\n"),
-             NSLOOKUP_COMMAND);
-      }
-
-      addresses[n_addresses++] = strdup(temp_buffer);
-    }
-    else if (strstr (chld_out.line[i], _("Non-authoritative answer:"))) {
-      non_authoritative = TRUE;
-    }
-
-
-    result = error_scan (chld_out.line[i]);
-    if (result != STATE_OK) {
-      msg = strchr (chld_out.line[i], ':');
-      if(msg) msg++;
+      printf (_("Querying %s for %s %s\n"), dns_server, names[i], np_dns_type_name (type));
+    ret = np_dns_query (dns_server, names[i], type, &opts, &reply);
+    elapsed_time += reply.time / 1.0e3;
+    if (ret != NP_DNS_OK || reply.rcode != NP_DNS_NXDOMAIN || i == n_names - 1)
       break;
+    np_dns_free_reply (&reply);
+  }
+
+  /* a name with no IPv4 address may still have an IPv6 one */
+  if (ret == NP_DNS_OK && reply.rcode == NP_DNS_NOERROR && type == NP_DNS_TYPE_A) {
+    for (j = 0; j < reply.n_rr; j++)
+      if (reply.rr[j].section == NP_DNS_ANSWER && reply.rr[j].type == type)
+        break;
+    if (j == reply.n_rr) {
+      np_dns_free_reply (&reply);
+      type = NP_DNS_TYPE_AAAA;
+      if (verbose)
+        printf (_("Querying %s for %s %s\n"), dns_server, names[i], np_dns_type_name (type));
+      ret = np_dns_query (dns_server, names[i], type, &opts, &reply);
+      elapsed_time += reply.time / 1.0e3;
     }
   }
 
-  /* scan stderr */
-  for(i = 0; i < chld_err.lines; i++) {
-    if (verbose)
-      puts(chld_err.line[i]);
+  if (ret == NP_DNS_TIMEOUT)
+    die (STATE_CRITICAL, _("No response from DNS %s\n"), dns_server);
+  else if (ret == NP_DNS_ERROR && errno == ECONNREFUSED)
+    die (STATE_CRITICAL, _("Connection to DNS %s was refused\n"), dns_server);
+  else if (ret == NP_DNS_ERROR && errno == ENETUNREACH)
+    die (STATE_CRITICAL, _("Network is unreachable\n"));
+  else if (ret == NP_DNS_ERROR)
+    die (STATE_UNKNOWN, _("DNS UNKNOWN - Cannot query %s: %s\n"), dns_server, np_dns_strerror (ret));
+
+  if (verbose) {
+    printf (_("%s answered with %s in %.3f ms%s%s, %d tries\n"), dns_server,
+            np_dns_rcode_name (reply.rcode), reply.time, reply.aa ? _(", authoritative") : "",
+            reply.tcp ? _(" over TCP") : "", reply.tries);
+    for (j = 0; j < reply.n_rr; j++)
+      printf ("%s\t%lu\t%s\t%s\n", reply.rr[j].name, reply.rr[j].ttl,
+              np_dns_type_name (reply.rr[j].type), reply.rr[j].data);
+  }
 
-    if (error_scan (chld_err.line[i]) != STATE_OK) {
-      result = max_state (result, error_scan (chld_err.line[i]));
-      msg = strchr(input_buffer, ':');
-      if(msg) msg++;
-    }
+  if (ret == NP_DNS_BADREPLY) {
+    msg = (char *)_("Malformed reply from the DNS server");
+    result = STATE_WARNING;
+  }
+  else if (reply.rcode == NP_DNS_FORMERR) {
+    xasprintf (&msg, _("DNS server at %s could not parse the query"), dns_server);
+    result = STATE_WARNING;
   }
+  else if (reply.rcode == NP_DNS_NXDOMAIN)
+    die (STATE_CRITICAL, _("Domain %s was not found by the server\n"), query_address);
+  else if (reply.rcode == NP_DNS_REFUSED)
+    die (STATE_CRITICAL, _("Query was refused by DNS server at %s\n"), dns_server);
+  else if (reply.rcode == NP_DNS_SERVFAIL)
+    die (STATE_CRITICAL, _("DNS failure for %s\n"), dns_server);
+  else if (reply.rcode != NP_DNS_NOERROR)
+    die (STATE_CRITICAL, _("DNS server at %s answered %s\n"), dns_server,
+         np_dns_rcode_name (reply.rcode));
+  else
+    result = STATE_OK;
 
-  if (addresses) {
-    int i,slen;
-    char *adrp;
-    qsort(addresses, n_addresses, sizeof(*addresses), qstrcmp);
-    for(i=0, slen=1; i < n_addresses; i++) {
-      slen += strlen(addresses[i])+1;
-    }
-    adrp = address = malloc(slen);
-    for(i=0; i < n_addresses; i++) {
-      if (i) *adrp++ = ',';
-      strcpy(adrp, addresses[i]);
-      adrp += strlen(addresses[i]);
-    }
-    *adrp = 0;
-  } else
-    die (STATE_CRITICAL,
-         _("DNS CRITICAL - '%s' msg parsing exited with no address\n"),
-         NSLOOKUP_COMMAND);
+  if (result == STATE_OK) {
+    if ((address = join_answers (&reply, type)) == NULL)
+      die (STATE_CRITICAL, _("DNS %s has no records\n"), dns_server);
+    non_authoritative = !reply.aa;
+  }
 
   /* compare to expected address */
-  if (result == STATE_OK && expected_address_cnt > 0) {
-    result = STATE_CRITICAL;
-    temp_buffer = "";
-    for (i=0; i<expected_address_cnt; i++) {
-      /* check if we get a match and prepare an error string */
-      if (strcmp(address, expected_address[i]) == 0) result = STATE_OK;
-      xasprintf(&temp_buffer, "%s%s; ", temp_buffer, expected_address[i]);
-    }
-    if (result == STATE_CRITICAL) {
-      /* Strip off last semicolon... */
-      temp_buffer[strlen(temp_buffer)-2] = '\0';
-      xasprintf(&msg, _("expected '%s' but got '%s'"), temp_buffer, address);
-    }
-  }
+  if (result == STATE_OK && expected_address_cnt > 0)
+    result = check_expected (address, &msg);
 
   /* check if authoritative */
   if (result == STATE_OK && expect_authority && non_authoritative) {
@@ -223,9 +215,6 @@ main (int argc, char **argv)
     xasprintf(&msg, _("server %s is not authoritative for %s"), dns_server, query_address);
   }
 
-  microsec = deltime (tv);
-  elapsed_time = (double)microsec / 1.0e6;
-
   if (result == STATE_OK) {
     if (strchr (address, ',') == NULL)
       multi_address = FALSE;
@@ -245,75 +234,244 @@ main (int argc, char **argv)
     printf ("|%s\n", fperfdata ("time", elapsed_time, "s", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0));
   }
   else if (result == STATE_WARNING)
-    printf (_("DNS WARNING - %s\n"),
-            !strcmp (msg, "") ? _(" Probably a non-existent host/domain") : msg);
+    printf (_("DNS WARNING - %s\n"), msg);
   else if (result == STATE_CRITICAL)
-    printf (_("DNS CRITICAL - %s\n"),
-            !strcmp (msg, "") ? _(" Probably a non-existent host/domain") : msg);
+    printf (_("DNS CRITICAL - %s\n"), msg);
   else
-    printf (_("DNS UNKNOWN - %s\n"),
-            !strcmp (msg, "") ? _(" Probably a non-existent host/domain") : msg);
+    printf (_("DNS UNKNOWN - %s\n"), msg);
 
   return result;
 }
 
 
+/* sorted, comma separated records of type from the answer section, or NULL */
+char *
+join_answers (np_dns_reply *reply, int type)
+{
+  char **answers = NULL;
+  char *joined, *p;
+  int n = 0, len = 1, i;
+
+  for (i = 0; i < reply->n_rr; i++) {
+    if (reply->rr[i].section != NP_DNS_ANSWER || reply->rr[i].type != type)
+      continue;
+    if (!(n % 10))
+      answers = realloc (answers, sizeof (*answers) * (n + 10));
+    answers[n++] = reply->rr[i].data;
+    len += strlen (reply->rr[i].data) + 1;
+  }
+  if (!n)
+    return NULL;
+
+  qsort (answers, n, sizeof (*answers), qstrcmp);
+  p = joined = malloc (len);
+  for (i = 0; i < n; i++) {
+    if (i) *p++ = ',';
+    strcpy (p, answers[i]);
+    p += strlen (answers[i]);
+  }
+  *p = '\0';
+  free (answers);
+  return joined;
+}
+
 
+/* OK if address is one of the -a values */
 int
-error_scan (char *input_buffer)
+check_expected (const char *address, char **msg)
 {
+  char *temp_buffer = "";
+  int result = STATE_CRITICAL;
+  int i;
+
+  for (i=0; i<expected_address_cnt; i++) {
+    /* check if we get a match and prepare an error string */
+    if (strcmp(address, expected_address[i]) == 0) result = STATE_OK;
+    xasprintf(&temp_buffer, "%s%s; ", temp_buffer, expected_address[i]);
+  }
+  if (result == STATE_CRITICAL) {
+    /* Strip off last semicolon... */
+    temp_buffer[strlen(temp_buffer)-2] = '\0';
+    xasprintf(msg, _("expected '%s' but got '%s'"), temp_buffer, address);
+  }
+  return result;
+}
 
-  /* the DNS lookup timed out */
-  if (strstr (input_buffer, _("Note: nslookup is deprecated and may be removed from future releases.")) ||
-      strstr (input_buffer, _("Consider using the `dig' or `host' programs instead.  Run nslookup with")) ||
-      strstr (input_buffer, _("the `-sil[ent]' option to prevent this message from appearing.")))
-    return STATE_OK;
 
-  /* DNS server is not running... */
-  else if (strstr (input_buffer, "No response from server"))
-    die (STATE_CRITICAL, _("No response from DNS %s\n"), dns_server);
+/* append text to a list joined by sep, freeing the old list */
+static void
+append_text (char **list, const char *sep, const char *text)
+{
+  char *old = *list;
 
-  /* Host name is valid, but server doesn't have records... */
-  else if (strstr (input_buffer, "No records"))
-    die (STATE_CRITICAL, _("DNS %s has no records\n"), dns_server);
+  xasprintf (list, "%s%s%s", old ? old : "", old ? sep : "", text);
+  free (old);
+}
 
-  /* Connection was refused */
-  else if (strstr (input_buffer, "Connection refused") ||
-     strstr (input_buffer, "Couldn't find server") ||
-           strstr (input_buffer, "Refused") ||
-           (strstr (input_buffer, "** server can't find") &&
-            strstr (input_buffer, ": REFUSED")))
-    die (STATE_CRITICAL, _("Connection to DNS %s was refused\n"), dns_server);
 
-  /* Query refused (usually by an ACL in the namserver) */
-  else if (strstr (input_buffer, "Query refused"))
-    die (STATE_CRITICAL, _("Query was refused by DNS server at %s\n"), dns_server);
+/* add a problem to the list and free its text */
+static void
+add_problem (char **problems, char *text)
+{
+  append_text (problems, "; ", text);
+  free (text);
+}
 
-  /* No information (e.g. nameserver IP has two PTR records) */
-  else if (strstr (input_buffer, "No information"))
-    die (STATE_CRITICAL, _("No information returned by DNS server at %s\n"), dns_server);
 
-  /* Host or domain name does not exist */
-  else if (strstr (input_buffer, "Non-existent") ||
-           strstr (input_buffer, "** server can't find") ||
-     strstr (input_buffer,"NXDOMAIN"))
-    die (STATE_CRITICAL, _("Domain %s was not found by the server\n"), query_address);
+/* ask all servers for all record types at once and compare their answers */
+int
+check_servers (void)
+{
+  np_dns_request *req;
+  np_dns_options opts;
+  np_dns_resolv resolv;
+  char **answers, *reverse, *text = NULL, *why, *problems = NULL, *agreed = NULL, *perf = NULL;
+  double *server_time, max_time = 0;
+  int result = STATE_OK, n, i, s, t, type;
+
+  if (n_servers == 0) {
+    np_dns_read_resolv_conf (NULL, &resolv);
+    dns_servers = malloc (sizeof (*dns_servers));
+    dns_servers[n_servers++] = resolv.server;
+  }
+  reverse = np_dns_reverse_name (query_address);
+  if (n_types == 0) {
+    query_types = malloc (sizeof (*query_types));
+    query_types[n_types++] = reverse ? NP_DNS_TYPE_PTR : NP_DNS_TYPE_A;
+  }
 
-  /* Network is unreachable */
-  else if (strstr (input_buffer, "Network is unreachable"))
-    die (STATE_CRITICAL, _("Network is unreachable\n"));
+  np_dns_init_options (&opts);
+  opts.port = server_port;
+  opts.retries = retries;
+  opts.timeout = timeout_interval * 1000 / (retries + 1);
+  alarm (timeout_interval + 1);
+
+  /* request t * n_servers + s asks server s for type t */
+  n = n_servers * n_types;
+  req = calloc (n, sizeof (*req));
+  answers = calloc (n, sizeof (*answers));
+  server_time = calloc (n_servers, sizeof (*server_time));
+  if (!req || !answers || !server_time)
+    die (STATE_UNKNOWN, _("DNS UNKNOWN - Could not allocate memory\n"));
+  for (i = 0; i < n; i++) {
+    req[i].server = dns_servers[i % n_servers];
+    req[i].type = query_types[i / n_servers];
+    req[i].name = reverse && req[i].type == NP_DNS_TYPE_PTR ? reverse : query_address;
+  }
 
-  /* Internal server failure */
-  else if (strstr (input_buffer, "Server failure"))
-    die (STATE_CRITICAL, _("DNS failure for %s\n"), dns_server);
+  np_dns_query_many (req, n, &opts);
+
+  for (i = 0; i < n; i++) {
+    s = i % n_servers;
+    type = req[i].type;
+    if (req[i].reply.time / 1.0e3 > server_time[s])
+      server_time[s] = req[i].reply.time / 1.0e3;
+
+    if (verbose) {
+      printf (_("%s %s %s: "), req[i].server, req[i].name, np_dns_type_name (type));
+      if (req[i].result != NP_DNS_OK)
+        printf ("%s\n", req[i].result == NP_DNS_ERROR ? strerror (req[i].error) : np_dns_strerror (req[i].result));
+      else
+        printf (_("%s in %.3f ms%s%s, %d tries\n"), np_dns_rcode_name (req[i].reply.rcode),
+                req[i].reply.time, req[i].reply.aa ? _(", authoritative") : "",
+                req[i].reply.tcp ? _(" over TCP") : "", req[i].reply.tries);
+    }
 
-  /* Request error or the DNS lookup timed out */
-  else if (strstr (input_buffer, "Format error") ||
-           strstr (input_buffer, "Timed out"))
-    return STATE_WARNING;
+    if (req[i].result == NP_DNS_ERROR) {
+      xasprintf (&text, _("%s %s: %s"), req[i].server, np_dns_type_name (type), strerror (req[i].error));
+      result = max_state (result, STATE_CRITICAL);
+    } else if (req[i].result != NP_DNS_OK) {
+      xasprintf (&text, _("%s %s: %s"), req[i].server, np_dns_type_name (type), np_dns_strerror (req[i].result));
+      result = max_state (result, req[i].result == NP_DNS_TIMEOUT ? STATE_CRITICAL : STATE_WARNING);
+    } else if (req[i].reply.rcode != NP_DNS_NOERROR) {
+      xasprintf (&text, _("%s: %s %s"), req[i].server, np_dns_type_name (type),
+                 np_dns_rcode_name (req[i].reply.rcode));
+      result = max_state (result, STATE_CRITICAL);
+    } else if ((answers[i] = join_answers (&req[i].reply, type)) == NULL) {
+      xasprintf (&text, _("%s has no %s records"), req[i].server, np_dns_type_name (type));
+      result = max_state (result, STATE_CRITICAL);
+    } else if (expected_address_cnt > 0 && check_expected (answers[i], &why) != STATE_OK) {
+      xasprintf (&text, _("%s %s: %s"), req[i].server, np_dns_type_name (type), why);
+      free (why);
+      result = max_state (result, STATE_CRITICAL);
+    } else if (expect_authority && !req[i].reply.aa) {
+      xasprintf (&text, _("server %s is not authoritative for %s"), req[i].server, req[i].name);
+      result = max_state (result, STATE_CRITICAL);
+    } else
+      continue;
+    add_problem (&problems, text);
+  }
 
-  return STATE_OK;
+  /* all servers that answered must give the same records */
+  for (t = 0; t < n_types; t++) {
+    char *first = NULL, *list = NULL, *entry;
+    int differ = FALSE;
+
+    for (s = 0; s < n_servers; s++) {
+      i = t * n_servers + s;
+      if (!answers[i])
+        continue;
+      if (!first)
+        first = answers[i];
+      else if (strcmp (first, answers[i]))
+        differ = TRUE;
+      xasprintf (&entry, "%s: %s", req[i].server, answers[i]);
+      append_text (&list, "; ", entry);
+      free (entry);
+    }
+    if (differ) {
+      xasprintf (&text, _("%s answers differ (%s)"), np_dns_type_name (query_types[t]), list);
+      add_problem (&problems, text);
+      result = max_state (result, STATE_CRITICAL);
+    } else if (first) {
+      xasprintf (&entry, "%s %s", np_dns_type_name (query_types[t]), first);
+      append_text (&agreed, ", ", entry);
+      free (entry);
+    }
+    free (list);
+  }
 
+  for (s = 0; s < n_servers; s++) {
+    char *label;
+
+    result = max_state (result, get_status (server_time[s], time_thresholds));
+    if (server_time[s] > max_time)
+      max_time = server_time[s];
+    xasprintf (&label, "time_%s", dns_servers[s]);
+    text = fperfdata (label, server_time[s], "s", FALSE, 0, FALSE, 0, TRUE, 0, FALSE, 0);
+    append_text (&perf, " ", text);
+    free (text);
+    free (label);
+  }
+
+  if (problems)
+    printf ("DNS %s - %s", state_text (result), problems);
+  else
+    printf (_("DNS %s: %d servers agree on %s: %s, %.3f seconds max response time"),
+            state_text (result), n_servers, query_address, agreed ? agreed : "", max_time);
+  printf ("|%s\n", perf);
+
+  return result;
+}
+
+
+
+/* add a server or a comma separated list of them */
+static void
+add_servers (char *list)
+{
+  char *server;
+
+  for (server = strtok (list, ","); server; server = strtok (NULL, ",")) {
+    /* TODO: this host_or_die check is probably unnecessary */
+    host_or_die (server);
+    if (strlen (server) >= ADDRESS_LENGTH)
+      die (STATE_UNKNOWN, _("Input buffer overflow\n"));
+    dns_servers = realloc (dns_servers, (n_servers + 1) * sizeof (*dns_servers));
+    dns_servers[n_servers++] = strdup (server);
+  }
+  if (n_servers)
+    strcpy (dns_server, dns_servers[0]);
 }
 
 
@@ -321,7 +479,8 @@ error_scan (char *input_buffer)
 int
 process_arguments (int argc, char **argv)
 {
-  int c;
+  int c, type;
+  char *ptr;
   char *warning = NULL;
   char *critical = NULL;
 
@@ -333,6 +492,9 @@ process_arguments (int argc, char **argv)
     {"timeout", required_argument, 0, 't'},
     {"hostname", required_argument, 0, 'H'},
     {"server", required_argument, 0, 's'},
+    {"port", required_argument, 0, 'p'},
+    {"retries", required_argument, 0, 'R'},
+    {"querytype", required_argument, 0, 'q'},
     {"reverse-server", required_argument, 0, 'r'},
     {"expected-address", required_argument, 0, 'a'},
     {"expect-authority", no_argument, 0, 'A'},
@@ -349,7 +511,7 @@ process_arguments (int argc, char **argv)
       strcpy (argv[c], "-t");
 
   while (1) {
-    c = getopt_long (argc, argv, "hVvAt:H:s:r:a:w:c:", long_opts, &opt_index);
+    c = getopt_long (argc, argv, "hVvAt:H:s:p:R:q:r:a:w:c:", long_opts, &opt_index);
 
     if (c == -1 || c == EOF)
       break;
@@ -372,13 +534,25 @@ process_arguments (int argc, char **argv)
         die (STATE_UNKNOWN, _("Input buffer overflow\n"));
       strcpy (query_address, optarg);
       break;
-    case 's': /* server name */
-      /* TODO: this host_or_die check is probably unnecessary.
-       * Better to confirm nslookup response matches */
-      host_or_die(optarg);
-      if (strlen (optarg) >= ADDRESS_LENGTH)
-        die (STATE_UNKNOWN, _("Input buffer overflow\n"));
-      strcpy (dns_server, optarg);
+    case 's': /* server name(s) */
+      add_servers (optarg);
+      break;
+    case 'q': /* record type(s) */
+      for (ptr = strtok (optarg, ","); ptr; ptr = strtok (NULL, ",")) {
+        if ((type = np_dns_type (ptr)) <= 0 || type > 65535 || type == NP_DNS_TYPE_OPT)
+          usage2 (_("Unknown record type"), ptr);
+        query_types = realloc (query_types, (n_types + 1) * sizeof (*query_types));
+        query_types[n_types++] = type;
+      }
+      break;
+    case 'p': /* server port */
+      if (!is_intpos (optarg) || (server_port = atoi (optarg)) > 65535)
+        usage2 (_("Port must be a positive integer"), optarg);
+      break;
+    case 'R': /* retries */
+      if (!is_intnonneg (optarg))
+        usage2 (_("Retries must be a non-negative integer"), optarg);
+      retries = atoi (optarg);
       break;
     case 'r': /* reverse server name */
       /* TODO: Is this host_or_die necessary? */
@@ -415,13 +589,8 @@ process_arguments (int argc, char **argv)
     strcpy (query_address, argv[c++]);
   }
 
-  if (strlen(dns_server)==0 && c<argc) {
-    /* TODO: See -s option */
-    host_or_die(argv[c]);
-    if (strlen(argv[c]) >= ADDRESS_LENGTH)
-      die (STATE_UNKNOWN, _("Input buffer overflow\n"));
-    strcpy (dns_server, argv[c++]);
-  }
+  if (n_servers==0 && c<argc)
+    add_servers (argv[c++]);
 
   set_thresholds(&time_thresholds, warning, critical);
 
@@ -447,8 +616,8 @@ print_help (void)
   printf ("Copyright (c) 1999 Ethan Galstad <nagios@nagios.org>\n");
   printf (COPYRIGHT, copyright, email);
 
-  printf ("%s\n", _("This plugin uses the nslookup program to obtain the IP address for the given host/domain query."));
-  printf ("%s\n", _("An optional DNS server to use may be specified."));
+  printf ("%s\n", _("This plugin queries a DNS server to obtain the IP address for the given host/domain query,"));
+  printf ("%s\n", _("or the host name for the given address. An optional DNS server to use may be specified."));
   printf ("%s\n", _("If no DNS server is specified, the default server(s) specified in /etc/resolv.conf will be used."));
 
   printf ("\n\n");
@@ -460,8 +629,16 @@ print_help (void)
 
   printf (" -H, --hostname=HOST\n");
   printf ("    %s\n", _("The name or address you want to query"));
-  printf (" -s, --server=HOST\n");
-  printf ("    %s\n", _("Optional DNS server you want to use for the lookup"));
+  printf (" -s, --server=HOST[,HOST...]\n");
+  printf ("    %s\n", _("Optional DNS server you want to use for the lookup. With several servers"));
+  printf ("    %s\n", _("(comma separated or repeated -s), all are asked at once and must agree"));
+  printf (" -q, --querytype=TYPE[,TYPE...]\n");
+  printf ("    %s\n", _("Record types to ask every server for at once, like A, AAAA, MX, NS or TXT"));
+  printf (" -p, --port=INTEGER\n");
+  printf ("    %s (%s: %d)\n", _("Port number of the DNS server"), _("default"), NP_DNS_PORT);
+  printf (" -R, --retries=INTEGER\n");
+  printf ("    %s (%s: %d)\n", _("Queries to resend if there is no answer"), _("default"), retries);
+  printf ("    %s\n", _("The tries share the timeout, a reply too large for UDP is asked again over TCP"));
   printf (" -a, --expected-address=IP-ADDRESS|HOST\n");
   printf ("    %s\n", _("Optional IP-ADDRESS you expect the DNS server to return. HOST must end with"));
   printf ("    %s\n", _("a dot (.). This option can be repeated multiple times (Returns OK if any"));
@@ -476,6 +653,14 @@ print_help (void)
 
   printf (UT_TIMEOUT, DEFAULT_SOCKET_TIMEOUT);
 
+  printf ("\n");
+  printf ("%s\n", _("Notes:"));
+  printf (" %s\n", _("Addresses are looked up with a PTR query. Names without a dot are tried with the"));
+  printf (" %s\n", _("search domains of /etc/resolv.conf first, names with no A record are asked for AAAA."));
+  printf (" %s\n", _("With several servers or -q, the name is asked as it is and the answers for each type"));
+  printf (" %s\n", _("must be the same on all servers. -a then applies to every type, -A to every server and"));
+  printf (" %s\n", _("-w/-c to the slowest answer of each server, with one time perfdata value per server."));
+
   printf (UT_SUPPORT);
 }
 
@@ -484,5 +669,6 @@ void
 print_usage (void)
 {
   printf ("%s\n", _("Usage:"));
-  printf ("%s -H host [-s server] [-a expected-address] [-A] [-t timeout] [-w warn] [-c crit]\n", progname);
+  printf ("%s -H host [-s server[,server...]] [-q type[,type...]] [-p port] [-R retries]\n", progname);
+  printf ("  [-a expected-address] [-A] [-t timeout] [-w warn] [-c crit]\n");
 }
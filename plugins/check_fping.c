@@ -45,13 +45,41 @@ enum {
   RTA = 1
 };
 
+/* a target of a multi-target run */
+typedef struct fping_target {
+  char *name;
+  int state;
+  int seen;                   /* a summary line was parsed */
+  double loss;
+  double rta;                 /* ms, negative if nothing came back */
+  char *error;                /* e.g. fping couldn't resolve it */
+} fping_target;
+
+/* output of one of fping's pipes that isn't a whole line yet */
+typedef struct line_buffer {
+  int fd;
+  char buf[MAX_INPUT_BUFFER];
+  size_t len;
+} line_buffer;
+
 int textscan (char *buf);
+int run_multi (void);
+void scan_summary (char *buf);
+fping_target *find_target (const char *name, size_t len);
+void add_target (const char *name);
+void read_target_file (const char *path);
 int process_arguments (int, char **);
 int get_threshold (char *arg, char *rv[2]);
 void print_help (void);
 void print_usage (void);
 
 char *server_name = NULL;
+fping_target *targets = NULL;
+int n_targets = 0;
+int max_targets = 0;
+int last_target = -1;
+int walive = -1;
+int calive = -1;
 int packet_size = PACKET_SIZE;
 int packet_count = PACKET_COUNT;
 int target_timeout = 0;
@@ -88,6 +116,9 @@ main (int argc, char **argv)
   if (process_arguments (argc, argv) == ERROR)
     usage4 (_("Could not parse arguments"));
 
+  if (n_targets > 1 || walive >= 0)
+    return run_multi ();
+
   server = strscpy (server, server_name);
 
   /* compose the command */
@@ -222,12 +253,278 @@ textscan (char *buf)
 
 
 
+/* check all targets with a single fping run. -q leaves only the per-target
+ * summaries, which are parsed as fping writes them out */
+int
+run_multi (void)
+{
+  line_buffer lines[2];
+  struct pollfd pfds[2];
+  char *command_line = NULL;
+  char *option_string = "";
+  char *targets_string = "";
+  char *problems = "";
+  char *perf = "";
+  char *end;
+  ssize_t got;
+  int status = STATE_OK;
+  int alive = 0;
+  int fping_result;
+  int i, open_fds;
+  fping_target *t;
+
+  for (i = 0; i < n_targets; i++)
+    xasprintf (&targets_string, "%s %s", targets_string, targets[i].name);
+
+  if (target_timeout)
+    xasprintf(&option_string, "%s-t %d ", option_string, target_timeout);
+  if (packet_interval)
+    xasprintf(&option_string, "%s-p %d ", option_string, packet_interval);
+
+  xasprintf (&command_line, "%s %s-q -b %d -c %d%s", PATH_TO_FPING,
+            option_string, packet_size, packet_count, targets_string);
+
+  if (verbose)
+    printf ("%s\n", command_line);
+
+  child_process = spopen (command_line);
+  if (child_process == NULL) {
+    printf (_("Could not open pipe: %s\n"), command_line);
+    return STATE_UNKNOWN;
+  }
+
+  lines[0].fd = fileno (child_process);
+  lines[1].fd = child_stderr_array[lines[0].fd];
+  lines[0].len = lines[1].len = 0;
+
+  /* fping writes the summaries to stderr. Both pipes are drained so that
+   * neither can fill up and stall it */
+  for (open_fds = 2; open_fds;) {
+    for (i = 0; i < 2; i++) {
+      pfds[i].fd = lines[i].fd;
+      pfds[i].events = POLLIN;
+      pfds[i].revents = 0;
+    }
+    if (poll (pfds, 2, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      die (STATE_UNKNOWN, _("poll() failed: %s\n"), strerror (errno));
+    }
+
+    for (i = 0; i < 2; i++) {
+      if (!pfds[i].revents)
+        continue;
+      got = read (lines[i].fd, lines[i].buf + lines[i].len,
+                  sizeof (lines[i].buf) - lines[i].len - 1);
+      if (got < 0 && errno == EINTR)
+        continue;
+      if (got <= 0) {
+        /* poll() ignores negative descriptors */
+        lines[i].fd = -1;
+        open_fds--;
+        /* a last line without a newline */
+        if (lines[i].len) {
+          lines[i].buf[lines[i].len] = '\0';
+          scan_summary (lines[i].buf);
+          lines[i].len = 0;
+        }
+        continue;
+      }
+      lines[i].len += got;
+      lines[i].buf[lines[i].len] = '\0';
+      while ((end = strchr (lines[i].buf, '\n')) != NULL) {
+        *end = '\0';
+        scan_summary (lines[i].buf);
+        lines[i].len -= end + 1 - lines[i].buf;
+        memmove (lines[i].buf, end + 1, lines[i].len + 1);
+      }
+      /* overlong lines are cut, as fgets() would have */
+      if (lines[i].len == sizeof (lines[i].buf) - 1) {
+        scan_summary (lines[i].buf);
+        lines[i].len = 0;
+      }
+    }
+  }
+  close (child_stderr_array[fileno (child_process)]);
+
+  /* 1 and 2 only mean some targets were unreachable or unknown */
+  fping_result = spclose (child_process);
+  if (fping_result > 2)
+    die (STATE_UNKNOWN, _("FPING UNKNOWN - %s returned %d\n"), PATH_TO_FPING,
+         fping_result);
+
+  for (i = 0; i < n_targets; i++) {
+    t = &targets[i];
+    if (t->error)
+      t->state = STATE_CRITICAL;
+    else if (!t->seen)
+      t->state = STATE_UNKNOWN;
+    else if (t->loss >= 100)
+      t->state = STATE_CRITICAL;
+    else if (cpl_p == TRUE && t->loss > cpl)
+      t->state = STATE_CRITICAL;
+    else if (crta_p == TRUE && t->rta > crta)
+      t->state = STATE_CRITICAL;
+    else if (wpl_p == TRUE && t->loss > wpl)
+      t->state = STATE_WARNING;
+    else if (wrta_p == TRUE && t->rta > wrta)
+      t->state = STATE_WARNING;
+    else
+      t->state = STATE_OK;
+
+    if (t->state != STATE_CRITICAL && t->state != STATE_UNKNOWN)
+      alive++;
+    if (walive < 0)
+      status = max_state_alt (status, t->state);
+
+    if (t->error)
+      xasprintf (&problems, "%s, %s: %s", problems, t->name, t->error);
+    else if (!t->seen)
+      xasprintf (&problems, "%s, %s: %s", problems, t->name, _("no result"));
+    else if (t->state != STATE_OK && t->rta >= 0)
+      xasprintf (&problems, "%s, %s: loss=%.0f%%, rta=%f ms", problems, t->name, t->loss, t->rta);
+    else if (t->state != STATE_OK)
+      xasprintf (&problems, "%s, %s: loss=%.0f%%", problems, t->name, t->loss);
+
+    if (verbose)
+      printf ("%s: %s\n", t->name, state_text (t->state));
+
+    if (!t->seen)
+      continue;
+    xasprintf (&perf, "%s%s%s ", perf, t->name,
+               perfdata ("loss", (long int)t->loss, "%", wpl_p, wpl, cpl_p, cpl, TRUE, 0, TRUE, 100));
+    if (t->rta >= 0)
+      xasprintf (&perf, "%s%s%s ", perf, t->name,
+                 fperfdata ("rta", t->rta/1.0e3, "s", wrta_p, wrta/1.0e3, crta_p, crta/1.0e3, TRUE, 0, FALSE, 0));
+  }
+
+  /* with -a, only the number of targets alive counts */
+  if (walive >= 0) {
+    if (alive < calive)
+      status = STATE_CRITICAL;
+    else if (alive < walive)
+      status = STATE_WARNING;
+  }
+
+  printf (_("FPING %s - %d of %d alive%s|%salive=%d;;;0;%d\n"),
+          state_text (status), alive, n_targets, problems, perf,
+          alive, n_targets);
+
+  return status;
+}
+
+
+
+/* fping -q prints "target : xmt/rcv/%loss = 1/1/0%, min/avg/max = ..." for
+ * each target, and "target: <reason>" for those it couldn't ping at all */
+void
+scan_summary (char *buf)
+{
+  fping_target *t;
+  char *p;
+  size_t len;
+  int xmt, rcv;
+
+  if (verbose)
+    printf ("%s\n", buf);
+
+  len = strcspn (buf, " :");
+  if (!len || !(t = find_target (buf, len)))
+    return;
+
+  if ((p = strstr (buf, "xmt/rcv/%loss = ")) != NULL) {
+    if (sscanf (p, "xmt/rcv/%%loss = %d/%d/%lf%%", &xmt, &rcv, &t->loss) != 3)
+      return;
+    t->seen = TRUE;
+    t->rta = -1;
+    if ((p = strstr (p, "min/avg/max = ")) != NULL)
+      sscanf (p, "min/avg/max = %*f/%lf", &t->rta);
+  }
+  else if (!t->seen && !t->error) {
+    p = buf + len;
+    p += strspn (p, " :");
+    t->error = strdup (*p ? p : _("not found"));
+  }
+}
+
+
+
+/* fping reports targets in the order given, so the one after the last
+ * match is tried first */
+fping_target *
+find_target (const char *name, size_t len)
+{
+  int i, j;
+
+  for (i = 0; i < n_targets; i++) {
+    j = (last_target + 1 + i) % n_targets;
+    if (strlen (targets[j].name) == len && !strncmp (targets[j].name, name, len)) {
+      last_target = j;
+      return &targets[j];
+    }
+  }
+  return NULL;
+}
+
+
+
+void
+add_target (const char *name)
+{
+  int i;
+
+  /* fping would only check a duplicate once */
+  for (i = 0; i < n_targets; i++)
+    if (!strcmp (targets[i].name, name))
+      return;
+
+  if (n_targets == max_targets) {
+    max_targets = max_targets ? max_targets * 2 : 16;
+    targets = realloc (targets, sizeof (fping_target) * max_targets);
+    if (targets == NULL)
+      die (STATE_UNKNOWN, _("Could not realloc() targets\n"));
+  }
+  memset (&targets[n_targets], 0, sizeof (fping_target));
+  targets[n_targets].name = strdup (name);
+  targets[n_targets].rta = -1;
+  n_targets++;
+}
+
+
+
+/* one target per line. Blank lines and lines starting with # are skipped.
+ * Names aren't looked up here: fping resolves them and reports failures */
+void
+read_target_file (const char *path)
+{
+  char buf[MAX_INPUT_BUFFER];
+  char *name;
+  FILE *fp;
+
+  if ((fp = fopen (path, "r")) == NULL)
+    die (STATE_UNKNOWN, _("Cannot open %s: %s\n"), path, strerror (errno));
+
+  while (fgets (buf, sizeof (buf), fp)) {
+    name = buf + strspn (buf, " \t");
+    name[strcspn (name, " \t\r\n#")] = '\0';
+    if (!*name)
+      continue;
+    if (strpbrk (name, "'\"\\"))
+      usage2 (_("Invalid hostname/address"), name);
+    add_target (name);
+  }
+  fclose (fp);
+}
+
+
+
 /* process command-line arguments */
 int
 process_arguments (int argc, char **argv)
 {
   int c;
   char *rv[2];
+  char *host;
 
   int option = 0;
   static struct option longopts[] = {
@@ -238,6 +535,8 @@ process_arguments (int argc, char **argv)
     {"number", required_argument, 0, 'n'},
     {"target-timeout", required_argument, 0, 'T'},
     {"interval", required_argument, 0, 'i'},
+    {"target-file", required_argument, 0, 'f'},
+    {"alive", required_argument, 0, 'a'},
     {"verbose", no_argument, 0, 'v'},
     {"version", no_argument, 0, 'V'},
     {"help", no_argument, 0, 'h'},
@@ -258,7 +557,7 @@ process_arguments (int argc, char **argv)
   }
 
   while (1) {
-    c = getopt_long (argc, argv, "+hVvH:c:w:b:n:T:i:", longopts, &option);
+    c = getopt_long (argc, argv, "+hVvH:c:w:b:n:T:i:f:a:", longopts, &option);
 
     if (c == -1 || c == EOF || c == 1)
       break;
@@ -275,11 +574,25 @@ process_arguments (int argc, char **argv)
     case 'v':                 /* verbose mode */
       verbose = TRUE;
       break;
-    case 'H':                 /* hostname */
-      if (is_host (optarg) == FALSE) {
-        usage2 (_("Invalid hostname/address"), optarg);
+    case 'H':                 /* hostname(s) */
+      for (host = strtok (optarg, ","); host; host = strtok (NULL, ",")) {
+        if (is_host (host) == FALSE) {
+          usage2 (_("Invalid hostname/address"), host);
+        }
+        server_name = strscpy (server_name, host);
+        add_target (host);
       }
-      server_name = strscpy (server_name, optarg);
+      break;
+    case 'f':                 /* file of targets */
+      read_target_file (optarg);
+      break;
+    case 'a':                 /* targets alive */
+      if (sscanf (optarg, "%d,%d", &walive, &calive) < 1 || walive < 0)
+        usage (_("Alive thresholds must be <warn>[,<crit>] target counts"));
+      if (calive < 0)
+        calive = walive ? 1 : 0;
+      else if (calive > walive)
+        usage (_("Critical alive threshold can't be above the warning one"));
       break;
     case 'c':
       get_threshold (optarg, rv);
@@ -334,8 +647,14 @@ process_arguments (int argc, char **argv)
     }
   }
 
-  if (server_name == NULL)
+  /* the old syntax had the host as the first argument */
+  if (server_name != NULL && n_targets == 0)
+    add_target (server_name);
+
+  if (n_targets == 0)
     usage4 (_("Hostname was not supplied"));
+  else if (n_targets == 1)
+    server_name = targets[0].name;
 
   return OK;
 }
@@ -404,6 +723,12 @@ print_help (void)
 
   printf (" %s\n", "-H, --hostname=HOST");
   printf ("    %s\n", _("name or IP Address of host to ping (IP Address bypasses name lookup, reducing system load)"));
+  printf ("    %s\n", _("May be given more than once, or as a comma separated list"));
+  printf (" %s\n", "-f, --target-file=FILE");
+  printf ("    %s\n", _("read the hosts to ping from FILE, one per line"));
+  printf (" %s\n", "-a, --alive=WARN[,CRIT]");
+  printf ("    %s\n", _("WARNING if fewer than WARN hosts are alive, CRITICAL if fewer than CRIT"));
+  printf ("    %s\n", _("(CRIT defaults to 1)"));
   printf (" %s\n", "-w, --warning=THRESHOLD");
   printf ("    %s\n", _("warning threshold pair"));
   printf (" %s\n", "-c, --critical=THRESHOLD");
@@ -421,6 +746,10 @@ print_help (void)
   printf (" %s\n", _("THRESHOLD is <rta>,<pl>%% where <rta> is the round trip average travel time (ms)"));
   printf (" %s\n", _("which triggers a WARNING or CRITICAL state, and <pl> is the percentage of"));
   printf (" %s\n", _("packet loss to trigger an alarm state."));
+  printf ("\n");
+  printf (" %s\n", _("Several hosts are all pinged by a single fping run. Each host is checked"));
+  printf (" %s\n", _("against the thresholds, and the worst result is returned. With -a, only"));
+  printf (" %s\n", _("the number of hosts alive (not CRITICAL) is compared to its thresholds."));
 
   printf (UT_SUPPORT);
 }
@@ -431,4 +760,5 @@ print_usage (void)
 {
   printf ("%s\n", _("Usage:"));
   printf (" %s <host_address> -w limit -c limit [-b size] [-n number] [-T number] [-i number]\n", progname);
+  printf (" %s -H host[,host...] | -f file [-a warn[,crit]] [-w limit] [-c limit] [...]\n", progname);
 }
@@ -10,7 +10,7 @@
 * This file contains the check_hpjd plugin
 * 
 * This plugin tests the STATUS of an HP printer with a JetDirect card.
-* Net-SNMP must be installed on the computer running the plugin.
+* It asks for all the status OIDs in one SNMPv1 request.
 * 
 * 
 * This program is free software: you can redistribute it and/or modify
@@ -34,14 +34,15 @@ const char *copyright = "2000-2007";
 const char *email = "nagiosplug-devel@lists.sourceforge.net";
 
 #include "common.h"
-#include "popen.h"
 #include "utils.h"
 #include "netutils.h"
+#include "utils_snmp.h"
 
 #define DEFAULT_COMMUNITY "public"
+#define DEFAULT_PORT "161"
 
 
-const char *option_summary = "-H host [-C community]\n";
+const char *option_summary = "-H host [-C community] [-p port]\n";
 
 #define HPJD_LINE_STATUS           ".1.3.6.1.4.1.11.2.3.9.1.1.2.1"
 #define HPJD_PAPER_STATUS          ".1.3.6.1.4.1.11.2.3.9.1.1.2.2"
@@ -59,6 +60,38 @@ const char *option_summary = "-H host [-C community]\n";
 #define ONLINE		0
 #define OFFLINE		1
 
+/* what is asked for, in this order; the answers are found by their OID */
+enum {
+	LINE_STATUS,
+	PAPER_STATUS,
+	INTERVENTION_REQUIRED,
+	PERIPHERAL_ERROR,
+	PAPER_JAM,
+	PAPER_OUT,
+	TONER_LOW,
+	PAGE_PUNT,
+	MEMORY_OUT,
+	DOOR_OPEN,
+	PAPER_OUTPUT,
+	STATUS_DISPLAY,
+	HPJD_OIDS
+};
+
+static const char *hpjd_oids[HPJD_OIDS] = {
+	HPJD_LINE_STATUS ".0",
+	HPJD_PAPER_STATUS ".0",
+	HPJD_INTERVENTION_REQUIRED ".0",
+	HPJD_GD_PERIPHERAL_ERROR ".0",
+	HPJD_GD_PAPER_JAM ".0",
+	HPJD_GD_PAPER_OUT ".0",
+	HPJD_GD_TONER_LOW ".0",
+	HPJD_GD_PAGE_PUNT ".0",
+	HPJD_GD_MEMORY_OUT ".0",
+	HPJD_GD_DOOR_OPEN ".0",
+	HPJD_GD_PAPER_OUTPUT ".0",
+	HPJD_GD_STATUS_DISPLAY ".0"
+};
+
 int process_arguments (int, char **);
 int validate_arguments (void);
 void print_help (void);
@@ -66,31 +99,22 @@ void print_usage (void);
 
 char *community = NULL;
 char *address = NULL;
+char *port = NULL;
 
 int
 main (int argc, char **argv)
 {
-	char command_line[1024];
 	int result = STATE_UNKNOWN;
-	int line;
-	char input_buffer[MAX_INPUT_BUFFER];
-	char query_string[512];
 	char *errmsg;
-	char *temp_buffer;
-	int line_status = ONLINE;
-	int paper_status = 0;
-	int intervention_required = 0;
-	int peripheral_error = 0;
-	int paper_jam = 0;
-	int paper_out = 0;
-	int toner_low = 0;
-	int page_punt = 0;
-	int memory_out = 0;
-	int door_open = 0;
-	int paper_output = 0;
-	char display_message[MAX_INPUT_BUFFER];
-
-	errmsg = malloc(MAX_INPUT_BUFFER);
+	np_snmp_options opts;
+	np_snmp_oid query[HPJD_OIDS];
+	np_snmp_pdu response;
+	np_snmp_varbind *vb;
+	long status[HPJD_OIDS];
+	int line_status, paper_status, intervention_required, peripheral_error, paper_jam,
+	    paper_out, toner_low, page_punt, memory_out, door_open, paper_output;
+	char *display_message = "";
+	int i, j;
 
 	setlocale (LC_ALL, "");
 	bindtextdomain (PACKAGE, LOCALEDIR);
@@ -102,134 +126,62 @@ main (int argc, char **argv)
 	if (process_arguments (argc, argv) == ERROR)
 		usage4 (_("Could not parse arguments"));
 
-	/* removed ' 2>1' at end of command 10/27/1999 - EG */
-	/* create the query string */
-	sprintf
-		(query_string,
-		 "%s.0 %s.0 %s.0 %s.0 %s.0 %s.0 %s.0 %s.0 %s.0 %s.0 %s.0 %s.0",
-		 HPJD_LINE_STATUS,
-		 HPJD_PAPER_STATUS,
-		 HPJD_INTERVENTION_REQUIRED,
-		 HPJD_GD_PERIPHERAL_ERROR,
-		 HPJD_GD_PAPER_JAM,
-		 HPJD_GD_PAPER_OUT,
-		 HPJD_GD_TONER_LOW,
-		 HPJD_GD_PAGE_PUNT,
-		 HPJD_GD_MEMORY_OUT,
-		 HPJD_GD_DOOR_OPEN, HPJD_GD_PAPER_OUTPUT, HPJD_GD_STATUS_DISPLAY);
-
-	/* get the command to run */
-	sprintf (command_line, "%s -OQa -m : -v 1 -c %s %s %s", PATH_TO_SNMPGET, community,
-									address, query_string);
-
-	/* run the command */
-	child_process = spopen (command_line);
-	if (child_process == NULL) {
-		printf (_("Could not open pipe: %s\n"), command_line);
-		return STATE_UNKNOWN;
-	}
-
-	child_stderr = fdopen (child_stderr_array[fileno (child_process)], "r");
-	if (child_stderr == NULL) {
-		printf (_("Could not open stderr for %s\n"), command_line);
-	}
-
-	result = STATE_OK;
-
-	line = 0;
-	while (fgets (input_buffer, MAX_INPUT_BUFFER - 1, child_process)) {
-
-		/* strip the newline character from the end of the input */
-		if (input_buffer[strlen (input_buffer) - 1] == '\n')
-			input_buffer[strlen (input_buffer) - 1] = 0;
-
-		line++;
-
-		temp_buffer = strtok (input_buffer, "=");
-		temp_buffer = strtok (NULL, "=");
-
-		if (temp_buffer == NULL && line < 13) {
-
-				result = STATE_UNKNOWN;
-				strcpy (errmsg, input_buffer);
-
-		} else {
-
-			switch (line) {
-
-			case 1:										/* 1st line should contain the line status */
-				line_status = atoi (temp_buffer);
-				break;
-			case 2:										/* 2nd line should contain the paper status */
-				paper_status = atoi (temp_buffer);
-				break;
-			case 3:										/* 3rd line should be intervention required */
-				intervention_required = atoi (temp_buffer);
-				break;
-			case 4:										/* 4th line should be peripheral error */
-				peripheral_error = atoi (temp_buffer);
-				break;
-			case 5:										/* 5th line should contain the paper jam status */
-				paper_jam = atoi (temp_buffer);
-				break;
-			case 6:										/* 6th line should contain the paper out status */
-				paper_out = atoi (temp_buffer);
-				break;
-			case 7:										/* 7th line should contain the toner low status */
-				toner_low = atoi (temp_buffer);
-				break;
-			case 8:										/* did data come too slow for engine */
-				page_punt = atoi (temp_buffer);
-				break;
-			case 9:										/* did we run out of memory */
-				memory_out = atoi (temp_buffer);
-				break;
-			case 10:										/* is there a door open */
-				door_open = atoi (temp_buffer);
-				break;
-			case 11:										/* is output tray full */
-				paper_output = atoi (temp_buffer);
-				break;
-			case 12:										/* display panel message */
-				strcpy (display_message, temp_buffer + 1);
-				break;
-			default:										/* fold multiline message */
-				strncat (display_message, input_buffer,
-						sizeof (display_message) - strlen (display_message) - 1);
-			}
+	for (i = 0; i < HPJD_OIDS; i++)
+		np_snmp_parse_oid (hpjd_oids[i], &query[i]);
 
-		}
+	np_snmp_init_options (&opts);
+	opts.community = community;
+	opts.port = atoi (port);
 
-		/* break out of the read loop if we encounter an error */
-		if (result != STATE_OK)
-			break;
+	/* all of them in one request, as snmpget used to ask */
+	result = np_snmp_request (address, &opts, NP_SNMP_GET, 0, 0, query, HPJD_OIDS, &response);
+	/* if printer could not be reached, escalate to critical */
+	if (result == NP_SNMP_TIMEOUT) {
+		printf (_("Timeout: No Response from %s\n"), address);
+		return STATE_CRITICAL;
 	}
-
-	/* WARNING if output found on stderr */
-	if (fgets (input_buffer, MAX_INPUT_BUFFER - 1, child_stderr)) {
-		result = max_state (result, STATE_WARNING);
-		/* remove CRLF */
-		if (input_buffer[strlen (input_buffer) - 1] == '\n')
-			input_buffer[strlen (input_buffer) - 1] = 0;
-		sprintf (errmsg, "%s", input_buffer );
-
+	if (result != NP_SNMP_OK) {
+		printf (_("SNMP request to %s failed: %s\n"), address, np_snmp_strerror (result));
+		return result == NP_SNMP_ERROR ? STATE_CRITICAL : STATE_UNKNOWN;
+	}
+	if (response.error_status != NP_SNMP_NOERROR) {
+		printf (_("Error in packet: %s, failed object: %s\n"),
+		        np_snmp_error_name (response.error_status),
+		        response.error_index > 0 && response.error_index <= HPJD_OIDS ?
+		        hpjd_oids[response.error_index - 1] : "-");
+		return STATE_UNKNOWN;
 	}
 
-	/* close stderr */
-	(void) fclose (child_stderr);
-
-	/* close the pipe */
-	if (spclose (child_process))
-		result = max_state (result, STATE_WARNING);
-
-	/* if there wasn't any output, display an error */
-	if (line == 0) {
+	/* match the answers to what was asked by OID, not by their place */
+	for (i = 0; i < HPJD_OIDS; i++) {
+		for (vb = NULL, j = 0; j < response.n_vb && !vb; j++) {
+			if (np_snmp_oid_compare (&response.vb[j].oid, &query[i]) == 0)
+				vb = &response.vb[j];
+		}
+		if (i == STATUS_DISPLAY && vb && vb->type == NP_SNMP_OCTET_STRING)
+			display_message = (char *)vb->data;
+		else if (i != STATUS_DISPLAY && vb && vb->type == NP_SNMP_INTEGER)
+			status[i] = vb->integer;
+		else {
+			printf (_("No valid data returned for %s\n"), hpjd_oids[i]);
+			return STATE_UNKNOWN;
+		}
+	}
 
-		/* might not be the problem, but most likely is. */
-		result = STATE_UNKNOWN ;
-		xasprintf (&errmsg, "%s : Timeout from host %s\n", errmsg, address );
+	line_status = status[LINE_STATUS];
+	paper_status = status[PAPER_STATUS];
+	intervention_required = status[INTERVENTION_REQUIRED];
+	peripheral_error = status[PERIPHERAL_ERROR];
+	paper_jam = status[PAPER_JAM];
+	paper_out = status[PAPER_OUT];
+	toner_low = status[TONER_LOW];
+	page_punt = status[PAGE_PUNT];
+	memory_out = status[MEMORY_OUT];
+	door_open = status[DOOR_OPEN];
+	paper_output = status[PAPER_OUTPUT];
 
-	}
+	result = STATE_OK;
+	errmsg = malloc (MAX_INPUT_BUFFER);
 
 	/* if we had no read errors, check the printer status results... */
 	if (result == STATE_OK) {
@@ -243,7 +195,7 @@ main (int argc, char **argv)
 			strcpy (errmsg, _("Out of Paper"));
 		}
 		else if (line_status == OFFLINE) {
-			if (strcmp (errmsg, "POWERSAVE ON") != 0) {
+			if (strcmp (display_message, "POWERSAVE ON") != 0) {
 				result = STATE_WARNING;
 				strcpy (errmsg, _("Printer Offline"));
 			}
@@ -284,19 +236,10 @@ main (int argc, char **argv)
 
 	if (result == STATE_OK)
 		printf (_("Printer ok - (%s)\n"), display_message);
-
-	else if (result == STATE_UNKNOWN) {
-
-		printf ("%s\n", errmsg);
-
-		/* if printer could not be reached, escalate to critical */
-		if (strstr (errmsg, "Timeout"))
-			result = STATE_CRITICAL;
-	}
-
-	else if (result == STATE_WARNING)
+	else
 		printf ("%s (%s)\n", errmsg, display_message);
 
+	np_snmp_free_pdu (&response);
 	return result;
 }
 
@@ -313,7 +256,7 @@ process_arguments (int argc, char **argv)
 		{"community", required_argument, 0, 'C'},
 /*  		{"critical",       required_argument,0,'c'}, */
 /*  		{"warning",        required_argument,0,'w'}, */
-/*  		{"port",           required_argument,0,'P'}, */
+		{"port", required_argument, 0, 'p'},
 		{"version", no_argument, 0, 'V'},
 		{"help", no_argument, 0, 'h'},
 		{0, 0, 0, 0}
@@ -324,7 +267,7 @@ process_arguments (int argc, char **argv)
 
 
 	while (1) {
-		c = getopt_long (argc, argv, "+hVH:C:", longopts, &option);
+		c = getopt_long (argc, argv, "+hVH:C:p:", longopts, &option);
 
 		if (c == -1 || c == EOF || c == 1)
 			break;
@@ -341,6 +284,11 @@ process_arguments (int argc, char **argv)
 		case 'C':									/* community */
 			community = strscpy (community, optarg);
 			break;
+		case 'p':									/* port */
+			if (!is_intpos (optarg))
+				usage2 (_("Port must be a positive integer"), optarg);
+			port = strscpy (port, optarg);
+			break;
 		case 'V':									/* version */
 			print_revision (progname, NP_VERSION);
 			exit (STATE_OK);
@@ -369,6 +317,9 @@ process_arguments (int argc, char **argv)
 			community = strdup (DEFAULT_COMMUNITY);
 	}
 
+	if (port == NULL)
+		port = strdup (DEFAULT_PORT);
+
 	return validate_arguments ();
 }
 
@@ -389,7 +340,6 @@ print_help (void)
 	printf (COPYRIGHT, copyright, email);
 
 	printf ("%s\n", _("This plugin tests the STATUS of an HP printer with a JetDirect card."));
-	printf ("%s\n", _("Net-snmp must be installed on the computer running the plugin."));
 
 	printf ("\n\n");
 
@@ -402,6 +352,10 @@ print_help (void)
 	printf ("    %s", _("The SNMP community name "));
 	printf (_("(default=%s)"), DEFAULT_COMMUNITY);
 	printf ("\n");
+	printf (" %s\n", "-p, --port=STRING");
+	printf ("    %s", _("Specify the port to check "));
+	printf (_("(default=%s)"), DEFAULT_PORT);
+	printf ("\n");
 
 	printf (UT_SUPPORT);
 }
@@ -412,5 +366,5 @@ void
 print_usage (void)
 {
   printf ("%s\n", _("Usage:"));
-	printf ("%s -H host [-C community]\n", progname);
+	printf ("%s -H host [-C community] [-p port]\n", progname);
 }
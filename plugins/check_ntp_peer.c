@@ -92,6 +92,37 @@ typedef struct {
 	uint16_t status;
 } ntp_assoc_status_pair;
 
+/* where a fragment of a READVAR response goes */
+typedef struct {
+	int offset;
+	int count;
+} ntp_fragment;
+
+/* the READVAR request to one peer association and the response to it */
+typedef struct {
+	uint16_t assoc;      /* Association, in network byte order */
+	uint16_t seq;        /* Sequence of the request in flight */
+	int getvar;          /* index into getvars[] of the variables asked for */
+	double sent;         /* when the request went out */
+	char *data;          /* the response data, once complete */
+	char *buf;           /* the fragments received so far */
+	int size;            /* bytes allocated for buf */
+	ntp_fragment *frags; /* the fragments received, each once */
+	int nfrags;
+	int length;          /* total bytes of data, once the last fragment is in */
+} ntp_peer_query;
+
+/* Putting the wanted variable names in the request cause the server to
+ * provide _only_ the requested values, thus reducing net traffic and
+ * making intepretation much simpler.  Older servers don't know what
+ * jitter is, so if we get an error we ask again with "dispersion", and
+ * then for everything. */
+static const char *getvars[] = { "stratum,offset,jitter", "stratum,offset,dispersion", "" };
+#define NUM_GETVARS (sizeof(getvars)/sizeof(getvars[0]))
+
+/* seconds to wait for a READVAR response before asking again */
+#define RESEND_INTERVAL 1.0
+
 /* bits 1,2 are the leap indicator */
 #define LI_MASK 0xc0
 #define LI(x) ((x&LI_MASK)>>6)
@@ -188,6 +219,146 @@ setup_control_request(ntp_control_message *p, uint8_t opcode, uint16_t seq){
 	/* Remaining fields are zero for requests */
 }
 
+static double now_double(void){
+	struct timeval t;
+	gettimeofday(&t, NULL);
+	return t.tv_sec + 0.000001 * t.tv_usec;
+}
+
+void send_readvar(int conn, ntp_peer_query *q, uint16_t seq){
+	ntp_control_message req;
+
+	setup_control_request(&req, OP_READVAR, seq);
+	req.assoc = q->assoc;
+	strncpy(req.data, getvars[q->getvar], MAX_CM_SIZE-1);
+	req.count = htons(strlen(getvars[q->getvar]));
+	DBG(printf("sending READVAR request for peer %.2x...\n", ntohs(q->assoc)));
+	write(conn, &req, SIZEOF_NTPCM(req));
+	DBG(print_ntp_control_message(&req));
+
+	/* whatever arrived for an earlier request is of no use now */
+	q->seq = seq;
+	q->sent = now_double();
+	q->nfrags = 0;
+	q->length = -1;
+}
+
+/* whether the fragments received cover all of the response */
+int readvar_complete(const ntp_peer_query *q){
+	int i, covered = 0, grown = 1;
+
+	if (q->length < 0) return 0;
+	while (grown && covered < q->length) {
+		grown = 0;
+		for (i = 0; i < q->nfrags; i++) {
+			if (q->frags[i].offset <= covered && q->frags[i].offset + q->frags[i].count > covered) {
+				covered = q->frags[i].offset + q->frags[i].count;
+				grown = 1;
+			}
+		}
+	}
+	return covered >= q->length;
+}
+
+/* Send READVAR requests to all the given peer associations at once and
+ * collect the responses, which may come in several fragments each, in any
+ * order.  Requests that go unanswered are sent again every so often until
+ * the plugin times out; peers that refuse all of getvars[] get no data. */
+void readvar_requests(int conn, ntp_peer_query *queries, int nqueries){
+	int i, pending = nqueries, offset, count;
+	uint16_t seq = 2;
+	double now;
+	ntp_control_message req;
+	struct pollfd pfd;
+	ntp_peer_query *q;
+	void *tmp;
+
+	for (i = 0; i < nqueries; i++)
+		send_readvar(conn, &queries[i], seq++);
+
+	pfd.fd = conn;
+	pfd.events = POLLIN;
+	while (pending > 0) {
+		now = now_double();
+		for (i = 0; i < nqueries; i++) {
+			q = &queries[i];
+			if (q->seq && now - q->sent >= RESEND_INTERVAL) {
+				if(verbose) printf("no response from peer %.2x, asking again\n", ntohs(q->assoc));
+				send_readvar(conn, q, seq++);
+			}
+		}
+
+		if (poll(&pfd, 1, 100) <= 0) continue;
+		memset(&req, 0, sizeof(req));
+		if (read(conn, &req, sizeof(req)) < 12) continue;
+		DBG(printf("receiving READVAR response...\n"));
+		DBG(print_ntp_control_message(&req));
+
+		/* find the request this answers, dropping anything that doesn't
+		 * answer one still in flight */
+		if (!(req.op&REM_RESP) || (req.op&OP_MASK) != OP_READVAR) continue;
+		for (i = 0, q = NULL; i < nqueries; i++) {
+			if (queries[i].seq && queries[i].seq == ntohs(req.seq) && queries[i].assoc == req.assoc) {
+				q = &queries[i];
+				break;
+			}
+		}
+		if (q == NULL) {
+			DBG(printf("discarding response with sequence %d\n", ntohs(req.seq)));
+			continue;
+		}
+
+		if (req.op&REM_ERROR) {
+			if (++q->getvar < (int)NUM_GETVARS) {
+				if(verbose) printf("The command failed for peer %.2x. This is usually caused by servers refusing\nthe 'jitter' variable. Asking for '%s' instead...\n",
+				                   ntohs(q->assoc), *getvars[q->getvar] ? getvars[q->getvar] : "everything");
+				send_readvar(conn, q, seq++);
+			} else {
+				if(verbose) printf("Server refused to tell anything about peer %.2x\n", ntohs(q->assoc));
+				q->seq = 0;
+				pending--;
+			}
+			continue;
+		}
+
+		offset = ntohs(req.offset);
+		count = ntohs(req.count);
+		if (count > MAX_CM_SIZE) continue;
+		/* a fragment that came twice adds nothing */
+		for (i = 0; i < q->nfrags; i++)
+			if (q->frags[i].offset == offset && q->frags[i].count == count) break;
+		if (i < q->nfrags) {
+			DBG(printf("discarding duplicate fragment at offset %d\n", offset));
+			continue;
+		}
+		if ((tmp = realloc(q->frags, (q->nfrags + 1) * sizeof(*q->frags))) == NULL)
+			die(STATE_UNKNOWN, "can not (re)allocate fragment list\n");
+		q->frags = tmp;
+		q->frags[q->nfrags].offset = offset;
+		q->frags[q->nfrags++].count = count;
+		/* fragments come in any order, so the buffer only ever grows */
+		if (offset + count + 1 > q->size) {
+			if ((tmp = realloc(q->buf, offset + count + 1)) == NULL)
+				die(STATE_UNKNOWN, "can not (re)allocate response buffer\n");
+			q->buf = tmp;
+			q->size = offset + count + 1;
+		}
+		memcpy(q->buf + offset, req.data, count);
+		if (!(req.op&REM_MORE))
+			q->length = offset + count;
+
+		/* all fragments in? */
+		if (readvar_complete(q)) {
+			q->buf[q->length] = '\0';
+			q->data = q->buf;
+			q->buf = NULL;
+			q->size = 0;
+			q->seq = 0;
+			pending--;
+		}
+	}
+}
+
 /* This function does all the actual work; roughly here's what it does
  * beside setting the offest, jitter and stratum passed as argument:
  *  - offset can be negative, so if it cannot get the offset, offset_result
@@ -200,14 +371,15 @@ setup_control_request(ntp_control_message *p, uint8_t opcode, uint16_t seq){
  *  used later in main to check is the server was synchronized. It works
  *  so I left it alone */
 int ntp_request(const char *host, double *offset, int *offset_result, double *jitter, int *stratum, int *num_truechimers){
-	int conn=-1, i, npeers=0, num_candidates=0;
+	int conn=-1, i, npeers=0, nqueries=0, num_candidates=0;
 	double tmp_offset = 0;
 	int min_peer_sel=PEER_INCLUDED;
 	int peers_size=0, peer_offset=0;
 	int status;
 	ntp_assoc_status_pair *peers=NULL;
+	ntp_peer_query *queries=NULL;
 	ntp_control_message req;
-	const char *getvar = "stratum,offset,jitter";
+	const char *getvar;
 	char *data, *value, *nptr;
 	void *tmp;
 
@@ -228,7 +400,7 @@ int ntp_request(const char *host, double *offset, int *offset_result, double *ji
 	 *     we take anything better than 0x04 (see the rfc for details) but
 	 *     set a minimum of warning.
 	 * 3) Send a READVAR request for information on each peer identified
-	 *    in 2b greater than the minimum selection value.
+	 *    in 2b greater than the minimum selection value, all at once.
 	 * 4) Extract the offset, jitter and stratum value from the data[]
 	 *    (it's ASCII)
 	 */
@@ -290,115 +462,96 @@ int ntp_request(const char *host, double *offset, int *offset_result, double *ji
 	}
 
 
+	/* Only query the current sync source; if there's no sync.peer, query
+	 * all candidates and use the best one.  The READVAR requests for all
+	 * of them go out at once and the responses are matched up by sequence
+	 * number as they come in, so this takes about one round trip however
+	 * many peers there are. */
+	queries=(ntp_peer_query*)calloc(npeers ? npeers : 1, sizeof(ntp_peer_query));
+	if(queries==NULL) die(STATE_UNKNOWN, "can not allocate peer query array\n");
 	for (i = 0; i < npeers; i++){
-		/* Only query this server if it is the current sync source */
-		/* If there's no sync.peer, query all candidates and use the best one */
 		if (PEER_SEL(peers[i].status) >= min_peer_sel){
 			if(verbose) printf("Getting offset, jitter and stratum for peer %.2x\n", ntohs(peers[i].assoc));
-			xasprintf(&data, "");
-			do{
-				setup_control_request(&req, OP_READVAR, 2);
-				req.assoc = peers[i].assoc;
-				/* Putting the wanted variable names in the request
-				 * cause the server to provide _only_ the requested values.
-				 * thus reducing net traffic, guaranteeing us only a single
-				 * datagram in reply, and making intepretation much simpler
-				 */
-				/* Older servers doesn't know what jitter is, so if we get an
-				 * error on the first pass we redo it with "dispersion" */
-				strncpy(req.data, getvar, MAX_CM_SIZE-1);
-				req.count = htons(strlen(getvar));
-				DBG(printf("sending READVAR request...\n"));
-				write(conn, &req, SIZEOF_NTPCM(req));
-				DBG(print_ntp_control_message(&req));
-
-				req.count = htons(MAX_CM_SIZE);
-				DBG(printf("receiving READVAR response...\n"));
-				read(conn, &req, SIZEOF_NTPCM(req));
-				DBG(print_ntp_control_message(&req));
-
-				if(!(req.op&REM_ERROR))
-					xasprintf(&data, "%s%s", data, req.data);
-			} while(req.op&REM_MORE);
-
-			if(req.op&REM_ERROR) {
-				if(strstr(getvar, "jitter")) {
-					if(verbose) printf("The command failed. This is usually caused by servers refusing the 'jitter'\nvariable. Restarting with 'dispersion'...\n");
-					getvar = "stratum,offset,dispersion";
-					i--;
-					continue;
-				} else if(strlen(getvar)) {
-					if(verbose) printf("Server didn't like dispersion either; will retrieve everything\n");
-					getvar = "";
-					i--;
-					continue;
-				}
+			queries[nqueries++].assoc = peers[i].assoc;
+		}
+	}
+	readvar_requests(conn, queries, nqueries);
+
+	for (i = 0; i < nqueries; i++){
+		data = queries[i].data;
+		if(data == NULL) continue;
+
+		if(verbose > 1)
+			printf("Server responded: >>>%s<<<\n", data);
+
+		/* get the offset */
+		if(verbose)
+			printf("parsing offset from peer %.2x: ", ntohs(queries[i].assoc));
+
+		value = np_extract_ntpvar(data, "offset");
+		nptr=NULL;
+		/* Convert the value if we have one */
+		if(value != NULL)
+			tmp_offset = strtod(value, &nptr) / 1000;
+		/* If value is null or no conversion was performed */
+		if(value == NULL || value==nptr) {
+			if(verbose) printf("error: unable to read server offset response.\n");
+		} else {
+			if(verbose) printf("%.10g\n", tmp_offset);
+			if(*offset_result == STATE_UNKNOWN || fabs(tmp_offset) < fabs(*offset)) {
+				*offset = tmp_offset;
+				*offset_result = STATE_OK;
+			} else {
+				/* Skip this one; move to the next */
+				continue;
 			}
+		}
 
-			if(verbose > 1)
-				printf("Server responded: >>>%s<<<\n", data);
-
-			/* get the offset */
-			if(verbose)
-				printf("parsing offset from peer %.2x: ", ntohs(peers[i].assoc));
-
-			value = np_extract_ntpvar(data, "offset");
+		if(do_jitter) {
+			/* get the jitter */
+			getvar = queries[i].getvar == 1 ? "dispersion" : "jitter";
+			if(verbose) {
+				printf("parsing %s from peer %.2x: ", getvar, ntohs(queries[i].assoc));
+			}
+			value = np_extract_ntpvar(data, getvar);
 			nptr=NULL;
 			/* Convert the value if we have one */
 			if(value != NULL)
-				tmp_offset = strtod(value, &nptr) / 1000;
+				*jitter = strtod(value, &nptr);
 			/* If value is null or no conversion was performed */
 			if(value == NULL || value==nptr) {
-				if(verbose) printf("error: unable to read server offset response.\n");
-			} else {
-				if(verbose) printf("%.10g\n", tmp_offset);
-				if(*offset_result == STATE_UNKNOWN || fabs(tmp_offset) < fabs(*offset)) {
-					*offset = tmp_offset;
-					*offset_result = STATE_OK;
-				} else {
-					/* Skip this one; move to the next */
-					continue;
-				}
+				if(verbose) printf("error: unable to read server jitter/dispersion response.\n");
+				*jitter = -1;
+			} else if(verbose) {
+				printf("%.10g\n", *jitter);
 			}
+		}
 
-			if(do_jitter) {
-				/* get the jitter */
-				if(verbose) {
-					printf("parsing %s from peer %.2x: ", strstr(getvar, "dispersion") != NULL ? "dispersion" : "jitter", ntohs(peers[i].assoc));
-				}
-				value = np_extract_ntpvar(data, strstr(getvar, "dispersion") != NULL ? "dispersion" : "jitter");
-				nptr=NULL;
-				/* Convert the value if we have one */
-				if(value != NULL)
-					*jitter = strtod(value, &nptr);
-				/* If value is null or no conversion was performed */
-				if(value == NULL || value==nptr) {
-					if(verbose) printf("error: unable to read server jitter/dispersion response.\n");
-					*jitter = -1;
-				} else if(verbose) {
-					printf("%.10g\n", *jitter);
-				}
+		if(do_stratum) {
+			/* get the stratum */
+			if(verbose) {
+				printf("parsing stratum from peer %.2x: ", ntohs(queries[i].assoc));
 			}
-
-			if(do_stratum) {
-				/* get the stratum */
-				if(verbose) {
-					printf("parsing stratum from peer %.2x: ", ntohs(peers[i].assoc));
-				}
-				value = np_extract_ntpvar(data, "stratum");
-				nptr=NULL;
-				/* Convert the value if we have one */
-				if(value != NULL)
-					*stratum = strtol(value, &nptr, 10);
-				if(value == NULL || value==nptr) {
-					if(verbose) printf("error: unable to read server stratum response.\n");
-					*stratum = -1;
-				} else {
-					if(verbose) printf("%i\n", *stratum);
-				}
+			value = np_extract_ntpvar(data, "stratum");
+			nptr=NULL;
+			/* Convert the value if we have one */
+			if(value != NULL)
+				*stratum = strtol(value, &nptr, 10);
+			if(value == NULL || value==nptr) {
+				if(verbose) printf("error: unable to read server stratum response.\n");
+				*stratum = -1;
+			} else {
+				if(verbose) printf("%i\n", *stratum);
 			}
-		} /* if (PEER_SEL(peers[i].status) >= min_peer_sel) */
-	} /* for (i = 0; i < npeers; i++) */
+		}
+	} /* for (i = 0; i < nqueries; i++) */
+
+	for (i = 0; i < nqueries; i++) {
+		free(queries[i].data);
+		free(queries[i].buf);
+		free(queries[i].frags);
+	}
+	free(queries);
 
 	close(conn);
 	if(peers!=NULL) free(peers);
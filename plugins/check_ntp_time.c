@@ -42,20 +42,25 @@ const char *email = "nagiosplug-devel@lists.sourceforge.net";
 #include "netutils.h"
 #include "utils.h"
 
-static char *server_address=NULL;
+static char **server_addresses=NULL;
+static int num_sources=0;
 static char *port="123";
 static int verbose=0;
 static int quiet=0;
 static char *owarn="60";
 static char *ocrit="120";
+static int samples=4;
+static double tolerance=0;
+static int quorum=0;
+static double agree=0.128;
 
 int process_arguments (int, char **);
 thresholds *offset_thresholds = NULL;
 void print_help (void);
 void print_usage (void);
 
-/* number of times to perform each request to get a good average. */
-#define AVG_NUM 4
+/* seconds to wait for a response before asking a server again */
+#define RESEND_INTERVAL 1.0
 
 /* max size of control message data */
 #define MAX_CM_SIZE 468
@@ -77,15 +82,32 @@ typedef struct {
 
 /* this structure holds data about results from querying offset from a peer */
 typedef struct {
-	time_t waiting;         /* ts set when we started waiting for a response */
+	double waiting;         /* ts set when we started waiting for a response */
 	int num_responses;      /* number of successfully recieved responses */
+	int complete;           /* no more requests are sent to this server */
 	uint8_t stratum;        /* copied verbatim from the ntp_message */
 	double rtdelay;         /* converted from the ntp_message */
 	double rtdisp;          /* converted from the ntp_message */
-	double offset[AVG_NUM]; /* offsets from each response */
+	double *offset;         /* offsets from each response */
+	double *delay;          /* round trip delay of each response */
 	uint8_t flags;       /* byte with leapindicator,vers,mode. see macros */
+	int source;             /* index of the -H argument this address is for */
 } ntp_server_results;
 
+/* this structure holds the offset found for one -H argument */
+typedef struct {
+	const char *host;
+	int status;             /* STATE_UNKNOWN if there is no usable offset */
+	double offset;
+	double delay;           /* round trip delay of the sample used */
+} ntp_source_result;
+
+/* one end of a source's interval, for marzullo() */
+typedef struct {
+	double value;
+	int type;               /* +1 where an interval starts, -1 where it ends */
+} interval_edge;
+
 /* bits 1,2 are the leap indicator */
 #define LI_MASK 0xc0
 #define LI(x) ((x&LI_MASK)>>6)
@@ -186,15 +208,112 @@ typedef struct {
 	}while(0);
 
 /* calculate the offset of the local clock */
-static inline double calc_offset(const ntp_message *m, const struct timeval *t){
-	double client_tx, peer_rx, peer_tx, client_rx;
+static inline double calc_offset(const ntp_message *m, double client_rx){
+	double client_tx, peer_rx, peer_tx;
 	client_tx = NTP64asDOUBLE(m->origts);
 	peer_rx = NTP64asDOUBLE(m->rxts);
 	peer_tx = NTP64asDOUBLE(m->txts);
-	client_rx=TVasDOUBLE((*t));
 	return (.5*((peer_tx-client_rx)+(peer_rx-client_tx)));
 }
 
+/* calculate the round trip delay, less the time spent in the server */
+static inline double calc_delay(const ntp_message *m, double client_rx){
+	double client_tx, peer_rx, peer_tx;
+	client_tx = NTP64asDOUBLE(m->origts);
+	peer_rx = NTP64asDOUBLE(m->rxts);
+	peer_tx = NTP64asDOUBLE(m->txts);
+	return ((client_rx-client_tx)-(peer_tx-peer_rx));
+}
+
+static double now_double(void){
+	struct timeval t;
+	gettimeofday(&t, NULL);
+	return TVasDOUBLE(t);
+}
+
+/* ask for SCM_TIMESTAMPNS, or SCM_TIMESTAMP if that's all we have */
+static int enable_recv_stamps(int sock){
+	int result=-1, on=1;
+
+#ifdef SO_TIMESTAMPNS
+	result=setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+#endif
+#ifdef SO_TIMESTAMP
+	if(result==-1)
+		result=setsockopt(sock, SOL_SOCKET, SO_TIMESTAMP, &on, sizeof(on));
+#endif
+
+	return result;
+}
+
+/* read one response, and the time it arrived at.  the kernel receive
+ * timestamp is used if there is one, as that leaves out however long we
+ * took to get around to reading the socket. */
+static ssize_t recv_response(int sock, ntp_message *m, double *rx_time){
+	char ctrl[64];
+	struct iovec iov;
+	struct msghdr hdr;
+	struct cmsghdr *cmsg;
+	struct timespec ts;
+	struct timeval tv;
+	ssize_t len;
+
+	iov.iov_base=m;
+	iov.iov_len=sizeof(ntp_message);
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.msg_iov=&iov;
+	hdr.msg_iovlen=1;
+	hdr.msg_control=ctrl;
+	hdr.msg_controllen=sizeof(ctrl);
+
+	len=recvmsg(sock, &hdr, 0);
+	*rx_time=now_double();
+	if(len<0 || hdr.msg_flags&MSG_CTRUNC) return len;
+
+	for(cmsg=CMSG_FIRSTHDR(&hdr); cmsg; cmsg=CMSG_NXTHDR(&hdr, cmsg)){
+		if(cmsg->cmsg_level!=SOL_SOCKET) continue;
+#ifdef SCM_TIMESTAMPNS
+		if(cmsg->cmsg_type==SCM_TIMESTAMPNS){
+			memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+			*rx_time=ts.tv_sec+(0.000000001*ts.tv_nsec);
+			break;
+		}
+#endif
+#ifdef SCM_TIMESTAMP
+		if(cmsg->cmsg_type==SCM_TIMESTAMP){
+			memcpy(&tv, CMSG_DATA(cmsg), sizeof(tv));
+			*rx_time=TVasDOUBLE(tv);
+			break;
+		}
+#endif
+	}
+
+	return len;
+}
+
+/* standard deviation of the offsets received from a server so far */
+static double offset_spread(const ntp_server_results *s){
+	int i;
+	double mean=0., var=0.;
+
+	for(i=0; i<s->num_responses; i++) mean+=s->offset[i];
+	mean/=s->num_responses;
+	for(i=0; i<s->num_responses; i++)
+		var+=(s->offset[i]-mean)*(s->offset[i]-mean);
+	return sqrt(var/s->num_responses);
+}
+
+/* the sample that spent the least time in transit is the one least
+ * skewed by queueing on the way, so take its offset rather than the
+ * mean of them all */
+static int min_delay_sample(const ntp_server_results *s){
+	int i, best=0;
+
+	for(i=1; i<s->num_responses; i++)
+		if(s->delay[i] < s->delay[best]) best=i;
+	return best;
+}
+
 /* print out a ntp packet in human readable/debuggable format */
 void print_ntp_message(const ntp_message *p){
 	struct timeval ref, orig, rx, tx;
@@ -293,19 +412,18 @@ int best_offset_server(const ntp_server_results *slist, int nservers){
 	}
 }
 
-/* do everything we need to get the total average offset
+/* do everything we need to get the offset from each source
  * - we use a certain amount of parallelization with poll() to ensure
  *   we don't waste time sitting around waiting for single packets.
  * - we also "manually" handle resolving host names and connecting, because
  *   we have to do it in a way that our lazy macros don't handle currently :( */
-double offset_request(const char *host, int *status){
-	int i=0, j=0, ga_result=0, num_hosts=0, *socklist=NULL, respnum=0;
-	int servers_completed=0, one_written=0, one_read=0, servers_readable=0, best_index=-1;
-	time_t now_time=0, start_ts=0;
+void offset_request(char **hosts, int nsources, ntp_source_result *results){
+	int i=0, j=0, k=0, ga_result=0, num_hosts=0, *socklist=NULL, respnum=0;
+	int servers_completed=0, one_read=0, servers_readable=0, best_index=-1;
+	double now_time=0, start_ts=0, recv_time=0;
 	ntp_message *req=NULL;
-	double avg_offset=0.;
-	struct timeval recv_time;
-	struct addrinfo *ai=NULL, *ai_tmp=NULL, hints;
+	ssize_t len;
+	struct addrinfo **ai=NULL, *ai_tmp=NULL, hints;
 	struct pollfd *ufds=NULL;
 	ntp_server_results *servers=NULL;
 
@@ -315,15 +433,26 @@ double offset_request(const char *host, int *status){
 	hints.ai_protocol = IPPROTO_UDP;
 	hints.ai_socktype = SOCK_DGRAM;
 
-	/* fill in ai with the list of hosts resolved by the host name */
-	ga_result = getaddrinfo(host, port, &hints, &ai);
-	if(ga_result!=0){
-		die(STATE_UNKNOWN, "error getting address for %s: %s\n",
-		    host, gai_strerror(ga_result));
+	/* fill in ai with the lists of hosts resolved by the host names */
+	ai=(struct addrinfo**)malloc(sizeof(struct addrinfo*)*nsources);
+	if(ai==NULL) die(STATE_UNKNOWN, "can not allocate address array");
+	for(k=0; k<nsources; k++){
+		ga_result = getaddrinfo(hosts[k], port, &hints, &ai[k]);
+		if(ga_result!=0){
+			/* a source that can't be found is unusable, and the quorum
+			 * decides if the others are enough */
+			if(num_hosts==0 && k==nsources-1)
+				die(STATE_UNKNOWN, "error getting address for %s: %s\n",
+				    hosts[k], gai_strerror(ga_result));
+			if(verbose) printf("error getting address for %s: %s\n", hosts[k], gai_strerror(ga_result));
+			ai[k]=NULL;
+			continue;
+		}
+		/* count the number of returned hosts */
+		for(ai_tmp=ai[k]; ai_tmp!=NULL; ai_tmp=ai_tmp->ai_next){ num_hosts++; }
 	}
 
-	/* count the number of returned hosts, and allocate stuff accordingly */
-	for(ai_tmp=ai; ai_tmp!=NULL; ai_tmp=ai_tmp->ai_next){ num_hosts++; }
+	/* and allocate stuff accordingly */
 	req=(ntp_message*)malloc(sizeof(ntp_message)*num_hosts);
 	if(req==NULL) die(STATE_UNKNOWN, "can not allocate ntp message array");
 	socklist=(int*)malloc(sizeof(int)*num_hosts);
@@ -333,11 +462,19 @@ double offset_request(const char *host, int *status){
 	servers=(ntp_server_results*)malloc(sizeof(ntp_server_results)*num_hosts);
 	if(servers==NULL) die(STATE_UNKNOWN, "can not allocate server array");
 	memset(servers, 0, sizeof(ntp_server_results)*num_hosts);
+	for(i=0; i<num_hosts; i++){
+		servers[i].offset=(double*)malloc(sizeof(double)*samples*2);
+		if(servers[i].offset==NULL) die(STATE_UNKNOWN, "can not allocate sample array");
+		servers[i].delay=servers[i].offset+samples;
+	}
 	DBG(printf("Found %d peers to check\n", num_hosts));
 
 	/* setup each socket for writing, and the corresponding struct pollfd */
-	ai_tmp=ai;
-	for(i=0;ai_tmp;i++){
+	k=0;
+	ai_tmp=ai[0];
+	for(i=0;i<num_hosts;i++){
+		while(ai_tmp==NULL) ai_tmp=ai[++k];
+		servers[i].source=k;
 		socklist[i]=socket(ai_tmp->ai_family, SOCK_DGRAM, IPPROTO_UDP);
 		if(socklist[i] == -1) {
 			perror(NULL);
@@ -349,7 +486,12 @@ double offset_request(const char *host, int *status){
 			   ntp servers when the client only supports on of them.
 			 */
 			DBG(printf("can't create socket connection on peer %i: %s\n", i, strerror(errno)));
+			ufds[i].fd=-1;
+			servers[i].complete=1;
+			servers_completed++;
 		} else {
+			if(enable_recv_stamps(socklist[i]))
+				DBG(printf("no kernel receive timestamps on peer %i\n", i));
 			ufds[i].fd=socklist[i];
 			ufds[i].events=POLLIN;
 			ufds[i].revents=0;
@@ -357,25 +499,23 @@ double offset_request(const char *host, int *status){
 		ai_tmp = ai_tmp->ai_next;
 	}
 
-	/* now do AVG_NUM checks to each host. We stop before timeout/2 seconds
+	/* now take the samples from each host. We stop before timeout/2 seconds
 	 * have passed in order to ensure post-processing and jitter time. */
-	now_time=start_ts=time(NULL);
-	while(servers_completed<num_hosts && now_time-start_ts <= socket_timeout/2){
+	now_time=start_ts=now_double();
+	while(servers_completed<num_hosts && now_time-start_ts <= socket_timeout/2.0){
 		/* loop through each server and find each one which hasn't
 		 * been touched in the past second or so and is still lacking
 		 * some responses. For each of these servers, send a new request,
 		 * and update the "waiting" timestamp with the current time. */
-		one_written=0;
-		now_time=time(NULL);
+		now_time=now_double();
 
 		for(i=0; i<num_hosts; i++){
-			if(servers[i].waiting<now_time && servers[i].num_responses<AVG_NUM){
+			if(!servers[i].complete && (servers[i].waiting==0 || now_time-servers[i].waiting >= RESEND_INTERVAL)){
 				if(verbose && servers[i].waiting != 0) printf("re-");
 				if(verbose) printf("sending request to peer %d\n", i);
 				setup_request(&req[i]);
 				write(socklist[i], &req[i], sizeof(ntp_message));
 				servers[i].waiting=now_time;
-				one_written=1;
 				break;
 			}
 		}
@@ -389,27 +529,49 @@ double offset_request(const char *host, int *status){
 
 		/* read from any sockets with pending data */
 		for(i=0; servers_readable && i<num_hosts; i++){
-			if(ufds[i].revents&POLLIN && servers[i].num_responses < AVG_NUM){
+			if(ufds[i].revents&(POLLIN|POLLERR) && !servers[i].complete){
+				servers_readable--;
+				len=recv_response(ufds[i].fd, &req[i], &recv_time);
+				if(len < 0){
+					/* nobody listening there, no sense asking again */
+					if(verbose) printf("error from peer %d: %s\n", i, strerror(errno));
+					ufds[i].fd=-1;
+					servers[i].complete=1;
+					servers_completed++;
+					continue;
+				}
+				if(len < (ssize_t)sizeof(ntp_message)){
+					if(verbose) printf("short response from peer %d\n", i);
+					continue;
+				}
 				if(verbose) {
 					printf("response from peer %d: ", i);
 				}
 
-				read(ufds[i].fd, &req[i], sizeof(ntp_message));
-				gettimeofday(&recv_time, NULL);
 				DBG(print_ntp_message(&req[i]));
 				respnum=servers[i].num_responses++;
-				servers[i].offset[respnum]=calc_offset(&req[i], &recv_time);
+				servers[i].offset[respnum]=calc_offset(&req[i], recv_time);
+				servers[i].delay[respnum]=calc_delay(&req[i], recv_time);
 				if(verbose) {
-					printf("offset %.10g\n", servers[i].offset[respnum]);
+					printf("offset %.10g, delay %.10g\n", servers[i].offset[respnum], servers[i].delay[respnum]);
 				}
 				servers[i].stratum=req[i].stratum;
 				servers[i].rtdisp=NTP32asDOUBLE(req[i].rtdisp);
 				servers[i].rtdelay=NTP32asDOUBLE(req[i].rtdelay);
 				servers[i].waiting=0;
 				servers[i].flags=req[i].flags;
-				servers_readable--;
 				one_read = 1;
-				if(servers[i].num_responses==AVG_NUM) servers_completed++;
+				if(servers[i].num_responses==samples){
+					servers[i].complete=1;
+				} else if(tolerance > 0 && servers[i].num_responses > 1 && offset_spread(&servers[i]) <= tolerance){
+					if(verbose) printf("offsets from peer %d settled after %d samples\n", i, servers[i].num_responses);
+					servers[i].complete=1;
+				}
+				if(servers[i].complete){
+					/* stray responses to resent requests are of no use now */
+					ufds[i].fd=-1;
+					servers_completed++;
+				}
 			}
 		}
 		/* lather, rinse, repeat. */
@@ -419,28 +581,120 @@ double offset_request(const char *host, int *status){
 		die(STATE_CRITICAL, "NTP CRITICAL: No response from NTP server\n");
 	}
 
-	/* now, pick the best server from the list */
-	best_index=best_offset_server(servers, num_hosts);
-	if(best_index < 0){
-		*status=STATE_UNKNOWN;
-	} else {
-		/* finally, calculate the average offset */
-		for(i=0; i<servers[best_index].num_responses;i++){
-			avg_offset+=servers[best_index].offset[j];
+	/* now, pick the best server from the list for each source; the
+	 * addresses of a source are next to each other in servers[] */
+	for(i=0, k=0; k<nsources; k++){
+		for(j=i; j<num_hosts && servers[j].source==k; j++);
+		results[k].host=hosts[k];
+		results[k].status=STATE_UNKNOWN;
+		best_index=best_offset_server(&servers[i], j-i);
+		if(best_index >= 0){
+			best_index+=i;
+			/* finally, take the offset of the least delayed sample */
+			respnum=min_delay_sample(&servers[best_index]);
+			results[k].offset=servers[best_index].offset[respnum];
+			results[k].delay=servers[best_index].delay[respnum];
+			results[k].status=STATE_OK;
+			if(verbose) printf("using sample %d of %d from peer %d (delay %.10g)\n",
+			                   respnum+1, servers[best_index].num_responses, best_index, results[k].delay);
 		}
-		avg_offset/=servers[best_index].num_responses;
+		i=j;
 	}
 
 	/* cleanup */
-	for(j=0; j<num_hosts; j++){ close(socklist[j]); }
+	for(j=0; j<num_hosts; j++){
+		close(socklist[j]);
+		free(servers[j].offset);
+	}
 	free(socklist);
 	free(ufds);
 	free(servers);
 	free(req);
-	freeaddrinfo(ai);
+	for(k=0; k<nsources; k++) if(ai[k]) freeaddrinfo(ai[k]);
+	free(ai);
+
+	if(verbose)
+		for(k=0; k<nsources; k++)
+			if(results[k].status==STATE_OK)
+				printf("overall offset from %s: %.10g\n", results[k].host, results[k].offset);
+}
+
+static int compare_edges(const void *a, const void *b){
+	const interval_edge *x=a, *y=b;
 
-	if(verbose) printf("overall average offset: %.10g\n", avg_offset);
-	return avg_offset;
+	if(x->value != y->value) return x->value < y->value ? -1 : 1;
+	/* intervals that merely touch still overlap */
+	return y->type - x->type;
+}
+
+/* Marzullo's algorithm: find the interval where the most of the sources'
+ * intervals [lo[i], hi[i]] overlap, and return how many do */
+int marzullo(const double *lo, const double *hi, int n, double *best_lo, double *best_hi){
+	int i, count=0, best=0;
+	interval_edge *edges;
+
+	edges=(interval_edge*)malloc(sizeof(interval_edge)*n*2);
+	if(edges==NULL) die(STATE_UNKNOWN, "can not allocate interval array");
+	for(i=0; i<n; i++){
+		edges[2*i].value=lo[i];
+		edges[2*i].type=1;
+		edges[2*i+1].value=hi[i];
+		edges[2*i+1].type=-1;
+	}
+	qsort(edges, n*2, sizeof(interval_edge), compare_edges);
+
+	for(i=0; i<n*2; i++){
+		count+=edges[i].type;
+		/* an end always follows a start */
+		if(count > best){
+			best=count;
+			*best_lo=edges[i].value;
+			*best_hi=edges[i+1].value;
+		}
+	}
+
+	free(edges);
+	return best;
+}
+
+/* Work out the offset the sources agree on.  Each source stands for the
+ * interval of its offset, give or take half of its round trip delay and
+ * half of the agreement window; the offset is the middle of the interval
+ * shared by the most sources, and there must be at least quorum of them.
+ * Returns the number of sources that agree. */
+int quorum_offset(const ntp_source_result *results, int nsources, double *offset){
+	int i, n=0, agreeing=0;
+	double *lo, *hi, best_lo=0, best_hi=0, r;
+
+	lo=(double*)malloc(sizeof(double)*nsources*2);
+	if(lo==NULL) die(STATE_UNKNOWN, "can not allocate interval array");
+	hi=lo+nsources;
+	for(i=0; i<nsources; i++){
+		if(results[i].status!=STATE_OK) continue;
+		r=(agree+fabs(results[i].delay))/2;
+		lo[n]=results[i].offset-r;
+		hi[n]=results[i].offset+r;
+		n++;
+	}
+	if(n > 0){
+		agreeing=marzullo(lo, hi, n, &best_lo, &best_hi);
+		*offset=(best_lo+best_hi)/2;
+		if(verbose) printf("%d of %d sources agree on an offset between %.10g and %.10g\n",
+		                   agreeing, nsources, best_lo, best_hi);
+	}
+
+	free(lo);
+	return agreeing;
+}
+
+void add_sources(char *list){
+	char *host;
+
+	for(host=strtok(list, ","); host; host=strtok(NULL, ",")){
+		server_addresses=realloc(server_addresses, sizeof(char*)*(num_sources+1));
+		if(server_addresses==NULL) die(STATE_UNKNOWN, "can not allocate host array");
+		server_addresses[num_sources++]=strdup(host);
+	}
 }
 
 int process_arguments(int argc, char **argv){
@@ -458,6 +712,10 @@ int process_arguments(int argc, char **argv){
 		{"timeout", required_argument, 0, 't'},
 		{"hostname", required_argument, 0, 'H'},
 		{"port", required_argument, 0, 'p'},
+		{"samples", required_argument, 0, 'n'},
+		{"tolerance", required_argument, 0, 'T'},
+		{"quorum", required_argument, 0, 'Q'},
+		{"agree", required_argument, 0, 'a'},
 		{0, 0, 0, 0}
 	};
 
@@ -466,7 +724,7 @@ int process_arguments(int argc, char **argv){
 		usage ("\n");
 
 	while (1) {
-		c = getopt_long (argc, argv, "Vhv46qw:c:t:H:p:", longopts, &option);
+		c = getopt_long (argc, argv, "Vhv46qw:c:t:H:p:n:T:Q:a:", longopts, &option);
 		if (c == -1 || c == EOF || c == 1)
 			break;
 
@@ -492,9 +750,7 @@ int process_arguments(int argc, char **argv){
 			ocrit = optarg;
 			break;
 		case 'H':
-			if(is_host(optarg) == FALSE)
-				usage2(_("Invalid hostname/address"), optarg);
-			server_address = strdup(optarg);
+			add_sources(optarg);
 			break;
 		case 'p':
 			port = strdup(optarg);
@@ -502,6 +758,24 @@ int process_arguments(int argc, char **argv){
 		case 't':
 			socket_timeout=atoi(optarg);
 			break;
+		case 'n':
+			if(!is_intpos(optarg) || (samples=atoi(optarg)) < 1)
+				usage2(_("Number of samples must be a positive integer"), optarg);
+			break;
+		case 'T':
+			if(!is_nonnegative(optarg))
+				usage2(_("Tolerance must be a non-negative number of seconds"), optarg);
+			tolerance=strtod(optarg, NULL);
+			break;
+		case 'Q':
+			if(!is_intpos(optarg) || (quorum=atoi(optarg)) < 1)
+				usage2(_("Quorum must be a positive integer"), optarg);
+			break;
+		case 'a':
+			if(!is_nonnegative(optarg))
+				usage2(_("Agreement window must be a non-negative number of seconds"), optarg);
+			agree=strtod(optarg, NULL);
+			break;
 		case '4':
 			address_family = AF_INET;
 			break;
@@ -519,9 +793,17 @@ int process_arguments(int argc, char **argv){
 		}
 	}
 
-	if(server_address == NULL){
+	if(num_sources == 0){
 		usage4(_("Hostname was not supplied"));
 	}
+	/* of several sources, one that can't be found is merely unusable */
+	if(num_sources == 1 && is_host(server_addresses[0]) == FALSE)
+		usage2(_("Invalid hostname/address"), server_addresses[0]);
+	/* by default, more than half of the sources have to agree */
+	if(quorum == 0)
+		quorum=num_sources/2+1;
+	if(quorum > num_sources)
+		usage4(_("Quorum can not be larger than the number of hosts"));
 
 	return 0;
 }
@@ -534,10 +816,21 @@ char *perfd_offset (double offset)
 		FALSE, 0, FALSE, 0);
 }
 
+char *perfd_source_offset (const char *host, double offset)
+{
+	char *label;
+
+	xasprintf (&label, "offset_%s", host);
+	return fperfdata (label, offset, "s",
+		FALSE, 0, FALSE, 0,
+		FALSE, 0, FALSE, 0);
+}
+
 int main(int argc, char *argv[]){
-	int result, offset_result;
+	int result, offset_result, i, agreeing=0;
 	double offset=0;
-	char *result_line, *perfdata_line;
+	char *result_line, *perfdata_line, *sep;
+	ntp_source_result *results;
 
 	setlocale (LC_ALL, "");
 	bindtextdomain (PACKAGE, LOCALEDIR);
@@ -559,7 +852,16 @@ int main(int argc, char *argv[]){
 	/* set socket timeout */
 	alarm (socket_timeout);
 
-	offset = offset_request(server_address, &offset_result);
+	results = (ntp_source_result*)calloc(num_sources, sizeof(ntp_source_result));
+	if (results == NULL) die(STATE_UNKNOWN, "can not allocate result array");
+	offset_request(server_addresses, num_sources, results);
+	if (num_sources == 1) {
+		offset = results[0].offset;
+		offset_result = results[0].status;
+	} else {
+		agreeing = quorum_offset(results, num_sources, &offset);
+		offset_result = (agreeing >= quorum ? STATE_OK : STATE_UNKNOWN);
+	}
 	if (offset_result == STATE_UNKNOWN) {
 		result = (quiet == 1 ? STATE_UNKNOWN : STATE_CRITICAL);
 	} else {
@@ -587,9 +889,26 @@ int main(int argc, char *argv[]){
 		xasprintf(&result_line, "%s %s %.10g secs", result_line, _("Offset"), offset);
 		xasprintf(&perfdata_line, "%s", perfd_offset(offset));
 	}
+	if(num_sources > 1){
+		xasprintf(&result_line, "%s, %d of %d sources agree", result_line, agreeing, num_sources);
+		if(offset_result == STATE_UNKNOWN)
+			xasprintf(&result_line, "%s, %d needed", result_line, quorum);
+		for(i=0, sep=" ("; i<num_sources; i++, sep=", "){
+			if(results[i].status == STATE_OK){
+				xasprintf(&result_line, "%s%s%s %.10g", result_line, sep, results[i].host, results[i].offset);
+				xasprintf(&perfdata_line, "%s%s%s", perfdata_line, *perfdata_line ? " " : "",
+				          perfd_source_offset(results[i].host, results[i].offset));
+			} else {
+				xasprintf(&result_line, "%s%s%s %s", result_line, sep, results[i].host, _("unusable"));
+			}
+		}
+		xasprintf(&result_line, "%s)", result_line);
+	}
 	printf("%s|%s\n", result_line, perfdata_line);
 
-	if(server_address!=NULL) free(server_address);
+	for(i=0; i<num_sources; i++) free(server_addresses[i]);
+	free(server_addresses);
+	free(results);
 	return result;
 }
 
@@ -614,6 +933,17 @@ void print_help(void){
 	printf ("    %s\n", _("Offset to result in warning status (seconds)"));
 	printf (" %s\n", "-c, --critical=THRESHOLD");
 	printf ("    %s\n", _("Offset to result in critical status (seconds)"));
+	printf (" %s\n", "-n, --samples=INTEGER");
+	printf ("    %s\n", _("Number of samples to take from each server (default: 4)"));
+	printf (" %s\n", "-T, --tolerance=SECONDS");
+	printf ("    %s\n", _("Take no more samples from a server once the standard deviation of its"));
+	printf ("    %s\n", _("offsets is below this (default: always take all samples)"));
+	printf (" %s\n", "-Q, --quorum=INTEGER");
+	printf ("    %s\n", _("Number of hosts that have to agree on the offset when several are given"));
+	printf ("    %s\n", _("(default: more than half of them)"));
+	printf (" %s\n", "-a, --agree=SECONDS");
+	printf ("    %s\n", _("How far apart the offsets of hosts that agree may be, on top of their"));
+	printf ("    %s\n", _("round trip delays (default: 0.128)"));
 	printf (UT_TIMEOUT, DEFAULT_SOCKET_TIMEOUT);
 	printf (UT_VERBOSE);
 
@@ -626,12 +956,20 @@ void print_help(void){
 	printf("%s\n", _("Notes:"));
 	printf(" %s\n", _("If you'd rather want to monitor an NTP server, please use"));
 	printf(" %s\n", _("check_ntp_peer."));
+	printf(" %s\n", _("Of the samples taken from the selected server, the offset of the one with"));
+	printf(" %s\n", _("the shortest round trip is used, as queueing delays skew the others."));
+	printf(" %s\n", _("With several -H options (or a comma separated list), each host is taken"));
+	printf(" %s\n", _("as an independent time source. All of them are queried at once and the"));
+	printf(" %s\n", _("offset is the middle of the range most of them agree on (Marzullo's"));
+	printf(" %s\n", _("algorithm). The check fails if fewer than the quorum agree."));
 	printf("\n");
 	printf(UT_THRESHOLDS_NOTES);
 
 	printf("\n");
 	printf("%s\n", _("Examples:"));
 	printf("  %s\n", ("./check_ntp_time -H ntpserv -w 0.5 -c 1"));
+	printf(" %s\n", _("At least 3 of 4 sources have to agree within 50ms:"));
+	printf("  %s\n", ("./check_ntp_time -H ntp1,ntp2,ntp3,ntp4 -Q 3 -a 0.05 -w 0.5 -c 1"));
 
 	printf (UT_SUPPORT);
 }
@@ -640,6 +978,7 @@ void
 print_usage(void)
 {
 	printf ("%s\n", _("Usage:"));
-	printf(" %s -H <host> [-4|-6] [-w <warn>] [-c <crit>] [-v verbose]\n", progname);
+	printf(" %s -H <host>[,<host>...] [-4|-6] [-w <warn>] [-c <crit>] [-n <samples>]\n", progname);
+	printf("       [-T <tolerance>] [-Q <quorum>] [-a <agree>] [-v verbose]\n");
 }
 
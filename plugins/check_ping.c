@@ -45,11 +45,31 @@ enum {
 	DEFAULT_MAX_PACKETS = 5       /* default no. of ICMP ECHO packets */
 };
 
+/* one ping child per address. Its output is collected while all of them
+ * run, and interpreted once it has exited */
+typedef struct ping_host {
+	const char *addr;
+	char *cmd;
+	FILE *child;
+	int fd[2];                 /* stdout, stderr; -1 once at EOF */
+	char *text[2];
+	size_t len[2], size[2];
+	int pl;
+	float rta;
+	int result;
+	char *warn_text;
+	int error_state;           /* an error_scan() verdict for the host */
+	char *error;
+} ping_host;
+
 int process_arguments (int, char **);
 int get_threshold (char *, float *, int *);
 int validate_arguments (void);
-int run_ping (const char *cmd, const char *addr);
-int error_scan (char buf[MAX_INPUT_BUFFER], const char *addr);
+void start_ping (ping_host *host);
+int read_ping (ping_host *host, int which);
+void wait_for_pings (ping_host *hosts, int n);
+void run_ping (ping_host *host);
+int error_scan (char buf[MAX_INPUT_BUFFER], ping_host *host);
 void print_usage (void);
 void print_help (void);
 
@@ -64,20 +84,15 @@ int max_addr = 1;
 int max_packets = -1;
 int verbose = 0;
 
-float rta = UNKNOWN_TRIP_TIME;
-int pl = UNKNOWN_PACKET_LOSS;
-
-char *warn_text;
-
 
 
 int
 main (int argc, char **argv)
 {
-	char *cmd = NULL;
-	char *rawcmd = NULL;
 	int result = STATE_UNKNOWN;
 	int this_result = STATE_UNKNOWN;
+	ping_host *hosts, *host;
+	char *text = NULL, *perf = NULL, *msg, *rta_label, *pl_label, *old;
 	int i;
 
 	setlocale (LC_ALL, "");
@@ -107,79 +122,97 @@ main (int argc, char **argv)
 	alarm (timeout_interval);
 #endif
 
-	for (i = 0 ; i < n_addresses ; i++) {
-
-#ifdef PING6_COMMAND
-		if (address_family != AF_INET && is_inet6_addr(addresses[i]))
-			rawcmd = strdup(PING6_COMMAND);
-		else
-			rawcmd = strdup(PING_COMMAND);
-#else
-		rawcmd = strdup(PING_COMMAND);
-#endif
+	hosts = calloc (n_addresses, sizeof (ping_host));
+	if (hosts == NULL)
+		die (STATE_UNKNOWN, _("Could not malloc() hosts\n"));
 
-		/* does the host address of number of packets argument come first? */
-#ifdef PING_PACKETS_FIRST
-# ifdef PING_HAS_TIMEOUT
-		xasprintf (&cmd, rawcmd, timeout_interval, max_packets, addresses[i]);
-# else
-		xasprintf (&cmd, rawcmd, max_packets, addresses[i]);
-# endif
-#else
-		xasprintf (&cmd, rawcmd, addresses[i], max_packets);
-#endif
+	/* ping all addresses at once, so checking several takes no longer
+	 * than the slowest of them */
+	for (i = 0 ; i < n_addresses ; i++) {
+		hosts[i].addr = addresses[i];
+		start_ping (&hosts[i]);
+	}
+	wait_for_pings (hosts, n_addresses);
 
-		if (verbose >= 2)
-			printf ("CMD: %s\n", cmd);
+	/* with several addresses, any one answering would have ended the check
+	 * already. What's left is reported in the order given */
+	for (i = 0 ; i < n_addresses ; i++) {
+		if (hosts[i].error)
+			die (hosts[i].error_state, "%s", hosts[i].error);
+	}
 
-		/* run the command */
-		this_result = run_ping (cmd, addresses[i]);
+	for (i = 0 ; i < n_addresses ; i++) {
+		host = &hosts[i];
 
-		if (pl == UNKNOWN_PACKET_LOSS || rta < 0.0) {
-			printf ("%s\n", cmd);
+		if (host->pl == UNKNOWN_PACKET_LOSS || host->rta < 0.0) {
+			printf ("%s\n", host->cmd);
 			die (STATE_UNKNOWN,
 			           _("CRITICAL - Could not interpret output from ping command\n"));
 		}
 
-		if (pl >= cpl || rta >= crta || rta < 0)
+		this_result = host->result;
+		if (host->pl >= cpl || host->rta >= crta || host->rta < 0)
 			this_result = STATE_CRITICAL;
-		else if (pl >= wpl || rta >= wrta)
+		else if (host->pl >= wpl || host->rta >= wrta)
 			this_result = STATE_WARNING;
-		else if (pl >= 0 && rta >= 0)
+		else if (host->pl >= 0 && host->rta >= 0)
 			this_result = max_state (STATE_OK, this_result);
+		result = max_state (result, this_result);
+
+		/* several addresses share one status line, and their perfdata
+		 * labels carry the address to tell them apart */
+		if (n_addresses > 1) {
+			xasprintf (&rta_label, "rta_%s", host->addr);
+			xasprintf (&pl_label, "pl_%s", host->addr);
+			xasprintf (&msg, "%s: ", host->addr);
+		} else {
+			rta_label = strdup ("rta");
+			pl_label = strdup ("pl");
+			msg = strdup ("");
+		}
 
-		if (n_addresses > 1 && this_result != STATE_UNKNOWN)
-			die (STATE_OK, "%s is alive\n", addresses[i]);
+		if (display_html == TRUE) {
+			old = msg;
+			xasprintf (&msg, "<A HREF='%s/traceroute.cgi?%s'>%s", CGIURL, host->addr, old);
+			free (old);
+		}
 
-		if (display_html == TRUE)
-			printf ("<A HREF='%s/traceroute.cgi?%s'>", CGIURL, addresses[i]);
-		if (pl == 100)
-			printf (_("PING %s - %sPacket loss = %d%%"), state_text (this_result), warn_text,
-							pl);
+		old = msg;
+		if (host->pl == 100)
+			xasprintf (&msg, _("%s%sPacket loss = %d%%"), old, host->warn_text, host->pl);
 		else
-			printf (_("PING %s - %sPacket loss = %d%%, RTA = %2.2f ms"),
-							state_text (this_result), warn_text, pl, rta);
-		if (display_html == TRUE)
-			printf ("</A>");
-
-		/* Print performance data */
-		printf("|%s", fperfdata ("rta", (double) rta, "ms",
-		                          wrta>0?TRUE:FALSE, wrta,
-		                          crta>0?TRUE:FALSE, crta,
-		                          TRUE, 0, FALSE, 0));
-		printf(" %s\n", perfdata ("pl", (long) pl, "%",
-		                          wpl>0?TRUE:FALSE, wpl,
-		                          cpl>0?TRUE:FALSE, cpl,
-		                          TRUE, 0, FALSE, 0));
-
-		if (verbose >= 2)
-			printf ("%f:%d%% %f:%d%%\n", wrta, wpl, crta, cpl);
-
-		result = max_state (result, this_result);
-		free (rawcmd);
-		free (cmd);
+			xasprintf (&msg, _("%s%sPacket loss = %d%%, RTA = %2.2f ms"),
+			           old, host->warn_text, host->pl, host->rta);
+		free (old);
+
+		old = text;
+		xasprintf (&text, "%s%s%s%s", old ? old : "", old ? "; " : "", msg,
+		           display_html == TRUE ? "</A>" : "");
+		free (old);
+		free (msg);
+
+		/* performance data */
+		old = perf;
+		xasprintf (&perf, "%s%s%s %s", old ? old : "", old ? " " : "",
+		           fperfdata (rta_label, (double) host->rta, "ms",
+		                      wrta>0?TRUE:FALSE, wrta,
+		                      crta>0?TRUE:FALSE, crta,
+		                      TRUE, 0, FALSE, 0),
+		           perfdata (pl_label, (long) host->pl, "%",
+		                     wpl>0?TRUE:FALSE, wpl,
+		                     cpl>0?TRUE:FALSE, cpl,
+		                     TRUE, 0, FALSE, 0));
+		free (old);
+		free (rta_label);
+		free (pl_label);
 	}
 
+	printf (_("PING %s - %s"), state_text (result), text);
+	printf ("|%s\n", perf);
+
+	if (verbose >= 2)
+		printf ("%f:%d%% %f:%d%%\n", wrta, wpl, crta, cpl);
+
 	return result;
 }
 
@@ -427,120 +460,272 @@ validate_arguments ()
 
 
 
+void
+start_ping (ping_host *host)
+{
+	char *rawcmd;
+
+#ifdef PING6_COMMAND
+	if (address_family != AF_INET && is_inet6_addr(host->addr))
+		rawcmd = strdup(PING6_COMMAND);
+	else
+		rawcmd = strdup(PING_COMMAND);
+#else
+	rawcmd = strdup(PING_COMMAND);
+#endif
+
+	/* does the host address of number of packets argument come first? */
+#ifdef PING_PACKETS_FIRST
+# ifdef PING_HAS_TIMEOUT
+	xasprintf (&host->cmd, rawcmd, timeout_interval, max_packets, host->addr);
+# else
+	xasprintf (&host->cmd, rawcmd, max_packets, host->addr);
+# endif
+#else
+	xasprintf (&host->cmd, rawcmd, host->addr, max_packets);
+#endif
+	free (rawcmd);
+
+	if (verbose >= 2)
+		printf ("CMD: %s\n", host->cmd);
+
+	if ((host->child = spopen (host->cmd)) == NULL)
+		die (STATE_UNKNOWN, _("Could not open pipe: %s\n"), host->cmd);
+
+	host->fd[0] = fileno (host->child);
+	host->fd[1] = child_stderr_array[host->fd[0]];
+	host->pl = UNKNOWN_PACKET_LOSS;
+	host->rta = UNKNOWN_TRIP_TIME;
+	host->result = STATE_UNKNOWN;
+}
+
+
+
+/* append what's waiting on one of the host's pipes to its text. Returns
+ * FALSE once the pipe is at EOF */
 int
-run_ping (const char *cmd, const char *addr)
+read_ping (ping_host *host, int which)
 {
-	char buf[MAX_INPUT_BUFFER];
-	int result = STATE_UNKNOWN;
-	int match;
+	ssize_t got;
+
+	if (host->size[which] - host->len[which] < MAX_INPUT_BUFFER) {
+		host->size[which] += MAX_INPUT_BUFFER;
+		host->text[which] = realloc (host->text[which], host->size[which]);
+		if (host->text[which] == NULL)
+			die (STATE_UNKNOWN, _("Could not realloc() ping output\n"));
+	}
+
+	got = read (host->fd[which], host->text[which] + host->len[which],
+	            host->size[which] - host->len[which] - 1);
+	if (got < 0 && errno == EINTR)
+		return TRUE;
+	if (got <= 0) {
+		if (which == 1)
+			close (host->fd[which]);
+		host->fd[which] = -1;
+		host->text[which][host->len[which]] = '\0';
+		return FALSE;
+	}
+
+	host->len[which] += got;
+	host->text[which][host->len[which]] = '\0';
+	return TRUE;
+}
+
+
+
+/* multiplex the pipes of all ping children until they are done. With
+ * several addresses, the first one found alive decides the check */
+void
+wait_for_pings (ping_host *hosts, int n)
+{
+	struct pollfd *pfds;
+	ping_host *host, **owner;
+	int running = n, i, j, nfds;
+
+	pfds = malloc (sizeof (struct pollfd) * n * 2);
+	owner = malloc (sizeof (ping_host *) * n * 2);
+	if (pfds == NULL || owner == NULL)
+		die (STATE_UNKNOWN, _("Could not malloc() poll array\n"));
+
+	while (running) {
+		for (i = nfds = 0 ; i < n ; i++) {
+			for (j = 0 ; j < 2 ; j++) {
+				if (hosts[i].fd[j] == -1)
+					continue;
+				pfds[nfds].fd = hosts[i].fd[j];
+				pfds[nfds].events = POLLIN;
+				pfds[nfds].revents = 0;
+				owner[nfds++] = &hosts[i];
+			}
+		}
+
+		if (poll (pfds, nfds, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			die (STATE_UNKNOWN, _("poll() failed: %s\n"), strerror (errno));
+		}
+
+		for (i = 0 ; i < nfds ; i++) {
+			if (!pfds[i].revents)
+				continue;
+			host = owner[i];
+			read_ping (host, pfds[i].fd == host->fd[0] ? 0 : 1);
+			if (host->fd[0] != -1 || host->fd[1] != -1)
+				continue;
+
+			running--;
+			spclose (host->child);
+			host->child = NULL;
+			run_ping (host);
+
+			if (n > 1 && !host->error && host->pl < 100 && host->rta >= 0.0)
+				die (STATE_OK, "%s is alive\n", host->addr);
+		}
+	}
+
+	free (owner);
+	free (pfds);
+}
+
 
-	if ((child_process = spopen (cmd)) == NULL)
-		die (STATE_UNKNOWN, _("Could not open pipe: %s\n"), cmd);
 
-	child_stderr = fdopen (child_stderr_array[fileno (child_process)], "r");
-	if (child_stderr == NULL)
-		printf (_("Cannot open stderr for %s\n"), cmd);
+/* copy the next line of text, like fgets() would have read it */
+static char *
+next_line (char **text, char buf[MAX_INPUT_BUFFER])
+{
+	size_t len;
+
+	if (**text == '\0')
+		return NULL;
+
+	len = strcspn (*text, "\n");
+	if ((*text)[len] == '\n')
+		len++;
+	if (len > MAX_INPUT_BUFFER - 2)
+		len = MAX_INPUT_BUFFER - 2;
+	memcpy (buf, *text, len);
+	buf[len] = '\0';
+	*text += len;
+	return buf;
+}
+
 
-	while (fgets (buf, MAX_INPUT_BUFFER - 1, child_process)) {
+
+void
+run_ping (ping_host *host)
+{
+	char buf[MAX_INPUT_BUFFER];
+	char *text;
+	int match;
+
+	text = host->text[0] ? host->text[0] : "";
+	while (next_line (&text, buf)) {
 
 		if (verbose >= 3)
 			printf("Output: %s", buf);
 
-		result = max_state (result, error_scan (buf, addr));
+		host->result = max_state (host->result, error_scan (buf, host));
 
 		/* get the percent loss statistics */
 		match = 0;
-		if((sscanf(buf,"%*d packets transmitted, %*d packets received, +%*d errors, %d%% packet loss%n",&pl,&match) && match) ||
-			 (sscanf(buf,"%*d packets transmitted, %*d packets received, +%*d duplicates, %d%% packet loss%n",&pl,&match) && match) ||
-			 (sscanf(buf,"%*d packets transmitted, %*d received, +%*d duplicates, %d%% packet loss%n",&pl,&match) && match) ||
-			 (sscanf(buf,"%*d packets transmitted, %*d packets received, %d%% packet loss%n",&pl,&match) && match) ||
-			 (sscanf(buf,"%*d packets transmitted, %*d packets received, %d%% loss, time%n",&pl,&match) && match) ||
-			 (sscanf(buf,"%*d packets transmitted, %*d received, %d%% loss, time%n",&pl,&match) && match) ||
-			 (sscanf(buf,"%*d packets transmitted, %*d received, %d%% packet loss, time%n",&pl,&match) && match) ||
-			 (sscanf(buf,"%*d packets transmitted, %*d received, +%*d errors, %d%% packet loss%n",&pl,&match) && match) ||
-			 (sscanf(buf,"%*d packets transmitted %*d received, +%*d errors, %d%% packet loss%n",&pl,&match) && match)
+		if((sscanf(buf,"%*d packets transmitted, %*d packets received, +%*d errors, %d%% packet loss%n",&host->pl,&match) && match) ||
+			 (sscanf(buf,"%*d packets transmitted, %*d packets received, +%*d duplicates, %d%% packet loss%n",&host->pl,&match) && match) ||
+			 (sscanf(buf,"%*d packets transmitted, %*d received, +%*d duplicates, %d%% packet loss%n",&host->pl,&match) && match) ||
+			 (sscanf(buf,"%*d packets transmitted, %*d packets received, %d%% packet loss%n",&host->pl,&match) && match) ||
+			 (sscanf(buf,"%*d packets transmitted, %*d packets received, %d%% loss, time%n",&host->pl,&match) && match) ||
+			 (sscanf(buf,"%*d packets transmitted, %*d received, %d%% loss, time%n",&host->pl,&match) && match) ||
+			 (sscanf(buf,"%*d packets transmitted, %*d received, %d%% packet loss, time%n",&host->pl,&match) && match) ||
+			 (sscanf(buf,"%*d packets transmitted, %*d received, +%*d errors, %d%% packet loss%n",&host->pl,&match) && match) ||
+			 (sscanf(buf,"%*d packets transmitted %*d received, +%*d errors, %d%% packet loss%n",&host->pl,&match) && match)
 			 )
 			continue;
 
 		/* get the round trip average */
 		else
-			if((sscanf(buf,"round-trip min/avg/max = %*f/%f/%*f%n",&rta,&match) && match) ||
-				 (sscanf(buf,"round-trip min/avg/max/mdev = %*f/%f/%*f/%*f%n",&rta,&match) && match) ||
-				 (sscanf(buf,"round-trip min/avg/max/sdev = %*f/%f/%*f/%*f%n",&rta,&match) && match) ||
-				 (sscanf(buf,"round-trip min/avg/max/stddev = %*f/%f/%*f/%*f%n",&rta,&match) && match) ||
-				 (sscanf(buf,"round-trip min/avg/max/std-dev = %*f/%f/%*f/%*f%n",&rta,&match) && match) ||
-				 (sscanf(buf,"round-trip (ms) min/avg/max = %*f/%f/%*f%n",&rta,&match) && match) ||
-				 (sscanf(buf,"round-trip (ms) min/avg/max/stddev = %*f/%f/%*f/%*f%n",&rta,&match) && match) ||
-				 (sscanf(buf,"rtt min/avg/max/mdev = %*f/%f/%*f/%*f ms%n",&rta,&match) && match))
+			if((sscanf(buf,"round-trip min/avg/max = %*f/%f/%*f%n",&host->rta,&match) && match) ||
+				 (sscanf(buf,"round-trip min/avg/max/mdev = %*f/%f/%*f/%*f%n",&host->rta,&match) && match) ||
+				 (sscanf(buf,"round-trip min/avg/max/sdev = %*f/%f/%*f/%*f%n",&host->rta,&match) && match) ||
+				 (sscanf(buf,"round-trip min/avg/max/stddev = %*f/%f/%*f/%*f%n",&host->rta,&match) && match) ||
+				 (sscanf(buf,"round-trip min/avg/max/std-dev = %*f/%f/%*f/%*f%n",&host->rta,&match) && match) ||
+				 (sscanf(buf,"round-trip (ms) min/avg/max = %*f/%f/%*f%n",&host->rta,&match) && match) ||
+				 (sscanf(buf,"round-trip (ms) min/avg/max/stddev = %*f/%f/%*f/%*f%n",&host->rta,&match) && match) ||
+				 (sscanf(buf,"rtt min/avg/max/mdev = %*f/%f/%*f/%*f ms%n",&host->rta,&match) && match))
 			continue;
 	}
 
 	/* this is needed because there is no rta if all packets are lost */
-	if (pl == 100)
-		rta = crta;
+	if (host->pl == 100)
+		host->rta = crta;
 
 	/* check stderr, setting at least WARNING if there is output here */
 	/* Add warning into warn_text */
-	while (fgets (buf, MAX_INPUT_BUFFER - 1, child_stderr)) {
+	text = host->text[1] ? host->text[1] : "";
+	while (next_line (&text, buf)) {
 		if (! strstr(buf,"WARNING - no SO_TIMESTAMP support, falling back to SIOCGSTAMP")) {
 			if (verbose >= 3) {
 				printf("Got stderr: %s", buf);
 			}
-			if ((result=error_scan(buf, addr)) == STATE_OK) {
-				result = STATE_WARNING;
-				if (warn_text == NULL) {
-					warn_text = strdup(_("System call sent warnings to stderr "));
+			if ((host->result=error_scan(buf, host)) == STATE_OK) {
+				host->result = STATE_WARNING;
+				if (host->warn_text == NULL) {
+					host->warn_text = strdup(_("System call sent warnings to stderr "));
 				} else {
-					xasprintf(&warn_text, "%s %s", warn_text, _("System call sent warnings to stderr "));
+					xasprintf(&host->warn_text, "%s %s", host->warn_text, _("System call sent warnings to stderr "));
 				}
 			}
 		}
 	}
 
-	(void) fclose (child_stderr);
-
+	if (host->warn_text == NULL)
+		host->warn_text = strdup("");
+}
 
-	spclose (child_process);
 
-	if (warn_text == NULL)
-		warn_text = strdup("");
 
-	return result;
+/* the first error seen is kept for the host, and reported unless another
+ * address turns out to be alive */
+static int
+ping_error (ping_host *host, const char *fmt)
+{
+	if (host->error == NULL) {
+		host->error_state = STATE_CRITICAL;
+		xasprintf (&host->error, fmt, host->addr);
+	}
+	return STATE_CRITICAL;
 }
 
-
-
 int
-error_scan (char buf[MAX_INPUT_BUFFER], const char *addr)
+error_scan (char buf[MAX_INPUT_BUFFER], ping_host *host)
 {
 	if (strstr (buf, "Network is unreachable") ||
 		strstr (buf, "Destination Net Unreachable")
 		)
-		die (STATE_CRITICAL, _("CRITICAL - Network Unreachable (%s)\n"), addr);
+		return ping_error (host, _("CRITICAL - Network Unreachable (%s)\n"));
 	else if (strstr (buf, "Destination Host Unreachable"))
-		die (STATE_CRITICAL, _("CRITICAL - Host Unreachable (%s)\n"), addr);
+		return ping_error (host, _("CRITICAL - Host Unreachable (%s)\n"));
 	else if (strstr (buf, "Destination Port Unreachable"))
-		die (STATE_CRITICAL, _("CRITICAL - Bogus ICMP: Port Unreachable (%s)\n"), addr);
+		return ping_error (host, _("CRITICAL - Bogus ICMP: Port Unreachable (%s)\n"));
 	else if (strstr (buf, "Destination Protocol Unreachable"))
-		die (STATE_CRITICAL, _("CRITICAL - Bogus ICMP: Protocol Unreachable (%s)\n"), addr);
+		return ping_error (host, _("CRITICAL - Bogus ICMP: Protocol Unreachable (%s)\n"));
 	else if (strstr (buf, "Destination Net Prohibited"))
-		die (STATE_CRITICAL, _("CRITICAL - Network Prohibited (%s)\n"), addr);
+		return ping_error (host, _("CRITICAL - Network Prohibited (%s)\n"));
 	else if (strstr (buf, "Destination Host Prohibited"))
-		die (STATE_CRITICAL, _("CRITICAL - Host Prohibited (%s)\n"), addr);
+		return ping_error (host, _("CRITICAL - Host Prohibited (%s)\n"));
 	else if (strstr (buf, "Packet filtered"))
-		die (STATE_CRITICAL, _("CRITICAL - Packet Filtered (%s)\n"), addr);
+		return ping_error (host, _("CRITICAL - Packet Filtered (%s)\n"));
 	else if (strstr (buf, "unknown host" ))
-		die (STATE_CRITICAL, _("CRITICAL - Host not found (%s)\n"), addr);
+		return ping_error (host, _("CRITICAL - Host not found (%s)\n"));
 	else if (strstr (buf, "Time to live exceeded"))
-		die (STATE_CRITICAL, _("CRITICAL - Time to live exceeded (%s)\n"), addr);
+		return ping_error (host, _("CRITICAL - Time to live exceeded (%s)\n"));
 	else if (strstr (buf, "Destination unreachable: "))
-		die (STATE_CRITICAL, _("CRITICAL - Destination Unreachable (%s)\n"), addr);
+		return ping_error (host, _("CRITICAL - Destination Unreachable (%s)\n"));
 
 	if (strstr (buf, "(DUP!)") || strstr (buf, "DUPLICATES FOUND")) {
-		if (warn_text == NULL)
-			warn_text = strdup (_(WARN_DUPLICATES));
-		else if (! strstr (warn_text, _(WARN_DUPLICATES)) &&
-		         xasprintf (&warn_text, "%s %s", warn_text, _(WARN_DUPLICATES)) == -1)
+		if (host->warn_text == NULL)
+			host->warn_text = strdup (_(WARN_DUPLICATES));
+		else if (! strstr (host->warn_text, _(WARN_DUPLICATES)) &&
+		         xasprintf (&host->warn_text, "%s %s", host->warn_text, _(WARN_DUPLICATES)) == -1)
 			die (STATE_UNKNOWN, _("Unable to realloc warn_text\n"));
 		return (STATE_WARNING);
 	}
@@ -570,7 +755,7 @@ print_help (void)
 	printf (UT_IPv46);
 
 	printf (" %s\n", "-H, --hostname=HOST");
-  printf ("    %s\n", _("host to ping"));
+  printf ("    %s\n", _("host to ping, may be given more than once"));
   printf (" %s\n", "-w, --warning=THRESHOLD");
   printf ("    %s\n", _("warning threshold pair"));
   printf (" %s\n", "-c, --critical=THRESHOLD");
@@ -593,6 +778,10 @@ print_help (void)
   printf ("%s\n", _("(percentage) and round trip average (milliseconds). It can produce HTML output"));
   printf ("%s\n", _("linking to a traceroute CGI contributed by Ian Cass. The CGI can be found in"));
   printf ("%s\n", _("the contrib area of the downloads section at http://www.nagios.org/"));
+  printf ("\n");
+  printf ("%s\n", _("Several hosts are pinged at the same time. The check is OK as soon as one"));
+  printf ("%s\n", _("of them answers, otherwise the results of all hosts are reported together,"));
+  printf ("%s\n", _("with perfdata labels such as rta_<host> and pl_<host>."));
 
 	printf (UT_SUPPORT);
 }
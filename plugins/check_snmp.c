@@ -35,6 +35,10 @@ const char *email = "nagiosplug-devel@lists.sourceforge.net";
 #include "common.h"
 #include "utils.h"
 #include "utils_cmd.h"
+#include "utils_snmp.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <ctype.h>
 
 #define DEFAULT_COMMUNITY "public"
 #define DEFAULT_PORT "161"
@@ -57,12 +61,26 @@ const char *email = "nagiosplug-devel@lists.sourceforge.net";
 #define WARN_STRING 16
 #define WARN_REGEX 32
 
-#define MAX_OIDS 8
-
 /* Longopts only arguments */
 #define L_CALCULATE_RATE CHAR_MAX+1
 #define L_RATE_MULTIPLIER CHAR_MAX+2
 #define L_INVERT_SEARCH CHAR_MAX+3
+#define L_TABLE CHAR_MAX+4
+#define L_ROW_LABEL CHAR_MAX+5
+#define L_RATE_SAMPLES CHAR_MAX+6
+#define L_CACHE CHAR_MAX+7
+#define L_V3_CACHE CHAR_MAX+8
+#define L_HOSTS CHAR_MAX+9
+#define L_WINDOW CHAR_MAX+10
+
+/* version of the --rate state data */
+#define RATE_STATE_VERSION 2
+
+/* GETBULK max-repetitions to start a table walk with */
+#define DEFAULT_MAX_REPETITIONS 25
+
+/* --hosts: requests out at once */
+#define DEFAULT_WINDOW 64
 
 /* Gobble to string - stop incrementing c when c[0] match one of the
  * characters in s */
@@ -95,7 +113,6 @@ char regex_expect[MAX_INPUT_BUFFER] = "";
 regex_t preg;
 regmatch_t pmatch[10];
 char errbuf[MAX_INPUT_BUFFER] = "";
-char perfstr[MAX_INPUT_BUFFER] = "| ";
 int cflags = REG_EXTENDED | REG_NOSUB | REG_NEWLINE;
 int eflags = 0;
 int errcode, excode;
@@ -124,25 +141,1017 @@ size_t labels_size = 8;
 size_t nunits = 0;
 size_t unitv_size = 8;
 int numoids = 0;
+int oids_size = 0;
 int numauthpriv = 0;
 int verbose = 0;
 int usesnmpgetnext = FALSE;
 char *warning_thresholds = NULL;
 char *critical_thresholds = NULL;
-thresholds *thlds[MAX_OIDS];
-double response_value[MAX_OIDS];
+thresholds **thlds = NULL;
+double *response_value = NULL;
 int retries = 0;
-int eval_method[MAX_OIDS];
+int *eval_method = NULL;
 char *delimiter;
 char *output_delim;
 char *miblist = NULL;
 int needmibs = FALSE;
+double timeout_seconds = DEFAULT_TIMEOUT;
+np_snmp_oid *snmp_oids = NULL;
+int *symbolic = NULL;
 int calculate_rate = 0;
 int rate_multiplier = 1;
-state_data *previous_state;
-double previous_value[MAX_OIDS];
+int rate_samples = 1;
+long long agent_uptime = -1;
 int perf_labels = 1;
+int table = FALSE;
+char *row_label = "{index}";
+char *hosts_file = NULL;
+int window = DEFAULT_WINDOW;
+
+/* a table walk: one cell for each column and index */
+typedef struct snmp_cell {
+	char *text;                  /* NULL if the row lacks the column */
+	double value;
+	int numeric;
+	int counter;
+} snmp_cell;
+
+typedef struct snmp_row {
+	char *index;
+	snmp_cell *cells;
+} snmp_row;
+
+/* --rate: the values of earlier calls, oldest first. Counters keep their
+ * type and exact value, so that they wrap at their own width */
+#define RATE_GAUGE 0
+#define RATE_COUNTER32 32
+#define RATE_COUNTER64 64
+
+typedef struct rate_value {
+	int type;
+	unsigned long long counter;
+	double gauge;
+} rate_value;
+
+typedef struct rate_sample {
+	time_t time;
+	long long uptime;            /* sysUpTime of the agent, -1 if unknown */
+	rate_value *values;
+} rate_sample;
+
+rate_value *rate_values = NULL;
+rate_sample *samples = NULL;
+int nsamples = 0;
+
+/* --cache: responses kept for a few seconds in the state directory, one
+ * file for each agent and community, shared by all checks asking it */
+int cache_ttl = 0;
+int v3_cache = FALSE;
+
+typedef struct cache_entry {
+	time_t time;
+	int type;                    /* NP_SNMP_GET or NP_SNMP_GETNEXT */
+	np_snmp_varbind asked;       /* the OID asked for, with no value */
+	np_snmp_varbind vb;          /* and the answer */
+} cache_entry;
+
+/* objects that can be asked for by name without snmpget loading MIBs */
+static const struct {
+	const char *module;
+	const char *name;
+	const char *oid;
+	int display;          /* a DisplayString, printed without quotes */
+} known_objects[] = {
+	{ "SNMPv2-MIB", "sysDescr", "1.3.6.1.2.1.1.1", TRUE },
+	{ "SNMPv2-MIB", "sysObjectID", "1.3.6.1.2.1.1.2", FALSE },
+	{ "SNMPv2-MIB", "sysUpTime", "1.3.6.1.2.1.1.3", FALSE },
+	{ "SNMPv2-MIB", "sysContact", "1.3.6.1.2.1.1.4", TRUE },
+	{ "SNMPv2-MIB", "sysName", "1.3.6.1.2.1.1.5", TRUE },
+	{ "SNMPv2-MIB", "sysLocation", "1.3.6.1.2.1.1.6", TRUE },
+	{ "SNMPv2-MIB", "sysServices", "1.3.6.1.2.1.1.7", FALSE },
+	{ "IF-MIB", "ifNumber", "1.3.6.1.2.1.2.1", FALSE },
+	{ "IF-MIB", "ifIndex", "1.3.6.1.2.1.2.2.1.1", FALSE },
+	{ "IF-MIB", "ifDescr", "1.3.6.1.2.1.2.2.1.2", TRUE },
+	{ "IF-MIB", "ifType", "1.3.6.1.2.1.2.2.1.3", FALSE },
+	{ "IF-MIB", "ifMtu", "1.3.6.1.2.1.2.2.1.4", FALSE },
+	{ "IF-MIB", "ifSpeed", "1.3.6.1.2.1.2.2.1.5", FALSE },
+	{ "IF-MIB", "ifPhysAddress", "1.3.6.1.2.1.2.2.1.6", FALSE },
+	{ "IF-MIB", "ifAdminStatus", "1.3.6.1.2.1.2.2.1.7", FALSE },
+	{ "IF-MIB", "ifOperStatus", "1.3.6.1.2.1.2.2.1.8", FALSE },
+	{ "IF-MIB", "ifLastChange", "1.3.6.1.2.1.2.2.1.9", FALSE },
+	{ "IF-MIB", "ifInOctets", "1.3.6.1.2.1.2.2.1.10", FALSE },
+	{ "IF-MIB", "ifInUcastPkts", "1.3.6.1.2.1.2.2.1.11", FALSE },
+	{ "IF-MIB", "ifInDiscards", "1.3.6.1.2.1.2.2.1.13", FALSE },
+	{ "IF-MIB", "ifInErrors", "1.3.6.1.2.1.2.2.1.14", FALSE },
+	{ "IF-MIB", "ifOutOctets", "1.3.6.1.2.1.2.2.1.16", FALSE },
+	{ "IF-MIB", "ifOutUcastPkts", "1.3.6.1.2.1.2.2.1.17", FALSE },
+	{ "IF-MIB", "ifOutDiscards", "1.3.6.1.2.1.2.2.1.19", FALSE },
+	{ "IF-MIB", "ifOutErrors", "1.3.6.1.2.1.2.2.1.20", FALSE },
+	{ "IF-MIB", "ifName", "1.3.6.1.2.1.31.1.1.1.1", TRUE },
+	{ "IF-MIB", "ifHCInOctets", "1.3.6.1.2.1.31.1.1.1.6", FALSE },
+	{ "IF-MIB", "ifHCOutOctets", "1.3.6.1.2.1.31.1.1.1.10", FALSE },
+	{ "IF-MIB", "ifHighSpeed", "1.3.6.1.2.1.31.1.1.1.15", FALSE },
+	{ "IF-MIB", "ifAlias", "1.3.6.1.2.1.31.1.1.1.18", TRUE },
+	{ "HOST-RESOURCES-MIB", "hrSystemUptime", "1.3.6.1.2.1.25.1.1", FALSE },
+	{ "HOST-RESOURCES-MIB", "hrSystemNumUsers", "1.3.6.1.2.1.25.1.5", FALSE },
+	{ "HOST-RESOURCES-MIB", "hrSystemProcesses", "1.3.6.1.2.1.25.1.6", FALSE },
+	{ "HOST-RESOURCES-MIB", "hrStorageDescr", "1.3.6.1.2.1.25.2.3.1.3", TRUE },
+	{ "HOST-RESOURCES-MIB", "hrStorageAllocationUnits", "1.3.6.1.2.1.25.2.3.1.4", FALSE },
+	{ "HOST-RESOURCES-MIB", "hrStorageSize", "1.3.6.1.2.1.25.2.3.1.5", FALSE },
+	{ "HOST-RESOURCES-MIB", "hrStorageUsed", "1.3.6.1.2.1.25.2.3.1.6", FALSE },
+	{ "HOST-RESOURCES-MIB", "hrProcessorLoad", "1.3.6.1.2.1.25.3.3.1.2", FALSE },
+	{ "UCD-SNMP-MIB", "memTotalReal", "1.3.6.1.4.1.2021.4.5", FALSE },
+	{ "UCD-SNMP-MIB", "memAvailReal", "1.3.6.1.4.1.2021.4.6", FALSE },
+	{ "UCD-SNMP-MIB", "laLoad", "1.3.6.1.4.1.2021.10.1.3", FALSE },
+	{ "UCD-SNMP-MIB", "laLoadInt", "1.3.6.1.4.1.2021.10.1.5", FALSE },
+	{ "UCD-SNMP-MIB", "ssCpuIdle", "1.3.6.1.4.1.2021.11.11", FALSE },
+	{ NULL, NULL, NULL, FALSE }
+};
+
+/* numeric OIDs, and the names above (with or without their MIB module
+ * and followed by an index) */
+static int
+resolve_oid (const char *str, np_snmp_oid *oid, int *by_name)
+{
+	char buf[MAX_INPUT_BUFFER];
+	const char *name = str, *sep;
+	size_t len;
+	int i;
+
+	*by_name = FALSE;
+	if (np_snmp_parse_oid (str, oid) == 0)
+		return OK;
+	if ((sep = strstr (str, "::")))
+		name = sep + 2;
+	len = strcspn (name, ".");
+	for (i = 0; known_objects[i].name; i++) {
+		if (strlen (known_objects[i].name) != len || strncmp (known_objects[i].name, name, len))
+			continue;
+		if (sep && (strlen (known_objects[i].module) != (size_t)(sep - str) ||
+		            strncmp (known_objects[i].module, str, sep - str)))
+			continue;
+		snprintf (buf, sizeof (buf), "%s%s", known_objects[i].oid, name + len);
+		*by_name = TRUE;
+		return np_snmp_parse_oid (buf, oid) == 0 ? OK : ERROR;
+	}
+	return ERROR;
+}
 
+/* the entry of known_objects oid is an instance of, or -1. Sets *n to
+ * the length of the object's OID */
+static int
+known_object (const np_snmp_oid *oid, unsigned int *n)
+{
+	np_snmp_oid known;
+	unsigned int i;
+	int j, best = -1;
+
+	for (j = 0; known_objects[j].name; j++) {
+		np_snmp_parse_oid (known_objects[j].oid, &known);
+		for (i = 0; i < known.n && i < oid->n && known.id[i] == oid->id[i]; i++);
+		if (i == known.n && (best < 0 || known.n > *n)) {
+			best = j;
+			*n = known.n;
+		}
+	}
+	return best;
+}
+
+/* the name snmpget would print: MODULE::name.index for objects asked for
+ * by name, iso.3.6.1... otherwise */
+static char *
+oid_name (const np_snmp_oid *oid, int by_name)
+{
+	static const char *roots[] = { "ccitt", "iso", "joint-iso-ccitt" };
+	char *name;
+	unsigned int i, n = 1;
+	int known = by_name ? known_object (oid, &n) : -1;
+
+	if (known >= 0)
+		xasprintf (&name, "%s::%s", known_objects[known].module, known_objects[known].name);
+	else {
+		name = strdup (roots[oid->id[0]]);
+		n = 1;
+	}
+	for (i = n; i < oid->n; i++)
+		xasprintf (&name, "%s.%u", name, oid->id[i]);
+	return name;
+}
+
+/* make room for n OIDs in oids and the arrays that go with it */
+static void
+grow_oids (int n)
+{
+	int old = oids_size;
+
+	if (n <= oids_size)
+		return;
+	oids_size = n + 8;
+	oids = realloc (oids, oids_size * sizeof (*oids));
+	thlds = realloc (thlds, oids_size * sizeof (*thlds));
+	response_value = realloc (response_value, oids_size * sizeof (*response_value));
+	rate_values = realloc (rate_values, oids_size * sizeof (*rate_values));
+	eval_method = realloc (eval_method, oids_size * sizeof (*eval_method));
+	snmp_oids = realloc (snmp_oids, oids_size * sizeof (*snmp_oids));
+	symbolic = realloc (symbolic, oids_size * sizeof (*symbolic));
+	if (!oids || !thlds || !response_value || !rate_values || !eval_method || !snmp_oids || !symbolic)
+		die (STATE_UNKNOWN, _("Could not reallocate OIDs [%d]\n"), n);
+	for (; old < oids_size; old++) {
+		memset (&rate_values[old], 0, sizeof (*rate_values));
+		eval_method[old] = CHECK_UNDEF;
+	}
+}
+
+static void
+snmp_options (np_snmp_options *opts)
+{
+	np_snmp_init_options (opts);
+	opts->port = atoi (port);
+	opts->version = strcmp (proto, "2c") ? NP_SNMP_V1 : NP_SNMP_V2C;
+	opts->community = community;
+	opts->retries = retries;
+	opts->timeout = timeout_seconds * 1000;
+}
+
+static void
+put64 (unsigned char **p, unsigned long long value)
+{
+	int i;
+
+	for (i = 56; i >= 0; i -= 8)
+		*(*p)++ = value >> i;
+}
+
+static unsigned long long
+get64 (const unsigned char **p)
+{
+	unsigned long long value = 0;
+	int i;
+
+	for (i = 0; i < 8; i++)
+		value = value << 8 | *(*p)++;
+	return value;
+}
+
+/* Open the cache of this agent, and lock it. Checks of the same agent wait
+ * here while one of them asks it, and then find its answers in the cache.
+ * Returns -1 if there is no cache to be had, and the check goes on without */
+static int
+cache_open (void)
+{
+	struct sha1_ctx ctx;
+	unsigned char digest[20];
+	struct flock lock;
+	char *dir, *path;
+	int fd, i;
+
+	sha1_init_ctx (&ctx);
+	sha1_process_bytes (server_address, strlen (server_address) + 1, &ctx);
+	sha1_process_bytes (port, strlen (port) + 1, &ctx);
+	sha1_process_bytes (proto, strlen (proto) + 1, &ctx);
+	sha1_process_bytes (community, strlen (community) + 1, &ctx);
+	sha1_finish_ctx (&ctx, digest);
+
+	xasprintf (&dir, "%s/%s", _np_state_calculate_location_prefix (), progname);
+	xasprintf (&path, "%s/cache-", dir);
+	for (i = 0; i < 20; i++)
+		xasprintf (&path, "%s%02x", path, digest[i]);
+	mkdir (_np_state_calculate_location_prefix (), S_IRWXU);
+	mkdir (dir, S_IRWXU);
+
+	if ((fd = open (path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR)) < 0) {
+		if (verbose)
+			printf ("Cannot open cache %s: %s\n", path, strerror (errno));
+		return -1;
+	}
+	memset (&lock, 0, sizeof (lock));
+	lock.l_type = F_WRLCK;
+	lock.l_whence = SEEK_SET;
+	if (fcntl (fd, F_SETLKW, &lock) < 0) {
+		if (verbose)
+			printf ("Cannot lock cache %s: %s\n", path, strerror (errno));
+		close (fd);
+		return -1;
+	}
+	if (verbose > 1)
+		printf ("Using cache %s\n", path);
+	free (dir);
+	free (path);
+	return fd;
+}
+
+/* Each entry is its time, the request type, then the OID asked for and
+ * the answer as BER encoded varbinds. Reading stops at anything amiss */
+static cache_entry *
+cache_read (int fd, int *n)
+{
+	struct stat st;
+	unsigned char *data, *p, *end;
+	cache_entry *entries = NULL;
+	int len;
+
+	*n = 0;
+	if (fstat (fd, &st) < 0 || st.st_size == 0 || (data = malloc (st.st_size)) == NULL)
+		return NULL;
+	if (read (fd, data, st.st_size) != st.st_size) {
+		free (data);
+		return NULL;
+	}
+	for (p = data, end = data + st.st_size; end - p > 9; (*n)++) {
+		if ((entries = realloc (entries, (*n + 1) * sizeof (*entries))) == NULL)
+			die (STATE_UNKNOWN, _("Cannot malloc"));
+		entries[*n].time = get64 ((const unsigned char **)&p);
+		entries[*n].type = *p++;
+		if ((len = np_snmp_decode_varbind (p, end - p, &entries[*n].asked)) < 0)
+			break;
+		p += len;
+		if ((len = np_snmp_decode_varbind (p, end - p, &entries[*n].vb)) < 0) {
+			np_snmp_free_varbind (&entries[*n].asked);
+			break;
+		}
+		p += len;
+	}
+	free (data);
+	return entries;
+}
+
+static np_snmp_varbind *
+cache_lookup (cache_entry *entries, int n, int type, const np_snmp_oid *oid, time_t now)
+{
+	int i;
+
+	for (i = n - 1; i >= 0; i--)
+		if (entries[i].type == type && !np_snmp_oid_compare (&entries[i].asked.oid, oid) &&
+		    entries[i].time <= now && now - entries[i].time < cache_ttl)
+			return &entries[i].vb;
+	return NULL;
+}
+
+/* Write what is still fresh back with the new answers, and let the next
+ * check have the cache */
+static void
+cache_write (int fd, cache_entry *entries, int n, int type, int *asked, int nasked,
+             np_snmp_varbind **vbs, time_t now)
+{
+	unsigned char *data = NULL, *p;
+	size_t size = 0, used = 0;
+	np_snmp_varbind none;
+	int i, k, len;
+
+	memset (&none, 0, sizeof (none));
+	none.type = NP_SNMP_NULL;
+	for (i = 0; i < n + nasked; i++) {
+		if (i < n) {
+			/* old entries go unless they are fresh and not asked again */
+			if (entries[i].time > now || now - entries[i].time >= cache_ttl)
+				continue;
+			for (k = 0; k < nasked && (type != entries[i].type ||
+			     np_snmp_oid_compare (&snmp_oids[asked[k]], &entries[i].asked.oid)); k++);
+			if (k < nasked)
+				continue;
+		}
+		while (size - used < 9 + 2 * NP_SNMP_MAX_PACKET) {
+			size = size ? size * 2 : 4 * NP_SNMP_MAX_PACKET;
+			if ((data = realloc (data, size)) == NULL)
+				die (STATE_UNKNOWN, _("Cannot malloc"));
+		}
+		p = data + used;
+		if (i < n) {
+			put64 (&p, entries[i].time);
+			*p++ = entries[i].type;
+			len = np_snmp_encode_varbind (p, NP_SNMP_MAX_PACKET, &entries[i].asked);
+			p += len < 0 ? 0 : len;
+			k = np_snmp_encode_varbind (p, NP_SNMP_MAX_PACKET, &entries[i].vb);
+		} else {
+			put64 (&p, now);
+			*p++ = type;
+			none.oid = snmp_oids[asked[i - n]];
+			len = np_snmp_encode_varbind (p, NP_SNMP_MAX_PACKET, &none);
+			p += len < 0 ? 0 : len;
+			k = np_snmp_encode_varbind (p, NP_SNMP_MAX_PACKET, vbs[asked[i - n]]);
+		}
+		if (len > 0 && k > 0)
+			used = p + k - data;
+	}
+
+	if (lseek (fd, 0, SEEK_SET) < 0 || ftruncate (fd, 0) < 0 ||
+	    (used && write (fd, data, used) != (ssize_t)used)) {
+		if (verbose)
+			printf ("Cannot write the cache: %s\n", strerror (errno));
+		ftruncate (fd, 0);
+	}
+	free (data);
+}
+
+/* ask the agent ourselves, and give the lines snmpget would have printed.
+ * All OIDs go in one request if the agent can answer that, else in as
+ * few as it takes */
+static void
+snmp_native_get (output *out)
+{
+	np_snmp_options opts;
+	np_snmp_pdu *pdus = NULL;
+	np_snmp_varbind **vbs;
+	np_snmp_oid *asking;
+	cache_entry *entries = NULL;
+	char *text = strdup (""), *name, *value, *ptr;
+	unsigned int n;
+	int *asked, nasked = 0, npdus = 0, nentries = 0, fd = -1;
+	int i, first, count, batch, result, known;
+	int type = usesnmpgetnext ? NP_SNMP_GETNEXT : NP_SNMP_GET;
+	time_t now;
+
+	snmp_options (&opts);
+	vbs = calloc (numoids, sizeof (*vbs));
+	asked = malloc (numoids * sizeof (*asked));
+	asking = malloc (numoids * sizeof (*asking));
+	if (!vbs || !asked || !asking)
+		die (STATE_UNKNOWN, _("Cannot malloc"));
+
+	/* what another check asked for a moment ago needn't be asked again */
+	time (&now);
+	if (cache_ttl && (fd = cache_open ()) >= 0)
+		entries = cache_read (fd, &nentries);
+	for (i = 0; i < numoids; i++) {
+		if (fd >= 0 && (vbs[i] = cache_lookup (entries, nentries, type, &snmp_oids[i], now)))
+			continue;
+		asking[nasked] = snmp_oids[i];
+		asked[nasked++] = i;
+	}
+	if (fd >= 0 && verbose)
+		printf ("%d of %d OIDs from the cache\n", numoids - nasked, numoids);
+
+	for (first = 0, batch = nasked; first < nasked; first += count) {
+		count = min (batch, nasked - first);
+		if (verbose)
+			printf ("SNMP%s %s %s:%s, OIDs %d to %d of %d, %d ms timeout, %d retries\n",
+			        strcmp (proto, "2c") ? "v1" : "v2c", usesnmpgetnext ? "GETNEXT" : "GET",
+			        server_address, port, first + 1, first + count, nasked, opts.timeout, retries);
+
+		if ((pdus = realloc (pdus, (npdus + 1) * sizeof (*pdus))) == NULL)
+			die (STATE_UNKNOWN, _("Cannot malloc"));
+		result = np_snmp_request (server_address, &opts, type, 0, 0, asking + first, count, &pdus[npdus]);
+		/* too many for one request or its response: try again with half */
+		if (count > 1 && ((result == NP_SNMP_ERROR && errno == EMSGSIZE) ||
+		                  (result == NP_SNMP_OK && pdus[npdus].error_status == NP_SNMP_TOOBIG))) {
+			np_snmp_free_pdu (&pdus[npdus]);
+			batch = count / 2;
+			if (verbose)
+				printf ("%d OIDs are too many for one request, asking for %d\n", count, batch);
+			count = 0;
+			continue;
+		}
+		if (result == NP_SNMP_TIMEOUT)
+			die (STATE_UNKNOWN, _("Timeout: No Response from %s:%s.\n"), server_address, port);
+		if (result != NP_SNMP_OK)
+			die (STATE_UNKNOWN, _("SNMP request to %s:%s failed: %s\n"), server_address, port,
+			     np_snmp_strerror (result));
+		if (pdus[npdus].error_status != NP_SNMP_NOERROR)
+			die (STATE_UNKNOWN, _("Error in packet: %s, failed object: %s\n"),
+			     np_snmp_error_name (pdus[npdus].error_status),
+			     pdus[npdus].error_index > 0 && pdus[npdus].error_index <= count ?
+			     oids[asked[first + pdus[npdus].error_index - 1]] : "-");
+		if (pdus[npdus].n_vb != count)
+			die (STATE_UNKNOWN, _("SNMP response has %d variables instead of %d\n"), pdus[npdus].n_vb, count);
+
+		if (verbose > 1)
+			printf ("response after %.1f ms, %d tries\n", pdus[npdus].time, pdus[npdus].tries);
+
+		for (i = 0; i < count; i++)
+			vbs[asked[first + i]] = &pdus[npdus].vb[i];
+		npdus++;
+	}
+
+	if (fd >= 0) {
+		if (nasked)
+			cache_write (fd, entries, nentries, type, asked, nasked, vbs, now);
+		close (fd);
+	}
+
+	for (i = 0; i < numoids; i++) {
+		name = oid_name (&vbs[i]->oid, symbolic[i]);
+		if (vbs[i]->type == NP_SNMP_OBJECT_ID) {
+			ptr = oid_name (vbs[i]->objid, symbolic[i]);
+			xasprintf (&value, "OID: %s", ptr);
+			free (ptr);
+		} else if (vbs[i]->type == NP_SNMP_OCTET_STRING && symbolic[i] &&
+		           (known = known_object (&vbs[i]->oid, &n)) >= 0 && known_objects[known].display)
+			xasprintf (&value, "STRING: %s", vbs[i]->data);
+		else
+			value = np_snmp_value_string (vbs[i]);
+		xasprintf (&text, "%s%s%s%s\n", text, name, delimiter, value);
+		free (name);
+		free (value);
+	}
+	for (i = 0; i < npdus; i++)
+		np_snmp_free_pdu (&pdus[i]);
+	for (i = 0; i < nentries; i++) {
+		np_snmp_free_varbind (&entries[i].asked);
+		np_snmp_free_varbind (&entries[i].vb);
+	}
+	free (pdus);
+	free (entries);
+	free (vbs);
+	free (asked);
+	free (asking);
+
+	/* multi-line strings become several lines, as they did with snmpget */
+	memset (out, 0, sizeof (*out));
+	out->buf = text;
+	out->buflen = strlen (text);
+	for (ptr = text; *ptr; out->lines++)
+		ptr += strcspn (ptr, "\n") + 1;
+	out->line = calloc (out->lines, sizeof (char *));
+	out->lens = calloc (out->lines, sizeof (size_t));
+	for (i = 0; (size_t)i < out->lines; i++) {
+		out->line[i] = strsep (&text, "\n");
+		out->lens[i] = strlen (out->line[i]);
+	}
+}
+
+/* a cell's value, with strings as they are rather than quoted */
+static void
+table_cell (snmp_cell *cell, const np_snmp_varbind *vb)
+{
+	char *end;
+
+	cell->numeric = TRUE;
+	cell->counter = FALSE;
+	switch (vb->type) {
+	case NP_SNMP_INTEGER:
+		xasprintf (&cell->text, "%ld", vb->integer);
+		cell->value = vb->integer;
+		break;
+	case NP_SNMP_COUNTER32:
+	case NP_SNMP_COUNTER64:
+		cell->counter = TRUE;
+		/* fall through */
+	case NP_SNMP_GAUGE32:
+	case NP_SNMP_TIMETICKS:
+		xasprintf (&cell->text, "%llu", vb->value);
+		cell->value = vb->value;
+		break;
+	case NP_SNMP_OCTET_STRING:
+		cell->text = strdup ((char *)vb->data);
+		cell->value = strtod (cell->text, &end);
+		cell->numeric = end > cell->text && *end == '\0';
+		break;
+	default:
+		cell->text = np_snmp_value_string (vb);
+		cell->numeric = FALSE;
+	}
+}
+
+/* the row for index, adding it if there is none. Columns mostly come in
+ * the same order, so the search starts after the last row found */
+static snmp_row *
+table_row (snmp_row **rows, int *nrows, int ncols, const char *index, int *cursor)
+{
+	int i, j;
+
+	for (i = 0; i < *nrows; i++) {
+		j = (*cursor + i) % *nrows;
+		if (!strcmp ((*rows)[j].index, index)) {
+			*cursor = j + 1;
+			return &(*rows)[j];
+		}
+	}
+	*rows = realloc (*rows, (*nrows + 1) * sizeof (**rows));
+	if (*rows == NULL)
+		die (STATE_UNKNOWN, _("Could not reallocate rows [%d]\n"), *nrows + 1);
+	(*rows)[*nrows].index = strdup (index);
+	(*rows)[*nrows].cells = calloc (ncols, sizeof (snmp_cell));
+	*cursor = *nrows + 1;
+	return &(*rows)[(*nrows)++];
+}
+
+/* walk the columns side by side, with GETBULK for SNMPv2c and GETNEXT for
+ * v1, and join them into rows by their index */
+static int
+table_walk (np_snmp_oid *columns, int ncols, snmp_row **rows)
+{
+	np_snmp_options opts;
+	np_snmp_pdu pdu;
+	np_snmp_oid *next, *ask;
+	char index[NP_SNMP_MAX_OID * 11 + 1];
+	int *active, *cursor, nactive = ncols, nrows = 0, max_repetitions = DEFAULT_MAX_REPETITIONS;
+	int type, result, progress, i, j, k, col;
+	size_t len;
+
+	snmp_options (&opts);
+	type = opts.version == NP_SNMP_V1 ? NP_SNMP_GETNEXT : NP_SNMP_GETBULK;
+	next = malloc (ncols * sizeof (*next));
+	ask = malloc (ncols * sizeof (*ask));
+	active = malloc (ncols * sizeof (*active));
+	cursor = calloc (ncols, sizeof (*cursor));
+	if (!next || !ask || !active || !cursor)
+		die (STATE_UNKNOWN, _("Cannot malloc"));
+	for (i = 0; i < ncols; i++) {
+		next[i] = columns[i];
+		active[i] = i;
+	}
+	*rows = NULL;
+
+	while (nactive > 0) {
+		for (k = 0; k < nactive; k++)
+			ask[k] = next[active[k]];
+		if (verbose)
+			printf ("%s %s:%s, %d columns%s\n", type == NP_SNMP_GETBULK ? "GETBULK" : "GETNEXT",
+			        server_address, port, nactive, type == NP_SNMP_GETBULK ? "" : ", 1 row");
+
+		result = np_snmp_request (server_address, &opts, type, 0, max_repetitions, ask, nactive, &pdu);
+		if (result == NP_SNMP_TIMEOUT)
+			die (STATE_UNKNOWN, _("Timeout: No Response from %s:%s.\n"), server_address, port);
+		if (result != NP_SNMP_OK)
+			die (STATE_UNKNOWN, _("SNMP request to %s:%s failed: %s\n"), server_address, port,
+			     np_snmp_strerror (result));
+		if (pdu.error_status == NP_SNMP_TOOBIG && type == NP_SNMP_GETBULK && max_repetitions > 1) {
+			max_repetitions /= 2;
+			np_snmp_free_pdu (&pdu);
+			continue;
+		}
+		/* SNMPv1 says noSuchName past the end of the MIB */
+		if (pdu.error_status == NP_SNMP_NOSUCHNAME && pdu.error_index > 0 && pdu.error_index <= nactive) {
+			memmove (active + pdu.error_index - 1, active + pdu.error_index,
+			         (nactive - pdu.error_index) * sizeof (*active));
+			nactive--;
+			np_snmp_free_pdu (&pdu);
+			continue;
+		}
+		if (pdu.error_status != NP_SNMP_NOERROR)
+			die (STATE_UNKNOWN, _("Error in packet: %s, failed object: %s\n"),
+			     np_snmp_error_name (pdu.error_status),
+			     pdu.error_index > 0 && pdu.error_index <= nactive ? oids[active[pdu.error_index - 1]] : "-");
+		if (pdu.n_vb == 0)
+			die (STATE_UNKNOWN, _("SNMP response has no variables\n"));
+
+		/* the varbinds go row by row, one for each column asked for */
+		for (i = 0, progress = FALSE; i < pdu.n_vb; i++) {
+			k = i % nactive;
+			if ((col = active[k]) < 0)
+				continue;
+			/* past the column, or not getting any further */
+			if (pdu.vb[i].type == NP_SNMP_ENDOFMIBVIEW || pdu.vb[i].oid.n <= columns[col].n ||
+			    memcmp (pdu.vb[i].oid.id, columns[col].id, columns[col].n * sizeof (*columns[col].id)) ||
+			    np_snmp_oid_compare (&pdu.vb[i].oid, &next[col]) <= 0) {
+				active[k] = -1;
+				continue;
+			}
+			next[col] = pdu.vb[i].oid;
+			for (j = columns[col].n, len = 0; j < (int)pdu.vb[i].oid.n; j++)
+				len += snprintf (index + len, sizeof (index) - len, "%s%u", len ? "." : "", pdu.vb[i].oid.id[j]);
+			table_cell (&table_row (rows, &nrows, ncols, index, &cursor[col])->cells[col], &pdu.vb[i]);
+			progress = TRUE;
+		}
+		for (i = 0, k = 0; k < nactive; k++)
+			if (active[k] >= 0)
+				active[i++] = active[k];
+		nactive = i;
+		np_snmp_free_pdu (&pdu);
+		if (nactive && !progress)
+			die (STATE_UNKNOWN, _("%s:%s does not walk any further\n"), server_address, port);
+	}
+	free (next);
+	free (ask);
+	free (active);
+	free (cursor);
+	return nrows;
+}
+
+/* the row label, with {index} and {COLUMN} replaced */
+static char *
+table_label (const snmp_row *row, np_snmp_oid *columns, int ncols)
+{
+	np_snmp_oid oid;
+	char *label = strdup (""), *name;
+	const char *p = row_label, *end;
+	int i, by_name;
+
+	while ((end = strchr (p, '{')) && strchr (end, '}')) {
+		xasprintf (&label, "%s%.*s", label, (int)(end - p), p);
+		p = end + 1;
+		end = strchr (p, '}');
+		name = strndup (p, end - p);
+		if (!strcmp (name, "index"))
+			xasprintf (&label, "%s%s", label, row->index);
+		else if (resolve_oid (name, &oid, &by_name) == OK) {
+			for (i = 0; i < ncols && np_snmp_oid_compare (&oid, &columns[i]); i++);
+			if (i < ncols && row->cells[i].text)
+				xasprintf (&label, "%s%s", label, row->cells[i].text);
+		}
+		free (name);
+		p = end + 1;
+	}
+	xasprintf (&label, "%s%s", label, p);
+	return label;
+}
+
+static int
+table_cell_state (const snmp_cell *cell, int col)
+{
+	int match;
+
+	if (thlds[col]->warning || thlds[col]->critical)
+		return cell->numeric ? get_status (cell->value, thlds[col]) : STATE_UNKNOWN;
+	if (eval_method[col] & (CRIT_STRING | CRIT_REGEX)) {
+		if (eval_method[col] & CRIT_STRING)
+			match = !strcmp (cell->text, string_value);
+		else
+			match = !regexec (&preg, cell->text, 10, pmatch, eflags);
+		return match != invert_search ? STATE_OK : STATE_CRITICAL;
+	}
+	return STATE_OK;
+}
+
+/* --table: check every row of the -o columns, and print the result */
+static int
+snmp_table (void)
+{
+	np_snmp_oid *columns;
+	snmp_row *rows;
+	char *msg, *perf = strdup (""), *rowname, *colname, *name, *p, *end;
+	const char *quote;
+	int ncols = numoids, nrows, result = STATE_OK, state, i, c, by_name;
+
+	/* the columns to check, then those only used in labels */
+	columns = malloc (numoids * sizeof (*columns));
+	memcpy (columns, snmp_oids, numoids * sizeof (*columns));
+	for (p = row_label; (p = strchr (p, '{')) && (end = strchr (p, '}')); p = end) {
+		name = strndup (p + 1, end - p - 1);
+		if (strcmp (name, "index")) {
+			columns = realloc (columns, (ncols + 1) * sizeof (*columns));
+			if (resolve_oid (name, &columns[ncols], &by_name) != OK)
+				die (STATE_UNKNOWN, _("Unknown column in row label: %s\n"), name);
+			for (i = 0; i < ncols && np_snmp_oid_compare (&columns[ncols], &columns[i]); i++);
+			if (i == ncols)
+				ncols++;
+		}
+		free (name);
+	}
+
+	nrows = table_walk (columns, ncols, &rows);
+	if (nrows == 0)
+		die (STATE_UNKNOWN, _("%s UNKNOWN - No rows under %s\n"), label, oids[0]);
+
+	xasprintf (&msg, ngettext ("%d row", "%d rows", nrows), nrows);
+	for (i = 0; i < nrows; i++) {
+		rowname = table_label (&rows[i], columns, ncols);
+		if (verbose > 1)
+			printf ("row %s: %s\n", rows[i].index, rowname);
+		for (c = 0; c < numoids; c++) {
+			if (!rows[i].cells[c].text)
+				continue;
+			colname = (size_t)c < nlabels && labels[c] ? labels[c] : oids[c];
+			state = table_cell_state (&rows[i].cells[c], c);
+			result = max_state (result, state);
+			if (state != STATE_OK)
+				xasprintf (&msg, "%s, %s %s *%s*%s%s", msg, rowname, colname, rows[i].cells[c].text,
+				           (size_t)c < nunits && unitv[c] ? " " : "",
+				           (size_t)c < nunits && unitv[c] ? unitv[c] : "");
+			if (rows[i].cells[c].numeric) {
+				xasprintf (&name, "%s_%s", rowname, perf_labels ? colname : oids[c]);
+				quote = !strpbrk (name, " ='\"") ? "" : strchr (name, '\'') ? "\"" : "'";
+				xasprintf (&perf, "%s%s%s%s%s=%s%s", perf, *perf ? " " : "", quote, name, quote,
+				           rows[i].cells[c].text, rows[i].cells[c].counter ? "c" : "");
+				free (name);
+			}
+		}
+		free (rowname);
+	}
+
+	printf ("%s %s - %s | %s\n", label, state_text (result), msg, perf);
+	return result;
+}
+
+/* --hosts: one host a line, from a file or "-" for stdin. Blank lines
+ * and comments are left out */
+static char **
+read_hosts (const char *path, int *n)
+{
+	FILE *fp;
+	char buf[MAX_INPUT_BUFFER], *host, **hosts = NULL;
+
+	if (!strcmp (path, "-"))
+		fp = stdin;
+	else if ((fp = fopen (path, "r")) == NULL)
+		die (STATE_UNKNOWN, _("Cannot read %s: %s\n"), path, strerror (errno));
+	for (*n = 0; fgets (buf, sizeof (buf), fp); ) {
+		host = buf + strspn (buf, " \t");
+		host[strcspn (host, " \t\r\n#")] = '\0';
+		if (*host == '\0')
+			continue;
+		if ((hosts = realloc (hosts, (*n + 1) * sizeof (*hosts))) == NULL)
+			die (STATE_UNKNOWN, _("Cannot malloc"));
+		hosts[(*n)++] = strdup (host);
+	}
+	if (fp != stdin)
+		fclose (fp);
+	return hosts;
+}
+
+/* --hosts: ask every host for the -o OIDs at once, then print a summary
+ * and a line for each host as send_nsca takes them */
+static int
+snmp_fleet (void)
+{
+	np_snmp_options opts;
+	np_snmp_pdu *pdus;
+	snmp_cell cell;
+	char **hosts, *lines = strdup (""), *msg, *perf, *colname, *name;
+	const char *quote;
+	int *results, nhosts, counts[STATE_UNKNOWN + 1] = { 0 }, result = STATE_OK, state, s, i, c;
+
+	hosts = read_hosts (hosts_file, &nhosts);
+	if (nhosts == 0)
+		die (STATE_UNKNOWN, _("No hosts in %s\n"), hosts_file);
+	pdus = malloc (nhosts * sizeof (*pdus));
+	results = malloc (nhosts * sizeof (*results));
+	if (!pdus || !results)
+		die (STATE_UNKNOWN, _("Cannot malloc"));
+
+	snmp_options (&opts);
+	if (verbose)
+		printf ("SNMP%s %s to %d hosts, %d at a time, %d ms timeout, %d retries\n",
+		        strcmp (proto, "2c") ? "v1" : "v2c", usesnmpgetnext ? "GETNEXT" : "GET",
+		        nhosts, min (window, nhosts), opts.timeout, retries);
+	np_snmp_request_all ((const char **)hosts, nhosts, &opts,
+	                     usesnmpgetnext ? NP_SNMP_GETNEXT : NP_SNMP_GET,
+	                     snmp_oids, numoids, window, pdus, results);
+
+	for (i = 0; i < nhosts; i++) {
+		msg = strdup ("");
+		perf = strdup ("");
+		state = STATE_UNKNOWN;
+		if (results[i] == NP_SNMP_TIMEOUT)
+			xasprintf (&msg, _(" Timeout: No Response from %s:%s"), hosts[i], port);
+		else if (results[i] != NP_SNMP_OK) {
+			errno = pdus[i].error;
+			xasprintf (&msg, _(" SNMP request to %s:%s failed: %s"), hosts[i], port,
+			           np_snmp_strerror (results[i]));
+		}
+		else if (pdus[i].error_status != NP_SNMP_NOERROR)
+			xasprintf (&msg, _(" Error in packet: %s, failed object: %s"),
+			           np_snmp_error_name (pdus[i].error_status),
+			           pdus[i].error_index > 0 && pdus[i].error_index <= numoids ?
+			           oids[pdus[i].error_index - 1] : "-");
+		else if (pdus[i].n_vb != numoids)
+			xasprintf (&msg, _(" SNMP response has %d variables instead of %d"), pdus[i].n_vb, numoids);
+		else {
+			state = STATE_OK;
+			for (c = 0; c < numoids; c++) {
+				table_cell (&cell, &pdus[i].vb[c]);
+				s = table_cell_state (&cell, c);
+				state = max_state (state, s);
+				colname = (size_t)c < nlabels && labels[c] ? labels[c] : NULL;
+				xasprintf (&msg, "%s%s%s%s%s%s%s%s%s", msg, c ? output_delim : " ",
+				           colname ? colname : "", colname ? " " : "", mark (s), cell.text, mark (s),
+				           (size_t)c < nunits && unitv[c] ? " " : "",
+				           (size_t)c < nunits && unitv[c] ? unitv[c] : "");
+				if (cell.numeric) {
+					name = perf_labels && colname ? colname : oids[c];
+					quote = !strpbrk (name, " ='\"") ? "" : strchr (name, '\'') ? "\"" : "'";
+					xasprintf (&perf, "%s%s%s%s%s=%s%s", perf, *perf ? " " : "", quote, name, quote,
+					           cell.text, cell.counter ? "c" : "");
+				}
+				free (cell.text);
+			}
+		}
+		if (verbose > 1 && results[i] != NP_SNMP_ERROR)
+			printf ("%s: %s after %.1f ms, %d tries\n", hosts[i], np_snmp_strerror (results[i]),
+			        pdus[i].time, pdus[i].tries);
+		counts[state]++;
+		result = max_state (result, state);
+		xasprintf (&lines, "%s%s\t%s\t%d\t%s %s -%s%s%s\n", lines, hosts[i], label, state,
+		           label, state_text (state), msg, *perf ? " | " : "", perf);
+		np_snmp_free_pdu (&pdus[i]);
+		free (msg);
+		free (perf);
+	}
+
+	printf (_("%s %s - %d hosts, %d ok, %d warning, %d critical, %d unknown"), label,
+	        state_text (result), nhosts, counts[STATE_OK], counts[STATE_WARNING],
+	        counts[STATE_CRITICAL], counts[STATE_UNKNOWN]);
+	printf (" | ok=%d warning=%d critical=%d unknown=%d\n%s", counts[STATE_OK],
+	        counts[STATE_WARNING], counts[STATE_CRITICAL], counts[STATE_UNKNOWN], lines);
+	return result;
+}
+
+
+/* The state is the number of OIDs and samples, then for each sample its
+ * time and sysUpTime, and the type and value of each OID, all big-endian */
+#define RATE_SAMPLE_SIZE(n) (16 + 9 * (n))
+
+static void
+rate_read_state (void)
+{
+	state_data *state = np_state_read ();
+	const unsigned char *p;
+	unsigned long long n, count, bits;
+	int s, i;
+
+	if (state == NULL || state->length < 16)
+		return;
+	p = state->data;
+	n = get64 (&p);
+	count = get64 (&p);
+	if (n != (unsigned long long)numoids || count > (unsigned long long)rate_samples ||
+	    (size_t)state->length != 16 + count * RATE_SAMPLE_SIZE (n)) {
+		if (verbose)
+			printf ("State is for another set of OIDs, starting again\n");
+		return;
+	}
+
+	/* with room for the sample to come */
+	samples = calloc (count + 1, sizeof (*samples));
+	if (samples == NULL)
+		die (STATE_UNKNOWN, _("Cannot malloc"));
+	for (s = 0; s < (int)count; s++) {
+		samples[s].time = get64 (&p);
+		samples[s].uptime = get64 (&p);
+		samples[s].values = calloc (numoids, sizeof (rate_value));
+		if (samples[s].values == NULL)
+			die (STATE_UNKNOWN, _("Cannot malloc"));
+		for (i = 0; i < numoids; i++) {
+			samples[s].values[i].type = *p++;
+			bits = get64 (&p);
+			if (samples[s].values[i].type == RATE_GAUGE) {
+				memcpy (&samples[s].values[i].gauge, &bits, sizeof (double));
+			} else {
+				samples[s].values[i].counter = bits;
+				samples[s].values[i].gauge = bits;
+			}
+		}
+	}
+	nsamples = count;
+	if (verbose > 2)
+		printf ("State has %d samples, the last from %lu\n", nsamples, (unsigned long)samples[nsamples - 1].time);
+}
+
+/* add this call's values to the samples, and keep the last rate_samples */
+static void
+rate_write_state (time_t now)
+{
+	unsigned char *data, *p;
+	unsigned long long bits;
+	int s, i;
+
+	if (samples == NULL && (samples = calloc (1, sizeof (*samples))) == NULL)
+		die (STATE_UNKNOWN, _("Cannot malloc"));
+	samples[nsamples].time = now;
+	samples[nsamples].uptime = agent_uptime;
+	samples[nsamples].values = rate_values;
+	if (++nsamples > rate_samples) {
+		/* the oldest is always one read from the state, never rate_values */
+		free (samples[0].values);
+		memmove (samples, samples + 1, (nsamples - 1) * sizeof (*samples));
+		nsamples--;
+	}
+
+	data = p = malloc (16 + nsamples * RATE_SAMPLE_SIZE (numoids));
+	if (data == NULL)
+		die (STATE_UNKNOWN, _("Cannot malloc"));
+	put64 (&p, numoids);
+	put64 (&p, nsamples);
+	for (s = 0; s < nsamples; s++) {
+		put64 (&p, samples[s].time);
+		put64 (&p, samples[s].uptime);
+		for (i = 0; i < numoids; i++) {
+			*p++ = samples[s].values[i].type;
+			if (samples[s].values[i].type == RATE_GAUGE)
+				memcpy (&bits, &samples[s].values[i].gauge, sizeof (double));
+			else
+				bits = samples[s].values[i].counter;
+			put64 (&p, bits);
+		}
+	}
+	np_state_write_binary (now, data, p - data);
+	free (data);
+}
+
+/* how much a value went up between two samples. A counter that is lower
+ * than before has wrapped, at 2^32 or 2^64 as its type says */
+static double
+rate_delta (const rate_value *from, const rate_value *to)
+{
+	if (from->type == RATE_COUNTER32 && to->type == RATE_COUNTER32)
+		return (to->counter - from->counter) & 0xffffffffULL;
+	if (from->type == RATE_COUNTER64 && to->type == RATE_COUNTER64)
+		return to->counter - from->counter;
+	return to->gauge - from->gauge;
+}
+
+/* the rate of OID i since the oldest sample, adding up the changes from
+ * sample to sample so that a wrap between any two of them is seen */
+static double
+rate_since_samples (int i, time_t now)
+{
+	double change = 0;
+	int s;
+
+	for (s = 0; s < nsamples; s++)
+		change += rate_delta (&samples[s].values[i], s + 1 < nsamples ? &samples[s + 1].values[i] : &rate_values[i]);
+	return change / (now - samples[0].time) * rate_multiplier;
+}
 
 static char *fix_snmp_range(char *th)
 {
@@ -155,6 +1164,7 @@ static char *fix_snmp_range(char *th)
 	left = strtod(th, NULL);
 	right = strtod(colon + 1, NULL);
 	if (right >= left) {
+		*colon = ':';
 		return th;
 	}
 	ret = malloc(strlen(th) + strlen(colon + 1) + 2);
@@ -163,31 +1173,316 @@ static char *fix_snmp_range(char *th)
 	return ret;
 }
 
+#ifdef PATH_TO_SNMPGET
+/* --v3-cache: what snmpget otherwise finds out again on every run, the
+ * agent's engine ID, boots and time, and the keys localized to it. The
+ * keys are only worked out here for SHA */
+typedef struct v3_engine {
+	char *id;                    /* all hex, "0x..." */
+	long boots;
+	long time;
+	time_t stored;
+	char *auth_key;
+	char *priv_key;
+} v3_engine;
+
+/* a file for each agent and set of credentials, readable by its owner only */
+static char *
+v3_cache_path (void)
+{
+	struct sha1_ctx ctx;
+	unsigned char digest[20];
+	const char *fields[8];
+	char *path;
+	int i;
+
+	fields[0] = server_address;
+	fields[1] = port;
+	fields[2] = seclevel;
+	fields[3] = secname;
+	fields[4] = authproto;
+	fields[5] = authpasswd;
+	fields[6] = privproto;
+	fields[7] = privpasswd;
+	sha1_init_ctx (&ctx);
+	for (i = 0; i < 8; i++)
+		sha1_process_bytes (fields[i] ? fields[i] : "", fields[i] ? strlen (fields[i]) + 1 : 1, &ctx);
+	sha1_finish_ctx (&ctx, digest);
+
+	xasprintf (&path, "%s/%s/v3-", _np_state_calculate_location_prefix (), progname);
+	for (i = 0; i < 20; i++)
+		xasprintf (&path, "%s%02x", path, digest[i]);
+	return path;
+}
+
+static int
+v3_cache_read (const char *path, v3_engine *engine)
+{
+	FILE *fp;
+	char name[16], value[256];
+
+	memset (engine, 0, sizeof (*engine));
+	if ((fp = fopen (path, "r")) == NULL)
+		return FALSE;
+	while (fscanf (fp, "%15s %255s", name, value) == 2) {
+		if (!strcmp (name, "engine"))
+			engine->id = strdup (value);
+		else if (!strcmp (name, "boots"))
+			engine->boots = strtol (value, NULL, 10);
+		else if (!strcmp (name, "time"))
+			engine->time = strtol (value, NULL, 10);
+		else if (!strcmp (name, "stored"))
+			engine->stored = strtol (value, NULL, 10);
+		else if (!strcmp (name, "authkey"))
+			engine->auth_key = strdup (value);
+		else if (!strcmp (name, "privkey"))
+			engine->priv_key = strdup (value);
+	}
+	fclose (fp);
+	return engine->id != NULL && engine->stored > 0;
+}
+
+static void
+v3_cache_write (const char *path, const v3_engine *engine)
+{
+	char *dir, *temp;
+	FILE *fp;
+	int fd;
+
+	dir = strdup (path);
+	*strrchr (dir, '/') = '\0';
+	mkdir (_np_state_calculate_location_prefix (), S_IRWXU);
+	mkdir (dir, S_IRWXU);
+	xasprintf (&temp, "%s.XXXXXX", path);
+	if ((fd = mkstemp (temp)) < 0 || (fp = fdopen (fd, "w")) == NULL) {
+		if (verbose)
+			printf ("Cannot write %s: %s\n", temp, strerror (errno));
+		return;
+	}
+	fchmod (fd, S_IRUSR | S_IWUSR);
+	fprintf (fp, "engine %s\nboots %ld\ntime %ld\nstored %lu\n", engine->id, engine->boots,
+	         engine->time, (unsigned long)engine->stored);
+	if (engine->auth_key)
+		fprintf (fp, "authkey %s\n", engine->auth_key);
+	if (engine->priv_key)
+		fprintf (fp, "privkey %s\n", engine->priv_key);
+	if (fclose (fp) != 0 || rename (temp, path) != 0)
+		unlink (temp);
+	free (dir);
+	free (temp);
+}
+
+static char *
+v3_hex (const unsigned char *data, size_t len)
+{
+	char *s = strdup ("0x");
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		xasprintf (&s, "%s%02x", s, data[i]);
+	return s;
+}
+
+/* after a run without the cache: ask for the engine ID, boots and time the
+ * agent has, work out the keys, and keep them for the next run */
+static void
+v3_discover (char **command_line, int nargs, const char *path)
+{
+	output out, err;
+	v3_engine engine;
+	unsigned char id[32], key[NP_SNMP_SHA1_KEY_LEN];
+	char *token, *text;
+	size_t len = 0;
+	int i;
+
+	/* snmpget, whatever the check ran, with values only and strings in hex */
+	command_line[0] = PATH_TO_SNMPGET;
+	command_line[nargs++] = "-Oqvx";
+	xasprintf (&command_line[nargs++], "%s:%s", server_address, port);
+	command_line[nargs++] = "1.3.6.1.6.3.10.2.1.1.0";
+	command_line[nargs++] = "1.3.6.1.6.3.10.2.1.2.0";
+	command_line[nargs++] = "1.3.6.1.6.3.10.2.1.3.0";
+	command_line[nargs] = NULL;
+	if (cmd_run_array (command_line, &out, &err, 0) != 0 || out.lines < 3) {
+		if (verbose)
+			printf ("Could not ask for the engine ID\n");
+		return;
+	}
+
+	/* the engine ID may take several lines, then boots and time */
+	memset (&engine, 0, sizeof (engine));
+	for (i = 0; i < out.lines - 2; i++) {
+		text = out.line[i];
+		while ((token = strsep (&text, " \t\"")) != NULL) {
+			if (*token == '\0')
+				continue;
+			if (strlen (token) != 2 || !isxdigit ((unsigned char)token[0]) ||
+			    !isxdigit ((unsigned char)token[1]) || len == sizeof (id)) {
+				if (verbose)
+					printf ("Engine ID not understood: %s\n", out.line[i]);
+				return;
+			}
+			id[len++] = strtol (token, NULL, 16);
+		}
+	}
+	if (len < 5)
+		return;
+	engine.id = v3_hex (id, len);
+	engine.boots = strtol (out.line[out.lines - 2], NULL, 10);
+	engine.time = strtol (out.line[out.lines - 1], NULL, 10);
+	time (&engine.stored);
+
+	if (authproto && !strcasecmp (authproto, "SHA") && strcmp (seclevel, "noAuthNoPriv")) {
+		np_snmp_localize_sha1 (authpasswd, id, len, key);
+		engine.auth_key = v3_hex (key, sizeof (key));
+		if (!strcmp (seclevel, "authPriv")) {
+			np_snmp_localize_sha1 (privpasswd, id, len, key);
+			engine.priv_key = v3_hex (key, sizeof (key));
+		}
+	}
+	if (verbose)
+		printf ("Engine %s, boots %ld, time %ld%s\n", engine.id, engine.boots, engine.time,
+		        engine.auth_key ? ", keys localized" : "");
+	v3_cache_write (path, &engine);
+}
+#endif
+
+/* run snmpget or snmpgetnext, for SNMPv3 and names that need MIBs */
+static void
+snmp_command_get (output *chld_out)
+{
+#ifdef PATH_TO_SNMPGET
+	output chld_err;
+	char **command_line = NULL;
+	char *cl_hidden_auth = NULL;
+	char *cache_path = NULL;
+	v3_engine engine;
+	int i, n, nargs, return_code = 0, external_error = 0, cached = FALSE;
+	time_t now;
+
+	/* Create the command array to execute */
+	if(usesnmpgetnext == TRUE) {
+		snmpcmd = strdup (PATH_TO_SNMPGETNEXT);
+	}else{
+		snmpcmd = strdup (PATH_TO_SNMPGET);
+	}
+
+	if (v3_cache && !strcmp (proto, "3")) {
+		cache_path = v3_cache_path ();
+		cached = v3_cache_read (cache_path, &engine);
+	}
+
+	/* 9 arguments to pass before authpriv options, 8 for the engine and keys, 1 for host and
+	 * numoids. Add one for terminating NULL */
+	command_line = calloc (9 + numauthpriv + 8 + 1 + max (numoids, 4) + 1, sizeof (char *));
+	command_line[0] = snmpcmd;
+	command_line[1] = strdup ("-t");
+	xasprintf (&command_line[2], "%g", timeout_seconds);
+	command_line[3] = strdup ("-r");
+	xasprintf (&command_line[4], "%d", retries);
+	command_line[5] = strdup ("-m");
+	command_line[6] = strdup (miblist);
+	command_line[7] = "-v";
+	command_line[8] = strdup (proto);
+	n = 9;
+
+	for (i = 0; i < numauthpriv; i++) {
+		/* localized keys instead of the passwords they come from */
+		if (cached && engine.auth_key && (!strcmp (authpriv[i], "-A") ||
+		    (engine.priv_key && !strcmp (authpriv[i], "-X")))) {
+			i++;
+			continue;
+		}
+		command_line[n++] = authpriv[i];
+	}
+	nargs = n;
+
+	/* This is just for display purposes, so it can remain a string */
+	xasprintf(&cl_hidden_auth, "%s -t %g -r %d -m %s -v %s %s",
+		snmpcmd, timeout_seconds, retries, strlen(miblist) ? miblist : "''", proto, "[authpriv]");
+
+	if (cached) {
+		time (&now);
+		command_line[n++] = "-e";
+		command_line[n++] = engine.id;
+		command_line[n++] = "-Z";
+		xasprintf (&command_line[n++], "%ld,%ld", engine.boots, engine.time + (long)(now - engine.stored));
+		xasprintf (&cl_hidden_auth, "%s -e %s -Z %s", cl_hidden_auth, engine.id, command_line[n - 1]);
+		if (engine.auth_key) {
+			command_line[n++] = "-3k";
+			command_line[n++] = engine.auth_key;
+		}
+		if (engine.auth_key && engine.priv_key) {
+			command_line[n++] = "-3K";
+			command_line[n++] = engine.priv_key;
+		}
+	}
+
+	xasprintf (&command_line[n++], "%s:%s", server_address, port);
+	xasprintf (&cl_hidden_auth, "%s %s:%s", cl_hidden_auth, server_address, port);
+
+	for (i = 0; i < numoids; i++) {
+		command_line[n++] = oids[i];
+		xasprintf(&cl_hidden_auth, "%s %s", cl_hidden_auth, oids[i]);	
+	}
+
+	command_line[n] = NULL;
+
+	if (verbose)
+		printf ("%s\n", cl_hidden_auth);
+
+	/* Run the command */
+	return_code = cmd_run_array (command_line, chld_out, &chld_err, 0);
+
+	/* Due to net-snmp sometimes showing stderr messages with poorly formed MIBs,
+	   only return state unknown if return code is non zero or there is no stdout.
+	   Do this way so that if there is stderr, will get added to output, which helps problem diagnosis
+	*/
+	if (return_code != 0)
+		external_error=1;
+	if (chld_out->lines == 0)
+		external_error=1;
+	if (external_error) {
+		/* the agent may have a new engine ID, find it out again next time */
+		if (cached)
+			unlink (cache_path);
+		if (chld_err.lines > 0) {
+			printf (_("External command error: %s\n"), chld_err.line[0]);
+			for (i = 1; i < chld_err.lines; i++) {
+				printf ("%s\n", chld_err.line[i]);
+			}
+		} else {
+			printf(_("External command error with no output (return code: %d)\n"), return_code);
+		}
+		exit (STATE_UNKNOWN);
+	}
+
+	if (cache_path && !cached)
+		v3_discover (command_line, nargs, cache_path);
+#else
+	die (STATE_UNKNOWN, _("SNMPv3 and OIDs by other names need snmpget, which was not found when the plugins were built\n"));
+#endif
+}
+
 int
 main (int argc, char **argv)
 {
-	int i, len, line, total_oids;
+	int i, line;
 	unsigned int bk_count = 0, dq_count = 0;
 	int iresult = STATE_UNKNOWN;
 	int result = STATE_UNKNOWN;
-	int return_code = 0;
-	int external_error = 0;
-	char **command_line = NULL;
-	char *cl_hidden_auth = NULL;
 	char *oidname = NULL;
 	char *response = NULL;
 	char *mult_resp = NULL;
 	char *outbuff;
+	char *perfstr;
 	char *ptr = NULL;
 	char *show = NULL;
 	char *th_warn=NULL;
 	char *th_crit=NULL;
 	char type[8] = "";
-	output chld_out, chld_err;
-	char *previous_string=NULL;
-	char *ap=NULL;
-	char *state_string=NULL;
-	size_t response_length, current_length, string_length;
+	output chld_out;
+	int restarted = FALSE;
 	char *temp_string=NULL;
 	char *quote_string=NULL;
 	time_t current_time;
@@ -195,6 +1490,7 @@ main (int argc, char **argv)
 	time_t duration;
 	char *conv = "12345678";
 	int is_counter=0;
+	int native;
 
 	setlocale (LC_ALL, "");
 	bindtextdomain (PACKAGE, LOCALEDIR);
@@ -202,16 +1498,15 @@ main (int argc, char **argv)
 
 	labels = malloc (labels_size * sizeof(*labels));
 	unitv = malloc (unitv_size * sizeof(*unitv));
-	for (i = 0; i < MAX_OIDS; i++)
-		eval_method[i] = CHECK_UNDEF;
+	grow_oids (1);
 
 	label = strdup ("SNMP");
 	units = strdup ("");
 	port = strdup (DEFAULT_PORT);
 	outbuff = strdup ("");
+	perfstr = strdup ("| ");
 	delimiter = strdup (" = ");
 	output_delim = strdup (DEFAULT_OUTPUT_DELIMITER);
-	timeout_interval = DEFAULT_TIMEOUT;
 	retries = DEFAULT_RETRIES;
 
 	np_init( (char *) progname, argc, argv );
@@ -228,17 +1523,7 @@ main (int argc, char **argv)
 		if (!strcmp(label, "SNMP"))
 			label = strdup("SNMP RATE");
 		time(&current_time);
-		i=0;
-		previous_state = np_state_read();
-		if(previous_state!=NULL) {
-			/* Split colon separated values */
-			previous_string = strdup((char *) previous_state->data);
-			while((ap = strsep(&previous_string, ":")) != NULL) {
-				if(verbose>2)
-					printf("State for %d=%s\n", i, ap);
-				previous_value[i++]=strtod(ap,NULL);
-			}
-		}
+		rate_read_state();
 	}
 
 	/* Populate the thresholds */
@@ -267,67 +1552,34 @@ main (int argc, char **argv)
 		}
 	}
 
-	/* Create the command array to execute */
-	if(usesnmpgetnext == TRUE) {
-		snmpcmd = strdup (PATH_TO_SNMPGETNEXT);
-	}else{
-		snmpcmd = strdup (PATH_TO_SNMPGET);
+	/* A rate needs the agent's sysUpTime too, to tell a restart from a
+	 * counter wrap. It is asked for last, and taken off again below */
+	if (calculate_rate) {
+		grow_oids (numoids + 1);
+		oids[numoids++] = usesnmpgetnext ? "1.3.6.1.2.1.1.3" : "1.3.6.1.2.1.1.3.0";
 	}
 
-	/* 9 arguments to pass before authpriv options + 1 for host and numoids. Add one for terminating NULL */
-	command_line = calloc (9 + numauthpriv + 1 + numoids + 1, sizeof (char *));
-	command_line[0] = snmpcmd;
-	command_line[1] = strdup ("-t");
-	xasprintf (&command_line[2], "%d", timeout_interval);
-	command_line[3] = strdup ("-r");
-	xasprintf (&command_line[4], "%d", retries);
-	command_line[5] = strdup ("-m");
-	command_line[6] = strdup (miblist);
-	command_line[7] = "-v";
-	command_line[8] = strdup (proto);
+	/* SNMPv1 and v2c are spoken natively, unless an OID needs MIBs */
+	native = strcmp (proto, "3") != 0;
+	for (i = 0; i < numoids && native; i++)
+		native = resolve_oid (oids[i], &snmp_oids[i], &symbolic[i]) == OK;
 
-	for (i = 0; i < numauthpriv; i++) {
-		command_line[9 + i] = authpriv[i];
+	if (hosts_file) {
+		if (!native)
+			die (STATE_UNKNOWN, _("--hosts needs SNMPv1 or v2c, and numeric OIDs or known names\n"));
+		return snmp_fleet ();
 	}
 
-	xasprintf (&command_line[9 + numauthpriv], "%s:%s", server_address, port);
-
-	/* This is just for display purposes, so it can remain a string */
-	xasprintf(&cl_hidden_auth, "%s -t %d -r %d -m %s -v %s %s %s:%s",
-		snmpcmd, timeout_interval, retries, strlen(miblist) ? miblist : "''", proto, "[authpriv]",
-		server_address, port);
-
-	for (i = 0; i < numoids; i++) {
-		command_line[9 + numauthpriv + 1 + i] = oids[i];
-		xasprintf(&cl_hidden_auth, "%s %s", cl_hidden_auth, oids[i]);	
+	if (table) {
+		if (!native)
+			die (STATE_UNKNOWN, _("--table needs SNMPv1 or v2c, and numeric OIDs or known names\n"));
+		return snmp_table ();
 	}
 
-	command_line[9 + numauthpriv + 1 + numoids] = NULL;
-
-	if (verbose)
-		printf ("%s\n", cl_hidden_auth);
-
-	/* Run the command */
-	return_code = cmd_run_array (command_line, &chld_out, &chld_err, 0);
-
-	/* Due to net-snmp sometimes showing stderr messages with poorly formed MIBs,
-	   only return state unknown if return code is non zero or there is no stdout.
-	   Do this way so that if there is stderr, will get added to output, which helps problem diagnosis
-	*/
-	if (return_code != 0)
-		external_error=1;
-	if (chld_out.lines == 0)
-		external_error=1;
-	if (external_error) {
-		if (chld_err.lines > 0) {
-			printf (_("External command error: %s\n"), chld_err.line[0]);
-			for (i = 1; i < chld_err.lines; i++) {
-				printf ("%s\n", chld_err.line[i]);
-			}
-		} else {
-			printf(_("External command error with no output (return code: %d)\n"), return_code);
-		}
-		exit (STATE_UNKNOWN);
+	if (native) {
+		snmp_native_get (&chld_out);
+	} else {
+		snmp_command_get (&chld_out);
 	}
 
 	if (verbose) {
@@ -336,7 +1588,22 @@ main (int argc, char **argv)
 		}
 	}
 
-	for (line=0, i=0; line < chld_out.lines; line++, i++) {
+	if (calculate_rate) {
+		numoids--;
+		if (chld_out.lines > 0) {
+			ptr = strstr (chld_out.line[--chld_out.lines], "Timeticks: (");
+			agent_uptime = ptr ? strtoll (ptr + 12, NULL, 10) : -1;
+		}
+		if (nsamples > 0 && agent_uptime >= 0 && samples[nsamples - 1].uptime > agent_uptime) {
+			if (verbose)
+				printf ("sysUpTime went back from %lld to %lld, the agent restarted\n",
+				        samples[nsamples - 1].uptime, agent_uptime);
+			nsamples = 0;
+			restarted = TRUE;
+		}
+	}
+
+	for (line=0, i=0; line < chld_out.lines && i < numoids; line++, i++) {
 		if(calculate_rate)
 			conv = "%.10g";
 		else
@@ -365,13 +1632,13 @@ main (int argc, char **argv)
 		} 
 		else if (strstr (response, "Counter32: ")) {
 			show = strstr (response, "Counter32: ") + 11;
-			is_counter=1;
+			is_counter=RATE_COUNTER32;
 			if(!calculate_rate) 
 				strcpy(type, "c");
 		}
 		else if (strstr (response, "Counter64: ")) {
 			show = strstr (response, "Counter64: ") + 11;
-			is_counter=1;
+			is_counter=RATE_COUNTER64;
 			if(!calculate_rate)
 				strcpy(type, "c");
 		}
@@ -432,20 +1699,15 @@ main (int argc, char **argv)
 			response_value[i] = strtod (ptr, NULL);
 
 			if(calculate_rate) {
-				if (previous_state!=NULL) {
-					duration = current_time-previous_state->time;
+				rate_values[i].type = is_counter;
+				rate_values[i].counter = is_counter ? strtoull(ptr, NULL, 10) : 0;
+				rate_values[i].gauge = response_value[i];
+				if (nsamples > 0) {
+					duration = current_time-samples[nsamples-1].time;
 					if(duration<=0)
 						die(STATE_UNKNOWN,_("Time duration between plugin calls is invalid"));
-					temp_double = response_value[i]-previous_value[i];
-					/* Simple overflow catcher (same as in rrdtool, rrd_update.c) */
-					if(is_counter) {
-						if(temp_double<(double)0.0)
-							temp_double+=(double)4294967296.0; /* 2^32 */
-						if(temp_double<(double)0.0)
-							temp_double+=(double)18446744069414584320.0; /* 2^64-2^32 */;
-					}
-					/* Convert to per second, then use multiplier */
-					temp_double = temp_double/duration*rate_multiplier;
+					/* Per second, then use multiplier */
+					temp_double = rate_since_samples(i, current_time);
 					iresult = get_status(temp_double, thlds[i]);
 					xasprintf (&show, conv, temp_double);
 				}
@@ -514,61 +1776,25 @@ main (int argc, char **argv)
 				temp_string=labels[i];
 			else
 				temp_string=oidname;
-			if (strpbrk (temp_string, " ='\"") == NULL) {
-				strncat(perfstr, temp_string, sizeof(perfstr)-strlen(perfstr)-1);
-			} else {
-				if (strpbrk (temp_string, "'") == NULL) {
-					quote_string="'";
-				} else {
-					quote_string="\"";
-				}
-				strncat(perfstr, quote_string, sizeof(perfstr)-strlen(perfstr)-1);
-				strncat(perfstr, temp_string, sizeof(perfstr)-strlen(perfstr)-1);
-				strncat(perfstr, quote_string, sizeof(perfstr)-strlen(perfstr)-1);
-			}
-			strncat(perfstr, "=", sizeof(perfstr)-strlen(perfstr)-1);
-			len = sizeof(perfstr)-strlen(perfstr)-1;
-			strncat(perfstr, show, len>ptr-show ? ptr-show : len);
-
-			if (type)
-				strncat(perfstr, type, sizeof(perfstr)-strlen(perfstr)-1);
-			strncat(perfstr, " ", sizeof(perfstr)-strlen(perfstr)-1);
+			if (strpbrk (temp_string, " ='\"") == NULL)
+				quote_string="";
+			else if (strpbrk (temp_string, "'") == NULL)
+				quote_string="'";
+			else
+				quote_string="\"";
+			xasprintf (&perfstr, "%s%s%s%s=%.*s%s ", perfstr, quote_string, temp_string,
+				quote_string, (int)(ptr - show), show, type);
 		}
 	}
-	total_oids=i;
 
 	/* Save state data, as all data collected now */
 	if(calculate_rate) {
-		string_length=1024;
-		state_string=malloc(string_length);
-		if(state_string==NULL)
-			die(STATE_UNKNOWN, _("Cannot malloc"));
-		
-		current_length=0;
-		for(i=0; i<total_oids; i++) {
-			xasprintf(&temp_string,"%.0f",response_value[i]);
-			if(temp_string==NULL)
-				die(STATE_UNKNOWN,_("Cannot asprintf()"));
-			response_length = strlen(temp_string);
-			if(current_length+response_length>string_length) {
-				string_length=current_length+1024;
-				state_string=realloc(state_string,string_length);
-				if(state_string==NULL)
-					die(STATE_UNKNOWN, _("Cannot realloc()"));
-			}
-			strcpy(&state_string[current_length],temp_string);
-			current_length=current_length+response_length;
-			state_string[current_length]=':';
-			current_length++;
-			free(temp_string);
-		}
-		state_string[--current_length]='\0';
-		if (verbose > 2)
-			printf("State string=%s\n",state_string);
-		
+		i = nsamples;
 		/* This is not strictly the same as time now, but any subtle variations will cancel out */
-		np_state_write_string(current_time, state_string );
-		if(previous_state==NULL) {
+		rate_write_state(current_time);
+		if(restarted)
+			die( STATE_OK, _("Agent restarted, no previous data to calculate rate - assume okay" ) );
+		if(i==0) {
 			/* Or should this be highest state? */
 			die( STATE_OK, _("No previous data to calculate rate - assume okay" ) );
 		}
@@ -618,7 +1844,14 @@ process_arguments (int argc, char **argv)
 		{"next", no_argument, 0, 'n'},
 		{"rate", no_argument, 0, L_CALCULATE_RATE},
 		{"rate-multiplier", required_argument, 0, L_RATE_MULTIPLIER},
+		{"rate-samples", required_argument, 0, L_RATE_SAMPLES},
 		{"invert-search", no_argument, 0, L_INVERT_SEARCH},
+		{"table", no_argument, 0, L_TABLE},
+		{"row-label", required_argument, 0, L_ROW_LABEL},
+		{"hosts", required_argument, 0, L_HOSTS},
+		{"window", required_argument, 0, L_WINDOW},
+		{"cache", required_argument, 0, L_CACHE},
+		{"v3-cache", no_argument, 0, L_V3_CACHE},
 		{"perf-oids", no_argument, 0, 'O'},
 		{0, 0, 0, 0}
 	};
@@ -694,10 +1927,10 @@ process_arguments (int argc, char **argv)
 			privpasswd = optarg;
 			break;
 		case 't':	/* timeout period */
-			if (!is_integer (optarg))
-				usage2 (_("Timeout interval must be a positive integer"), optarg);
+			if (!is_positive (optarg))
+				usage2 (_("Timeout interval must be a positive number"), optarg);
 			else
-				timeout_interval = atoi (optarg);
+				timeout_seconds = strtod (optarg, NULL);
 			break;
 
 	/* Test parameters */
@@ -723,8 +1956,8 @@ process_arguments (int argc, char **argv)
 					 */
 					needmibs = TRUE;
 			}
-			if (!oids) oids = calloc(MAX_OIDS, sizeof (char *));
-			for (ptr = strtok(optarg, ", "); ptr != NULL && j < MAX_OIDS; ptr = strtok(NULL, ", "), j++) {
+			for (ptr = strtok(optarg, ", "); ptr != NULL; ptr = strtok(NULL, ", "), j++) {
+				grow_oids (j + 2);
 				oids[j] = strdup(ptr);
 			}
 			numoids = j;
@@ -740,6 +1973,7 @@ process_arguments (int argc, char **argv)
 		case 's':									/* string or substring */
 			strncpy (string_value, optarg, sizeof (string_value) - 1);
 			string_value[sizeof (string_value) - 1] = 0;
+			grow_oids (jj + 1);
 			eval_method[jj++] = CRIT_STRING;
 			ii++;
 			break;
@@ -755,6 +1989,7 @@ process_arguments (int argc, char **argv)
 				printf (_("Could Not Compile Regular Expression"));
 				return ERROR;
 			}
+			grow_oids (jj + 1);
 			eval_method[jj++] = CRIT_REGEX;
 			ii++;
 			break;
@@ -825,19 +2060,45 @@ process_arguments (int argc, char **argv)
 			break;
 		case L_CALCULATE_RATE:
 			if(calculate_rate==0)
-				np_enable_state(NULL, 1);
+				np_enable_state(NULL, RATE_STATE_VERSION);
 			calculate_rate = 1;
 			break;
 		case L_RATE_MULTIPLIER:
 			if(!is_integer(optarg)||((rate_multiplier=atoi(optarg))<=0))
 				usage2(_("Rate multiplier must be a positive integer"),optarg);
 			break;
+		case L_RATE_SAMPLES:
+			if(!is_integer(optarg)||((rate_samples=atoi(optarg))<=0))
+				usage2(_("Rate samples must be a positive integer"),optarg);
+			break;
+		case L_CACHE:
+			if(!is_intpos(optarg))
+				usage2(_("Cache time must be a positive integer"),optarg);
+			cache_ttl = atoi(optarg);
+			break;
+		case L_V3_CACHE:
+			v3_cache = TRUE;
+			break;
 		case L_INVERT_SEARCH:
 			invert_search=1;
 			break;
 		case 'O':
 			perf_labels=0;
 			break;
+		case L_TABLE:
+			table = TRUE;
+			break;
+		case L_ROW_LABEL:
+			row_label = optarg;
+			break;
+		case L_HOSTS:
+			hosts_file = optarg;
+			break;
+		case L_WINDOW:
+			if (!is_intpos (optarg))
+				usage2 (_("Window must be a positive integer"), optarg);
+			window = atoi (optarg);
+			break;
 		}
 	}
 
@@ -884,7 +2145,7 @@ validate_arguments ()
 	}
 
 	/* Check server_address is given */
-	if (server_address == NULL)
+	if (server_address == NULL && hosts_file == NULL)
 		die(STATE_UNKNOWN, _("No host specified\n"));
 
 	/* Check oid is given */
@@ -894,6 +2155,16 @@ validate_arguments ()
 	if (proto == NULL)
 		xasprintf(&proto, DEFAULT_PROTOCOL);
 
+	if (table && (calculate_rate || usesnmpgetnext))
+		usage4 (_("--table can't be used with --rate or --next"));
+
+	/* a rate needs its samples' own time and sysUpTime, not the cache's */
+	if (cache_ttl && calculate_rate)
+		usage4 (_("--cache can't be used with --rate"));
+
+	if (hosts_file && (table || calculate_rate || cache_ttl))
+		usage4 (_("--hosts can't be used with --table, --rate or --cache"));
+
 	if ((strcmp(proto,"1") == 0) || (strcmp(proto, "2c")==0)) {	/* snmpv1 or snmpv2c */
 		numauthpriv = 2;
 		authpriv = calloc (numauthpriv, sizeof (char *));
@@ -1080,6 +2351,8 @@ print_help (void)
 	printf ("    %s\n", _("Enable rate calculation. See 'Rate Calculation' below"));
 	printf (" %s\n", "--rate-multiplier");
 	printf ("    %s\n", _("Converts rate per second. For example, set to 60 to convert to per minute"));
+	printf (" %s\n", "--rate-samples=INTEGER");
+	printf ("    %s\n", _("Average the rate over this many earlier calls (default 1)"));
 
 	/* Tests Against Strings */
 	printf (" %s\n", "-s, --string=STRING");
@@ -1099,9 +2372,36 @@ print_help (void)
 	printf (" %s\n", "-D, --output-delimiter=STRING");
 	printf ("    %s\n", _("Separates output on multiple OID requests"));
 
-	printf (UT_TIMEOUT, DEFAULT_SOCKET_TIMEOUT);
+	printf (" %s\n", "-t, --timeout=SECONDS");
+	printf ("    %s ", _("Seconds to wait for each response, fractions allowed"));
+	printf ("(%s %d)\n", _("default is"), DEFAULT_TIMEOUT);
 	printf (" %s\n", "-e, --retries=INTEGER");
-	printf ("    %s\n", _("Number of retries to be used in the requests"));
+	printf ("    %s ", _("Number of retries to be used in the requests"));
+	printf ("(%s %d)\n", _("default is"), DEFAULT_RETRIES);
+	printf (" %s\n", "--cache=SECONDS");
+	printf ("    %s\n", _("Share the agent's answers with other checks of it for this many seconds,"));
+	printf ("    %s\n", _("through a file in the state directory. Checks wait while another asks"));
+	printf ("    %s\n", _("the agent, and then only ask for what it didn't (SNMPv1 and v2c GETs,"));
+	printf ("    %s\n", _("not with --rate)"));
+
+	printf (" %s\n", "--v3-cache");
+	printf ("    %s\n", _("Keep the agent's engine ID, boots and time, and with SHA the keys localized"));
+	printf ("    %s\n", _("to it, for the next SNMPv3 check, which then skips discovery and the key"));
+	printf ("    %s\n", _("derivation. The file is in the state directory, readable by its owner only"));
+
+	printf (" %s\n", "--table");
+	printf ("    %s\n", _("Walk the -o OIDs as columns of a table, checking each row. See 'Tables' below"));
+	printf (" %s\n", "--row-label=TEMPLATE");
+	printf ("    %s\n", _("Label for each row, where {index} is the row's index and {COLUMN} the row's"));
+	printf ("    %s\n", _("value in another column, e.g. '{IF-MIB::ifDescr}' (default {index})"));
+
+	printf (" %s\n", "--hosts=FILE");
+	printf ("    %s\n", _("Check every host listed in FILE, one a line, or on stdin with '-', instead"));
+	printf ("    %s\n", _("of -H. See 'Many hosts' below"));
+	printf (" %s\n", "--window=INTEGER");
+	printf ("    %s\n", _("Hosts asked at once with --hosts"));
+	printf ("    %s\n", _("Default:"));
+	printf ("    %d\n", DEFAULT_WINDOW);
 
 	printf (" %s\n", "-O, --perf-oids");
 	printf ("    %s\n", _("Label performance data with OIDs instead of --label's"));
@@ -1109,14 +2409,16 @@ print_help (void)
 	printf (UT_VERBOSE);
 
 	printf ("\n");
-	printf ("%s\n", _("This plugin uses the 'snmpget' command included with the NET-SNMP package."));
-	printf ("%s\n", _("if you don't have the package installed, you will need to download it from"));
-	printf ("%s\n", _("http://net-snmp.sourceforge.net before you can use this plugin."));
+	printf ("%s\n", _("This plugin speaks SNMPv1 and v2c itself for numeric OIDs and a few common"));
+	printf ("%s\n", _("names (system group, IF-MIB, HOST-RESOURCES-MIB). SNMPv3 and other names use"));
+	printf ("%s\n", _("the 'snmpget' command included with the NET-SNMP package, which you can get"));
+	printf ("%s\n", _("from http://net-snmp.sourceforge.net."));
 
 	printf ("\n");
 	printf ("%s\n", _("Notes:"));
 	printf (" %s\n", _("- Multiple OIDs (and labels) may be indicated by a comma or space-delimited  "));
-	printf ("   %s %i %s\n", _("list (lists with internal spaces must be quoted). Maximum:"), MAX_OIDS, _("OIDs."));
+	printf ("   %s\n", _("list (lists with internal spaces must be quoted). They are asked for in as"));
+	printf ("   %s\n", _("few requests as the agent can answer."));
 
 	printf(" -%s", UT_THRESHOLDS_NOTES);
 
@@ -1134,6 +2436,30 @@ print_help (void)
 	printf(" %s\n", _("On the first run, there will be no prior state - this will return with OK."));
 	printf(" %s\n", _("The state is uniquely determined by the arguments to the plugin, so"));
 	printf(" %s\n", _("changing the arguments will create a new state file."));
+	printf(" %s\n", _("Counters that went down have wrapped, at 2^32 or 2^64 as their type says,"));
+	printf(" %s\n", _("unless sysUpTime went down too: then the agent restarted, and the rate"));
+	printf(" %s\n", _("starts again."));
+
+	printf("\n");
+	printf("%s\n", _("Tables:"));
+	printf(" %s\n", _("With --table, every -o OID is a column, walked with GETBULK (GETNEXT for"));
+	printf(" %s\n", _("SNMPv1), and the values are joined into rows by their index. The thresholds,"));
+	printf(" %s\n", _("-s and -r for each column apply to each of its rows, and -s and -r compare"));
+	printf(" %s\n", _("strings without quotes. Rows with a problem are listed, and there is"));
+	printf(" %s\n", _("performance data for every numeric value, named after the row label and"));
+	printf(" %s\n", _("the column's -l label. For example, every interface of a switch:"));
+	printf(" %s\n", "check_snmp -H switch -P 2c --table -o ifOperStatus,ifInErrors -l status,errors \\");
+	printf(" %s\n", "  -w 1:1,100 --row-label='{ifDescr}'");
+
+	printf("\n");
+	printf("%s\n", _("Many hosts:"));
+	printf(" %s\n", _("With --hosts, one check asks all the hosts in a list for the -o OIDs, up to"));
+	printf(" %s\n", _("--window of them at a time, with SNMPv1 or v2c. The first line sums up the"));
+	printf(" %s\n", _("results, and the worst of them is the check's. A line for each host"));
+	printf(" %s\n", _("follows, with the host, the -l label, the state and the output separated by"));
+	printf(" %s\n", _("tabs, as send_nsca takes passive check results. For example:"));
+	printf(" %s\n", "check_snmp --hosts=switches.txt -P 2c -o sysUpTime.0 -c 8640000: | \\");
+	printf(" %s\n", "  tail -n +2 | send_nsca -H nagios");
 
 	printf (UT_SUPPORT);
 }
@@ -1148,5 +2474,6 @@ print_usage (void)
 	printf ("[-C community] [-s string] [-r regex] [-R regexi] [-t timeout] [-e retries]\n");
 	printf ("[-l label] [-u units] [-p port-number] [-d delimiter] [-D output-delimiter]\n");
 	printf ("[-m miblist] [-P snmp version] [-L seclevel] [-U secname] [-a authproto]\n");
-	printf ("[-A authpasswd] [-x privproto] [-X privpasswd]\n");
+	printf ("[-A authpasswd] [-x privproto] [-X privpasswd] [--table [--row-label template]]\n");
+	printf ("[--cache seconds] [--hosts file [--window count]]\n");
 }
@@ -297,10 +297,10 @@ popen_timeout_alarm_handler (int signo)
 	int fh;
 	if (signo == SIGALRM) {
 		if (child_process != NULL) {
-			fh=fileno (child_process);
-			if(fh >= 0){
-				kill (childpid[fh], SIGKILL);
-			}
+			/* there may be more than one child running */
+			for (fh = 0; fh < maxfd; fh++)
+				if (childpid[fh] > 0)
+					kill (childpid[fh], SIGKILL);
 			printf (_("CRITICAL - Plugin timed out after %d seconds\n"),
 						timeout_interval);
 		} else {
@@ -10,7 +10,7 @@ use NPTest;
 
 use vars qw($tests);
 
-BEGIN {$tests = 4; plan tests => $tests}
+BEGIN {$tests = 8; plan tests => $tests}
 
 my $successOutput = '/^FPING OK - /';
 my $failureOutput = '/^FPING CRITICAL - /';
@@ -32,6 +32,8 @@ if ( -x "./check_fping" )
   $t += checkCmd( "./check_fping $host_responsive",    0,       $successOutput );
   $t += checkCmd( "./check_fping $host_nonresponsive", [ 1, 2 ] );
   $t += checkCmd( "./check_fping $hostname_invalid",   [ 1, 2 ] );
+  $t += checkCmd( "./check_fping -H $host_responsive,$host_nonresponsive",      2, '/^FPING CRITICAL - 1 of 2 alive/' );
+  $t += checkCmd( "./check_fping -H $host_responsive -H $host_nonresponsive -a 1", 0, '/^FPING OK - 1 of 2 alive/' );
 }
 else
 {
@@ -8,7 +8,7 @@ use strict;
 use Test::More;
 use NPTest;
 
-plan tests => 20;
+plan tests => 26;
 
 my $successOutput = '/PING (ok|OK) - Packet loss = +[0-9]{1,2}\%, +RTA = [\.0-9]+ ms/';
 my $failureOutput = '/Packet loss = +[0-9]{1,2}\%, +RTA = [\.0-9]+ ms/';
@@ -95,6 +95,21 @@ $res = NPTest->testCmd(
 is( $res->return_code, 2, "Old syntax: Timeout - host nonresponsive" );
 like( $res->output, '/100%/', "Error contains '100%' string (for 100% packet loss)" );
 
+# all addresses are pinged at once, and any one of them answering is enough
+$res = NPTest->testCmd(
+	"./check_ping -H $host_nonresponsive -H $host_responsive -w 10,100% -c 10,100% -p 1 -t 15"
+	);
+is( $res->return_code, 0, "Several addresses, one responsive" );
+like( $res->output, "/$host_responsive is alive/", "Output names the responsive address" );
+
+$res = NPTest->testCmd(
+	"./check_ping -H $host_nonresponsive,$host_nonresponsive -w 10,100% -c 10,100% -p 1 -t 15"
+	);
+is( $res->return_code, 2, "Several addresses, none responsive" );
+like( $res->output, '/100%/', "Error contains '100%' string (for 100% packet loss)" );
+is( ($res->output =~ tr/|//), 1, "One perfdata section for all addresses" );
+like( $res->output, "/pl_$host_nonresponsive=100%/", "Perfdata labels name the address" );
+
 $res = NPTest->testCmd(
 	"./check_ping $hostname_invalid 0 0 0 0 -p 1 -t 1"
 	);
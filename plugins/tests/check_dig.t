@@ -0,0 +1,161 @@
+#! /usr/bin/perl -w -I ..
+#
+# Test check_dig's own queries against a stand-in DNS server
+#
+
+use strict;
+use Test::More;
+use NPTest;
+use IO::Socket::INET;
+use IO::Select;
+
+plan skip_all => "No check_dig compiled" unless (-x "./check_dig");
+plan tests => 33;
+
+my $port = 50000 + int(rand(1000));
+my $udp = IO::Socket::INET->new(Proto => "udp", LocalAddr => "127.0.0.1", LocalPort => $port)
+	or die "Cannot bind udp port $port: $!";
+my $tcp = IO::Socket::INET->new(Proto => "tcp", LocalAddr => "127.0.0.1", LocalPort => $port,
+	Listen => 5, ReuseAddr => 1) or die "Cannot bind tcp port $port: $!";
+
+sub rr {
+	my ($type, $class, $ttl, $rdata) = @_;
+	return pack("nnnNn", 0xc00c, $type, $class, $ttl, length($rdata)) . $rdata;
+}
+
+my $flaky = 0;
+sub answer {
+	my ($query, $over_tcp) = @_;
+	my ($id, $flags, $qd, $an, $ns, $ar) = unpack("n6", $query);
+	my ($pos, @labels) = (12);
+	while ((my $len = ord(substr($query, $pos, 1))) > 0) {
+		push @labels, substr($query, $pos + 1, $len);
+		$pos += $len + 1;
+	}
+	my $name = lc join(".", @labels);
+	my ($qtype, $qclass) = unpack("nn", substr($query, $pos + 1, 4));
+	my $question = substr($query, 12, $pos + 5 - 12);
+
+	return undef if $name eq "drop.test" || ($name eq "flaky.test" && $flaky++ % 2);
+
+	my ($rcode, @rr) = (0);
+	if ($name eq "version.bind" && $qclass == 3 && $qtype == 16) {
+		push @rr, rr(16, 3, 0, "\x08stand-in");
+	} elsif ($name eq "host.test" || $name eq "flaky.test") {
+		push @rr, rr(1, 1, 300, pack("C4", 192, 0, 2, 1)) if $qtype == 1;
+	} elsif ($name eq "big.test") {
+		push @rr, rr(1, 1, 300, pack("C4", 192, 0, 2, $_)) foreach (1..3);
+		@rr = () unless $over_tcp;
+	} elsif ($name ne "nodata.test") {
+		$rcode = 3;
+	}
+	# an OPT record for an OPT record
+	my $opt = $ar ? "\0" . pack("nnNn", 41, 1232, 0, 0) : "";
+	my $tc = $name eq "big.test" && !$over_tcp ? 0x200 : 0;
+	return pack("n6", $id, 0x8400 | $tc | ($flags & 0x100) | 0x80 | $rcode, 1, scalar(@rr), 0, $ar ? 1 : 0)
+		. $question . join("", @rr) . $opt;
+}
+
+my $pid = fork();
+if (!$pid) {
+	my $select = IO::Select->new($udp, $tcp);
+	while (1) {
+		foreach my $s ($select->can_read) {
+			if ($s == $udp) {
+				my $peer = $udp->recv(my $query, 512);
+				my $reply = answer($query, 0);
+				$udp->send($reply, 0, $peer) if defined $reply;
+			} else {
+				my $c = $tcp->accept or next;
+				$c->read(my $len, 2);
+				$c->read(my $query, unpack("n", $len));
+				my $reply = answer($query, 1);
+				print $c pack("n", length($reply)) . $reply if defined $reply;
+				close $c;
+			}
+		}
+	}
+	exit;
+}
+close $udp;
+close $tcp;
+
+END { kill "TERM", $pid if $pid; }
+
+my $dig = "./check_dig -H 127.0.0.1 -p $port";
+my $res;
+
+$res = NPTest->testCmd("$dig -l host.test");
+is( $res->return_code, 0, "Found host.test" );
+like( $res->output, '/^DNS OK - [\.0-9]+ seconds? response time \(host\.test\. 300 IN A 192\.0\.2\.1\)\|time=[\.0-9]+s;;;0\.000000$/',
+	"Output OK" );
+
+$res = NPTest->testCmd("$dig -l host.test -a 192.0.2.1");
+is( $res->return_code, 0, "Got expected address" );
+
+$res = NPTest->testCmd("$dig -l host.test -a 192.0.2.9");
+is( $res->return_code, 1, "Got wrong address" );
+like( $res->output, '/\(Server not found in ANSWER SECTION\)/', "Output OK" );
+
+$res = NPTest->testCmd("$dig -l nxdomain.test");
+is( $res->return_code, 2, "Non-existent domain" );
+like( $res->output, '/\(Server answered NXDOMAIN\)/', "Output OK" );
+
+$res = NPTest->testCmd("$dig -l nodata.test");
+is( $res->return_code, 2, "No records" );
+like( $res->output, '/\(No ANSWER SECTION found\)/', "Output OK" );
+
+$res = NPTest->testCmd("$dig -l version.bind -T TXT -C CH");
+is( $res->return_code, 0, "Chaos class" );
+like( $res->output, '/\(version\.bind\. 0 CH TXT "stand-in"\)/', "Output OK" );
+
+$res = NPTest->testCmd("$dig -l host.test -E 1232 -v");
+is( $res->return_code, 0, "EDNS query" );
+like( $res->output, '/, EDNS$/m', "Server answered with EDNS" );
+
+$res = NPTest->testCmd("$dig -l host.test -v");
+unlike( $res->output, '/EDNS/', "No EDNS by default" );
+
+$res = NPTest->testCmd("$dig -l host.test -P tcp -v");
+is( $res->return_code, 0, "TCP query" );
+like( $res->output, '/ over TCP$/m', "Output OK" );
+
+$res = NPTest->testCmd("$dig -l big.test -v");
+is( $res->return_code, 0, "Truncated answer" );
+like( $res->output, '/ over TCP$/m', "Asked again over TCP" );
+
+$res = NPTest->testCmd("$dig -l host.test -n 5");
+is( $res->return_code, 0, "Several queries" );
+like( $res->output, '/^DNS OK - [\.0-9]+ seconds average response time \(host\.test\. 300 IN A 192\.0\.2\.1\), min\/avg\/max [\.0-9]+\/[\.0-9]+\/[\.0-9]+ over 5 of 5 queries\|time=[\.0-9]+s;;;0\.000000 time_min=[\.0-9]+s;;;0\.000000 time_max=[\.0-9]+s;;;0\.000000$/',
+	"Output OK" );
+
+$res = NPTest->testCmd("$dig -l flaky.test -n 4 -t 4");
+is( $res->return_code, 1, "Some queries unanswered" );
+like( $res->output, '/over 2 of 4 queries\|/', "Output OK" );
+
+# every other flaky.test query waits 500 ms for nothing, so -t 2 runs out
+my $start = time;
+$res = NPTest->testCmd("$dig -l flaky.test -n 20 -t 2");
+is( $res->return_code, 1, "Timeout spent before all queries were sent" );
+like( $res->output, '/over \d+ of \d+ queries, \d+ not sent in time\|/', "Output OK" );
+cmp_ok( time - $start, '<=', 4, "-t still limits the check" );
+
+$res = NPTest->testCmd("$dig -l host.test -n 2 -A +norecurse");
+is( $res->return_code, 3, "-n with -A rejected" );
+like( $res->output, '/-n can\'t be used with -A/', "Output OK" );
+
+$res = NPTest->testCmd("$dig -l drop.test -t 1");
+is( $res->return_code, 2, "No answer" );
+like( $res->output, '/\(No response from 127\.0\.0\.1\)/', "Output OK" );
+
+$res = NPTest->testCmd("$dig -l host.test -w 0.000001 -c 5");
+is( $res->return_code, 1, "Warning threshold passed" );
+
+$res = NPTest->testCmd("$dig -l host.test -w 0.000001 -c 0.000001");
+is( $res->return_code, 2, "Critical threshold passed" );
+
+$res = NPTest->testCmd("$dig -l host.test -T bogus");
+is( $res->return_code, 3, "Unknown record type" );
+
+$res = NPTest->testCmd("$dig -l host.test -E 100");
+is( $res->return_code, 3, "EDNS size too small" );
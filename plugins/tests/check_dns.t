@@ -0,0 +1,207 @@
+#! /usr/bin/perl -w -I ..
+#
+# Test check_dns against a stand-in DNS server answering from a fixed zone
+#
+
+use strict;
+use Test::More;
+use NPTest;
+use IO::Socket::INET;
+use IO::Select;
+use Socket qw(inet_pton AF_INET6);
+
+plan skip_all => "No check_dns compiled" unless (-x "./check_dns");
+plan tests => 43;
+
+my %zone = (
+	"host.test"		=> [ 1, A => "192.0.2.2", A => "192.0.2.1", MX => "10 mail.host.test" ],
+	"split.test"		=> [ 1, A => "192.0.2.20" ],
+	"nonauth.test"		=> [ 0, A => "192.0.2.3" ],
+	"v6only.test"		=> [ 1, AAAA => "2001:db8::1" ],
+	"big.test"		=> [ 1, A => "192.0.2.10", A => "192.0.2.11", A => "192.0.2.12" ],
+	"1.2.0.192.in-addr.arpa"	=> [ 1, PTR => "host.test" ],
+);
+my %rcodes = ( "servfail.test" => 2, "nxdomain.test" => 3, "refused.test" => 5 );
+my %types = ( A => 1, MX => 15, PTR => 12, AAAA => 28 );
+
+# the second server is out of sync for split.test
+my %zone2 = ( "split.test" => [ 1, A => "192.0.2.21" ] );
+
+my $port = 50000 + int(rand(1000));
+
+sub encode_name {
+	return join("", map { chr(length($_)) . $_ } split(/\./, shift)) . "\0";
+}
+
+sub answer {
+	my ($query, $over_tcp, $zone) = @_;
+	my ($id, $flags) = unpack("nn", $query);
+	my ($pos, @labels) = (12);
+	while ((my $len = ord(substr($query, $pos, 1))) > 0) {
+		push @labels, substr($query, $pos + 1, $len);
+		$pos += $len + 1;
+	}
+	my $name = lc join(".", @labels);
+	my $qtype = unpack("n", substr($query, $pos + 1, 2));
+	my $question = substr($query, 12, $pos + 5 - 12);
+
+	return undef if $name eq "drop.test";
+
+	my ($aa, $rcode, @rr) = (1, $rcodes{$name} || 0);
+	if (my $rrset = $zone->{$name} || $zone{$name}) {
+		($aa, my @data) = @$rrset;
+		while (my ($type, $value) = splice(@data, 0, 2)) {
+			next unless $types{$type} == $qtype;
+			my $rdata = $type eq "A" ? pack("C4", split(/\./, $value))
+				: $type eq "AAAA" ? inet_pton(AF_INET6, $value)
+				: $type eq "MX" ? pack("n", (split(/ /, $value))[0]) . encode_name((split(/ /, $value))[1])
+				: encode_name($value);
+			push @rr, pack("nnnNn", 0xc00c, $qtype, 1, 300, length($rdata)) . $rdata;
+		}
+	} elsif (!$rcode) {
+		$rcode = 3;
+	}
+	my $tc = 0;
+	if ($name eq "big.test" && !$over_tcp) {
+		($tc, @rr) = (1);
+	}
+	return pack("nnnnnn", $id, 0x8000 | ($aa << 10) | ($tc << 9) | ($flags & 0x100) | 0x80 | $rcode,
+		1, scalar(@rr), 0, 0) . $question . join("", @rr);
+}
+
+sub serve {
+	my ($address, $zone) = @_;
+	my $udp = IO::Socket::INET->new(Proto => "udp", LocalAddr => $address, LocalPort => $port)
+		or die "Cannot bind udp port $port: $!";
+	my $tcp = IO::Socket::INET->new(Proto => "tcp", LocalAddr => $address, LocalPort => $port,
+		Listen => 5, ReuseAddr => 1) or die "Cannot bind tcp port $port: $!";
+	my $pid = fork();
+	if ($pid) {
+		close $udp;
+		close $tcp;
+		return $pid;
+	}
+	my $select = IO::Select->new($udp, $tcp);
+	while (1) {
+		foreach my $s ($select->can_read) {
+			if ($s == $udp) {
+				my $peer = $udp->recv(my $query, 512);
+				my $reply = answer($query, 0, $zone);
+				$udp->send($reply, 0, $peer) if defined $reply;
+			} else {
+				my $c = $tcp->accept or next;
+				$c->read(my $len, 2);
+				$c->read(my $query, unpack("n", $len));
+				my $reply = answer($query, 1, $zone);
+				print $c pack("n", length($reply)) . $reply if defined $reply;
+				close $c;
+			}
+		}
+	}
+}
+
+my @pids = (serve("127.0.0.1", {}), serve("127.0.0.2", \%zone2));
+END { kill "TERM", @pids if @pids; }
+
+my $dns = "./check_dns -s 127.0.0.1 -p $port";
+my $res;
+
+$res = NPTest->testCmd("$dns -H host.test");
+is( $res->return_code, 0, "Found host.test" );
+like( $res->output, '/^DNS OK: [\.0-9]+ seconds? response time\. host\.test returns 192\.0\.2\.1,192\.0\.2\.2\|time=[\.0-9]+s;;;0\.000000$/',
+	"Addresses sorted, perfdata" );
+
+$res = NPTest->testCmd("$dns -H host.test -a 192.0.2.1,192.0.2.2");
+is( $res->return_code, 0, "Got expected addresses" );
+
+$res = NPTest->testCmd("$dns -H host.test -a 192.0.2.9 -a 192.0.2.1");
+is( $res->return_code, 2, "Got wrong addresses" );
+is( $res->output, "DNS CRITICAL - expected '192.0.2.9; 192.0.2.1' but got '192.0.2.1,192.0.2.2'", "Output OK" );
+
+$res = NPTest->testCmd("$dns -H host.test -A");
+is( $res->return_code, 0, "Authoritative answer" );
+
+$res = NPTest->testCmd("$dns -H nonauth.test");
+is( $res->return_code, 0, "Non-authoritative answer" );
+like( $res->output, '/nonauth\.test returns 192\.0\.2\.3\|/', "Output OK" );
+
+$res = NPTest->testCmd("$dns -H nonauth.test -A");
+is( $res->return_code, 2, "Non-authoritative answer with -A" );
+is( $res->output, "DNS CRITICAL - server 127.0.0.1 is not authoritative for nonauth.test", "Output OK" );
+
+$res = NPTest->testCmd("$dns -H v6only.test");
+is( $res->return_code, 0, "IPv6 address when there is no A record" );
+like( $res->output, '/v6only\.test returns 2001:db8::1\|/', "Output OK" );
+
+$res = NPTest->testCmd("$dns -H big.test -v");
+is( $res->return_code, 0, "Truncated answer" );
+like( $res->output, '/over TCP, 1 tries/', "Asked again over TCP" );
+like( $res->output, '/big\.test returns 192\.0\.2\.10,192\.0\.2\.11,192\.0\.2\.12\|/', "Whole answer" );
+
+$res = NPTest->testCmd("$dns -H 192.0.2.1");
+is( $res->return_code, 0, "Reverse lookup" );
+like( $res->output, '/192\.0\.2\.1 returns host\.test\.\|/', "Output OK" );
+
+$res = NPTest->testCmd("$dns -H 192.0.2.1 -a host.test.");
+is( $res->return_code, 0, "Got expected fqdn" );
+
+$res = NPTest->testCmd("$dns -H nxdomain.test");
+is( $res->return_code, 2, "Non-existent domain" );
+is( $res->output, "Domain nxdomain.test was not found by the server", "Output OK" );
+
+$res = NPTest->testCmd("$dns -H servfail.test");
+is( $res->return_code, 2, "Server failure" );
+is( $res->output, "DNS failure for 127.0.0.1", "Output OK" );
+
+$res = NPTest->testCmd("$dns -H refused.test");
+is( $res->return_code, 2, "Refused query" );
+is( $res->output, "Query was refused by DNS server at 127.0.0.1", "Output OK" );
+
+$res = NPTest->testCmd("$dns -H host.test -w 0 -c 5");
+is( $res->return_code, 1, "Warning threshold passed" );
+
+$res = NPTest->testCmd("$dns -H host.test -w 0 -c 0");
+is( $res->return_code, 2, "Critical threshold passed" );
+
+my $start = time;
+$res = NPTest->testCmd("$dns -H drop.test -t 2 -R 3");
+is( $res->return_code, 2, "No answer" );
+is( $res->output, "No response from DNS 127.0.0.1", "Output OK" );
+cmp_ok( time - $start, '<=', 3, "Tries share the timeout" );
+
+$res = NPTest->testCmd("./check_dns -s 127.0.0.1 -p " . ($port + 1000) . " -H host.test");
+is( $res->output, "Connection to DNS 127.0.0.1 was refused", "Nothing listening" );
+
+# several servers and record types at once
+my $both = "./check_dns -s 127.0.0.1,127.0.0.2 -p $port";
+
+$res = NPTest->testCmd("$both -H host.test -q A,MX");
+is( $res->return_code, 0, "Servers agree" );
+like( $res->output, '/^DNS OK: 2 servers agree on host\.test: A 192\.0\.2\.1,192\.0\.2\.2, MX 10 mail\.host\.test\., [\.0-9]+ seconds max response time\|time_127\.0\.0\.1=[\.0-9]+s;;;0\.000000 time_127\.0\.0\.2=[\.0-9]+s;;;0\.000000$/',
+	"Output and per server perfdata" );
+
+$res = NPTest->testCmd("$both -H split.test");
+is( $res->return_code, 2, "Servers disagree" );
+like( $res->output, '/^DNS CRITICAL - A answers differ \(127\.0\.0\.1: 192\.0\.2\.20; 127\.0\.0\.2: 192\.0\.2\.21\)\|/',
+	"Output OK" );
+
+$res = NPTest->testCmd("./check_dns -s 127.0.0.1 -s 127.0.0.2 -p $port -H 192.0.2.1 -a host.test.");
+is( $res->return_code, 0, "Reverse lookup on both servers" );
+
+$res = NPTest->testCmd("$both -H host.test -q MX -a '10 mail.host.test.'");
+is( $res->return_code, 0, "Expected MX" );
+
+$res = NPTest->testCmd("$both -H host.test -q A -a 192.0.2.1");
+is( $res->return_code, 2, "Wrong address on both servers" );
+like( $res->output, "/^DNS CRITICAL - 127.0.0.1 A: expected '192.0.2.1' but got '192.0.2.1,192.0.2.2'; 127.0.0.2 A: /", "Output OK" );
+
+$res = NPTest->testCmd("$both -H host.test -q AAAA");
+is( $res->return_code, 2, "No records of a type" );
+like( $res->output, '/^DNS CRITICAL - 127\.0\.0\.1 has no AAAA records; 127\.0\.0\.2 has no AAAA records\|/', "Output OK" );
+
+$start = time;
+$res = NPTest->testCmd("./check_dns -s 127.0.0.1,127.0.0.2,127.0.0.3 -p $port -H drop.test -q A,MX -t 2");
+is( $res->return_code, 2, "No answers" );
+like( $res->output, '/^DNS CRITICAL - 127\.0\.0\.1 A: no response; 127\.0\.0\.2 A: no response; 127\.0\.0\.3 A: Connection refused; 127\.0\.0\.1 MX: no response; /',
+	"Output OK" );
+cmp_ok( time - $start, '<=', 3, "Servers asked at the same time" );
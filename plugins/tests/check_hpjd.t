@@ -0,0 +1,55 @@
+#! /usr/bin/perl -w -I ..
+#
+# Test check_hpjd against the stand-in SNMP agent
+#
+
+use strict;
+use Test::More;
+use NPTest;
+use FindBin qw($Bin);
+
+plan skip_all => "No check_hpjd compiled" unless (-x "./check_hpjd");
+plan tests => 14;
+
+my $port = 16300 + int(rand(100));
+
+my $pid = fork();
+if ($pid == 0) {
+	exec($^X, "$Bin/check_snmp_agent.pl", $port);
+}
+END { kill "INT", $pid if $pid; }
+# give our agent some time to startup
+sleep(1);
+
+my $hpjd = "./check_hpjd -H 127.0.0.1 -p $port";
+my $res;
+
+$res = NPTest->testCmd("$hpjd");
+is( $res->return_code, 0, "Printer ready" );
+is( $res->output, "Printer ok - (READY)", "Output OK" );
+
+$res = NPTest->testCmd("$hpjd -C jammed");
+is( $res->return_code, 1, "Paper jam" );
+is( $res->output, "Paper Jam (READY)", "Output OK" );
+
+$res = NPTest->testCmd("$hpjd -C offline");
+is( $res->return_code, 1, "Printer offline" );
+is( $res->output, "Printer Offline (OFFLINE)", "Output OK" );
+
+$res = NPTest->testCmd("$hpjd -C powersave");
+is( $res->return_code, 0, "Offline to save power" );
+is( $res->output, "Printer ok - (POWERSAVE ON)", "Output OK" );
+
+$res = NPTest->testCmd("$hpjd -C reversed");
+is( $res->return_code, 1, "Answers found by their OID" );
+is( $res->output, "Toner Low (READY)", "Output OK" );
+
+$res = NPTest->testCmd("$hpjd -C lossy");
+is( $res->return_code, 0, "Lost request sent again" );
+
+$res = NPTest->testCmd("./check_hpjd -H 127.0.0.1 -p " . ($port + 100));
+is( $res->return_code, 2, "Nothing listening" );
+is( $res->output, "SNMP request to 127.0.0.1 failed: Connection refused", "Output OK" );
+
+$res = NPTest->testCmd("$hpjd -p x");
+is( $res->return_code, 3, "Bad port" );
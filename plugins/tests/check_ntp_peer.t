@@ -0,0 +1,140 @@
+#! /usr/bin/perl -w -I ..
+#
+# Test check_ntp_peer against stand-in NTP servers answering control messages
+#
+
+use strict;
+use Test::More;
+use NPTest;
+use IO::Socket::INET;
+use IO::Select;
+use Time::HiRes qw(time);
+
+plan skip_all => "No check_ntp_peer compiled" unless (-x "./check_ntp_peer");
+plan tests => 18;
+
+my $port = 50000 + int(rand(1000));
+
+# one synchronised server, its variables for the sync peer split in two
+# fragments; one without a sync source, with 20 candidates; and one whose
+# fragments come last first, and the first of them twice.
+my %synced = (
+	delay => 0.1,
+	peers => {
+		1 => [ 0x96, "stratum=2, offset=1.500, jitter=0.200" ],
+		2 => [ 0x94, "stratum=3, offset=0.100, jitter=0.100" ],
+		3 => [ 0x94, "stratum=3, offset=0.100, jitter=0.100" ],
+	},
+	fragment => { 1 => 1 },
+);
+my %split = (
+	delay => 0.1,
+	peers => { 1 => [ 0x96, "stratum=2, offset=1.500, jitter=0.200" ] },
+	split => { 1 => 1 },
+);
+my %unsynced = (
+	delay => 0.3,
+	peers => { map { $_ => [ 0x94, "stratum=3, offset=" . ($_ * 10 - 69.5) . ", jitter=4.000" ] } (1..20) },
+	nojitter => { 7 => "stratum=3, offset=0.500, dispersion=7.000" },
+	drop => { 3 => 1 },
+);
+
+sub control {
+	my ($op, $seq, $assoc, $offset, $data) = @_;
+	my $pad = (4 - length($data) % 4) % 4;
+	return pack("CCnnnnn", 0x16, 0x80 | $op, $seq, 0, $assoc, $offset, length($data)) . $data . ("\0" x $pad);
+}
+
+sub serve {
+	my ($port, $conf) = @_;
+	my $udp = IO::Socket::INET->new(Proto => "udp", LocalAddr => "127.0.0.1", LocalPort => $port)
+		or die "Cannot bind udp port $port: $!";
+	my $pid = fork();
+	if ($pid) {
+		close $udp;
+		return $pid;
+	}
+	my $select = IO::Select->new($udp);
+	my (@queue, %dropped);
+	while (1) {
+		my $wait = @queue ? $queue[0][0] - time : undef;
+		$wait = 0 if defined $wait && $wait < 0;
+		if ($select->can_read($wait)) {
+			my $peer = $udp->recv(my $query, 1024);
+			my ($flags, $op, $seq, $status, $assoc, $offset, $count) = unpack("CCnnnnn", $query);
+			my $vars = substr($query, 12, $count);
+			$op &= 0x1f;
+			if ($op == 1) {
+				my $list = join("", map { pack("nn", $_, $conf->{peers}{$_}[0] << 8) } sort { $a <=> $b } keys %{$conf->{peers}});
+				$udp->send(control(1, $seq, 0, 0, $list), 0, $peer);
+				next;
+			}
+			next if $conf->{drop}{$assoc} && !$dropped{$assoc}++;
+			my @replies;
+			if ($conf->{nojitter}{$assoc}) {
+				@replies = $vars =~ /jitter/ ? (control(0x40 | 2, $seq, $assoc, 0, ""))
+					: (control(2, $seq, $assoc, 0, $conf->{nojitter}{$assoc}));
+			} elsif ($conf->{split}{$assoc}) {
+				my $data = $conf->{peers}{$assoc}[1];
+				my $head = control(0x20 | 2, $seq, $assoc, 0, substr($data, 0, 12));
+				@replies = (control(2, $seq, $assoc, 24, substr($data, 24)), $head, $head,
+					control(0x20 | 2, $seq, $assoc, 12, substr($data, 12, 12)));
+			} elsif ($conf->{fragment}{$assoc}) {
+				my $data = $conf->{peers}{$assoc}[1];
+				@replies = (control(2, $seq, $assoc, 16, substr($data, 16)),
+					control(0x20 | 2, $seq, $assoc, 0, substr($data, 0, 16)));
+			} else {
+				@replies = (control(2, $seq, $assoc, 0, $conf->{peers}{$assoc}[1]));
+			}
+			# answer later, the newest request first
+			unshift @queue, map { [ time + $conf->{delay} + 0.01 * $_, $replies[$_], $peer ] } (0..$#replies);
+		}
+		while (@queue && $queue[0][0] <= time) {
+			my $item = shift @queue;
+			$udp->send($item->[1], 0, $item->[2]);
+		}
+		@queue = sort { $a->[0] <=> $b->[0] } @queue;
+	}
+}
+
+my @pids = (serve($port, \%synced), serve($port + 1, \%unsynced), serve($port + 2, \%split));
+END { kill "TERM", @pids if @pids; }
+
+my $res;
+
+$res = NPTest->testCmd("./check_ntp_peer -H 127.0.0.1 -p $port -w 1 -c 2 -j 1 -k 2 -W 3 -C 4");
+is( $res->return_code, 0, "Sync peer within thresholds" );
+is( $res->output, "NTP OK: Offset 0.0015 secs, jitter=0.200000, stratum=2|offset=0.001500s;1.000000;2.000000; jitter=0.200000;1.000000;2.000000;0.000000 stratum=2;3;4;0;16",
+	"Output OK" );
+
+$res = NPTest->testCmd("./check_ntp_peer -H 127.0.0.1 -p $port -w 0.001 -c 2");
+is( $res->return_code, 1, "Offset warning" );
+
+$res = NPTest->testCmd("./check_ntp_peer -H 127.0.0.1 -p $port -v");
+like( $res->output, '/^Getting offset, jitter and stratum for peer 01$/m', "Asked the sync peer" );
+unlike( $res->output, '/for peer 0[23]$/m', "Not the other candidates" );
+
+my $start = time;
+$res = NPTest->testCmd("./check_ntp_peer -H 127.0.0.1 -p " . ($port + 1) . " -t 3 -w 1 -c 2 -j 10 -k 20 -v");
+my $elapsed = time - $start;
+is( $res->return_code, 1, "No sync source" );
+like( $res->output, '/^NTP WARNING: Server not synchronized, Offset 0\.0005 secs, jitter=7\.000000\|/m', "Best candidate used" );
+is( scalar(() = $res->output =~ /^Getting offset, jitter and stratum for peer/mg), 20, "All candidates asked" );
+cmp_ok( $elapsed, '<', 2, "Candidates asked at the same time" );
+like( $res->output, "/Asking for 'stratum,offset,dispersion' instead\\.\\.\\.\$/m", "Asked again without jitter" );
+like( $res->output, '/^no response from peer 03, asking again$/m', "Lost request sent again" );
+like( $res->output, '/^parsing offset from peer 03: -0\.0395$/m', "Answer to the resent request used" );
+
+$res = NPTest->testCmd("./check_ntp_peer -H 127.0.0.1 -p " . ($port + 1) . " -q");
+is( $res->return_code, 3, "No sync source, quietly" );
+
+$res = NPTest->testCmd("./check_ntp_peer -H 127.0.0.1 -p " . ($port + 1) . " -m 20: -n 20:");
+is( $res->return_code, 1, "Truechimers counted" );
+like( $res->output, '/truechimers=20\|/', "Output OK" );
+
+$res = NPTest->testCmd("./check_ntp_peer -H 127.0.0.1 -p " . ($port + 1000) . " -t 2");
+is( $res->return_code, 2, "Nothing listening" );
+
+$res = NPTest->testCmd("./check_ntp_peer -H 127.0.0.1 -p " . ($port + 2) . " -w 1 -c 2 -j 1 -k 2");
+is( $res->return_code, 0, "Fragments reordered and duplicated" );
+like( $res->output, '/^NTP OK: Offset 0\.0015 secs, jitter=0\.200000\|offset=0\.001500s;/', "Whole response put together" );
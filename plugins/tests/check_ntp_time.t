@@ -0,0 +1,120 @@
+#! /usr/bin/perl -w -I ..
+#
+# Test check_ntp_time against stand-in NTP servers whose clocks run ahead
+#
+
+use strict;
+use Test::More;
+use NPTest;
+use IO::Socket::INET;
+use Time::HiRes qw(time sleep);
+
+plan skip_all => "No check_ntp_time compiled" unless (-x "./check_ntp_time");
+plan tests => 27;
+
+my $port = 50000 + int(rand(1000));
+
+sub ntp_stamp {
+	my $t = shift;
+	return pack("NN", int($t) + 2208988800, ($t - int($t)) * 4294967296);
+}
+
+# answer with our clock $ahead seconds fast.  With $lag set, every other
+# answer is held back after being stamped, as if stuck in a queue.
+sub serve {
+	my ($address, $port, $ahead, $lag) = @_;
+	my $udp = IO::Socket::INET->new(Proto => "udp", LocalAddr => $address, LocalPort => $port)
+		or die "Cannot bind udp port $port: $!";
+	my $pid = fork();
+	if ($pid) {
+		close $udp;
+		return $pid;
+	}
+	my $n = 0;
+	while (my $peer = $udp->recv(my $query, 48)) {
+		next if length($query) < 48;
+		my $rx = ntp_stamp(time + $ahead);
+		my $origts = substr($query, 40, 8);
+		my $tx = ntp_stamp(time + $ahead);
+		sleep($lag) if $lag && $n++ % 2;
+		$udp->send(pack("CCccNNN", 0x24, 2, 4, -20, 0x10, 0x10, 0x7f000001)
+			. $rx . $origts . $rx . $tx, 0, $peer);
+	}
+	exit;
+}
+
+# 127.0.0.3 is a falseticker
+my @pids = (serve("127.0.0.1", $port, 0.5), serve("127.0.0.1", $port + 1, 0.5, 0.3),
+	serve("127.0.0.2", $port, 0.52), serve("127.0.0.3", $port, 2));
+END { kill "TERM", @pids if @pids; }
+
+my $ntp = "./check_ntp_time -H 127.0.0.1 -p $port";
+my $res;
+
+$res = NPTest->testCmd("$ntp -w 1 -c 2");
+is( $res->return_code, 0, "Offset within thresholds" );
+like( $res->output, '/^NTP OK: Offset 0\.[45]\d* secs\|offset=[\.0-9]+s;1\.000000;2\.000000;$/', "Output OK" );
+
+$res = NPTest->testCmd("$ntp -w 0.49:0.51 -c 0.4:0.6");
+is( $res->return_code, 0, "Offset is the one the server is ahead by" );
+
+$res = NPTest->testCmd("$ntp -w 0.1 -c 2");
+is( $res->return_code, 1, "Warning threshold passed" );
+
+$res = NPTest->testCmd("$ntp -w 0.1 -c 0.2");
+is( $res->return_code, 2, "Critical threshold passed" );
+
+$res = NPTest->testCmd("$ntp -v");
+is( scalar(() = $res->output =~ /^response from peer 0:/mg), 4, "Four samples by default" );
+
+$res = NPTest->testCmd("$ntp -n 7 -v");
+is( scalar(() = $res->output =~ /^response from peer 0:/mg), 7, "Seven samples asked for" );
+like( $res->output, '/^using sample \d of 7 from peer 0/m', "Output OK" );
+
+$res = NPTest->testCmd("$ntp -n 20 -T 0.1 -v");
+is( scalar(() = $res->output =~ /^response from peer 0:/mg), 2, "Stopped once offsets settled" );
+like( $res->output, '/^offsets from peer 0 settled after 2 samples$/m', "Output OK" );
+
+# half of the samples are 0.3s late, which would pull a mean 0.075s off
+$res = NPTest->testCmd("./check_ntp_time -H 127.0.0.1 -p " . ($port + 1) . " -n 4 -w 0.49:0.51 -c 0.4:0.6");
+is( $res->return_code, 0, "Delayed samples left out" );
+
+$res = NPTest->testCmd("./check_ntp_time -H 127.0.0.1 -p " . ($port + 1000) . " -t 2");
+is( $res->return_code, 2, "Nothing listening" );
+is( $res->output, "NTP CRITICAL: No response from NTP server", "Output OK" );
+
+$res = NPTest->testCmd("$ntp -n 0");
+is( $res->return_code, 3, "Bad number of samples" );
+
+# several independent sources
+my $three = "./check_ntp_time -H 127.0.0.1,127.0.0.2,127.0.0.3 -p $port";
+
+$res = NPTest->testCmd("$three -w 0.505:0.515 -c 1");
+is( $res->return_code, 0, "Majority agrees, falseticker left out" );
+like( $res->output, '/^NTP OK: Offset 0\.5\d* secs, 2 of 3 sources agree \(127\.0\.0\.1 0\.[45]\d*, 127\.0\.0\.2 0\.5\d*, 127\.0\.0\.3 [12]\.\d*\)\|offset=[\.0-9]+s;0\.515000;1\.000000; offset_127\.0\.0\.1=[\.0-9]+s;;; offset_127\.0\.0\.2=[\.0-9]+s;;; offset_127\.0\.0\.3=[\.0-9]+s;;;$/',
+	"Output OK" );
+
+$res = NPTest->testCmd("$three -Q 3");
+is( $res->return_code, 2, "Quorum not reached" );
+like( $res->output, '/^NTP CRITICAL: Offset unknown, 2 of 3 sources agree, 3 needed \(/', "Output OK" );
+
+$res = NPTest->testCmd("$three -Q 3 -q");
+is( $res->return_code, 3, "Quorum not reached, quietly" );
+
+$res = NPTest->testCmd("$three -a 0.01");
+is( $res->return_code, 2, "Sources too far apart" );
+like( $res->output, '/, 1 of 3 sources agree, 2 needed \(/', "Output OK" );
+
+$res = NPTest->testCmd("./check_ntp_time -H 127.0.0.1 -H 127.0.0.2 -H 127.0.0.4 -p $port -w 1 -c 2");
+is( $res->return_code, 0, "Quorum with one source down" );
+like( $res->output, '/2 of 3 sources agree \(127\.0\.0\.1 [\.0-9]+, 127\.0\.0\.2 [\.0-9]+, 127\.0\.0\.4 unusable\)\|/', "Output OK" );
+
+$res = NPTest->testCmd("./check_ntp_time -H 127.0.0.1,nosuchhost.invalid,127.0.0.2 -p $port -w 1 -c 2");
+is( $res->return_code, 0, "Quorum with one source not found" );
+like( $res->output, '/2 of 3 sources agree \(127\.0\.0\.1 [\.0-9]+, nosuchhost\.invalid unusable, 127\.0\.0\.2 [\.0-9]+\)\|/', "Output OK" );
+
+$res = NPTest->testCmd("./check_ntp_time -H nosuchhost.invalid -p $port");
+is( $res->return_code, 3, "Only source not found" );
+
+$res = NPTest->testCmd("$three -Q 4");
+is( $res->return_code, 3, "Quorum larger than the number of sources" );
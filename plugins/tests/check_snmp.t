@@ -7,44 +7,49 @@ use strict;
 use Test::More;
 use NPTest;
 use FindBin qw($Bin);
+use Time::HiRes qw(time);
 
-my $tests = 53;
-# Check that all dependent modules are available
+my $tests = 107;
+# Check that all dependent modules are available, else our agent answers
+# on its own
 eval {
 	require NetSNMP::OID;
 	require NetSNMP::agent;
 	require NetSNMP::ASN;
 };
+my $snmpd = !$@ && grep { -x "$_/snmpd" } split(/:/, $ENV{PATH});
 
-if ($@) {
-	plan skip_all => "Missing required module for test: $@";
+if (-x "./check_snmp") {
+	plan tests => $tests;
 } else {
-	if (-x "./check_snmp") {
-		plan tests => $tests;
-	} else {
-		plan skip_all => "No check_snmp compiled";
-	}
+	plan skip_all => "No check_snmp compiled";
 }
 
 my $port_snmp = 16100 + int(rand(100));
+my $port_own = $port_snmp + 100;
 
 
 # Start up server
 my @pids;
-my $pid = fork();
-if ($pid) {
-	# Parent
-	push @pids, $pid;
-	# give our agent some time to startup
-	sleep(1);
-} else {
+foreach my $port ($port_snmp, $port_own) {
+	my $pid = fork();
+	if ($pid) {
+		# Parent
+		push @pids, $pid;
+		next;
+	}
 	# Child
 	#print "child\n";
 
-	print "Please contact SNMP at: $port_snmp\n";
-	close(STDERR); # Coment out to debug snmpd problems (most errors sent there are OK)
-	exec("snmpd -c tests/conf/snmpd.conf -C -f -r udp:$port_snmp");
+	print "Please contact SNMP at: $port\n";
+	if ($snmpd && $port == $port_snmp) {
+		close(STDERR); # Coment out to debug snmpd problems (most errors sent there are OK)
+		exec("snmpd -c tests/conf/snmpd.conf -C -f -r udp:$port");
+	}
+	exec($^X, "$Bin/check_snmp_agent.pl", $port);
 }
+# give our agents some time to startup
+sleep(1);
 
 END { 
 	foreach my $pid (@pids) {
@@ -214,3 +219,149 @@ $res = NPTest->testCmd( "./check_snmp -H 127.0.0.1 -C public -p $port_snmp -o .1
 is($res->return_code, 0, "String check should check whole string, not a parsed number" );
 is($res->output, 'SNMP OK - "CUSTOM CHECK OK: foo is 12345" | ', "String check witn numbers returns whole string");
 
+# Against the agent on its own, for what snmpd can't be made to do
+my $own = "./check_snmp -H 127.0.0.1 -p $port_own";
+
+$res = NPTest->testCmd( "$own -o SNMPv2-MIB::sysLocation.0,sysContact.0" );
+is($res->return_code, 0, "Objects asked for by name" );
+is($res->output, 'SNMP OK - Wonderland Alice | ', "DisplayStrings without quotes" );
+
+$res = NPTest->testCmd( "$own -o .1.3.6.1.4.1.8072.3.2.67.10 -n" );
+is($res->output, 'SNMP OK - "stringtests" | ', "GETNEXT gets the following object" );
+
+$res = NPTest->testCmd( "$own -P 2c -o .1.3.6.1.4.1.8072.3.2.67.99" );
+is($res->output, 'SNMP OK - No Such Object available on this agent at this OID | ', "SNMPv2c exception" );
+
+$res = NPTest->testCmd( "$own -o .1.3.6.1.4.1.8072.3.2.67.99" );
+is($res->return_code, 3, "SNMPv1 error status" );
+is($res->output, 'Error in packet: noSuchName, failed object: .1.3.6.1.4.1.8072.3.2.67.99', "Output OK" );
+
+# the lossy community loses every other request
+$res = NPTest->testCmd( "$own -C lossy -t 0.2 -o sysLocation.0" );
+is($res->return_code, 0, "Lost request retried" );
+
+$res = NPTest->testCmd( "$own -C lossy -t 0.2 -e 0 -o sysLocation.0" );
+is($res->return_code, 3, "Lost request not retried" );
+is($res->output, "Timeout: No Response from 127.0.0.1:$port_own.", "Output OK" );
+
+$res = NPTest->testCmd( "$own -t 0 -o sysLocation.0" );
+is($res->return_code, 3, "Timeout must be positive" );
+
+# the slow community answers after 0.3 seconds
+my $start = time;
+$res = NPTest->testCmd( "$own -C slow -t 0.1 -e 1 -o sysLocation.0" );
+is($res->return_code, 3, "Slow agent timed out" );
+cmp_ok(time - $start, '<', 0.5, "Timeouts in fractions of seconds" );
+
+$res = NPTest->testCmd( "$own -C slow -t 2 -o sysLocation.0" );
+is($res->return_code, 0, "Slow agent within the timeout" );
+
+# more OIDs than fit in a response from the small community
+my $many = join(",", map { ".1.3.6.1.4.1.8072.3.2.67.$_" } ((11..15) x 4));
+$res = NPTest->testCmd( "$own -o $many" );
+my $all = $res->output;
+$res = NPTest->testCmd( "$own -C small -o $many -v" );
+like($res->output, '/^20 OIDs are too many for one request, asking for 10$/m', "Split on tooBig" );
+is((split(/\n/, $res->output))[-1], $all, "All OIDs answered" );
+is(scalar(() = $all =~ /stringtests/g), 4, "Output OK" );
+
+$res = NPTest->testCmd( "$own -o " . join(",", (".1.3.6.1.4.1.8072.3.2.67.12") x 10) . " -w 3,3,3,3,3,3,3,3,3,3:4" );
+is($res->return_code, 1, "Thresholds for more than 8 OIDs" );
+like($res->output, '/^SNMP WARNING - (\*3\.5\* ){9}3\.5 \|/', "Only the tenth OID within its range" );
+
+# perfdata longer than any fixed buffer
+$res = NPTest->testCmd( "$own -o " . join(",", (".1.3.6.1.4.1.8072.3.2.67.12") x 400) . " -w " . join(",", (5) x 400) );
+is($res->return_code, 0, "400 OIDs" );
+is(scalar(() = $res->output =~ /=3\.5 /g), 400, "Perfdata for all of them" );
+
+# rates of counters that wrap on the third call, at 2^32 and 2^64
+system("rm -f ".$ENV{'NAGIOS_PLUGIN_STATE_DIRECTORY'}."/check_snmp/*");
+my $counters = "$own -o .1.3.6.1.4.1.8072.3.2.67.7,.1.3.6.1.4.1.8072.3.2.67.8 --rate";
+$res = NPTest->testCmd( $counters );
+is($res->output, "No previous data to calculate rate - assume okay" );
+sleep 1;
+$res = NPTest->testCmd( $counters );
+like($res->output, '/^SNMP RATE OK - (1000 100000|500 50000) \|/', "Rates of a Counter32 and a Counter64" );
+sleep 1;
+$res = NPTest->testCmd( $counters );
+like($res->output, '/^SNMP RATE OK - (1000 100000|500 50000) \|/', "Both wrapped" );
+
+# a gauge going down 500 each time, averaged over two calls
+my $average = "$own -o .1.3.6.1.4.1.8072.3.2.67.6 --rate --rate-samples=2";
+$res = NPTest->testCmd( $average );
+sleep 1;
+$res = NPTest->testCmd( $average );
+like($res->output, '/^SNMP RATE OK - -(500|250) \|/', "Gauges go down without wrapping" );
+sleep 1;
+$res = NPTest->testCmd( $average );
+like($res->output, '/^SNMP RATE OK - -(500|333\.3+|250) \|/', "Averaged over two calls" );
+
+# the rebooting community gets a lower sysUpTime each time
+$res = NPTest->testCmd( "$own -C rebooting -o .1.3.6.1.4.1.8072.3.2.67.10 --rate" );
+sleep 1;
+$res = NPTest->testCmd( "$own -C rebooting -o .1.3.6.1.4.1.8072.3.2.67.10 --rate" );
+is($res->return_code, 0, "Agent restarted" );
+is($res->output, "Agent restarted, no previous data to calculate rate - assume okay", "Output OK" );
+
+# answers shared through the cache
+$res = NPTest->testCmd( "$own -o sysLocation.0,sysContact.0 --cache 60 -v" );
+like($res->output, '/^0 of 2 OIDs from the cache$/m', "Nothing cached yet" );
+$res = NPTest->testCmd( "$own -o sysContact.0,sysLocation.0,sysDescr.0 --cache 60 -v" );
+like($res->output, '/^2 of 3 OIDs from the cache\nSNMPv1 GET 127\.0\.0\.1:\d+, OIDs 1 to 1 of 1,/m', "Only the new OID asked for" );
+is((split(/\n/, $res->output))[-1], 'SNMP OK - Alice Wonderland check_snmp test agent | ', "Output OK" );
+$res = NPTest->testCmd( "$own -P 2c -o sysLocation.0 --cache 60 -v" );
+like($res->output, '/^0 of 1 OIDs from the cache$/m', "Not shared between versions" );
+
+$res = NPTest->testCmd( "$own -o .1.3.6.1.4.1.8072.3.2.67.7 --rate --cache 60" );
+is($res->return_code, 3, "No rates from the cache" );
+like($res->output, '/--cache can.t be used with --rate/', "Output OK" );
+
+# five checks of the slow community at once: one asks, the others wait for it
+$start = time;
+$res = NPTest->testCmd( "for i in 1 2 3 4 5; do $own -C slow -o sysLocation.0 --cache 60 -v & done; wait" );
+cmp_ok(time - $start, '<', 1, "Checks at the same time asked once" );
+is(scalar(() = $res->output =~ /^1 of 1 OIDs from the cache$/mg), 4, "The others answered from the cache" );
+
+# tables, from the agent's 30 interfaces
+$res = NPTest->testCmd( "$own -P 2c --table -o ifOperStatus -l status -w 1:1 --row-label='{ifDescr}' -v" );
+is($res->return_code, 1, "Table walked" );
+like($res->output, '/^SNMP WARNING - 30 rows, eth6 status \*2\* \| eth0_status=1 eth1_status=1 .* eth29_status=1$/m', "Output OK" );
+is(scalar(() = $res->output =~ /^GETBULK /mg), 2, "25 rows for each GETBULK" );
+my $table = (split(/\n/, $res->output))[-1];
+
+$res = NPTest->testCmd( "$own -P 2c -C small --table -o ifOperStatus -l status -w 1:1 --row-label='{ifDescr}'" );
+is($res->output, $table, "Fewer rows for each GETBULK on tooBig" );
+
+$res = NPTest->testCmd( "$own --table -o ifOperStatus,ifInOctets -l status,in -c ,:20000 -v" );
+is($res->return_code, 2, "Columns joined into rows" );
+like($res->output, '/^SNMP CRITICAL - 30 rows, 21 in \*21000\*, .*, 30 in \*30000\* \| 1_status=1 1_in=1000c 2_status=1 2_in=2000c /m', "Output OK" );
+is(scalar(() = $res->output =~ /^GETNEXT /mg), 31, "A row for each GETNEXT with SNMPv1" );
+
+$res = NPTest->testCmd( "$own -P 2c --table -o .1.3.6.1.2.1.2.2.1.99" );
+is($res->return_code, 3, "Empty table" );
+is($res->output, 'SNMP UNKNOWN - No rows under .1.3.6.1.2.1.2.2.1.99', "Output OK" );
+
+$res = NPTest->testCmd( "$own --table --rate -o ifInOctets" );
+is($res->return_code, 3, "No rates for tables" );
+
+# many hosts in one check, 127.0.0.2 without an agent
+my $hosts = "/tmp/check_snmp_hosts.$$";
+open(my $fh, ">", $hosts) or die "Cannot write $hosts: $!";
+print $fh "# agents\n127.0.0.1\n\n127.0.0.2\n  127.0.0.1  # again\n";
+close $fh;
+END { unlink $hosts if $hosts }
+$res = NPTest->testCmd( "./check_snmp --hosts=$hosts -p $port_own -o sysUpTime.0,ifInOctets.7 -l uptime,in -c ,:5000" );
+is($res->return_code, 2, "Hosts checked" );
+like($res->output, '/^SNMP CRITICAL - 3 hosts, 0 ok, 0 warning, 2 critical, 1 unknown \| ok=0 warning=0 critical=2 unknown=1\n/', "Summary first" );
+is(scalar(() = $res->output =~ /^127\.0\.0\.1\tSNMP\t2\tSNMP CRITICAL - uptime \d+ in \*7000\* \| uptime=\d+ in=7000c$/mg), 2, "A line for each host" );
+like($res->output, "/^127\\.0\\.0\\.2\tSNMP\t3\tSNMP UNKNOWN - SNMP request to 127\\.0\\.0\\.2:$port_own failed: Connection refused\$/m", "Output OK" );
+
+$start = time;
+$res = NPTest->testCmd( "for i in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20; do echo 127.0.0.1; done | ./check_snmp --hosts=- -p $port_own -C slow -o sysLocation.0 --window 10 -v" );
+cmp_ok(time - $start, '<', 2, "Twenty slow hosts asked ten at a time" );
+is($res->return_code, 0, "Hosts from stdin" );
+like($res->output, '/^SNMPv1 GET to 20 hosts, 10 at a time, /m', "Output OK" );
+like($res->output, '/^SNMP OK - 20 hosts, 20 ok, 0 warning, 0 critical, 0 unknown \|/m', "Output OK" );
+
+$res = NPTest->testCmd( "./check_snmp --hosts=$hosts -o sysUpTime.0 --rate" );
+is($res->return_code, 3, "No rates for many hosts" );
@@ -1,17 +1,35 @@
 #! /usr/bin/perl -w -I ..
 #
-# Subagent for testing check_snmp
+# Subagent for testing check_snmp. Without snmpd, run it as
+# "check_snmp_agent.pl PORT" to answer SNMPv1/v2c requests on its own.
 #
 
 #use strict; # Doesn't work
-use NetSNMP::OID qw(:all);
-use NetSNMP::agent;
-use NetSNMP::ASN qw(ASN_OCTET_STR ASN_COUNTER ASN_COUNTER64 ASN_INTEGER ASN_INTEGER64 ASN_UNSIGNED ASN_UNSIGNED64);
+BEGIN {
+	if (eval { require NetSNMP::OID; require NetSNMP::agent; require NetSNMP::ASN; 1 }) {
+		NetSNMP::OID->import(qw(:all));
+		NetSNMP::agent->import();
+		NetSNMP::ASN->import(qw(ASN_OCTET_STR ASN_COUNTER ASN_COUNTER64 ASN_INTEGER ASN_INTEGER64 ASN_UNSIGNED ASN_UNSIGNED64));
+	} else {
+		# the BER tags, all we need on our own
+		*ASN_INTEGER = sub () { 0x02 };
+		*ASN_OCTET_STR = sub () { 0x04 };
+		*ASN_COUNTER = sub () { 0x41 };
+		*ASN_UNSIGNED = sub () { 0x42 };
+		*ASN_COUNTER64 = sub () { 0x46 };
+		*ASN_INTEGER64 = sub () { 0x7a };
+		*ASN_UNSIGNED64 = sub () { 0x7b };
+	}
+}
+use IO::Socket::INET;
+use IO::Select;
+use Math::BigInt;
+use Time::HiRes qw(time);
 #use Math::Int64 qw(uint64); # Skip that module whie we don't need it
-sub uint64 { return $_ }
+sub uint64 { return Math::BigInt->new(shift) }
 
-if (!$agent) {
-	print "This program must run as an embedded NetSNMP agent\n";
+if (!$agent && !@ARGV) {
+	print "This program must run as an embedded NetSNMP agent, or be given a port\n";
 	exit 1;
 }
 
@@ -45,8 +63,24 @@ my $oidelts;
 	$oidelts = scalar(@oid);
 }
 
-my $regoid = new NetSNMP::OID($baseoid);
-$agent->register('check_snmp_agent', $regoid, \&my_snmp_handler);
+# And update the value
+sub advance {
+	my $index = shift;
+	if (defined($incrts[$index])) {
+		$values[$index] += $incrts[$index];
+	} elsif ($fields[$index] != ASN_OCTET_STR) {
+		my $minus = int(rand(2))*-1;
+		$minus = 1 unless ($minus);
+		my $exp = 32;
+		$exp = 64 if ($fields[$index]  == ASN_COUNTER64 || $fields[$index] == ASN_INTEGER64 || $fields[$index] == ASN_UNSIGNED64);
+		$values[$index] = int(rand(2**$exp));
+	}
+}
+
+if ($agent) {
+	my $regoid = new NetSNMP::OID($baseoid);
+	$agent->register('check_snmp_agent', $regoid, \&my_snmp_handler);
+}
 
 sub my_snmp_handler {
 	my ($handler, $registration_info, $request_info, $requests) = @_;
@@ -95,17 +129,209 @@ sub my_snmp_handler {
 		# Set the response... setValue is a bit touchy about the data type, but accepts plain strings.
 		my $value = sprintf("%s", $values[$index]);
 		$request->setValue($fields[$index], $value);
+		advance($index);
+	}
+}
+
+#
+# On our own: what snmpd.conf and the handler above give, over UDP.
+# Community "lossy" drops every other request, "slow" answers after 0.3s
+# while the agent goes on with other requests,
+# "small" says tooBig to responses over 484 bytes, and to "rebooting" the
+# agent's sysUpTime goes down with each request. The ifTable has 30
+# interfaces, all up but the seventh. The HP printer status check_hpjd asks
+# for says "jammed", "offline" or "powersave" as the community does, and to
+# "reversed" the toner is low and the variables come back in reverse order.
+#
+
+sub ber {
+	my ($tag, $data) = @_;
+	my $len = length($data);
+	return chr($tag) . ($len < 0x80 ? chr($len) : $len < 0x100 ? pack("CC", 0x81, $len) : pack("Cn", 0x82, $len)) . $data;
+}
+
+sub ber_integer {
+	my $data = pack("N", shift);
+	$data =~ s/^\x00+(?=[\x00-\x7f])//;
+	$data =~ s/^\xff+(?=[\x80-\xff])//;
+	return ber(0x02, $data);
+}
+
+sub ber_unsigned {
+	my ($tag, $value) = @_;
+	$value = Math::BigInt->new("$value");
+	$value %= Math::BigInt->new(2)->bpow($tag == ASN_COUNTER64 ? 64 : 32);
+	my $hex = substr($value->as_hex, 2);
+	$hex = "0$hex" if length($hex) % 2;
+	$hex = "00$hex" if $hex =~ /^[89a-f]/;
+	return ber($tag, pack("H*", $hex));
+}
+
+sub ber_oid {
+	my @ids = split(/\./, shift);
+	return ber(0x06, pack("w*", $ids[0] * 40 + $ids[1], @ids[2..$#ids]));
+}
+
+# tag, contents and what follows
+sub ber_read {
+	my $buf = shift;
+	my ($tag, $len) = unpack("CC", $buf);
+	my $off = 2;
+	if ($len & 0x80) {
+		my $n = $len & 0x7f;
+		$len = 0;
+		$len = $len * 256 + ord(substr($buf, $off++, 1)) for (1..$n);
+	}
+	return ($tag, substr($buf, $off, $len), substr($buf, $off + $len));
+}
+
+sub read_integer {
+	my $data = shift;
+	my $value = 0;
+	$value = $value * 256 + $_ for unpack("C*", $data);
+	$value -= 256 ** length($data) if length($data) && ord($data) & 0x80;
+	return $value;
+}
 
-		# And update the value
-		if (defined($incrts[$index])) {
-			$values[$index] += $incrts[$index];
-		} elsif ($fields[$index] != ASN_OCTET_STR) {
-			my $minus = int(rand(2))*-1;
-			$minus = 1 unless ($minus);
-			my $exp = 32;
-			$exp = 64 if ($fields[$index]  == ASN_COUNTER64 || $fields[$index] == ASN_INTEGER64 || $fields[$index] == ASN_UNSIGNED64);
-			$values[$index] = int(rand(2**$exp));
+sub read_oid {
+	my @ids = unpack("w*", shift);
+	my $first = shift @ids;
+	my $top = $first < 40 ? 0 : $first < 80 ? 1 : 2;
+	return join(".", $top, $first - 40 * $top, @ids);
+}
+
+sub oid_cmp {
+	my @a = split(/\./, $_[0]);
+	my @b = split(/\./, $_[1]);
+	while (@a && @b) {
+		my $c = shift(@a) <=> shift(@b);
+		return $c if $c;
+	}
+	return @a <=> @b;
+}
+
+my $base = substr($baseoid, 1);
+my $started = time;
+my $rebooting = 100000;
+my $community; # of the request being answered
+
+sub printer {
+	my $i = shift;
+	return 1 if $i == 1 && ($community eq "offline" || $community eq "powersave");
+	return 1 if $i == 9 && $community eq "jammed";
+	return 1 if $i == 10 && $community eq "reversed";
+	return 0;
+}
+
+my %mib = (
+	"1.3.6.1.2.1.1.1.0" => sub { ber(ASN_OCTET_STR, "check_snmp test agent") },
+	"1.3.6.1.2.1.1.3.0" => sub { ber_unsigned(0x43, $community eq "rebooting" ? $rebooting-- : int((time - $started) * 100)) },
+	"1.3.6.1.2.1.1.4.0" => sub { ber(ASN_OCTET_STR, "Alice") },
+	"1.3.6.1.2.1.1.6.0" => sub { ber(ASN_OCTET_STR, "Wonderland") },
+	(map { my $i = $_; (
+		"1.3.6.1.2.1.2.2.1.2.$i" => sub { ber(ASN_OCTET_STR, "eth" . ($i - 1)) },
+		"1.3.6.1.2.1.2.2.1.8.$i" => sub { ber_integer($i == 7 ? 2 : 1) },
+		"1.3.6.1.2.1.2.2.1.10.$i" => sub { ber_unsigned(ASN_COUNTER, $i * 1000) },
+	) } (1..30)),
+	(map { my $i = $_; ("1.3.6.1.4.1.11.2.3.9.1.1.2.$i.0" => sub { ber_integer(printer($i)) }) }
+		(1, 2, 3, 6, 8, 9, 10, 11, 12, 17, 19)),
+	"1.3.6.1.4.1.11.2.3.9.1.1.3.0" => sub { ber(ASN_OCTET_STR, $community eq "powersave" ? "POWERSAVE ON"
+		: $community eq "offline" ? "OFFLINE" : "READY") },
+	map { my $i = $_; ("$base.$i" => sub {
+		my $value = $fields[$i] == ASN_OCTET_STR ? ber($fields[$i], $values[$i]) : ber_unsigned($fields[$i], $values[$i]);
+		advance($i);
+		return $value;
+	}) } (0..$#fields)
+);
+my @order = sort { oid_cmp($a, $b) } keys %mib;
+
+sub next_oid {
+	my $oid = shift;
+	for (@order) {
+		return $_ if oid_cmp($_, $oid) > 0;
+	}
+	return undef;
+}
+
+sub answer {
+	my $query = shift;
+	my (undef, $msg) = ber_read($query);
+	my ($v, $version, $type, $pdu, $id, $nonrep, $maxrep, $list);
+	(undef, $version, $msg) = ber_read($msg);
+	(undef, $community, $msg) = ber_read($msg);
+	($type, $pdu) = ber_read($msg);
+	(undef, $id, $pdu) = ber_read($pdu);
+	(undef, $nonrep, $pdu) = ber_read($pdu);
+	(undef, $maxrep, $pdu) = ber_read($pdu);
+	(undef, $list) = ber_read($pdu);
+	($version, $nonrep, $maxrep) = map { read_integer($_) } ($version, $nonrep, $maxrep);
+
+	my @oids;
+	while (length($list)) {
+		my $vb;
+		(undef, $vb, $list) = ber_read($list);
+		push @oids, read_oid((ber_read($vb))[1]);
+	}
+
+	my ($error, $index, @vbs) = (0, 0);
+	my $get = sub {
+		my ($oid, $next, $n) = @_;
+		my $found = $next ? next_oid($oid) : exists($mib{$oid}) ? $oid : undef;
+		if (defined $found) {
+			push @vbs, ber(0x30, ber_oid($found) . $mib{$found}->());
+			return $found;
+		}
+		# v1 has an error for the whole request, v2c an exception per variable
+		($error, $index) = (2, $n) if $version == 0 && !$error;
+		push @vbs, ber(0x30, ber_oid($oid) . ber($next ? 0x82 : 0x80, ""));
+		return undef;
+	};
+	if ($type == 0xa5) {
+		$nonrep = @oids if $nonrep > @oids;
+		$get->($oids[$_], 1, $_ + 1) for (0..$nonrep - 1);
+		my @repeat = @oids[$nonrep..$#oids];
+		for (1..$maxrep) {
+			@repeat = map { $get->($_, 1, 0) || $_ } @repeat;
+		}
+	} else {
+		$get->($oids[$_], $type == 0xa1, $_ + 1) for (0..$#oids);
+	}
+	@vbs = map { ber(0x30, ber_oid($_) . ber(0x05, "")) } @oids if $error;
+	@vbs = reverse @vbs if $community eq "reversed";
+
+	my $response = sub {
+		return ber(0x30, ber_integer($version) . ber(ASN_OCTET_STR, $community)
+			. ber(0xa2, ber(0x02, $id) . ber_integer($error) . ber_integer($index) . ber(0x30, join("", @vbs))));
+	};
+	my $message = $response->();
+	if ($community eq "small" && length($message) > 484) {
+		($error, $index, @vbs) = (1, 0);
+		$message = $response->();
+	}
+	return $message, $community;
+}
+
+sub serve {
+	my $port = shift;
+	my $udp = IO::Socket::INET->new(Proto => "udp", LocalAddr => "127.0.0.1", LocalPort => $port)
+		or die "Cannot bind udp port $port: $!";
+	my $select = IO::Select->new($udp);
+	my ($n, @queue) = (0);
+	while (1) {
+		my $wait = @queue ? $queue[0][0] - time : undef;
+		$wait = 0 if defined $wait && $wait < 0;
+		if ($select->can_read($wait)) {
+			my $peer = $udp->recv(my $query, 65535);
+			my ($response, $community) = answer($query);
+			next if $community eq "lossy" && $n++ % 2 == 0;
+			@queue = sort { $a->[0] <=> $b->[0] } @queue,
+				[ time + ($community eq "slow" ? 0.3 : 0), $response, $peer ];
+		}
+		while (@queue && $queue[0][0] <= time) {
+			my $item = shift @queue;
+			$udp->send($item->[1], 0, $item->[2]);
 		}
 	}
 }
 
+serve(shift @ARGV) unless $agent;